@@ -5,6 +5,8 @@ global isr0, isr1, isr2, isr3, isr4, isr5, isr6, isr7, isr8, isr9, isr10, isr11,
 global isr16, isr17, isr18, isr19, isr20, isr21, isr22, isr23, isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31
 global irq0, irq1, irq2, irq3, irq4, irq5, irq6, irq7, irq8, irq9, irq10, irq11, irq12, irq13, irq14, irq15
 global isr128 ; Syscall interrupt
+global syscall_entry ; SYSCALL instruction, see syscall_init_cpu()
+global isr239, isr240, isr241, isr255 ; Local APIC (timer, IPIs, spurious)
 
 extern isr_handler
 extern syscall_handler
@@ -75,14 +77,26 @@ extern syscall_handler
         jmp isr_common_stub
 %endmacro
 
+; GS base holds the per-CPU data while in the kernel. Coming from ring 3
+; (CS RPL != 0) the user's GS is live, so swap it out on entry and back in on
+; exit. %1 is the offset of the saved CS from rsp.
+%macro SWAPGS_IF_USER 1
+    test qword [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 section .text
 
 ; This is the common stub for all ISRs (exceptions and IRQs)
 isr_common_stub:
+    SWAPGS_IF_USER 24 ; int_no, err_code, rip, cs
     PUSH_REGS
     mov rdi, rsp ; Pass pointer to struct registers to C handler
     call isr_handler
     POP_REGS
+    SWAPGS_IF_USER 24
     add rsp, 16 ; Pop int_no and err_code
     iretq
 
@@ -93,14 +107,72 @@ isr128:
     ; No error code pushed by 'int' instruction
     push 0  ; Dummy error code
     push 128; Interrupt number (for consistency, though not strictly needed)
+    SWAPGS_IF_USER 24
     PUSH_REGS
     mov rdi, rsp ; Pass pointer to struct registers to C handler
     call syscall_handler
     POP_REGS
+    SWAPGS_IF_USER 24
     add rsp, 16 ; Pop int_no and err_code
     sti
     iretq
 
+; cpu_t fields, checked by _Static_assert in smp.h
+CPU_KERNEL_RSP equ 8
+CPU_USER_RSP equ 16
+
+; User selectors with RPL 3, as loaded by SYSRET (see gdt.h)
+USER_DATA_SEL equ 0x1B
+USER_CODE_SEL equ 0x23
+
+; struct registers offsets of the hardware frame
+REGS_RIP equ 136
+REGS_CS equ 144
+REGS_SS equ 168
+
+; SYSCALL entry. The CPU saved the user RIP in rcx and RFLAGS in r11 and
+; cleared IF (MSR_SFMASK), but we're still on the user stack. Build the same
+; frame as isr128 so syscall_handler sees no difference.
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+    push USER_DATA_SEL           ; ss
+    push qword [gs:CPU_USER_RSP] ; rsp
+    push r11                     ; rflags
+    push USER_CODE_SEL           ; cs
+    push rcx                     ; rip
+    push 0   ; Dummy error code
+    push 128 ; Interrupt number, as for int 0x80
+    PUSH_REGS
+    mov rdi, rsp
+    call syscall_handler
+    cli
+
+    ; SYSRET can only return to a canonical RIP (otherwise it faults in ring 0
+    ; on the user stack) with our user selectors. Anything else goes through
+    ; IRETQ.
+    mov rcx, [rsp + REGS_RIP]
+    shr rcx, 47
+    jnz .iret
+    cmp qword [rsp + REGS_CS], USER_CODE_SEL
+    jne .iret
+    cmp qword [rsp + REGS_SS], USER_DATA_SEL
+    jne .iret
+
+    POP_REGS
+    mov rcx, [rsp + 16] ; rip, past int_no and err_code
+    mov r11, [rsp + 32] ; rflags
+    mov rsp, [rsp + 40] ; User stack
+    swapgs
+    o64 sysret
+
+.iret:
+    POP_REGS
+    SWAPGS_IF_USER 24
+    add rsp, 16 ; Pop int_no and err_code
+    iretq
+
 ; Define all ISRs
 ISR_NO_ERR 0
 ISR_NO_ERR 1
@@ -135,6 +207,12 @@ ISR_NO_ERR 29
 ISR_NO_ERR 30
 ISR_NO_ERR 31
 
+; Local APIC vectors
+ISR_NO_ERR 239
+ISR_NO_ERR 240
+ISR_NO_ERR 241
+ISR_NO_ERR 255
+
 ; Define all IRQs
 IRQ 0, 32
 IRQ 1, 33
@@ -5,6 +5,7 @@ global thread_starter
 
 extern hhdm_offset
 extern thread_entry
+extern scheduler_finish_switch
 
 ; void thread_switch(thread_t* old_thread, thread_t* new_thread);
 ; rdi = old_thread
@@ -45,7 +46,14 @@ thread_switch:
     
     ret
 
+; First run of a userspace thread. thread_switch `ret`s here with the IRETQ
+; frame on the stack.
 userspace_trampoline:
+    sub rsp, 8 ; Keep the stack 16-byte aligned for the call
+    call scheduler_finish_switch
+    add rsp, 8
+    mov rdi, r12 ; Thread argument, see setup_user_frame()
+    swapgs ; Kernel GS base goes to KERNEL_GS_BASE while in ring 3
     iretq
     
 ; thread_starter(func, arg)
@@ -0,0 +1,27 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// Interrupt vectors used by the local APIC (above the remapped 8259 range)
+#define LAPIC_TIMER_VECTOR 0xEF
+#define IPI_VECTOR_RESCHEDULE 0xF0
+#define IPI_VECTOR_TLB_SHOOTDOWN 0xF1
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Enable the local APIC of the calling CPU.
+void lapic_init();
+uint32_t lapic_get_id();
+void lapic_eoi();
+
+void lapic_send_ipi(uint32_t lapic_id, uint8_t vector);
+void lapic_broadcast_ipi(uint8_t vector); // All CPUs except the caller
+
+// Per-CPU scheduler tick. lapic_timer_init() picks the mode and calibrates
+// once on the BSP, lapic_timer_start() arms the timer of the calling CPU.
+void lapic_timer_init(uint64_t period_ns);
+void lapic_timer_start();
+// Arm the next tick, called from the timer interrupt.
+void lapic_timer_rearm();
+
+#endif // APIC_H
@@ -1,8 +1,10 @@
 #ifndef ARP_H
 #define ARP_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "rcu.h"
 
 #define ARP_ETHER_TYPE 0x0806 // Ethernet Type for ARP
 #define ARP_HARDWARE_TYPE_ETHERNET 0x0001
@@ -34,16 +36,18 @@ typedef struct arp_packet {
     uint32_t target_ip;
 } __attribute__((packed)) arp_packet_t;
 
-// ARP cache entry
+// ARP cache entry. Never modified once published; an update replaces the
+// whole entry and frees the old one after an RCU grace period.
 typedef struct arp_cache_entry {
     uint32_t ip_addr;
     uint8_t mac_addr[6];
     // Add timestamp for cache aging later
+    rcu_head_t rcu;
 } arp_cache_entry_t;
 
 void arp_init();
 void arp_handle_packet(const uint8_t* packet, size_t size);
 void arp_send_request(uint32_t target_ip);
-uint8_t* arp_lookup_mac(uint32_t ip_addr); // Returns MAC or NULL if not in cache
+bool arp_lookup_mac(uint32_t ip_addr, uint8_t mac_out[6]); // False if not in cache
 
 #endif // ARP_H
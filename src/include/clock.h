@@ -0,0 +1,25 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// Monotonic time based on the TSC. The TSC is calibrated once at boot and is
+// assumed to be invariant and synchronized between CPUs.
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// Calibrate the TSC. Called by timer_init(), before that the clock reads 0.
+void clock_init();
+uint64_t clock_tsc_hz();
+// Nanoseconds since clock_init()
+uint64_t clock_monotonic_ns();
+uint64_t clock_ns_to_tsc(uint64_t ns);
+uint64_t clock_tsc_to_ns(uint64_t cycles);
+
+// Conversion parameters, for the vDSO: ns = (tsc - tsc_boot) * ns_mult >> 32
+uint64_t clock_tsc_boot();
+uint64_t clock_ns_mult();
+// Length of one timer_get_ticks() tick
+uint64_t clock_tick_ns();
+
+#endif // CLOCK_H
@@ -6,7 +6,19 @@
 
 #define SHA256_HASH_SIZE 32
 
-// STUB: A real implementation would have a context structure.
+// SHA256 state, for hashing data that arrives in pieces
+typedef struct {
+    uint8_t buffer[64]; // Data buffer for 512-bit (64-byte) blocks
+    uint32_t buffer_len; // Current length of data in buffer
+    uint64_t bit_len;    // Total length of processed bits
+    uint32_t hash[8];    // Current hash value
+} sha256_context;
+
+void sha256_init_ctx(sha256_context* ctx);
+void sha256_update_ctx(sha256_context* ctx, const uint8_t* data, size_t len);
+void sha256_final_ctx(sha256_context* ctx, uint8_t hash_out[SHA256_HASH_SIZE]);
+
+// All of data in one go
 void sha256_hash(const uint8_t* data, size_t len, uint8_t* hash_out);
 
 // STUB: Verifies an RSA signature against a SHA256 hash.
@@ -1,7 +1,9 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "waitqueue.h"
 
 typedef enum {
     EVENT_NONE,
@@ -23,4 +25,11 @@ void event_init();
 void event_push(event_t event);
 int event_pop(event_t* event); // Returns 1 if an event was popped, 0 otherwise
 
+// Input descriptors (SYS_INPUT_OPEN) read whole event_t records from the
+// queue, blocking until there is at least one. Returns bytes read or -1.
+int64_t event_read(void* user_buf, size_t size);
+int event_pending(); // Events queued
+// Woken with POLLIN by event_push()
+wait_queue_t* event_wait_queue();
+
 #endif // EVENT_H
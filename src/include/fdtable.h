@@ -0,0 +1,78 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+// File descriptor tables. A table starts with FD_TABLE_INITIAL slots and
+// doubles when the lowest free descriptor doesn't fit, up to its soft limit.
+// Tables are reference counted so threads of one process can share them;
+// kernel threads all share a single table.
+
+#define FD_TABLE_INITIAL 16
+#define FD_LIMIT_DEFAULT 1024 // Soft limit of the first table, inherited after that
+#define FD_LIMIT_MAX 65536    // Hard limit, nobody can go above this
+
+// Forward declare vfs_node_t to avoid circular dependency
+struct vfs_node;
+struct socket; // Forward declare socket for fd_entry_t union
+struct io_ring;
+struct epoll;
+
+typedef enum {
+    FD_TYPE_NONE,
+    FD_TYPE_FILE,
+    FD_TYPE_SOCKET,
+    FD_TYPE_IORING,
+    FD_TYPE_INPUT, // Input event queue, see event_read()
+    FD_TYPE_EPOLL
+} fd_type_t;
+
+// An open file, socket, io ring, input queue or epoll set. Shared by every descriptor that refers to it and
+// kept alive by fd_get() references while a syscall uses it.
+typedef struct fd_entry {
+    fd_type_t type;
+    volatile int refcount;
+    union {
+        struct { // For files
+            struct vfs_node* node;
+            uint64_t offset; // Current read/write offset
+            int flags; // Flags used when opening the file
+        } file;
+        struct socket* sock; // For sockets
+        struct io_ring* ring; // For io rings
+        struct epoll* ep; // For epoll sets
+    } data;
+} fd_entry_t;
+
+typedef struct fd_table {
+    spinlock_t lock;
+    volatile int refcount; // Threads using this table
+    int size;              // Slots allocated in `entries`
+    int limit;             // Soft limit, descriptors are < limit
+    int hard_limit;        // Ceiling for `limit`
+    fd_entry_t **entries;
+    uint64_t *open_fds;    // Bit per slot, set when in use
+    uint64_t *full_words;  // Bit per open_fds word, set when all 64 are in use
+} fd_table_t;
+
+// New empty table, limits copied from `parent` (or the defaults if NULL)
+fd_table_t *fd_table_create(fd_table_t *parent);
+fd_table_t *fd_table_share(fd_table_t *table); // Take another reference
+void fd_table_release(fd_table_t *table);      // Closes everything on the last one
+
+fd_entry_t *fd_entry_alloc(fd_type_t type);
+// Put `entry` at the lowest free descriptor. Takes over the caller's
+// reference on success; returns the descriptor or -1.
+int fd_install(fd_table_t *table, fd_entry_t *entry);
+// Look up an open descriptor and take a reference to it, NULL if not open
+fd_entry_t *fd_get(fd_table_t *table, int fd);
+void fd_put(fd_entry_t *entry); // Drop a reference, closes the file on the last one
+int fd_close(fd_table_t *table, int fd);
+// Lowest open descriptor >= `from`, or -1
+int fd_next_open(fd_table_t *table, int from);
+
+int fd_table_get_limit(fd_table_t *table, uint64_t *soft, uint64_t *hard);
+int fd_table_set_limit(fd_table_t *table, uint64_t soft, uint64_t hard);
+
+#endif // FDTABLE_H
@@ -0,0 +1,28 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+struct thread;
+
+// Lazy x87/SSE/AVX context switching. The kernel itself is built without
+// SSE, so only threads that take a #NM ever get an FPU state area.
+
+// Enable the FPU and XSAVE on the calling CPU. The BSP also sizes the
+// state area from CPUID.
+void fpu_init_cpu();
+// Called by schedule() right before switching from prev to next.
+void fpu_switch(struct thread *prev, struct thread *next);
+// #NM (Device Not Available) handler
+void fpu_handle_nm();
+// Drop every reference to a dying thread's state and free it.
+void fpu_thread_free(struct thread *thread);
+
+// Let kernel code use SSE (see K_SIMD_OBJS in the Makefile). The section
+// runs with interrupts off, so keep it short: chunk bulk work into a few
+// tens of microseconds per begin/end pair. Sections don't nest.
+int kernel_fpu_usable();
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif // FPU_H
@@ -44,6 +44,7 @@ int fs_create_file(const char *path, uint32_t flags); // flags: FS_FILE_FLAG_FIL
 int fs_write_file(const char *path, const uint8_t *data, size_t size);
 int fs_read_file(const char *path, uint8_t *buffer, size_t size);
 int fs_delete_file(const char *path);
+int fs_rename_file(const char *old_path, const char *new_path); // Replaces an existing file at new_path
 int fs_list_dir(const char *path);
 int fs_get_file_info(const char *path, fs_file_entry_t *info);
 int fs_get_file_info_by_index(int index, fs_file_entry_t *info); // New: to support readdir
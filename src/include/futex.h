@@ -0,0 +1,25 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+// Fast user-space locking. A lock is a 32-bit word in user memory that
+// threads update with atomics; the kernel only gets involved to put a
+// thread to sleep on the word or to wake sleepers. Waiters are keyed by the
+// physical address of the word, so threads of a process and processes
+// sharing the page agree on it. Shared with userspace, see kyroolib.h and
+// userspace/lib/libc/sync.h.
+
+// SYS_FUTEX(uaddr, op, val, val2 [r10], uaddr2 [r8])
+#define FUTEX_WAIT 0    // Sleep if *uaddr == val. val2: timeout in ns, 0 waits forever
+#define FUTEX_WAKE 1    // Wake up to val sleepers, returns how many
+#define FUTEX_REQUEUE 3 // Wake up to val, move up to val2 more to uaddr2
+
+#define FUTEX_BUCKETS 32 // Wait queues waiters are hashed into
+
+// SYS_FUTEX. FUTEX_WAIT returns 0 once woken, -1 if *uaddr != val, on
+// timeout or for a bad address. The others return the number of threads
+// woken (and requeued) or -1.
+int64_t ksys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2);
+
+#endif // FUTEX_H
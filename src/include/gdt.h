@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+// GDT selectors. User data sits right below user code because SYSRET derives
+// both from one MSR_STAR field (SS = base + 8, CS = base + 16).
+#define KERNEL_CODE_SELECTOR 0x08
+#define KERNEL_DATA_SELECTOR 0x10
+#define USER_DATA_SELECTOR 0x18
+#define USER_CODE_SELECTOR 0x20
+#define TSS_SELECTOR 0x28
+
 // GDT entry structure
 struct gdt_entry_bits {
     uint16_t limit_low;
@@ -32,7 +40,10 @@ struct gdt_system_entry_bits {
 } __attribute__((packed));
 
 
-void gdt_init();
+struct cpu;
+
+void gdt_init(); // BSP
+void gdt_init_cpu(struct cpu* cpu);
 void gdt_set_tss(void* tss_base);
 
 #endif // GDT_H
\ No newline at end of file
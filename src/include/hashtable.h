@@ -0,0 +1,88 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Intrusive chained hash table. Objects embed a hash_node_t and the table
+// never allocates per entry; only the bucket array is allocated, at init and
+// when the table grows. Insertion can't fail: if growing fails the chains
+// just get longer. The table does no locking of its own.
+//
+//   typedef struct { int fd; hash_node_t link; } entry_t;
+//   hashtable_insert(&table, &e->link, hash_u64(e->fd));
+//   entry_t *e, *found = NULL;
+//   hashtable_for_each_possible(&table, e, link, hash_u64(fd)) {
+//     if (e->fd == fd) { found = e; break; }
+//   }
+
+typedef struct hash_node {
+  struct hash_node *next;
+  uint64_t hash; // Kept so the table can rehash without asking the owner
+} hash_node_t;
+
+typedef struct {
+  hash_node_t **buckets;
+  size_t bucket_count; // Power of two
+  size_t min_buckets;  // Never shrink below the initial size
+  size_t count;
+} hashtable_t;
+
+#define HASHTABLE_MIN_BUCKETS 8
+
+#define hash_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// 64-bit mix, good enough to spread sequential keys (fds, ports, PFNs)
+static inline uint64_t hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// FNV-1a over a NUL-terminated string
+static inline uint64_t hash_str(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// `buckets` is rounded up to a power of two. Returns -1 if the bucket array
+// can't be allocated.
+int hashtable_init(hashtable_t *table, size_t buckets);
+// Frees the bucket array. The entries belong to the caller.
+void hashtable_destroy(hashtable_t *table);
+
+void hashtable_insert(hashtable_t *table, hash_node_t *node, uint64_t hash);
+// `node` must be in the table
+void hashtable_remove(hashtable_t *table, hash_node_t *node);
+
+// First node in `hash`'s bucket with a matching hash, then the next one
+hash_node_t *hashtable_first(const hashtable_t *table, uint64_t hash);
+hash_node_t *hashtable_next(const hash_node_t *node);
+
+static inline size_t hashtable_count(const hashtable_t *table) {
+  return table->count;
+}
+
+// Iterate the entries whose hash equals `hash`; the caller compares keys
+#define hashtable_for_each_possible(table, pos, member, hash_value)         \
+  for (hash_node_t *ht_n_ = hashtable_first((table), (hash_value));         \
+       ht_n_ && ((pos) = hash_entry(ht_n_, __typeof__(*(pos)), member), 1); \
+       ht_n_ = hashtable_next(ht_n_))
+
+// Iterate every entry. Don't insert or remove while iterating.
+#define hashtable_for_each(table, pos, member)                                \
+  for (size_t ht_b_ = 0; ht_b_ < (table)->bucket_count; ht_b_++)             \
+    for (hash_node_t *ht_n_ = (table)->buckets[ht_b_];                        \
+         ht_n_ && ((pos) = hash_entry(ht_n_, __typeof__(*(pos)), member), 1); \
+         ht_n_ = ht_n_->next)
+
+#endif // HASHTABLE_H
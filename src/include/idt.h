@@ -22,5 +22,6 @@ struct idt_ptr_struct {
 
 
 void idt_init();
+void idt_load(); // Load the shared IDT on the calling CPU
 
 #endif // IDT_H
@@ -0,0 +1,106 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+#include "waitqueue.h"
+
+// Submission/completion rings for batched I/O. SYS_IORING_SETUP maps a
+// region into the process: an io_ring_header_t, then the submission queue
+// entries (at sq_offset), then the completion queue entries (at cq_offset).
+// Userspace fills SQEs at sq_tail and advances it. The kernel takes them from
+// sq_head, runs them in order and posts one CQE per SQE at cq_tail, and
+// userspace reaps CQEs from cq_head. Indices run freely and wrap with the
+// entry count (a power of two); each side only writes its own index.
+//
+// Without IORING_SETUP_SQPOLL, SYS_IORING_ENTER runs the queued SQEs on the
+// calling thread. With it, a kernel thread picks them up as soon as sq_tail
+// moves. After sq_idle_ms without work it sets IORING_SQ_NEED_WAKEUP and
+// sleeps until the next SYS_IORING_ENTER.
+//
+// Requests run like the matching syscall, blocking included: a RECV on an
+// idle socket holds up the SQEs behind it. SQEs are only consumed while the
+// CQ has room for their completions.
+// Shared with userspace, see kyroolib.h.
+
+#define IORING_MAX_ENTRIES 256
+
+// Rings are mapped upwards from here, each at fresh addresses
+#define IORING_VADDR_BASE 0x00007F0000000000ULL
+
+// io_ring_params_t.flags
+#define IORING_SETUP_SQPOLL (1 << 0) // Kernel thread polls the SQ
+
+// io_ring_header_t.sq_flags
+#define IORING_SQ_NEED_WAKEUP (1 << 0) // SQPOLL thread sleeps, enter wakes it
+
+#define IORING_OP_NOP 0
+#define IORING_OP_READ 1  // read(fd, addr, len)
+#define IORING_OP_WRITE 2 // write(fd, addr, len)
+#define IORING_OP_SEND 3  // send(fd, addr, len, op_flags)
+#define IORING_OP_RECV 4  // recv(fd, addr, len, op_flags)
+#define IORING_OP_OPEN 5  // open((const char *)addr, op_flags), res is the fd
+#define IORING_OP_CLOSE 6 // close(fd), not for io ring descriptors
+
+typedef struct io_sqe {
+  uint8_t opcode;
+  uint8_t flags; // Must be 0
+  uint16_t reserved;
+  int32_t fd;
+  uint64_t addr; // Buffer or path
+  uint32_t len;
+  uint32_t op_flags;  // Open flags, send/recv flags
+  uint64_t user_data; // Copied to the completion
+} io_sqe_t;
+
+typedef struct io_cqe {
+  uint64_t user_data;
+  int32_t res; // What the syscall would have returned
+  uint32_t flags;
+} io_cqe_t;
+
+typedef struct io_ring_header {
+  // Submission queue
+  volatile uint32_t sq_head; // Written by the kernel
+  volatile uint32_t sq_tail; // Written by userspace
+  uint32_t sq_entries;
+  volatile uint32_t sq_flags;
+  uint32_t sq_offset;
+  uint32_t pad0[11]; // CQ indices on their own cache line
+  // Completion queue
+  volatile uint32_t cq_head; // Written by userspace
+  volatile uint32_t cq_tail; // Written by the kernel
+  uint32_t cq_entries; // Twice sq_entries
+  uint32_t cq_offset;
+  uint32_t pad1[12];
+} io_ring_header_t;
+
+typedef struct io_ring_params {
+  uint32_t flags;      // IORING_SETUP_*
+  uint32_t sq_idle_ms; // SQPOLL: how long to poll before sleeping
+  // Filled in by the kernel
+  uint32_t sq_entries;
+  uint32_t cq_entries;
+  uint64_t ring_addr; // Where the region is mapped
+  uint64_t ring_size;
+} io_ring_params_t;
+
+struct io_ring;
+struct fd_table;
+
+// SYS_IORING_SETUP: ring with at least `entries` SQ slots (rounded up to a
+// power of two) for the calling program. Returns its descriptor, or -1.
+int io_ring_setup(uint32_t entries, io_ring_params_t *params);
+// SYS_IORING_ENTER: submit up to `to_submit` SQEs (without SQPOLL), then
+// wait until `min_complete` CQEs are ready (with SQPOLL). Returns the number
+// of SQEs submitted, or -1.
+int io_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete);
+// The ring's descriptor was closed for the last time
+void io_ring_release(struct io_ring *ring);
+// The program's last thread is exiting, stop the polling threads of the
+// rings in its descriptor table
+void io_ring_exit(struct fd_table *files);
+// For poll: POLLIN while completions wait to be reaped
+uint32_t io_ring_poll(struct io_ring *ring);
+wait_queue_t *io_ring_wait_queue(struct io_ring *ring);
+
+#endif // IO_RING_H
@@ -23,6 +23,20 @@ static inline void enable_interrupts() { __asm__ __volatile__("sti"); }
 
 static inline void disable_interrupts() { __asm__ __volatile__("cli"); }
 
+// Save RFLAGS and disable interrupts; pair with local_irq_restore() so that
+// nested critical sections don't re-enable interrupts too early.
+static inline uint64_t local_irq_save() {
+    uint64_t flags;
+    __asm__ __volatile__("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    if (flags & 0x200) { // IF
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
 static inline uint64_t read_cr2() {
     uint64_t val;
     __asm__ __volatile__("mov %%cr2, %0" : "=r"(val));
@@ -0,0 +1,30 @@
+#ifndef KMUTEX_H
+#define KMUTEX_H
+
+#include <stdint.h>
+
+// Sleeping lock for kernel code that may run long or be preempted while
+// holding it (file data copies, disk I/O). Unlike a spinlock it doesn't
+// raise the preempt count, so cond_resched() still switches inside it.
+// Waiters sleep on one shared queue and get the lock handed over oldest
+// first. Not for IRQ context, and not while holding a spinlock.
+//
+// Mutexes may be embedded in objects that are freed: they have no lock
+// class or registry entry of their own.
+
+typedef struct kmutex {
+  uint32_t locked;
+  uint32_t waiters; // Threads queued for this mutex
+} kmutex_t;
+
+#define KMUTEX_INIT {0, 0}
+
+static inline void kmutex_init(kmutex_t *m) {
+  m->locked = 0;
+  m->waiters = 0;
+}
+
+void kmutex_lock(kmutex_t *m);
+void kmutex_unlock(kmutex_t *m);
+
+#endif // KMUTEX_H
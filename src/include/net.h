@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "driver.h" // For device_t
+#include "rcu.h"
 
 // Forward declaration
 struct net_dev;
@@ -25,10 +26,16 @@ typedef struct net_dev {
     struct net_dev* next;
 } net_dev_t;
 
-// Global list of network devices
+// Global list of network devices. Devices are published with RCU and never
+// removed, so readers can walk it without locking.
 extern net_dev_t* network_devices;
 
 void net_init();
 void net_register_device(net_dev_t* net_dev);
 
+// The device traffic goes out on, NULL if there is none yet
+static inline net_dev_t *net_default_device() {
+    return rcu_dereference(network_devices);
+}
+
 #endif // NET_H
@@ -0,0 +1,63 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include <stdint.h>
+
+// Readiness multiplexing. SYS_POLL checks a set of descriptors once and
+// blocks until one of them is ready; SYS_EPOLL_* keep a registered set in an
+// epoll descriptor, fed by wait queue callbacks, so waiting doesn't rescan
+// every descriptor. Sockets, input descriptors (SYS_INPUT_OPEN), io rings,
+// epoll descriptors and files can be polled; files are always ready.
+// Shared with userspace, see kyroolib.h.
+
+#define POLLIN 0x001   // Data to read (input events, CQEs, ready epoll items)
+#define POLLOUT 0x004  // Writing won't block
+#define POLLERR 0x008  // Reported whether asked for or not
+#define POLLHUP 0x010  // Closed; reported whether asked for or not
+#define POLLNVAL 0x020 // Not an open descriptor
+
+#define EPOLLIN POLLIN
+#define EPOLLOUT POLLOUT
+#define EPOLLERR POLLERR
+#define EPOLLHUP POLLHUP
+#define EPOLLET (1U << 31) // Report a change once instead of while it lasts
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define POLL_MAX_FDS 1024 // Most descriptors SYS_POLL takes
+#define EPOLL_MAX_EVENTS 256 // Most events SYS_EPOLL_WAIT returns at once
+
+typedef struct pollfd {
+  int32_t fd; // Negative: ignored, revents is 0
+  int16_t events;
+  int16_t revents; // Filled in by the kernel
+} pollfd_t;
+
+typedef struct epoll_event {
+  uint32_t events; // EPOLL* for EPOLL_CTL_ADD/MOD; what happened for wait
+  uint32_t pad;
+  uint64_t data;   // Returned as is
+} epoll_event_t;
+
+struct fd_entry;
+struct epoll;
+
+// Current readiness of an open descriptor, POLL* bits
+uint32_t fd_poll(struct fd_entry *f);
+
+// SYS_POLL: timeout_ms < 0 waits forever, 0 doesn't wait. Returns the
+// number of entries with revents set, or -1.
+int ksys_poll(pollfd_t *user_fds, uint32_t nfds, int timeout_ms);
+// SYS_EPOLL_CREATE, returns the descriptor or -1
+int ksys_epoll_create();
+// SYS_EPOLL_CTL: add, change or remove `fd`. An added descriptor stays open
+// until it is removed again or the epoll descriptor is closed.
+int ksys_epoll_ctl(int epfd, int op, int fd, const epoll_event_t *user_event);
+// SYS_EPOLL_WAIT: up to `max` events, timeout as for poll()
+int ksys_epoll_wait(int epfd, epoll_event_t *user_events, int max, int timeout_ms);
+// The epoll descriptor was closed for the last time
+void epoll_release(struct epoll *ep);
+
+#endif // POLL_H
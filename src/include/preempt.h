@@ -0,0 +1,73 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include "smp.h"
+
+// Kernel preemption. The running thread can be switched out on the way back
+// from an interrupt or syscall, or when it drops its last spinlock, unless
+// its preempt count is raised. Holding a spinlock raises it, and
+// preempt_disable() can be used for per-CPU data that needs no lock.
+//
+// The count lives in cpu_t and is accessed %gs-relative, so reading and
+// updating it can't be split by a migration. schedule() saves it per thread.
+
+static inline int preempt_count() {
+    int count;
+    __asm__ __volatile__("movl %%gs:%c1, %0"
+                         : "=r"(count)
+                         : "i"(__builtin_offsetof(cpu_t, preempt_count)));
+    return count;
+}
+
+static inline int need_resched() {
+    int flag;
+    __asm__ __volatile__("movl %%gs:%c1, %0"
+                         : "=r"(flag)
+                         : "i"(__builtin_offsetof(cpu_t, need_resched)));
+    return flag;
+}
+
+// Ask for a reschedule at the next preemption point on this CPU
+static inline void set_need_resched() {
+    __asm__ __volatile__("movl $1, %%gs:%c0"
+                         :
+                         : "i"(__builtin_offsetof(cpu_t, need_resched))
+                         : "memory");
+}
+
+static inline void preempt_disable() {
+    __asm__ __volatile__("incl %%gs:%c0"
+                         :
+                         : "i"(__builtin_offsetof(cpu_t, preempt_count))
+                         : "memory");
+}
+
+// Drop the count without checking for a pending reschedule
+static inline void preempt_enable_no_resched() {
+    __asm__ __volatile__("decl %%gs:%c0"
+                         :
+                         : "i"(__builtin_offsetof(cpu_t, preempt_count))
+                         : "memory");
+}
+
+// Switch away if a reschedule is pending and we're preemptible (count 0 and
+// interrupts enabled).
+void preempt_schedule();
+
+static inline void preempt_enable() {
+    preempt_enable_no_resched();
+    if (need_resched()) {
+        preempt_schedule();
+    }
+}
+
+// Voluntary preemption point for long loops in the kernel (copies, disk
+// I/O). Syscalls run with interrupts off, so a timer tick that fell due
+// during the loop is still pending: it's let in here first, and can switch
+// us out on its way back. Not for code that turned interrupts off itself.
+void cond_resched();
+
+// Preemption point on the way out of an interrupt, interrupts still off
+void preempt_irq_exit();
+
+#endif // PREEMPT_H
@@ -0,0 +1,29 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stdint.h>
+#include "vmm.h" // For pml4_t
+#include "syscall.h" // For rusage_t
+
+// A user program: the address space its threads share. Every thread of the
+// program holds a reference; the address space is destroyed when the last
+// one is reaped. Kernel threads don't belong to a process.
+typedef struct process {
+  uint64_t pid; // Id of the program's first thread
+  pml4_t *pml4;
+  volatile int refcount;
+  rusage_t exited; // Usage of threads already reaped, under threads_lock
+  volatile uint64_t maxrss_pages; // Most user pages seen mapped
+  volatile int nr_threads; // Threads running the program, it ends with the last
+  volatile uint64_t ioring_vaddr; // Where the next io ring gets mapped
+  struct syscall_stats *sc_stats; // Per-syscall counters, NULL if not kept
+} process_t;
+
+// Wrap a new address space, the process owns it from now on (even on failure)
+process_t *process_create(pml4_t *pml4);
+process_t *process_get(process_t *proc);
+void process_put(process_t *proc);
+// Count the pages mapped in the address space and update maxrss_pages
+void process_update_rss(process_t *proc);
+
+#endif // PROCESS_H
@@ -0,0 +1,49 @@
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include <stdint.h>
+
+// Radix tree mapping 64-bit integer keys (PFNs, file offsets, fds) to
+// non-NULL pointers. Each level resolves 6 bits of the key, and the tree only
+// gets as tall as the largest key needs, so dense small keys stay 1-2 levels
+// deep. Interior nodes are allocated on insert and freed once they're empty.
+// No locking of its own.
+
+#define RADIX_TREE_BITS 6
+#define RADIX_TREE_SLOTS (1 << RADIX_TREE_BITS)
+
+typedef struct radix_tree_node {
+  void *slots[RADIX_TREE_SLOTS];
+  uint32_t count; // Non-NULL slots
+} radix_tree_node_t;
+
+typedef struct {
+  radix_tree_node_t *root;
+  uint32_t height; // Levels below the root pointer, 0 when empty
+} radix_tree_t;
+
+#define RADIX_TREE_INIT {NULL, 0}
+
+void radix_tree_init(radix_tree_t *tree);
+// Frees the nodes. The stored pointers belong to the caller.
+void radix_tree_destroy(radix_tree_t *tree);
+
+// Returns -1 if `key` is already present or a node can't be allocated
+int radix_tree_insert(radix_tree_t *tree, uint64_t key, void *value);
+void *radix_tree_lookup(const radix_tree_t *tree, uint64_t key);
+// Returns the removed value, or NULL if `key` wasn't present
+void *radix_tree_delete(radix_tree_t *tree, uint64_t key);
+
+// The entry with the smallest key >= `start`, its key stored in `key_out`.
+// NULL if there is none.
+void *radix_tree_next(const radix_tree_t *tree, uint64_t start,
+                      uint64_t *key_out);
+
+// Iterate entries in key order. Deleting the current entry is fine.
+#define radix_tree_for_each(tree, key, value)                        \
+  for ((value) = radix_tree_next((tree), 0, &(key)); (value);         \
+       (value) = (key) == UINT64_MAX                                  \
+                     ? NULL                                           \
+                     : radix_tree_next((tree), (key) + 1, &(key)))
+
+#endif // RADIX_TREE_H
@@ -0,0 +1,65 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "preempt.h"
+
+// Read-copy-update for read-mostly data. Readers run between rcu_read_lock()
+// and rcu_read_unlock(), take no locks and write nothing shared; they must
+// not block. Writers serialize among themselves with an ordinary lock,
+// publish with rcu_assign_pointer(), and free what they unlinked only after a
+// grace period, with synchronize_rcu() or call_rcu().
+//
+// Quiescent-state based: a read-side section runs with preemption disabled,
+// so a CPU that goes through schedule() can't be inside one. A grace period
+// ends once every online CPU has done that at least once.
+
+typedef struct rcu_head {
+  struct rcu_head *next;
+  void (*func)(struct rcu_head *head);
+} rcu_head_t;
+
+typedef void (*rcu_callback_t)(rcu_head_t *head);
+
+static inline void rcu_read_lock() { preempt_disable(); }
+static inline void rcu_read_unlock() { preempt_enable(); }
+
+// Load a pointer readers may follow. Pairs with rcu_assign_pointer().
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+// Publish `v` once it's fully initialized
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// Singly linked lists through a `next` member. Writers hold the list's lock.
+#define rcu_list_for_each(pos, head) \
+  for ((pos) = rcu_dereference(head); (pos); (pos) = rcu_dereference((pos)->next))
+
+#define rcu_list_add(head, node)             \
+  do {                                       \
+    (node)->next = (head);                   \
+    rcu_assign_pointer((head), (node));      \
+  } while (0)
+
+// Unlink `node`. Readers may still be looking at it until a grace period ends.
+#define rcu_list_del(head, node)                              \
+  do {                                                        \
+    __typeof__(head) *rcu_pp_ = &(head);                      \
+    while (*rcu_pp_ && *rcu_pp_ != (node)) {                  \
+      rcu_pp_ = &(*rcu_pp_)->next;                            \
+    }                                                         \
+    if (*rcu_pp_) {                                           \
+      rcu_assign_pointer(*rcu_pp_, (node)->next);             \
+    }                                                         \
+  } while (0)
+
+#define rcu_container_of(ptr, type, member) \
+  ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+// Start the callback worker. Callbacks queued before this run afterwards.
+void rcu_init();
+// Wait for a grace period. Sleeps, so not from IRQs, under spinlocks or in a
+// read-side section.
+void synchronize_rcu();
+// Run `func(head)` after a grace period, from the "rcu" worker thread. Safe
+// from any context.
+void call_rcu(rcu_head_t *head, rcu_callback_t func);
+
+#endif // RCU_H
@@ -6,6 +6,22 @@
 void scheduler_init();
 void schedule();
 void scheduler_add_thread(thread_t *thread);
+// Make a THREAD_BLOCKED thread runnable again. Safe from IRQ context.
+void scheduler_wake(thread_t *thread);
+// Completes a context switch on the new thread's stack. Called right after
+// thread_switch() returns and by freshly created threads.
+void scheduler_finish_switch();
+// Per-CPU idle loop, never returns.
+void scheduler_idle_loop();
+// Block the current thread for at least `ns` nanoseconds (rounded up to the
+// next timer tick).
+void scheduler_sleep_ns(uint64_t ns);
+// Like schedule() for a thread that set itself THREAD_BLOCKED (interrupts
+// off), but also wakes it once the TSC passes `wake_tsc`. Returns 1 if it
+// timed out, 0 if scheduler_wake() came first.
+int scheduler_block_until(uint64_t wake_tsc);
+// Timer tick hook, wakes sleepers that are due.
+void scheduler_tick();
 thread_t *get_current_thread();
 uint64_t timer_get_ticks();
 
@@ -0,0 +1,19 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized helpers, built with K_SIMD_CFLAGS. Only call these between
+// kernel_fpu_begin() and kernel_fpu_end().
+
+// Copy with non-temporal stores, for write-only destinations such as the
+// framebuffer. Regions must not overlap.
+void simd_copy_nt(void *dest, const void *src, size_t n);
+
+// SHA-256 compression of `blocks` 64-byte blocks using the SHA extensions.
+// Round constants come from K_SHA256 in crypto.c.
+extern const uint32_t K_SHA256[64];
+void sha256_ni_transform(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+#endif // SIMD_H
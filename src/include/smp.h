@@ -0,0 +1,75 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "limine.h"
+#include "spinlock.h"
+#include "tss.h"
+#include "vmm.h" // For pml4_t
+
+#define MAX_CPUS 32
+#define GDT_ENTRIES 7 // Null, Kernel Code/Data, User Code/Data, TSS (2 entries)
+
+struct thread;
+
+// Per-CPU data. While running in the kernel, GS base points at the current
+// CPU's cpu_t; user GS is swapped in with swapgs on every ring transition.
+typedef struct cpu {
+    struct cpu *self; // Must stay first, this_cpu() reads %gs:0
+    // Read by the SYSCALL entry in isr_stubs.asm at fixed offsets
+    uint64_t kernel_rsp; // Kernel stack top of the running thread, as TSS rsp0
+    uint64_t user_rsp;   // User RSP while the SYSCALL entry switches stacks
+    uint32_t id;      // Logical index, 0 is the BSP
+    uint32_t lapic_id;
+    volatile int online;
+
+    struct thread *current_thread;
+    struct thread *idle_thread;
+    struct thread *prev_thread; // Thread we just switched away from
+    int prev_requeue;           // Put prev_thread back on the run queue
+    int preempt_count;          // preempt_disable() depth, see preempt.h
+    volatile int need_resched;  // Switch at the next preemption point
+    volatile uint64_t rcu_qs;   // RCU quiescent states passed, see rcu.h
+    uint64_t timer_deadline;    // TSC value of the next scheduler tick
+    struct thread *fpu_owner;   // Thread whose FPU state was last loaded here
+    int kernel_fpu_active;      // Inside kernel_fpu_begin/end
+    uint64_t kernel_fpu_flags;  // RFLAGS saved by kernel_fpu_begin
+
+    // READY threads only, FIFO through thread->next
+    spinlock_t rq_lock;
+    struct thread *rq_head;
+    struct thread *rq_tail;
+    volatile uint32_t rq_len;
+
+    uint64_t gdt[GDT_ENTRIES] __attribute__((aligned(16)));
+    struct tss_entry_struct tss __attribute__((aligned(16)));
+
+#if CONFIG_LOCKDEP
+    spinlock_t *held_locks[LOCKDEP_MAX_DEPTH];
+    int held_depth;
+#endif
+} cpu_t;
+
+_Static_assert(offsetof(cpu_t, kernel_rsp) == 8, "isr_stubs.asm CPU_KERNEL_RSP");
+_Static_assert(offsetof(cpu_t, user_rsp) == 16, "isr_stubs.asm CPU_USER_RSP");
+
+extern cpu_t cpus[MAX_CPUS];
+
+static inline cpu_t *this_cpu() {
+    cpu_t *cpu;
+    __asm__ __volatile__("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Point GS base at the BSP's cpu_t. Must run before anything takes a lock.
+void smp_early_init();
+// Start all APs reported by the bootloader. They end up in the idle loop.
+void smp_init(struct limine_smp_response *smp);
+uint32_t smp_cpu_count();
+
+// Invalidate `addr` on every other CPU that might have it cached.
+void tlb_shootdown(pml4_t *pml4, uint64_t addr);
+void tlb_shootdown_handle();
+
+#endif // SMP_H
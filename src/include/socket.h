@@ -6,6 +6,9 @@
 #include "net.h" // For net_dev_t, IP addresses
 #include "udp.h" // For UDP functions
 #include "thread.h" // For blocking/non-blocking behavior
+#include "spinlock.h"
+#include "rcu.h"
+#include "waitqueue.h"
 
 // Socket domains
 #define AF_INET     2   // IPv4 Internet protocols
@@ -20,6 +23,9 @@
 #define IPPROTO_TCP     6   // Transmission Control Protocol
 #define IPPROTO_UDP     17  // User Datagram Protocol
 
+// Largest send or receive from userspace, the largest UDP datagram
+#define SOCK_USER_MAX   65536
+
 // Socket states
 typedef enum {
     SOCK_STATE_CLOSED,
@@ -66,8 +72,10 @@ typedef struct socket {
         tcp_tcb_t* tcp_tcb; // For TCP sockets
     } proto_data;
     
-    // For blocking calls (common to both UDP and TCP recv)
-    thread_t* waiting_thread; // Thread currently waiting on this socket
+    // Threads blocked in recv and epoll sets watching the socket, woken
+    // with POLLIN when data arrives
+    wait_queue_t wq;
+    spinlock_t lock; // Protects the receive buffer
 
     // Functions for protocol-specific operations
     int (*sock_connect)(struct socket* sock, const sockaddr_in_t* addr);
@@ -76,10 +84,12 @@ typedef struct socket {
     void (*sock_close)(struct socket* sock);
 
     struct socket* next; // For linked list of all active sockets
+    rcu_head_t rcu;      // Deferred free after sock_close()
 } socket_t;
 
 
-// Global list of active sockets (managed by kernel)
+// Global list of active sockets (managed by kernel). Walked under
+// rcu_read_lock() on receive; sock_create/bind/close serialize on a writer lock.
 extern socket_t* active_sockets;
 
 // Functions for socket management (kernel-side)
@@ -90,7 +100,12 @@ socket_t* sock_accept(socket_t* sock, sockaddr_in_t* addr);
 int sock_connect(socket_t* sock, const sockaddr_in_t* addr);
 int sock_send(socket_t* sock, const void* buf, size_t len, int flags);
 int sock_recv(socket_t* sock, void* buf, size_t len, int flags);
+// Same, with `buf` in userspace. Returns -1 if it faults.
+int sock_send_user(socket_t* sock, const void* user_buf, size_t len, int flags);
+int sock_recv_user(socket_t* sock, void* user_buf, size_t len, int flags);
 int sock_close(socket_t* sock);
+// Readiness for poll: POLLIN with data buffered, POLLOUT once sends can go out
+uint32_t sock_poll(socket_t* sock);
 void sock_handle_incoming_packet(net_dev_t *net_dev, const ipv4_header_t *ip_hdr, const uint8_t *payload, size_t payload_size, uint8_t protocol);
 
 #endif // SOCKET_H
@@ -0,0 +1,60 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+
+// Set to 1 to keep per-lock acquisition/contention counters (see `lockstat`).
+#ifndef CONFIG_LOCK_STATS
+#define CONFIG_LOCK_STATS 1
+#endif
+
+// Lock-order checking. Enabled by `make DEBUG=1`, which passes
+// -DCONFIG_LOCKDEP=1. Costs a few hundred cycles per acquisition.
+#ifndef CONFIG_LOCKDEP
+#define CONFIG_LOCKDEP 0
+#endif
+
+#define LOCKDEP_MAX_CLASSES 64
+#define LOCKDEP_MAX_DEPTH 16
+
+// FIFO ticket lock. Waiters are served in the order they arrived, so a busy
+// lock can't starve a CPU.
+typedef struct spinlock {
+    volatile uint32_t next_ticket;
+    volatile uint32_t owner_ticket;
+    const char *name;
+
+    // Registry bookkeeping, filled in on first acquisition
+    volatile int registered;
+    int id; // Lock class for lockdep, 1-based (0 = not registered yet)
+    struct spinlock *next_registered;
+
+#if CONFIG_LOCK_STATS
+    uint64_t acquisitions;
+    uint64_t contended;   // Acquisitions that had to spin
+    uint64_t spin_cycles; // TSC cycles spent spinning
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(lock_name) { .next_ticket = 0, .owner_ticket = 0, .name = (lock_name) }
+
+void spinlock_init(spinlock_t *lock, const char *name);
+
+void spin_lock(spinlock_t *lock);
+int spin_trylock(spinlock_t *lock); // Returns 1 if the lock was taken
+void spin_unlock(spinlock_t *lock);
+
+// Same as above, but also disables interrupts. Use for anything an IRQ
+// handler might touch.
+uint64_t spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags);
+
+static inline int spin_is_locked(spinlock_t *lock) {
+    return lock->next_ticket != lock->owner_ticket;
+}
+
+// Print counters for every lock that has been taken at least once.
+void spinlock_dump_stats(void);
+void spinlock_reset_stats(void);
+
+#endif // SPINLOCK_H
@@ -1,6 +1,7 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include <stddef.h>
 #include "isr.h"
 
 // Syscall numbers
@@ -31,8 +32,110 @@
 #define SYS_EXEC 24
 #define SYS_GFX_GET_FB_INFO 25
 #define SYS_INPUT_POLL_EVENT 26
+#define SYS_SLEEP 27 // (uint64_t milliseconds)
+#define SYS_THREAD_STATS 28 // (thread_info_t *buf, int max, uint64_t *uptime_ns), returns count
+#define SYS_WAITPID 29 // (uint64_t tid, int *status), returns tid
+#define SYS_GETRLIMIT 30 // (int resource, rlimit_t *rlim)
+#define SYS_SETRLIMIT 31 // (int resource, const rlimit_t *rlim)
+#define SYS_THREAD_SPAWN 32 // (void (*entry)(void *), void *stack, void *arg), returns tid
+#define SYS_ARCH_PRCTL 33 // (int code, uint64_t addr)
+#define SYS_WAIT4 34 // (uint64_t tid, int *status, rusage_t *usage), returns tid
+#define SYS_GETRUSAGE 35 // (int who, rusage_t *usage)
+#define SYS_IORING_SETUP 36 // (uint32_t entries, io_ring_params_t *params), returns fd
+#define SYS_IORING_ENTER 37 // (int fd, uint32_t to_submit, uint32_t min_complete)
+#define SYS_LSEEK 38 // (int fd, int64_t offset, int whence), returns the new offset
+#define SYS_PREAD 39 // (int fd, void *buf, size_t size, uint64_t offset)
+#define SYS_PWRITE 40 // (int fd, const void *buf, size_t size, uint64_t offset)
+#define SYS_READV 41 // (int fd, const iovec_t *iov, int iovcnt)
+#define SYS_WRITEV 42 // (int fd, const iovec_t *iov, int iovcnt)
+#define SYS_POLL 43 // (pollfd_t *fds, uint32_t nfds, int timeout_ms), returns ready count
+#define SYS_EPOLL_CREATE 44 // (), returns fd
+#define SYS_EPOLL_CTL 45 // (int epfd, int op, int fd, const epoll_event_t *event)
+#define SYS_EPOLL_WAIT 46 // (int epfd, epoll_event_t *events, int max, int timeout_ms)
+#define SYS_INPUT_OPEN 47 // (), returns an fd that reads event_t records
+#define SYS_FUTEX 48 // (uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2), see futex.h
+#define SYS_OPENAT 49 // (int dirfd, const char *path, int flags), returns fd
+#define SYS_FSTATAT 50 // (int dirfd, const char *path, struct stat *stat_buf)
+#define SYS_MKDIRAT 51 // (int dirfd, const char *path)
+#define SYS_UNLINKAT 52 // (int dirfd, const char *path, int flags)
+#define SYS_FSTAT 53 // (int fd, struct stat *stat_buf)
+#define SYS_RENAME 54 // (const char *old_path, const char *new_path)
+#define SYS_RENAMEAT 55 // (int old_dirfd, const char *old_path, int new_dirfd, const char *new_path)
+#define SYS_COPY_FILE_RANGE 56 // (int fd_in, uint64_t *off_in, int fd_out, uint64_t *off_out, size_t len)
+#define SYS_SENDFILE 57 // (int out_fd, int in_fd, uint64_t *offset, size_t count)
+
+// Whence for SYS_LSEEK
+#define SEEK_SET 0 // offset
+#define SEEK_CUR 1 // Current offset + offset
+#define SEEK_END 2 // File length + offset
+
+// dirfd for the *at syscalls: resolve from the root. Absolute paths always
+// are, relative ones otherwise start at the directory open as dirfd.
+#define AT_FDCWD -100
+#define AT_REMOVEDIR 0x200 // SYS_UNLINKAT flag: remove a directory, as SYS_RMDIR
+
+// One buffer of SYS_READV/SYS_WRITEV
+typedef struct iovec {
+    void *iov_base;
+    size_t iov_len;
+} iovec_t;
+
+#define IOV_MAX 1024 // Most buffers per call
+
+// Codes for SYS_ARCH_PRCTL
+#define ARCH_SET_FS 0x1002 // FS base = addr, for thread-local storage
+#define ARCH_GET_FS 0x1003 // *(uint64_t *)addr = FS base
+
+// Resources for SYS_GETRLIMIT/SYS_SETRLIMIT
+#define RLIMIT_NOFILE 7 // Open file descriptors
+
+typedef struct rlimit {
+    uint64_t rlim_cur; // Soft limit, what's enforced
+    uint64_t rlim_max; // Hard limit, ceiling for rlim_cur
+} rlimit_t;
+
+// Who SYS_GETRUSAGE reports on
+#define RUSAGE_SELF 0   // The calling thread's whole process
+#define RUSAGE_THREAD 1 // Only the calling thread
+
+// Resource usage of a process or thread. Times are in nanoseconds.
+typedef struct rusage {
+    uint64_t utime_ns;     // CPU time in userspace
+    uint64_t stime_ns;     // CPU time in the kernel; all of it for kernel threads
+    uint64_t maxrss_pages; // Peak resident userspace pages
+    uint64_t page_faults;
+    uint64_t read_bytes;   // Through the VFS
+    uint64_t write_bytes;
+    uint64_t nvcsw;        // Voluntary context switches
+    uint64_t nivcsw;       // Involuntary context switches
+} rusage_t;
+
+// One entry of SYS_THREAD_STATS. Times are in nanoseconds.
+typedef struct thread_info {
+    uint64_t id;
+    uint32_t state; // thread_state_t
+    uint32_t cpu;
+    char name[16];
+    uint64_t run_ns;
+    uint64_t wait_ns;
+    uint64_t wakeup_avg_ns;
+    uint64_t wakeup_max_ns;
+    uint64_t wakeups;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+} thread_info_t;
+
+// Bodies of the file syscalls, on an explicit descriptor table so io rings
+// can run them from their polling thread. Same results as the syscalls.
+struct fd_table;
+int64_t ksys_read(struct fd_table *files, int fd, void *buf, size_t size);
+int64_t ksys_write(struct fd_table *files, int fd, const void *buf, size_t size);
+int ksys_open(struct fd_table *files, const char *user_path, int flags);
+int ksys_openat(struct fd_table *files, int dirfd, const char *user_path, int flags);
 
 void syscall_init();
+// Enable SYSCALL/SYSRET on the calling CPU
+void syscall_init_cpu();
 void syscall_handler(struct registers *regs);
 
 #endif // SYSCALL_H
@@ -0,0 +1,45 @@
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+#include <stdint.h>
+
+// Set to 1 to count calls, errors and latency for every syscall, system-wide
+// and per process (see `syscallstat`). Costs two atomic adds and a few
+// cycles per syscall.
+#ifndef CONFIG_SYSCALL_STATS
+#define CONFIG_SYSCALL_STATS 1
+#endif
+
+#define SYSCALL_STATS_NR 64      // Syscall numbers tracked, higher ones aren't
+#define SYSCALL_STATS_BUCKETS 32 // Latency bucket k: [2^k, 2^(k+1)) ns, the last is open
+
+typedef struct syscall_stat {
+  uint64_t calls;
+  uint64_t errors; // Calls that returned a negative value
+  uint64_t ns;     // Total latency, blocking included
+  uint32_t hist[SYSCALL_STATS_BUCKETS];
+} syscall_stat_t;
+
+struct process;
+
+typedef struct syscall_stats {
+  syscall_stat_t sys[SYSCALL_STATS_NR];
+  struct process *proc; // Owner, NULL for the system-wide counters
+  struct syscall_stats *next;
+} syscall_stats_t;
+
+#if CONFIG_SYSCALL_STATS
+// Counters for a new process, registered for `syscallstat`. NULL if out of
+// memory, the process is then only counted system-wide.
+syscall_stats_t *syscall_stats_alloc(struct process *proc);
+void syscall_stats_free(syscall_stats_t *stats);
+// One finished syscall. `proc` may be NULL.
+void syscall_stats_record(struct process *proc, uint64_t num, uint64_t cycles, int64_t ret);
+#endif
+
+// Print the system-wide counters and a line per process, or with a `pid`,
+// the counters of that process. With `hist`, also the latency histograms.
+void syscall_stats_dump(uint64_t pid, int hist);
+void syscall_stats_reset(void);
+
+#endif // SYSCALL_STATS_H
@@ -4,33 +4,11 @@
 #include <stdint.h>
 #include "isr.h" // For struct registers
 #include "vmm.h" // For pml4_t, USER_STACK_SIZE, USER_STACK_TOP
+#include "fdtable.h"
 
 #define KERNEL_STACK_SIZE 8192 // 8KB stack for kernel threads
 
-#define MAX_FILES 16
-
-// Forward declare vfs_node_t to avoid circular dependency
-struct vfs_node;
-struct socket; // Forward declare socket for fd_entry_t union
-
-typedef enum {
-    FD_TYPE_NONE,
-    FD_TYPE_FILE,
-    FD_TYPE_SOCKET
-} fd_type_t;
-
-// Define file descriptor entry
-typedef struct {
-    fd_type_t type;
-    union {
-        struct { // For files
-            struct vfs_node* node;
-            uint64_t offset; // Current read/write offset
-            int flags; // Flags used when opening the file
-        } file;
-        struct socket* sock; // For sockets
-    } data;
-} fd_entry_t;
+#define THREAD_NAME_LEN 16
 
 // State of a thread
 typedef enum {
@@ -40,6 +18,29 @@ typedef enum {
     THREAD_DEAD
 } thread_state_t;
 
+// Scheduler accounting, in TSC cycles. Updated by schedule() and the wakeup
+// paths; read without locking for statistics.
+typedef struct {
+    uint64_t run_cycles;        // Time spent on a CPU
+    uint64_t wait_cycles;       // Time spent READY in a run queue
+    uint64_t wakeup_cycles;     // Sum of wakeup-to-run delays
+    uint64_t wakeup_max_cycles; // Longest wakeup-to-run delay
+    uint64_t wakeups;
+    uint64_t nvcsw;             // Voluntary switches (blocked, slept, exited)
+    uint64_t nivcsw;            // Involuntary switches (preempted)
+    uint64_t on_cpu_since;      // When it last got a CPU
+    uint64_t ready_since;       // When it last became READY
+    int woken;                  // Became READY through scheduler_wake()
+    uint64_t sys_cycles;        // Part of run_cycles spent in syscalls
+    uint64_t sys_since;         // Start of the current in-syscall stretch
+    int in_syscall;
+    // Resource usage, see rusage_t
+    uint64_t page_faults;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+} thread_stats_t;
+
+// NOTE: thread_switch (switch.asm) relies on the offsets of rsp and pml4.
 typedef struct thread {
   uint64_t id;
   thread_state_t state;
@@ -47,17 +48,56 @@ typedef struct thread {
   void *user_stack_base; // Base address of userspace stack
   uint64_t rsp; // Stack pointer
   pml4_t *pml4; // Page map level 4 for virtual memory
-  fd_entry_t fd_table[MAX_FILES]; // File descriptor table
-  struct thread *next; // For scheduler linked list
+  fd_table_t *files; // File descriptor table, shared by all kernel threads
+  struct thread *next; // For scheduler run queues
+  uint32_t cpu; // CPU the thread last ran on (or is queued on)
+  volatile int on_cpu; // Set while a CPU is running on this thread's stack
+  void *fpu_state; // XSAVE/FXSAVE area, 64-byte aligned. NULL until first FPU use
+  void *fpu_alloc; // Unaligned allocation backing fpu_state
+  uint32_t fpu_cpu; // CPU the FPU state was last loaded on
+  char name[THREAD_NAME_LEN];
+  thread_stats_t stats;
+  uint64_t wake_tsc; // When a sleeping thread is due
+  struct thread *sleep_next; // Scheduler sleep queue
+  int sleeping; // On the sleep queue, under its lock
+  int timed_out; // Woken by the sleep queue rather than scheduler_wake()
+  struct thread *all_next; // List of all threads, for statistics
+  struct thread *all_prev;
+  uint64_t parent_id; // Thread that created this one
+  int exit_status; // Passed to thread_exit()
+  uint64_t wait_tid; // Thread we're blocked on in thread_wait()
+  struct thread *wait_next; // Exit waiters list
+  int preempt_count; // cpu->preempt_count while switched out
+  struct process *proc; // User program this thread runs in, NULL for kernel threads
+  uint64_t fs_base; // FS base, points at the thread's TLS block in userspace
 } thread_t;
 
 // Function pointer for thread entry point
 typedef void (*thread_func_t)(void*);
 
 void thread_init();
+thread_t* thread_create_idle(); // Adopt the calling CPU's boot stack as its idle thread
 thread_t* thread_create(thread_func_t func, void* arg); // For kernel threads
 thread_t* thread_create_userspace(uint64_t entry_point, pml4_t* pml4); // For userspace ELFs
-void thread_exit();
+// Another thread of the caller's program, sharing its address space and
+// descriptor table. Starts at `entry_point` with rsp = `user_stack` and
+// rdi = `arg`. Returns NULL for kernel threads.
+thread_t *thread_spawn_user(uint64_t entry_point, uint64_t user_stack, uint64_t arg);
+void thread_exit(int status);
+// Block until child thread `tid` exits and collect its exit status and, if
+// `usage` isn't NULL, its resource usage (the whole process's if `tid` started
+// the program). Returns 0, or -1 if `tid` isn't a child of the caller (or was
+// already waited for).
+struct rusage;
+int thread_wait(uint64_t tid, int *status, struct rusage *usage);
+// Resource usage of `thread` (RUSAGE_THREAD) or its process (RUSAGE_SELF)
+void thread_get_usage(thread_t *thread, int who, struct rusage *out);
+void thread_set_name(thread_t *thread, const char *name);
+void thread_unregister(thread_t *thread); // Drop from the thread list before freeing
+void thread_forget_children(uint64_t parent_id); // Drop exit records nobody will wait for
+// Copy statistics of up to `max` threads into `out`, returns how many.
+struct thread_info;
+int thread_snapshot(struct thread_info *out, int max);
 
 // Assembly function for context switching
 void thread_switch(thread_t* old_thread, thread_t* new_thread);
@@ -22,7 +22,10 @@ struct tss_entry_struct {
     uint16_t iomap_base;
 } __attribute__((packed));
 
-void tss_init();
-void tss_set_stack(uint64_t stack);
+struct cpu;
+
+void tss_init(); // BSP
+void tss_init_cpu(struct cpu* cpu);
+void tss_set_stack(uint64_t stack); // rsp0 and SYSCALL stack of the calling CPU
 
 #endif // TSS_H
@@ -0,0 +1,37 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "isr.h" // For struct registers
+
+// Copying to and from userspace. Syscalls pass user pointers, which may be
+// anything: the range is checked against the lower half first, and a fault
+// during the copy (an unmapped page, a read-only one) makes the copy fail
+// instead of panicking the kernel. The faulting instructions are listed in
+// the __ex_table section with the address to resume at, see
+// uaccess_fixup().
+
+// First address past the user half
+#define USER_SPACE_END 0x0000800000000000ULL
+
+// `size` bytes at `ptr` lie entirely in the user half
+static inline bool access_ok(const void *ptr, size_t size) {
+  uint64_t addr = (uint64_t)ptr;
+  return addr < USER_SPACE_END && size <= USER_SPACE_END - addr;
+}
+
+// Return 0, or -1 if the range isn't userspace or a page faulted. On a
+// fault the destination may be partly written.
+int copy_from_user(void *dst, const void *user_src, size_t size);
+int copy_to_user(void *user_dst, const void *src, size_t size);
+// Copy a NUL-terminated string of at most `max` bytes, NUL included.
+// Returns its length, or -1 on a fault or if it doesn't fit.
+int64_t strncpy_from_user(char *dst, const char *user_src, size_t max);
+
+// Called for kernel-mode page and protection faults. If the faulting
+// instruction has a fixup, points regs->rip at it and returns true.
+bool uaccess_fixup(struct registers *regs);
+
+#endif // UACCESS_H
@@ -21,6 +21,12 @@ void udp_handle_packet(net_dev_t *net_dev, const ipv4_header_t *ip_hdr,
                        const uint8_t *packet, size_t size);
 void udp_send_packet(uint32_t dest_ip, uint16_t src_port, uint16_t dest_port,
                      const uint8_t *data, size_t len);
-void udp_register_handler(uint16_t port, udp_handler_t handler);
+// Route datagrams for `port` (host byte order) to `handler`. `owner` is
+// what the binding belongs to, e.g. a socket, or NULL for the kernel's own
+// services. Returns -1 if another owner has the port; the same owner
+// registering again just swaps the handler.
+int udp_register_handler(uint16_t port, udp_handler_t handler, void *owner);
+// Remove the binding for `port`, if `owner` still has it
+void udp_unregister_handler(uint16_t port, void *owner);
 
 #endif
@@ -0,0 +1,51 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include "vmm.h" // For pml4_t
+
+// Every process has two kernel-provided pages mapped just below its stack
+// guard page:
+// - a read-only data page (vdso_data_t) with the clock parameters
+// - a code page with functions that read the clock from userspace, without
+//   a syscall
+// Shared with userspace, see kyroolib.h.
+
+#define VDSO_DATA_VADDR 0x00007FFFFFEFC000ULL
+#define VDSO_TEXT_VADDR 0x00007FFFFFEFD000ULL
+
+#define VDSO_MAGIC 0x4F5344564F52594BULL // "KYROVDSO"
+#define VDSO_VERSION 1
+
+#define CLOCK_MONOTONIC 1
+
+typedef struct {
+  int64_t tv_sec;
+  int64_t tv_nsec;
+} vdso_timespec_t;
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  // Seqlock generation, odd while the kernel rewrites the clock fields
+  volatile uint32_t seq;
+
+  uint64_t tsc_boot; // TSC value at monotonic time 0
+  uint64_t ns_mult;  // ns per TSC cycle, 32.32 fixed point
+  uint64_t tick_ns;  // Length of one timer tick, as for SYS_GET_TICKS
+
+  // Exported functions, as offsets from VDSO_TEXT_VADDR:
+  //   uint64_t get_ticks(void);
+  //   int clock_gettime(int clock, vdso_timespec_t *ts);
+  uint64_t get_ticks_offset;
+  uint64_t clock_gettime_offset;
+} vdso_data_t;
+
+// Build both pages. Needs the clock to be calibrated.
+void vdso_init();
+// Republish the clock parameters, e.g. after recalibration
+void vdso_update();
+// Map the pages into a new user address space
+void vdso_map(pml4_t *pml4);
+
+#endif // VDSO_H
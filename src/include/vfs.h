@@ -35,6 +35,14 @@ typedef int (*readdir_vfs_t)(struct vfs_node *node, uint32_t index, struct diren
 typedef int (*remove_vfs_t)(struct vfs_node *node, char *name);
 typedef int (*rmdir_vfs_t)(struct vfs_node *node, char *name, uint16_t mode);
 typedef int (*stat_vfs_t)(struct vfs_node *node, struct stat *stat_buf);
+// Move old_dir/old_name to new_dir/new_name in one step, replacing what is
+// there. Both directories belong to the filesystem whose op is called.
+typedef int (*rename_vfs_t)(struct vfs_node *old_dir, char *old_name,
+                            struct vfs_node *new_dir, char *new_name);
+// Copy file data without a bounce buffer. Both files belong to the
+// filesystem whose op is called. Returns bytes copied, short at EOF.
+typedef uint32_t (*copy_range_vfs_t)(struct vfs_node *in, uint64_t off_in,
+                                     struct vfs_node *out, uint64_t off_out, uint32_t size);
 typedef int (*ioctl_vfs_t)(struct vfs_node *node, int request, void* argp);
 typedef int (*mount_vfs_t)(struct vfs_node *mount_point, struct vfs_node *device_node, const char* fs_type_name); // Updated signature
 typedef int (*unmount_vfs_t)(struct vfs_node *mount_point); // New: for unmounting filesystems
@@ -65,6 +73,8 @@ typedef struct vfs_node {
   remove_vfs_t remove;
   rmdir_vfs_t rmdir;
   stat_vfs_t stat;
+  rename_vfs_t rename;
+  copy_range_vfs_t copy_range;
   ioctl_vfs_t ioctl;
   mount_vfs_t mount;
 } vfs_node_t;
@@ -77,6 +87,10 @@ typedef struct vfs_node {
 #define S_ISREG(m)  (((m) & S_IFMT) == S_IFREG)  // test for regular file
 
 // Flags for VFS nodes
+// Largest file the VFS lets a write or seek reach. KyroFS keeps sizes in
+// 32 bits, and offsets come straight from userspace.
+#define VFS_FILE_SIZE_MAX (1ULL << 31)
+
 #define VFS_FILE 0x01
 #define VFS_DIRECTORY 0x02
 #define VFS_MOUNTPOINT 0x04
@@ -94,10 +108,17 @@ extern vfs_node_t *vfs_root;
 
 void vfs_init();
 void vfs_open(vfs_node_t *node, int flags); // New declaration
+// Once per vfs_open(), when the last descriptor on it goes away
+void vfs_close(vfs_node_t *node);
 uint32_t vfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                   uint8_t *buffer);
 uint32_t vfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer);
+// File to file inside the kernel: the filesystem's copy_range op if both
+// share it, otherwise through a kernel buffer. Returns bytes copied (short
+// at EOF) or (uint32_t)-1.
+uint32_t vfs_copy_range(vfs_node_t *in, uint64_t off_in, vfs_node_t *out, uint64_t off_out,
+                        uint32_t size);
 vfs_node_t *vfs_finddir(vfs_node_t *node, char *name);
 int vfs_readdir(vfs_node_t *node, uint32_t index, struct dirent *dir_entry); // Changed return type and added arg
 int vfs_mkdir(vfs_node_t *root, const char *path, uint16_t mode);
@@ -106,6 +127,8 @@ int vfs_remove(vfs_node_t *root, const char *path);
 vfs_node_t *vfs_resolve_path(vfs_node_t *root, const char *path);
 int vfs_rmdir(vfs_node_t *root, const char *path, uint16_t mode); // New: for removing directories
 int vfs_stat(vfs_node_t *root, const char *path, struct stat *stat_buf); // New: for getting file/dir info
+// Rename within one filesystem, -1 across filesystems (copy instead)
+int vfs_rename(vfs_node_t *old_root, const char *old_path, vfs_node_t *new_root, const char *new_path);
 int vfs_ioctl(vfs_node_t *node, int request, void* argp); // New: for device-specific control
 int vfs_mount(vfs_node_t *mount_point, vfs_node_t *device_node, const char* fs_type_name); // New: for mounting filesystems
 int vfs_unmount(vfs_node_t *mount_point); // New: for unmounting filesystems
@@ -8,6 +8,7 @@
 #define PAGE_WRITE (1 << 1)
 #define PAGE_USER (1 << 2)
 #define PAGE_NO_EXEC (1ULL << 63) // No-Execute bit (NX)
+#define PAGE_ADDR_MASK 0x000FFFFFFFFFF000ULL // Physical address bits of an entry
 
 extern uint64_t hhdm_offset; // Defined in kernel.c
 
@@ -52,5 +53,8 @@ pml4_t* vmm_create_address_space();
 void vmm_destroy_address_space(pml4_t* pml4);
 void vmm_switch_address_space(pml4_t* pml4);
 pml4_t* vmm_get_current_pml4();
+uint64_t vmm_count_user_pages(pml4_t* pml4); // Pages mapped in the lower half
+// Physical address `virt` maps to in `pml4`, NULL if it isn't mapped
+void* vmm_get_phys(pml4_t* pml4, void* virt);
 
 #endif // VMM_H
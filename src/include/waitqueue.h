@@ -0,0 +1,50 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+// A list of parties interested in an object's state: threads blocked on it,
+// or epoll sets watching it. Whoever changes the state calls wake_up() with
+// the poll events that changed, and every entry's callback runs.
+//
+// Waiters add their entry before checking the condition and block after,
+// so a wake_up() between the check and schedule() isn't lost.
+
+struct thread;
+struct wait_queue_entry;
+
+// Runs under the queue's lock with interrupts off, possibly in IRQ context.
+// Must not block or touch the queue.
+typedef void (*wait_func_t)(struct wait_queue_entry *entry, uint32_t events);
+
+typedef struct wait_queue_entry {
+  wait_func_t func;
+  void *private; // The thread for wait_wake_thread()
+  struct wait_queue_entry *next;
+  struct wait_queue_entry *prev;
+} wait_queue_entry_t;
+
+typedef struct wait_queue {
+  spinlock_t lock;
+  wait_queue_entry_t *head;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT(lock_name) { .lock = SPINLOCK_INIT(lock_name), .head = NULL }
+
+void wait_queue_init(wait_queue_t *wq, const char *name);
+// Entry that wakes `thread` on any event
+void wait_entry_init(wait_queue_entry_t *entry, struct thread *thread);
+void wait_queue_add(wait_queue_t *wq, wait_queue_entry_t *entry);
+void wait_queue_remove(wait_queue_t *wq, wait_queue_entry_t *entry);
+// As above, for owners that pick or move entries themselves (futex.c). The
+// caller holds wq->lock. New entries go to the head.
+void wait_queue_link(wait_queue_t *wq, wait_queue_entry_t *entry);
+void wait_queue_unlink(wait_queue_t *wq, wait_queue_entry_t *entry);
+// Run every entry's callback. Safe from IRQ context.
+void wake_up(wait_queue_t *wq, uint32_t events);
+
+// Default callback, scheduler_wake()s entry->private
+void wait_wake_thread(wait_queue_entry_t *entry, uint32_t events);
+
+#endif // WAITQUEUE_H
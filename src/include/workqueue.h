@@ -0,0 +1,39 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Deferred work ("bottom halves"). IRQ handlers acknowledge the hardware and
+// queue a work item; a dedicated kernel thread runs it later with interrupts
+// enabled, where it can take as long as it needs and be preempted.
+//
+// Each workqueue has one worker thread, so items on the same queue run in
+// order and never concurrently with each other.
+
+typedef void (*work_func_t)(void *arg);
+
+typedef struct work {
+  work_func_t func;
+  void *arg;
+  struct work *next;
+  volatile int pending; // Queued and not yet started
+} work_t;
+
+#define WORK_INIT(fn, data) { .func = (fn), .arg = (data), .next = NULL, .pending = 0 }
+
+typedef struct workqueue workqueue_t;
+
+// Shared queue for work that doesn't need its own thread
+extern workqueue_t *system_wq;
+
+void workqueue_init();
+workqueue_t *workqueue_create(const char *name);
+void work_init(work_t *work, work_func_t func, void *arg);
+// Queue `work` unless it's already pending. Safe from IRQ context. Returns
+// false if it was already queued; it will still run once, so events that
+// arrive in a burst get handled in one batch.
+bool queue_work(workqueue_t *wq, work_t *work);
+bool schedule_work(work_t *work); // queue_work(system_wq, work)
+
+#endif // WORKQUEUE_H
@@ -0,0 +1,157 @@
+#include "apic.h"
+#include "clock.h"
+#include "cpu.h"
+#include "isr.h" // For local_irq_save/restore
+#include "log.h"
+#include "smp.h" // For the per-CPU timer deadline
+#include "vmm.h" // For hhdm_offset
+#include <stdbool.h>
+#include <stddef.h>
+
+// xAPIC register offsets
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_ICR_PENDING (1 << 12)
+#define LAPIC_ICR_ASSERT (1 << 14)
+#define LAPIC_ICR_ALL_BUT_SELF (3 << 18)
+
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_TIMER_ONESHOT (0 << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define MSR_TSC_DEADLINE 0x6E0
+#define CPUID_1_ECX_TSC_DEADLINE (1 << 24)
+#define LAPIC_CALIBRATE_NS 10000000ULL // 10 ms
+
+#define APIC_BASE_ENABLE (1 << 11)
+#define APIC_BASE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// Same physical address on every CPU; accessed through the HHDM like the
+// e1000 registers.
+static volatile uint32_t *lapic_regs = NULL;
+
+// Timer configuration, the same on every CPU
+static bool timer_tsc_deadline = false;
+static uint64_t timer_period_tsc = 0;   // TSC-deadline mode
+static uint32_t timer_period_count = 0; // One-shot mode, in divided bus clocks
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_regs[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_regs[reg / 4] = value;
+}
+
+void lapic_init() {
+    uint64_t apic_base = rdmsr(MSR_APIC_BASE);
+    if (!lapic_regs) {
+        lapic_regs = (volatile uint32_t *)((apic_base & APIC_BASE_ADDR_MASK) + hhdm_offset);
+        klog(LOG_INFO, "LAPIC: Registers at phys %p", (void *)(apic_base & APIC_BASE_ADDR_MASK));
+    }
+    if (!(apic_base & APIC_BASE_ENABLE)) {
+        wrmsr(MSR_APIC_BASE, apic_base | APIC_BASE_ENABLE);
+    }
+
+    lapic_write(LAPIC_TPR, 0); // Accept all interrupt priorities
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t lapic_get_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_write_icr(uint32_t high, uint32_t low) {
+    // ICR high and low must be written back to back on this CPU
+    uint64_t flags = local_irq_save();
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+    lapic_write(LAPIC_ICR_HIGH, high);
+    lapic_write(LAPIC_ICR_LOW, low);
+    local_irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t lapic_id, uint8_t vector) {
+    lapic_write_icr(lapic_id << 24, LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_broadcast_ipi(uint8_t vector) {
+    lapic_write_icr(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_timer_init(uint64_t period_ns) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    timer_tsc_deadline = (ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+    timer_period_tsc = clock_ns_to_tsc(period_ns);
+
+    if (timer_tsc_deadline) {
+        klog(LOG_INFO, "LAPIC: Timer in TSC-deadline mode, period %lu ns.", period_ns);
+        return;
+    }
+
+    // No TSC-deadline support: measure the timer's own clock against the TSC
+    // once and use one-shot mode. All CPUs share the same bus clock.
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    uint64_t wait = clock_ns_to_tsc(LAPIC_CALIBRATE_NS);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < wait) {
+        cpu_relax();
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    uint64_t count = (uint64_t)elapsed * period_ns / LAPIC_CALIBRATE_NS;
+    timer_period_count = count ? (uint32_t)count : 1;
+    klog(LOG_INFO, "LAPIC: Timer in one-shot mode, %lu kHz bus clock / 16.",
+         (uint64_t)elapsed * (NSEC_PER_SEC / LAPIC_CALIBRATE_NS) / 1000);
+}
+
+void lapic_timer_start() {
+    if (timer_tsc_deadline) {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+        // The LVT write has to land before the first deadline is armed
+        __asm__ __volatile__("mfence" ::: "memory");
+        this_cpu()->timer_deadline = rdtsc();
+    } else {
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    }
+    lapic_timer_rearm();
+}
+
+void lapic_timer_rearm() {
+    if (!timer_tsc_deadline) {
+        lapic_write(LAPIC_TIMER_INITIAL, timer_period_count);
+        return;
+    }
+
+    // Advance from the previous deadline so ticks don't drift, but don't try
+    // to catch up on ticks we missed.
+    cpu_t *cpu = this_cpu();
+    uint64_t now = rdtsc();
+    uint64_t next = cpu->timer_deadline + timer_period_tsc;
+    if ((int64_t)(next - now) <= 0) {
+        next = now + timer_period_tsc;
+    }
+    cpu->timer_deadline = next;
+    wrmsr(MSR_TSC_DEADLINE, next);
+}
@@ -4,10 +4,14 @@
 #include "kstring.h" // For memcpy, memset
 #include "log.h"
 #include "net.h" // For getting local MAC
+#include "spinlock.h"
 
 #define ARP_CACHE_SIZE 16
-static arp_cache_entry_t arp_cache[ARP_CACHE_SIZE];
+// Looked up for every outgoing packet, so readers use RCU. Writers hold
+// arp_lock.
+static arp_cache_entry_t *arp_cache[ARP_CACHE_SIZE];
 static uint8_t arp_cache_next_idx = 0;
+static spinlock_t arp_lock = SPINLOCK_INIT("arp_cache");
 
 // Hardcoded local IP for now (e.g., a test IP)
 // extern uint32_t local_ip; // Use the local_ip from ip.c
@@ -17,34 +21,83 @@ void arp_init() {
   klog(LOG_INFO, "ARP initialized.");
 }
 
+static void arp_free_entry(rcu_head_t *head) {
+  kfree(rcu_container_of(head, arp_cache_entry_t, rcu));
+}
+
+static bool mac_equal(const uint8_t *a, const uint8_t *b) {
+  for (int i = 0; i < 6; i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void arp_update_cache(uint32_t ip_addr, const uint8_t mac_addr[6]) {
-  // Check if already in cache
+  // Most ARP traffic just confirms what we already know
+  bool known = false;
+  rcu_read_lock();
   for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-    if (arp_cache[i].ip_addr == ip_addr) {
-      memcpy(arp_cache[i].mac_addr, mac_addr, 6);
-      // klog(LOG_INFO, "ARP: Updated cache entry.");
-      return;
+    arp_cache_entry_t *entry = rcu_dereference(arp_cache[i]);
+    if (entry && entry->ip_addr == ip_addr && mac_equal(entry->mac_addr, mac_addr)) {
+      known = true;
+      break;
     }
   }
+  rcu_read_unlock();
+  if (known) {
+    return;
+  }
 
-  // Add new entry
-  arp_cache[arp_cache_next_idx].ip_addr = ip_addr;
-  memcpy(arp_cache[arp_cache_next_idx].mac_addr, mac_addr, 6);
-  arp_cache_next_idx = (arp_cache_next_idx + 1) % ARP_CACHE_SIZE;
-  // klog(LOG_INFO, "ARP: Added new cache entry.");
+  arp_cache_entry_t *new_entry = (arp_cache_entry_t *)kmalloc(sizeof(arp_cache_entry_t));
+  if (!new_entry) {
+    klog(LOG_ERROR, "ARP: Failed to allocate cache entry.");
+    return;
+  }
+  new_entry->ip_addr = ip_addr;
+  memcpy(new_entry->mac_addr, mac_addr, 6);
+
+  // Replace the entry for this IP if there is one, otherwise the oldest slot
+  uint64_t flags = spin_lock_irqsave(&arp_lock);
+  int slot = -1;
+  for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+    if (arp_cache[i] && arp_cache[i]->ip_addr == ip_addr) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    slot = arp_cache_next_idx;
+    arp_cache_next_idx = (arp_cache_next_idx + 1) % ARP_CACHE_SIZE;
+  }
+  arp_cache_entry_t *old = arp_cache[slot];
+  rcu_assign_pointer(arp_cache[slot], new_entry);
+  spin_unlock_irqrestore(&arp_lock, flags);
+
+  if (old) {
+    call_rcu(&old->rcu, arp_free_entry);
+  }
 }
 
-uint8_t *arp_lookup_mac(uint32_t ip_addr) {
+bool arp_lookup_mac(uint32_t ip_addr, uint8_t mac_out[6]) {
+  bool found = false;
+  rcu_read_lock();
   for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-    if (arp_cache[i].ip_addr == ip_addr) {
-      return arp_cache[i].mac_addr;
+    arp_cache_entry_t *entry = rcu_dereference(arp_cache[i]);
+    if (entry && entry->ip_addr == ip_addr) {
+      memcpy(mac_out, entry->mac_addr, 6);
+      found = true;
+      break;
     }
   }
-  return NULL;
+  rcu_read_unlock();
+  return found;
 }
 
 void arp_send_request(uint32_t target_ip) {
-  if (!network_devices) {
+  net_dev_t *dev = net_default_device();
+  if (!dev) {
     klog(LOG_WARN, "ARP: No network device to send request.");
     return;
   }
@@ -64,7 +117,7 @@ void arp_send_request(uint32_t target_ip) {
 
   // Ethernet Header
   memset(eth_hdr->dest_mac, 0xFF, 6); // Broadcast
-  memcpy(eth_hdr->src_mac, network_devices->mac_addr, 6);
+  memcpy(eth_hdr->src_mac, dev->mac_addr, 6);
   eth_hdr->ether_type =
       __builtin_bswap16(ARP_ETHER_TYPE); // Host to Network byte order
 
@@ -74,19 +127,20 @@ void arp_send_request(uint32_t target_ip) {
   arp_pkt->hw_addr_len = ARP_HW_ADDR_LEN_ETHERNET;
   arp_pkt->pr_addr_len = ARP_PR_ADDR_LEN_IPV4;
   arp_pkt->opcode = __builtin_bswap16(ARP_OPCODE_REQUEST);
-  memcpy(arp_pkt->sender_mac, network_devices->mac_addr, 6);
+  memcpy(arp_pkt->sender_mac, dev->mac_addr, 6);
   arp_pkt->sender_ip =
       __builtin_bswap32(ip_get_local_ip()); // Use IP layer's local_ip
   memset(arp_pkt->target_mac, 0x00, 6);     // Unknown for request
   arp_pkt->target_ip = __builtin_bswap32(target_ip);
 
-  network_devices->send_packet(network_devices, packet_buffer, packet_size);
+  dev->send_packet(dev, packet_buffer, packet_size);
   // klog(LOG_INFO, "ARP: Sent request for IP: XXX.XXX.XXX.XXX"); // Needs
   // proper IP printing
   kfree(packet_buffer);
 }
 
 void arp_handle_packet(const uint8_t *packet, size_t size) {
+  net_dev_t *dev = net_default_device();
   if (size < sizeof(arp_packet_t)) {
     klog(LOG_WARN, "ARP: Packet too small.");
     return;
@@ -115,7 +169,7 @@ void arp_handle_packet(const uint8_t *packet, size_t size) {
       // klog(LOG_INFO, "ARP: Received request for our IP, sending reply.");
 
       // Construct and send ARP reply
-      if (!network_devices) {
+      if (!dev) {
         klog(LOG_WARN, "ARP: No network device to send reply.");
         return;
       }
@@ -134,7 +188,7 @@ void arp_handle_packet(const uint8_t *packet, size_t size) {
 
       // Ethernet Header
       memcpy(eth_hdr->dest_mac, arp_pkt->sender_mac, 6); // Reply to sender
-      memcpy(eth_hdr->src_mac, network_devices->mac_addr, 6);
+      memcpy(eth_hdr->src_mac, dev->mac_addr, 6);
       eth_hdr->ether_type = __builtin_bswap16(ARP_ETHER_TYPE);
 
       // ARP Packet (reply)
@@ -144,13 +198,13 @@ void arp_handle_packet(const uint8_t *packet, size_t size) {
       arp_reply_pkt->hw_addr_len = ARP_HW_ADDR_LEN_ETHERNET;
       arp_reply_pkt->pr_addr_len = ARP_PR_ADDR_LEN_IPV4;
       arp_reply_pkt->opcode = __builtin_bswap16(ARP_OPCODE_REPLY);
-      memcpy(arp_reply_pkt->sender_mac, network_devices->mac_addr, 6);
+      memcpy(arp_reply_pkt->sender_mac, dev->mac_addr, 6);
       arp_reply_pkt->sender_ip =
           __builtin_bswap32(ip_get_local_ip()); // Use IP layer's local_ip
       memcpy(arp_reply_pkt->target_mac, arp_pkt->sender_mac, 6);
       arp_reply_pkt->target_ip = __builtin_bswap32(sender_ip);
 
-      network_devices->send_packet(network_devices, reply_buffer, reply_size);
+      dev->send_packet(dev, reply_buffer, reply_size);
       kfree(reply_buffer);
     }
   } else if (opcode == ARP_OPCODE_REPLY) {
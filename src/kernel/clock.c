@@ -0,0 +1,151 @@
+#include "clock.h"
+#include "apic.h"
+#include "cpu.h"
+#include "isr.h"
+#include "log.h"
+#include "port_io.h"
+#include <stddef.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61 // Bit 0: channel 2 gate, bit 5: channel 2 output
+#define PIT_CALIBRATE_MS 10
+
+#define PIC1_DATA 0x21
+
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_boot = 0;
+static uint64_t ns_mult = 0; // ns per TSC cycle, 32.32 fixed point
+static uint32_t timer_hz = 100;
+
+// Ask the CPU (or the hypervisor) for the TSC frequency. Returns 0 if it
+// doesn't tell.
+static uint64_t tsc_hz_from_cpuid() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+
+    // Leaf 0x15: TSC/crystal ratio and crystal frequency
+    if (max_leaf >= 0x15) {
+        cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+        if (eax && ebx && ecx) {
+            return (uint64_t)ecx * ebx / eax;
+        }
+    }
+
+    // KVM and VMware report the TSC frequency in kHz in leaf 0x40000010
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (ecx & (1U << 31)) {
+        cpuid(0x40000000, 0, &eax, &ebx, &ecx, &edx);
+        if (eax >= 0x40000010) {
+            cpuid(0x40000010, 0, &eax, &ebx, &ecx, &edx);
+            if (eax) {
+                return (uint64_t)eax * 1000;
+            }
+        }
+    }
+
+    // Leaf 0x16: nominal base frequency in MHz, close enough on most parts
+    if (max_leaf >= 0x16) {
+        cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+        if (eax & 0xFFFF) {
+            return (uint64_t)(eax & 0xFFFF) * 1000000;
+        }
+    }
+    return 0;
+}
+
+// Count TSC cycles over a PIT channel 2 one-shot. Channel 2 isn't wired to
+// an IRQ, so this works with interrupts off and doesn't touch channel 0.
+static uint64_t tsc_hz_from_pit() {
+    uint16_t latch = PIT_FREQUENCY * PIT_CALIBRATE_MS / 1000;
+
+    // Gate high, speaker off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, latch >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        cpu_relax();
+    }
+    uint64_t end = rdtsc();
+
+    return (end - start) * 1000 / PIT_CALIBRATE_MS;
+}
+
+void clock_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        if (!(edx & (1 << 8))) {
+            klog(LOG_WARN, "Clock: TSC is not invariant, timekeeping may drift.");
+        }
+    }
+
+    const char *source = "CPUID";
+    uint64_t hz = tsc_hz_from_cpuid();
+    if (!hz) {
+        source = "PIT";
+        hz = tsc_hz_from_pit();
+    }
+    if (!hz) {
+        panic("Clock: TSC calibration failed", NULL);
+    }
+
+    tsc_hz = hz;
+    ns_mult = (NSEC_PER_SEC << 32) / hz;
+    tsc_boot = rdtsc();
+    klog(LOG_INFO, "Clock: TSC runs at %lu kHz (%s).", hz / 1000, source);
+}
+
+uint64_t clock_tsc_hz() {
+    return tsc_hz;
+}
+
+uint64_t clock_tsc_boot() {
+    return tsc_boot;
+}
+
+uint64_t clock_ns_mult() {
+    return ns_mult;
+}
+
+uint64_t clock_tick_ns() {
+    return NSEC_PER_SEC / timer_hz;
+}
+
+uint64_t clock_tsc_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * ns_mult) >> 32);
+}
+
+uint64_t clock_monotonic_ns() {
+    return clock_tsc_to_ns(rdtsc() - tsc_boot);
+}
+
+uint64_t clock_ns_to_tsc(uint64_t ns) {
+    // Split so the product fits in 64 bits for any sane TSC frequency
+    return ns / NSEC_PER_SEC * tsc_hz + ns % NSEC_PER_SEC * tsc_hz / NSEC_PER_SEC;
+}
+
+// Ticks keep their old meaning (1/timer_hz seconds since boot), they are just
+// derived from the clock now instead of counted in an interrupt handler.
+uint64_t timer_get_ticks() {
+    return clock_monotonic_ns() / clock_tick_ns();
+}
+
+void timer_init(uint32_t frequency) {
+    timer_hz = frequency;
+    clock_init();
+
+    // The PIT isn't used for scheduling anymore, keep IRQ 0 quiet
+    outb(PIC1_DATA, inb(PIC1_DATA) | 0x01);
+
+    lapic_init();
+    lapic_timer_init(NSEC_PER_SEC / frequency);
+    lapic_timer_start();
+}
@@ -1,17 +1,24 @@
 #include "crypto.h"
+#include "cpu.h"
+#include "fpu.h"
 #include "log.h"
 #include "kstring.h" // For memcpy, memset
+#include "simd.h"
+#include <stdbool.h>
+
+// Blocks hashed per kernel_fpu_begin/end section (4 KiB)
+#define SHA256_NI_BATCH 64
 
 // SHA256 constants (first 32 bits of the fractional parts of the cube roots of the first 64 primes)
-static const uint32_t K_SHA256[64] = {
+const uint32_t K_SHA256[64] __attribute__((aligned(16))) = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
     0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
     0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
     0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
     0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1db71064, 0x2c61692f, 0x4a74a4b8, 0x5c60f198, 0x76a980bb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
 #define ROTR(x, n) ((x >> n) | (x << (32 - n)))
@@ -32,15 +39,7 @@ static uint32_t H_SHA256[8] = {
     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
 };
 
-// Internal SHA256 state context
-typedef struct {
-    uint8_t buffer[64]; // Data buffer for 512-bit (64-byte) blocks
-    uint32_t buffer_len; // Current length of data in buffer
-    uint64_t bit_len;    // Total length of processed bits
-    uint32_t hash[8];    // Current hash value
-} sha256_context;
-
-static void sha256_transform(sha256_context* ctx, const uint8_t block[64]) {
+static void sha256_transform_scalar(sha256_context* ctx, const uint8_t block[64]) {
     uint32_t a, b, c, d, e, f, g, h;
     uint32_t W[64];
     uint32_t T1, T2;
@@ -92,22 +91,62 @@ static void sha256_transform(sha256_context* ctx, const uint8_t block[64]) {
     ctx->hash[7] += h;
 }
 
-static void sha256_init_ctx(sha256_context* ctx) {
+// 0 = not checked yet, 1 = SHA extensions usable, -1 = scalar only
+static int sha_ni_state = 0;
+
+static bool sha_ni_available() {
+    if (sha_ni_state == 0) {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        bool sha = false;
+        if (eax >= 7) {
+            cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+            sha = (ebx & (1 << 29)) != 0;
+            cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+            sha = sha && (ecx & (1 << 19)) && (ecx & (1 << 9)); // SSE4.1, SSSE3
+        }
+        sha_ni_state = sha ? 1 : -1;
+    }
+    return sha_ni_state > 0;
+}
+
+// Compress `blocks` consecutive 64-byte blocks into ctx->hash.
+static void sha256_transform(sha256_context* ctx, const uint8_t* data, size_t blocks) {
+    if (sha_ni_available() && kernel_fpu_usable()) {
+        while (blocks > 0) {
+            size_t n = blocks < SHA256_NI_BATCH ? blocks : SHA256_NI_BATCH;
+            kernel_fpu_begin();
+            sha256_ni_transform(ctx->hash, data, n);
+            kernel_fpu_end();
+            data += n * 64;
+            blocks -= n;
+        }
+        return;
+    }
+    for (; blocks > 0; blocks--, data += 64) {
+        sha256_transform_scalar(ctx, data);
+    }
+}
+
+void sha256_init_ctx(sha256_context* ctx) {
     memcpy(ctx->hash, H_SHA256, sizeof(H_SHA256)); // Use static H array
     ctx->buffer_len = 0;
     ctx->bit_len = 0;
 }
 
-static void sha256_update_ctx(sha256_context* ctx, const uint8_t* data, size_t len) {
+void sha256_update_ctx(sha256_context* ctx, const uint8_t* data, size_t len) {
     size_t i;
 
     ctx->bit_len += (uint64_t)len * 8; // Update total bit length
 
     while (len > 0) {
-        // Fill buffer
-        if (ctx->buffer_len == 64) {
-            sha256_transform(ctx, ctx->buffer);
-            ctx->buffer_len = 0;
+        // Whole blocks are hashed straight from the input
+        if (ctx->buffer_len == 0 && len >= 64) {
+            size_t blocks = len / 64;
+            sha256_transform(ctx, data, blocks);
+            data += blocks * 64;
+            len -= blocks * 64;
+            continue;
         }
 
         i = 64 - ctx->buffer_len; // Bytes to copy to fill buffer
@@ -118,10 +157,16 @@ static void sha256_update_ctx(sha256_context* ctx, const uint8_t* data, size_t l
         ctx->buffer_len += i;
         data += i;
         len -= i;
+
+        // Never leave a full buffer behind, sha256_final_ctx() appends to it
+        if (ctx->buffer_len == 64) {
+            sha256_transform(ctx, ctx->buffer, 1);
+            ctx->buffer_len = 0;
+        }
     }
 }
 
-static void sha256_final_ctx(sha256_context* ctx, uint8_t hash_out[SHA256_HASH_SIZE]) {
+void sha256_final_ctx(sha256_context* ctx, uint8_t hash_out[SHA256_HASH_SIZE]) {
     size_t i;
     uint32_t msg_len_hi, msg_len_lo;
 
@@ -131,7 +176,7 @@ static void sha256_final_ctx(sha256_context* ctx, uint8_t hash_out[SHA256_HASH_S
     // If there's not enough room for the 64-bit length, pad with zeros and process block
     if (ctx->buffer_len > 56) {
         memset(ctx->buffer + ctx->buffer_len, 0, 64 - ctx->buffer_len);
-        sha256_transform(ctx, ctx->buffer);
+        sha256_transform(ctx, ctx->buffer, 1);
         ctx->buffer_len = 0;
     }
 
@@ -145,7 +190,7 @@ static void sha256_final_ctx(sha256_context* ctx, uint8_t hash_out[SHA256_HASH_S
     memcpy(ctx->buffer + 56, &msg_len_hi, 4); // Assuming memcpy works with uint32_t
     memcpy(ctx->buffer + 60, &msg_len_lo, 4);
 
-    sha256_transform(ctx, ctx->buffer);
+    sha256_transform(ctx, ctx->buffer, 1);
 
     // Output hash (big-endian)
     for (i = 0; i < 8; i++) {
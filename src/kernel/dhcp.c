@@ -49,7 +49,8 @@ static uint8_t get_dhcp_option(const uint8_t* options, size_t options_len, uint8
 }
 
 void dhcp_send_request(uint32_t requested_ip, uint32_t server_ip) {
-  if (!network_devices) {
+  net_dev_t *dev = net_default_device();
+  if (!dev) {
     klog(LOG_WARN, "DHCP: No network device to send request.");
     return;
   }
@@ -63,7 +64,7 @@ void dhcp_send_request(uint32_t requested_ip, uint32_t server_ip) {
   pkt.xid = __builtin_bswap32(dhcp_xid);
   pkt.ciaddr = __builtin_bswap32(ip_get_local_ip()); // Client IP address if renewing, 0 if selecting
   pkt.flags = __builtin_bswap16(0x8000); // Broadcast flag
-  memcpy(pkt.chaddr, network_devices->mac_addr, 6); // Client hardware address
+  memcpy(pkt.chaddr, dev->mac_addr, 6); // Client hardware address
   pkt.magic_cookie = __builtin_bswap32(DHCP_MAGIC_COOKIE);
 
   // Options
@@ -214,6 +215,7 @@ void dhcp_handle_reply(net_dev_t *net_dev, ipv4_header_t *ip_hdr,
 }
 
 void dhcp_discover() {
+  net_dev_t *dev = net_default_device();
   current_dhcp_state = DHCP_STATE_INIT;
   klog(LOG_INFO, "DHCP: Starting discovery process.");
 
@@ -226,7 +228,7 @@ void dhcp_discover() {
   pkt.xid = __builtin_bswap32(dhcp_xid);
   pkt.ciaddr = 0; // Client IP address - 0 for discover
   pkt.flags = __builtin_bswap16(0x8000); // Broadcast flag
-  memcpy(pkt.chaddr, network_devices->mac_addr, 6); // Client hardware address
+  memcpy(pkt.chaddr, dev->mac_addr, 6); // Client hardware address
   pkt.magic_cookie = __builtin_bswap32(DHCP_MAGIC_COOKIE);
 
   // Options: 53 (DHCP Message Type), len 1, value 1 (Discover)
@@ -240,7 +242,10 @@ void dhcp_discover() {
 }
 
 void dhcp_init() {
-  udp_register_handler(68, dhcp_handle_reply);
+  if (udp_register_handler(68, dhcp_handle_reply, NULL) != 0) {
+    klog(LOG_ERROR, "DHCP: port 68 is already bound.");
+    return;
+  }
   klog(LOG_INFO, "DHCP client initialized.");
 }
 
@@ -12,6 +12,7 @@
 #include "port_io.h"
 #include "vmm.h"
 #include "scheduler.h" // For schedule()
+#include "workqueue.h"
 
 #define E1000_VENDOR_ID 0x8086
 #define E1000_DEVICE_ID_82540EM 0x100e
@@ -70,6 +71,15 @@
 #define E1000_NUM_RX_DESC 32
 #define E1000_NUM_TX_DESC 8
 
+// Interrupt causes that mean "packets received"
+#define E1000_ICR_RXDMT0 (1 << 4) // Rx descriptor minimum threshold
+#define E1000_ICR_RXO (1 << 6)    // Receiver overrun
+#define E1000_ICR_RXT0 (1 << 7)   // Receiver timer
+#define E1000_ICR_RX (E1000_ICR_RXDMT0 | E1000_ICR_RXO | E1000_ICR_RXT0)
+
+// Packets handled per run of the receive work before giving others a turn
+#define E1000_RX_BUDGET 16
+
 // Receive Descriptor
 struct e1000_rx_desc {
   uint64_t addr;   // Address of data buffer
@@ -107,6 +117,8 @@ typedef struct e1000_device {
   uint64_t tx_descs_phys;
   uint8_t *tx_buffers[E1000_NUM_TX_DESC];
   volatile uint16_t tx_cur; // Next descriptor to send
+  workqueue_t *rx_wq;
+  work_t rx_work; // Drains the receive ring, queued by the IRQ handler
 } e1000_device_t;
 
 // --- MMIO Register Access ---
@@ -121,6 +133,7 @@ static inline void e1000_write_reg(e1000_device_t *dev, uint32_t offset,
 
 // --- Network Core Implementation (from net.h) ---
 net_dev_t *network_devices = NULL;
+static spinlock_t net_devices_lock = SPINLOCK_INIT("net_devices"); // Writers only
 
 void net_init() {
   network_devices = NULL;
@@ -131,17 +144,74 @@ void net_register_device(net_dev_t *net_dev) {
   if (!net_dev)
     return;
 
-  net_dev->next = network_devices;
-  network_devices = net_dev;
+  uint64_t flags = spin_lock_irqsave(&net_devices_lock);
+  rcu_list_add(network_devices, net_dev);
+  spin_unlock_irqrestore(&net_devices_lock, flags);
   klog(LOG_INFO, "Network device registered.");
 }
 
+// --- E1000 Receive ---
+static void e1000_handle_frame(uint8_t *packet_buffer, uint16_t length) {
+  if (length <= sizeof(ethernet_header_t)) {
+    klog(LOG_WARN, "E1000: Received too small packet.");
+    return;
+  }
+
+  ethernet_header_t *eth_hdr = (ethernet_header_t *)packet_buffer;
+  uint16_t ether_type = __builtin_bswap16(eth_hdr->ether_type);
+
+  switch (ether_type) {
+  case ARP_ETHER_TYPE:
+    // klog(LOG_INFO, "E1000: Received ARP packet.");
+    arp_handle_packet(packet_buffer + sizeof(ethernet_header_t),
+                      length - sizeof(ethernet_header_t));
+    break;
+  case 0x0800: // ETHERTYPE_IPV4
+    // klog(LOG_INFO, "E1000: Received IPv4 packet.");
+    ip_handle_packet(net_default_device(),
+                     packet_buffer + sizeof(ethernet_header_t),
+                     length - sizeof(ethernet_header_t));
+    break;
+  default:
+    klog(LOG_INFO, "E1000: Received unknown EtherType.");
+    break;
+  }
+}
+
+// Receive work, runs in the e1000 worker thread with interrupts enabled.
+// RX interrupts stay masked while it runs, like NAPI: one interrupt starts
+// polling, and polling stops once the ring is empty.
+static void e1000_rx_work(void *arg) {
+  e1000_device_t *e1000_dev = (e1000_device_t *)arg;
+  int handled = 0;
+
+  while ((e1000_dev->rx_descs[e1000_dev->rx_cur].status & 0x01)) { // DD bit set
+    if (handled == E1000_RX_BUDGET) {
+      // Out of budget, go to the back of the queue and keep polling
+      queue_work(e1000_dev->rx_wq, &e1000_dev->rx_work);
+      return;
+    }
+    uint16_t cur = e1000_dev->rx_cur;
+    e1000_handle_frame(e1000_dev->rx_buffers[cur], e1000_dev->rx_descs[cur].length);
+
+    // Clear status and give descriptor back to hardware
+    e1000_dev->rx_descs[cur].status = 0;
+    e1000_dev->rx_cur = (cur + 1) % E1000_NUM_RX_DESC;
+    e1000_write_reg(e1000_dev, E1000_REG_RDT, cur);
+    handled++;
+  }
+
+  // Ring is empty, back to interrupts. A frame that arrived just now has
+  // already set its cause bit in ICR, so unmasking raises the IRQ for it.
+  e1000_write_reg(e1000_dev, E1000_REG_IMS, E1000_ICR_RX);
+}
+
 // --- E1000 Interrupt Handler ---
 static void e1000_interrupt_handler(struct registers *regs) {
   (void)regs; // Suppress unused parameter warning
 
   e1000_device_t *e1000_dev =
-      (e1000_device_t *)((device_t *)network_devices->dev)->private_data;
+      (e1000_device_t *)((device_t *)net_default_device()->dev)->private_data;
 
   uint32_t icr = e1000_read_reg(e1000_dev, E1000_REG_ICR);
   if (!icr)
@@ -151,39 +221,10 @@ static void e1000_interrupt_handler(struct registers *regs) {
   klog_print_hex(icr);
   klog_putchar('\n'); */
 
-  // Handle received packets
-  while ((e1000_dev->rx_descs[e1000_dev->rx_cur].status & 0x01)) { // DD bit set
-    uint16_t length = e1000_dev->rx_descs[e1000_dev->rx_cur].length;
-    uint8_t *packet_buffer = e1000_dev->rx_buffers[e1000_dev->rx_cur];
-
-    if (length > sizeof(ethernet_header_t)) {
-      ethernet_header_t *eth_hdr = (ethernet_header_t *)packet_buffer;
-      uint16_t ether_type = __builtin_bswap16(eth_hdr->ether_type);
-
-      switch (ether_type) {
-      case ARP_ETHER_TYPE:
-        // klog(LOG_INFO, "E1000: Received ARP packet.");
-        arp_handle_packet(packet_buffer + sizeof(ethernet_header_t),
-                          length - sizeof(ethernet_header_t));
-        break;
-      case 0x0800: // ETHERTYPE_IPV4
-        // klog(LOG_INFO, "E1000: Received IPv4 packet.");
-        ip_handle_packet(network_devices,
-                         packet_buffer + sizeof(ethernet_header_t),
-                         length - sizeof(ethernet_header_t));
-        break;
-      default:
-        klog(LOG_INFO, "E1000: Received unknown EtherType.");
-        break;
-      }
-    } else {
-      klog(LOG_WARN, "E1000: Received too small packet.");
-    }
-
-    // Clear status and give descriptor back to hardware
-    e1000_dev->rx_descs[e1000_dev->rx_cur].status = 0;
-    e1000_dev->rx_cur = (e1000_dev->rx_cur + 1) % E1000_NUM_RX_DESC;
-    e1000_write_reg(e1000_dev, E1000_REG_RDT, e1000_dev->rx_cur - 1);
+  // Reading ICR acknowledged it. Leave the packets to the receive work.
+  if (icr & E1000_ICR_RX) {
+    e1000_write_reg(e1000_dev, E1000_REG_IMC, E1000_ICR_RX);
+    queue_work(e1000_dev->rx_wq, &e1000_dev->rx_work);
   }
 }
 
@@ -367,7 +408,14 @@ static int e1000_attach(device_t *dev) {
   e1000_write_reg(e1000_dev, E1000_REG_TCTL,
                   E1000_TCTL_EN | E1000_TCTL_PSP | (0x10 << 4) | (0x40 << 12));
 
-  // 9. Register interrupt handler
+  // 9. Register interrupt handler. Received frames are processed by a
+  // dedicated worker thread, not in the handler.
+  e1000_dev->rx_wq = workqueue_create("e1000-rx");
+  if (!e1000_dev->rx_wq) {
+    klog(LOG_ERROR, "E1000: Failed to create the receive workqueue.");
+    return -1;
+  }
+  work_init(&e1000_dev->rx_work, e1000_rx_work, e1000_dev);
   e1000_dev->irq = pci_read_config_byte(dev->bus, dev->device, dev->func,
                                         PCI_INTERRUPT_LINE);
   register_irq_handler(e1000_dev->irq, e1000_interrupt_handler);
@@ -380,7 +428,7 @@ static int e1000_attach(device_t *dev) {
   // Register with network core
   e1000_dev->net_dev.send_packet = e1000_send_packet;
   e1000_dev->net_dev.receive_packet =
-      NULL; // Zero-copy, so packets are handled in interrupt
+      NULL; // Zero-copy, packets are handled by e1000_rx_work()
   net_register_device(&e1000_dev->net_dev);
 
   // klog(LOG_INFO, "E1000: Device initialized and registered successfully.");
@@ -118,8 +118,14 @@ int elf_exec_as_thread(const char* path) {
 
     if (entry_point) {
         klog(LOG_INFO, "ELF Exec: Starting userspace thread at entry point %x", entry_point);
-        thread_create_userspace(entry_point, new_pml4);
-        return 0; // Success
+        thread_t *thread = thread_create_userspace(entry_point, new_pml4);
+        if (!thread) {
+            // thread_create_userspace() has already freed the address space
+            return -1;
+        }
+        const char *name = strrchr(path, '/');
+        thread_set_name(thread, name ? name + 1 : path);
+        return (int)thread->id; // Success
     }
     
     klog(LOG_ERROR, "ELF Exec: Failed to load ELF");
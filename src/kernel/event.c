@@ -1,6 +1,9 @@
 #include "event.h"
 #include "log.h"
-#include "isr.h" // For disable/enable interrupts
+#include "spinlock.h"
+#include "poll.h" // For POLLIN
+#include "scheduler.h"
+#include "uaccess.h"
 
 #define EVENT_QUEUE_SIZE 256
 
@@ -8,6 +11,8 @@ static event_t event_queue[EVENT_QUEUE_SIZE];
 static int queue_head = 0;
 static int queue_tail = 0;
 static int event_count = 0;
+static spinlock_t event_lock = SPINLOCK_INIT("event_queue");
+static wait_queue_t event_wq = WAIT_QUEUE_INIT("event_wq");
 
 void event_init() {
     queue_head = 0;
@@ -17,26 +22,74 @@ void event_init() {
 }
 
 void event_push(event_t event) {
-    disable_interrupts();
+    uint64_t flags = spin_lock_irqsave(&event_lock);
     if (event_count < EVENT_QUEUE_SIZE) {
         event_queue[queue_tail] = event;
         queue_tail = (queue_tail + 1) % EVENT_QUEUE_SIZE;
         event_count++;
     } else {
+        spin_unlock_irqrestore(&event_lock, flags);
         klog(LOG_WARN, "Event queue full, event dropped.");
+        return;
     }
-    enable_interrupts();
+    spin_unlock_irqrestore(&event_lock, flags);
+    wake_up(&event_wq, POLLIN);
 }
 
 int event_pop(event_t* event) {
-    disable_interrupts();
+    uint64_t flags = spin_lock_irqsave(&event_lock);
     if (event_count > 0) {
         *event = event_queue[queue_head];
         queue_head = (queue_head + 1) % EVENT_QUEUE_SIZE;
         event_count--;
-        enable_interrupts();
+        spin_unlock_irqrestore(&event_lock, flags);
         return 1; // Success
     }
-    enable_interrupts();
+    spin_unlock_irqrestore(&event_lock, flags);
     return 0; // Queue was empty
 }
+
+int64_t event_read(void* user_buf, size_t size) {
+    size_t max = size / sizeof(event_t);
+    if (max == 0 || !access_ok(user_buf, size)) {
+        return -1;
+    }
+
+    thread_t* self = get_current_thread();
+    wait_queue_entry_t wait;
+    wait_entry_init(&wait, self);
+    wait_queue_add(&event_wq, &wait);
+    size_t n = 0;
+    int64_t ret = 0;
+    while (n == 0 && ret == 0) {
+        // Block until there is something to read
+        uint64_t flags = spin_lock_irqsave(&event_lock);
+        while (event_count == 0) {
+            self->state = THREAD_BLOCKED;
+            spin_unlock(&event_lock); // Interrupts stay off until we're switched out
+            schedule();
+            spin_lock(&event_lock);
+        }
+        spin_unlock_irqrestore(&event_lock, flags);
+
+        // Another reader may have emptied the queue meanwhile, then wait again
+        event_t event;
+        while (n < max && event_pop(&event)) {
+            if (copy_to_user((event_t*)user_buf + n, &event, sizeof(event_t)) != 0) {
+                ret = -1;
+                break;
+            }
+            n++;
+        }
+    }
+    wait_queue_remove(&event_wq, &wait);
+    return n ? (int64_t)(n * sizeof(event_t)) : ret;
+}
+
+int event_pending() {
+    return __atomic_load_n(&event_count, __ATOMIC_RELAXED);
+}
+
+wait_queue_t* event_wait_queue() {
+    return &event_wq;
+}
@@ -1,9 +1,12 @@
 #include "fb.h"
 #include "font.h"
+#include "fpu.h"
 #include "heap.h"
 #include "kstring.h"
 #include "limine.h"
 #include "log.h"
+#include "preempt.h" // For cond_resched
+#include "simd.h"
 #include "vmm.h"
 #include <stdbool.h>
 
@@ -14,6 +17,9 @@ static struct limine_framebuffer *fb_tag_global_ptr = NULL;
 static uint32_t *backbuffer = NULL;
 static size_t backbuffer_size = 0;
 
+// Bytes copied per kernel_fpu_begin/end section in fb_flush()
+#define FB_FLUSH_CHUNK (64 * 1024)
+
 void fb_init(struct limine_framebuffer *fb_tag) {
     fb_tag_global_ptr = fb_tag;
 
@@ -51,7 +57,26 @@ void fb_init_backbuffer(void) {
 
 void fb_flush(void) {
     if (backbuffer && fb_tag_global_ptr && fb_tag_global_ptr->address) {
-        memcpy(fb_tag_global_ptr->address, backbuffer, backbuffer_size);
+        uint8_t *dst = (uint8_t *)fb_tag_global_ptr->address;
+        const uint8_t *src = (const uint8_t *)backbuffer;
+        bool use_simd = kernel_fpu_usable();
+        // Chunked, with a preemption point after each one. The FPU section
+        // runs with interrupts off, so it has to stay short anyway.
+        for (size_t done = 0; done < backbuffer_size; done += FB_FLUSH_CHUNK) {
+            size_t n = backbuffer_size - done;
+            if (n > FB_FLUSH_CHUNK) {
+                n = FB_FLUSH_CHUNK;
+            }
+            if (use_simd) {
+                // The framebuffer is never read back, so stream past the cache
+                kernel_fpu_begin();
+                simd_copy_nt(dst + done, src + done, n);
+                kernel_fpu_end();
+            } else {
+                memcpy(dst + done, src + done, n);
+            }
+            cond_resched();
+        }
     }
 }
 
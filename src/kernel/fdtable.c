@@ -0,0 +1,285 @@
+#include "fdtable.h"
+#include "heap.h"
+#include "io_ring.h" // For io_ring_release
+#include "kstring.h"
+#include "log.h"
+#include "poll.h" // For epoll_release
+#include "socket.h" // For sock_close
+#include "vfs.h" // For vfs_close
+#include <stdbool.h>
+#include <stddef.h> // for NULL
+
+#define BITS_PER_WORD 64
+#define WORDS_FOR(n) (((n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+fd_table_t *fd_table_create(fd_table_t *parent) {
+  fd_table_t *table = (fd_table_t *)kmalloc(sizeof(fd_table_t));
+  if (!table) {
+    return NULL;
+  }
+  table->size = FD_TABLE_INITIAL;
+  table->entries = (fd_entry_t **)kmalloc(sizeof(fd_entry_t *) * table->size);
+  table->open_fds = (uint64_t *)kmalloc(sizeof(uint64_t) * WORDS_FOR(table->size));
+  table->full_words = (uint64_t *)kmalloc(sizeof(uint64_t) * WORDS_FOR(WORDS_FOR(table->size)));
+  if (!table->entries || !table->open_fds || !table->full_words) {
+    kfree(table->entries);
+    kfree(table->open_fds);
+    kfree(table->full_words);
+    kfree(table);
+    return NULL;
+  }
+  memset(table->entries, 0, sizeof(fd_entry_t *) * table->size);
+  memset(table->open_fds, 0, sizeof(uint64_t) * WORDS_FOR(table->size));
+  memset(table->full_words, 0, sizeof(uint64_t) * WORDS_FOR(WORDS_FOR(table->size)));
+
+  spinlock_init(&table->lock, "fd_table");
+  table->refcount = 1;
+  if (parent) {
+    uint64_t flags = spin_lock_irqsave(&parent->lock);
+    table->limit = parent->limit;
+    table->hard_limit = parent->hard_limit;
+    spin_unlock_irqrestore(&parent->lock, flags);
+  } else {
+    table->limit = FD_LIMIT_DEFAULT;
+    table->hard_limit = FD_LIMIT_MAX;
+  }
+  return table;
+}
+
+fd_table_t *fd_table_share(fd_table_t *table) {
+  __atomic_add_fetch(&table->refcount, 1, __ATOMIC_RELAXED);
+  return table;
+}
+
+void fd_table_release(fd_table_t *table) {
+  if (!table || __atomic_sub_fetch(&table->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  // Last user is gone, nobody else can touch the table now
+  for (int fd = fd_next_open(table, 0); fd >= 0; fd = fd_next_open(table, fd + 1)) {
+    fd_put(table->entries[fd]);
+  }
+  kfree(table->entries);
+  kfree(table->open_fds);
+  kfree(table->full_words);
+  kfree(table);
+}
+
+fd_entry_t *fd_entry_alloc(fd_type_t type) {
+  fd_entry_t *entry = (fd_entry_t *)kmalloc(sizeof(fd_entry_t));
+  if (!entry) {
+    return NULL;
+  }
+  memset(entry, 0, sizeof(fd_entry_t));
+  entry->type = type;
+  entry->refcount = 1;
+  return entry;
+}
+
+void fd_put(fd_entry_t *entry) {
+  if (!entry || __atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  if (entry->type == FD_TYPE_SOCKET && entry->data.sock) {
+    sock_close(entry->data.sock);
+  } else if (entry->type == FD_TYPE_IORING && entry->data.ring) {
+    io_ring_release(entry->data.ring);
+  } else if (entry->type == FD_TYPE_EPOLL && entry->data.ep) {
+    epoll_release(entry->data.ep);
+  } else if (entry->type == FD_TYPE_FILE && entry->data.file.node) {
+    vfs_close(entry->data.file.node);
+  }
+  kfree(entry);
+}
+
+// --- Slot bitmaps, caller holds table->lock ---
+
+static void mark_open(fd_table_t *table, int fd) {
+  int word = fd / BITS_PER_WORD;
+  table->open_fds[word] |= 1ULL << (fd % BITS_PER_WORD);
+  if (table->open_fds[word] == ~0ULL) {
+    table->full_words[word / BITS_PER_WORD] |= 1ULL << (word % BITS_PER_WORD);
+  }
+}
+
+static void mark_free(fd_table_t *table, int fd) {
+  int word = fd / BITS_PER_WORD;
+  table->open_fds[word] &= ~(1ULL << (fd % BITS_PER_WORD));
+  table->full_words[word / BITS_PER_WORD] &= ~(1ULL << (word % BITS_PER_WORD));
+}
+
+// Lowest clear bit, may be past `size` if every slot is taken. The summary
+// bitmap lets us skip 64 full slots per bit, so this is a handful of word
+// scans even at FD_LIMIT_MAX.
+static int find_free(fd_table_t *table) {
+  int words = WORDS_FOR(table->size);
+  for (int s = 0; s < WORDS_FOR(words); s++) {
+    uint64_t full = table->full_words[s];
+    if (full == ~0ULL) {
+      continue;
+    }
+    int word = s * BITS_PER_WORD + __builtin_ctzll(~full);
+    if (word >= words) {
+      break;
+    }
+    return word * BITS_PER_WORD + __builtin_ctzll(~table->open_fds[word]);
+  }
+  return table->size;
+}
+
+// Make room for descriptor `fd`. Drops and retakes the lock to allocate.
+static bool expand(fd_table_t *table, int fd, uint64_t *flags) {
+  int new_size = table->size;
+  while (new_size <= fd) {
+    new_size *= 2;
+  }
+  spin_unlock_irqrestore(&table->lock, *flags);
+
+  fd_entry_t **entries = (fd_entry_t **)kmalloc(sizeof(fd_entry_t *) * new_size);
+  uint64_t *open_fds = (uint64_t *)kmalloc(sizeof(uint64_t) * WORDS_FOR(new_size));
+  uint64_t *full_words = (uint64_t *)kmalloc(sizeof(uint64_t) * WORDS_FOR(WORDS_FOR(new_size)));
+
+  *flags = spin_lock_irqsave(&table->lock);
+  if (!entries || !open_fds || !full_words || table->size >= new_size) {
+    // Out of memory, or somebody else grew it while we were allocating
+    bool grown = table->size >= new_size;
+    spin_unlock_irqrestore(&table->lock, *flags);
+    kfree(entries);
+    kfree(open_fds);
+    kfree(full_words);
+    *flags = spin_lock_irqsave(&table->lock);
+    return grown;
+  }
+
+  int old_words = WORDS_FOR(table->size);
+  int old_summary = WORDS_FOR(old_words);
+  memcpy(entries, table->entries, sizeof(fd_entry_t *) * table->size);
+  memset(entries + table->size, 0, sizeof(fd_entry_t *) * (new_size - table->size));
+  memcpy(open_fds, table->open_fds, sizeof(uint64_t) * old_words);
+  memset(open_fds + old_words, 0, sizeof(uint64_t) * (WORDS_FOR(new_size) - old_words));
+  memcpy(full_words, table->full_words, sizeof(uint64_t) * old_summary);
+  memset(full_words + old_summary, 0,
+         sizeof(uint64_t) * (WORDS_FOR(WORDS_FOR(new_size)) - old_summary));
+
+  fd_entry_t **old_entries = table->entries;
+  uint64_t *old_open = table->open_fds;
+  uint64_t *old_full = table->full_words;
+  table->entries = entries;
+  table->open_fds = open_fds;
+  table->full_words = full_words;
+  table->size = new_size;
+
+  spin_unlock_irqrestore(&table->lock, *flags);
+  kfree(old_entries);
+  kfree(old_open);
+  kfree(old_full);
+  *flags = spin_lock_irqsave(&table->lock);
+  return true;
+}
+
+int fd_install(fd_table_t *table, fd_entry_t *entry) {
+  if (!table || !entry) {
+    return -1;
+  }
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  for (;;) {
+    int fd = find_free(table);
+    if (fd >= table->limit) {
+      spin_unlock_irqrestore(&table->lock, flags);
+      klog(LOG_WARN, "FD: Out of file descriptors (limit %d).", table->limit);
+      return -1;
+    }
+    if (fd < table->size) {
+      table->entries[fd] = entry;
+      mark_open(table, fd);
+      spin_unlock_irqrestore(&table->lock, flags);
+      return fd;
+    }
+    if (!expand(table, fd, &flags)) {
+      spin_unlock_irqrestore(&table->lock, flags);
+      klog(LOG_ERROR, "FD: Failed to grow the descriptor table.");
+      return -1;
+    }
+    // The table may have changed while unlocked, look again
+  }
+}
+
+fd_entry_t *fd_get(fd_table_t *table, int fd) {
+  if (!table || fd < 0) {
+    return NULL;
+  }
+  fd_entry_t *entry = NULL;
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  if (fd < table->size && table->entries[fd]) {
+    entry = table->entries[fd];
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+  }
+  spin_unlock_irqrestore(&table->lock, flags);
+  return entry;
+}
+
+int fd_close(fd_table_t *table, int fd) {
+  if (!table || fd < 0) {
+    return -1;
+  }
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  if (fd >= table->size || !table->entries[fd]) {
+    spin_unlock_irqrestore(&table->lock, flags);
+    return -1;
+  }
+  fd_entry_t *entry = table->entries[fd];
+  table->entries[fd] = NULL;
+  mark_free(table, fd);
+  spin_unlock_irqrestore(&table->lock, flags);
+
+  fd_put(entry); // Closes it, unless a syscall is still using it
+  return 0;
+}
+
+int fd_next_open(fd_table_t *table, int from) {
+  if (!table || from < 0) {
+    return -1;
+  }
+  int result = -1;
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  for (int word = from / BITS_PER_WORD; word < WORDS_FOR(table->size); word++) {
+    uint64_t bits = table->open_fds[word];
+    if (word == from / BITS_PER_WORD) {
+      bits &= ~0ULL << (from % BITS_PER_WORD);
+    }
+    if (bits) {
+      result = word * BITS_PER_WORD + __builtin_ctzll(bits);
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&table->lock, flags);
+  return result;
+}
+
+int fd_table_get_limit(fd_table_t *table, uint64_t *soft, uint64_t *hard) {
+  if (!table) {
+    return -1;
+  }
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  *soft = table->limit;
+  *hard = table->hard_limit;
+  spin_unlock_irqrestore(&table->lock, flags);
+  return 0;
+}
+
+int fd_table_set_limit(fd_table_t *table, uint64_t soft, uint64_t hard) {
+  if (!table || soft > hard) {
+    return -1;
+  }
+  uint64_t flags = spin_lock_irqsave(&table->lock);
+  // There's no privilege model, but a hard limit can still only go down
+  if (hard > (uint64_t)table->hard_limit) {
+    spin_unlock_irqrestore(&table->lock, flags);
+    return -1;
+  }
+  // Descriptors already open above the new limit stay open
+  table->limit = (int)soft;
+  table->hard_limit = (int)hard;
+  spin_unlock_irqrestore(&table->lock, flags);
+  return 0;
+}
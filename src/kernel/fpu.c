@@ -0,0 +1,226 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "heap.h"
+#include "isr.h" // For local_irq_save/restore
+#include "kstring.h"
+#include "log.h"
+#include "smp.h"
+#include "thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// A thread's FPU registers are saved to its area when it is switched out
+// after using them, and only loaded back on its first FPU instruction after
+// being switched in (CR0.TS makes that trap with #NM). If nothing else used
+// the FPU on this CPU in the meantime, the registers are still live and TS
+// is simply left clear.
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE (1 << 18)
+
+#define CPUID_1_ECX_XSAVE (1 << 26)
+#define CPUID_1_ECX_AVX (1 << 28)
+#define CPUID_D1_EAX_XSAVEOPT (1 << 0)
+
+#define XCR0_X87 (1 << 0)
+#define XCR0_SSE (1 << 1)
+#define XCR0_AVX (1 << 2)
+#define XCR0_AVX512 (7 << 5) // Opmask, ZMM_Hi256, Hi16_ZMM
+
+#define FXSAVE_SIZE 512
+#define FPU_AREA_ALIGN 64
+#define FCW_DEFAULT 0x037F
+#define MXCSR_DEFAULT 0x1F80
+
+static bool fpu_ready = false;
+static bool use_xsave = false;
+static bool use_xsaveopt = false;
+static uint64_t xcr0 = 0;
+static uint32_t fpu_area_size = FXSAVE_SIZE;
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+    __asm__ __volatile__("xsetbv" : : "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void clts() { __asm__ __volatile__("clts" ::: "memory"); }
+
+static inline void stts() { write_cr0(read_cr0() | CR0_TS); }
+
+static void fpu_save(void *area) {
+    if (use_xsaveopt) {
+        __asm__ __volatile__("xsaveopt64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else if (use_xsave) {
+        __asm__ __volatile__("xsave64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else {
+        __asm__ __volatile__("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static void fpu_restore(void *area) {
+    if (use_xsave) {
+        __asm__ __volatile__("xrstor64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else {
+        __asm__ __volatile__("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+void fpu_init_cpu() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool bsp = this_cpu()->id == 0;
+
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (ecx & CPUID_1_ECX_XSAVE) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (bsp && (ecx & CPUID_1_ECX_XSAVE)) {
+        uint32_t supported_lo, supported_hi, size;
+        cpuid(0xD, 0, &supported_lo, &size, &ecx, &supported_hi);
+        xcr0 = XCR0_X87 | XCR0_SSE;
+        if (supported_lo & XCR0_AVX) {
+            xcr0 |= XCR0_AVX;
+        }
+        if ((supported_lo & XCR0_AVX512) == XCR0_AVX512) {
+            xcr0 |= XCR0_AVX512;
+        }
+        use_xsave = true;
+    }
+    if (use_xsave) {
+        xsetbv(0, xcr0);
+    }
+    if (bsp && use_xsave) {
+        // EBX of leaf 0xD now reflects the components we just enabled
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_area_size = ebx;
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        use_xsaveopt = (eax & CPUID_D1_EAX_XSAVEOPT) != 0;
+    }
+
+    // Nobody owns this CPU's FPU yet, trap on first use
+    this_cpu()->fpu_owner = NULL;
+    stts();
+
+    if (bsp) {
+        fpu_ready = true;
+        klog(LOG_INFO, "FPU: %s, XCR0 = %p, %d byte state area.",
+             use_xsaveopt ? "XSAVEOPT" : (use_xsave ? "XSAVE" : "FXSAVE"), (void *)xcr0, fpu_area_size);
+    }
+}
+
+// A fresh area restores to the power-on state: x87/SSE/AVX registers clear,
+// default control words.
+static void *fpu_alloc_area(thread_t *thread) {
+    void *raw = kmalloc(fpu_area_size + FPU_AREA_ALIGN);
+    if (!raw) {
+        return NULL;
+    }
+    uint8_t *area = (uint8_t *)(((uint64_t)raw + FPU_AREA_ALIGN - 1) & ~(uint64_t)(FPU_AREA_ALIGN - 1));
+    memset(area, 0, fpu_area_size);
+    *(uint16_t *)(area + 0) = FCW_DEFAULT;
+    *(uint32_t *)(area + 24) = MXCSR_DEFAULT;
+
+    thread->fpu_alloc = raw;
+    thread->fpu_state = area;
+    return area;
+}
+
+void fpu_switch(thread_t *prev, thread_t *next) {
+    cpu_t *cpu = this_cpu();
+
+    // TS clear means prev touched the FPU during this time slice, so its
+    // registers are live and newer than its area.
+    if (cpu->fpu_owner == prev && !(read_cr0() & CR0_TS)) {
+        if (prev->state == THREAD_DEAD) {
+            cpu->fpu_owner = NULL;
+        } else {
+            fpu_save(prev->fpu_state);
+        }
+    }
+
+    // Skip the trap if next's registers are still loaded here
+    if (cpu->fpu_owner == next && next->fpu_cpu == cpu->id) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+void fpu_handle_nm() {
+    cpu_t *cpu = this_cpu();
+    thread_t *current = cpu->current_thread;
+    clts();
+
+    if (cpu->fpu_owner == current && current->fpu_cpu == cpu->id) {
+        return; // Registers are already ours
+    }
+    // The owner's state was saved when it was switched out
+
+    void *area = current->fpu_state;
+    if (!area) {
+        area = fpu_alloc_area(current);
+        if (!area) {
+            panic("FPU: Out of memory for the FPU state area", NULL);
+        }
+    }
+    fpu_restore(area);
+    cpu->fpu_owner = current;
+    current->fpu_cpu = cpu->id;
+}
+
+void fpu_thread_free(thread_t *thread) {
+    // A stale owner pointer could match a new thread allocated at the same
+    // address and skip its restore.
+    uint32_t count = smp_cpu_count();
+    for (uint32_t i = 0; i < count; i++) {
+        thread_t *expected = thread;
+        __atomic_compare_exchange_n(&cpus[i].fpu_owner, &expected, NULL, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    if (thread->fpu_alloc) {
+        kfree(thread->fpu_alloc);
+        thread->fpu_alloc = NULL;
+        thread->fpu_state = NULL;
+    }
+}
+
+int kernel_fpu_usable() {
+    return fpu_ready && !this_cpu()->kernel_fpu_active;
+}
+
+void kernel_fpu_begin() {
+    uint64_t flags = local_irq_save();
+    cpu_t *cpu = this_cpu();
+    if (cpu->kernel_fpu_active) {
+        panic("FPU: Nested kernel_fpu_begin()", NULL);
+    }
+    cpu->kernel_fpu_active = 1;
+    cpu->kernel_fpu_flags = flags;
+
+    // If the registers hold changes the owner's area doesn't have yet, save
+    // them. Either way they're about to be clobbered, so the owner reloads
+    // from its area on next use.
+    thread_t *owner = cpu->fpu_owner;
+    if (owner && !(read_cr0() & CR0_TS)) {
+        fpu_save(owner->fpu_state);
+    }
+    cpu->fpu_owner = NULL;
+    clts();
+
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+void kernel_fpu_end() {
+    cpu_t *cpu = this_cpu();
+    stts();
+    cpu->kernel_fpu_active = 0;
+    local_irq_restore(cpu->kernel_fpu_flags);
+}
@@ -1,7 +1,9 @@
 #include "fs_disk.h"
 #include "heap.h"
+#include "kmutex.h"
 #include "kstring.h"
 #include "log.h"
+#include "preempt.h" // For cond_resched
 #include "ide.h" // For ide_read_sectors, ide_write_sectors, ide_disk_info_t
 #include "vfs.h" // For VFS node interaction
 #include "thread.h" // For get_current_thread (to get disk_fd)
@@ -12,6 +14,11 @@ static uint32_t mounted_partition_lba = 0;
 static fs_superblock_t current_superblock;
 static fs_file_entry_t *file_table_cache = NULL; // Cache the file table in memory
 
+// Serializes the operations below. They read and rewrite the superblock,
+// the file table and the block allocator, and yield between PIO blocks, so
+// a spinlock won't do.
+static kmutex_t fs_disk_lock = KMUTEX_INIT;
+
 // Helper to read a block from the disk
 static int read_block(uint32_t lba, uint8_t *buffer) {
     if (mounted_disk_fd < 0) {
@@ -61,7 +68,7 @@ static int update_file_table() {
     return write_block(current_superblock.file_table_start_block, (uint8_t*)file_table_cache);
 }
 
-int fs_format(int disk_fd, uint32_t partition_lba, uint32_t partition_size) {
+static int fs_format_locked(int disk_fd, uint32_t partition_lba, uint32_t partition_size) {
     klog(LOG_INFO, "FS_DISK: Formatting partition LBA %u, size %u", partition_lba, partition_size);
 
     // Initialize superblock
@@ -99,7 +106,7 @@ int fs_format(int disk_fd, uint32_t partition_lba, uint32_t partition_size) {
     return 0;
 }
 
-int fs_mount(int disk_fd, uint32_t partition_lba) {
+static int fs_mount_locked(int disk_fd, uint32_t partition_lba) {
     klog(LOG_INFO, "FS_DISK: Mounting filesystem on LBA %u...", partition_lba);
 
     // Read superblock
@@ -138,7 +145,7 @@ int fs_mount(int disk_fd, uint32_t partition_lba) {
     return 0;
 }
 
-int fs_unmount() {
+static int fs_unmount_locked() {
     if (mounted_disk_fd < 0) {
         klog(LOG_WARN, "FS_DISK: No filesystem currently mounted.");
         return 0;
@@ -193,7 +200,7 @@ static uint32_t allocate_block() {
     return block;
 }
 
-int fs_create_file(const char *path, uint32_t flags) {
+static int fs_create_file_locked(const char *path, uint32_t flags) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -226,7 +233,7 @@ int fs_create_file(const char *path, uint32_t flags) {
     return 0;
 }
 
-int fs_write_file(const char *path, const uint8_t *data, size_t size) {
+static int fs_write_file_locked(const char *path, const uint8_t *data, size_t size) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -265,6 +272,7 @@ int fs_write_file(const char *path, const uint8_t *data, size_t size) {
             klog(LOG_ERROR, "FS_DISK: Failed to write data block for %s.", path);
             return -1;
         }
+        cond_resched(); // PIO transfers are slow, let others in between blocks
     }
     entry->size_bytes = size;
     update_file_table();
@@ -272,7 +280,7 @@ int fs_write_file(const char *path, const uint8_t *data, size_t size) {
     return size;
 }
 
-int fs_read_file(const char *path, uint8_t *buffer, size_t size) {
+static int fs_read_file_locked(const char *path, uint8_t *buffer, size_t size) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -303,12 +311,13 @@ int fs_read_file(const char *path, uint8_t *buffer, size_t size) {
         }
         size_t copy_len = (bytes_to_read - i * FS_BLOCK_SIZE > FS_BLOCK_SIZE) ? FS_BLOCK_SIZE : (bytes_to_read - i * FS_BLOCK_SIZE);
         memcpy(buffer + i * FS_BLOCK_SIZE, block_buf, copy_len);
+        cond_resched();
     }
     klog(LOG_INFO, "FS_DISK: Read %u bytes from file: %s", bytes_to_read, path);
     return bytes_to_read;
 }
 
-int fs_delete_file(const char *path) {
+static int fs_delete_file_locked(const char *path) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -337,7 +346,49 @@ int fs_delete_file(const char *path) {
     return 0;
 }
 
-int fs_list_dir(const char *path) {
+static int fs_rename_file_locked(const char *old_path, const char *new_path) {
+    if (mounted_disk_fd < 0) {
+        klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
+        return -1;
+    }
+    if (strlen(new_path) >= FS_MAX_FILENAME_LEN) {
+        klog(LOG_ERROR, "FS_DISK: Filename too long: %s", new_path);
+        return -1;
+    }
+    int entry_idx = find_file_entry(old_path);
+    if (entry_idx == -1) {
+        klog(LOG_WARN, "FS_DISK: File not found for rename: %s", old_path);
+        return -1;
+    }
+    int target_idx = find_file_entry(new_path);
+    if (target_idx == entry_idx) {
+        return 0;
+    }
+    fs_file_entry_t *entry = &file_table_cache[entry_idx];
+    if (target_idx != -1) {
+        fs_file_entry_t *target = &file_table_cache[target_idx];
+        if ((target->flags & FS_FILE_FLAG_DIRECTORY) || (entry->flags & FS_FILE_FLAG_DIRECTORY)) {
+            klog(LOG_ERROR, "FS_DISK: Cannot replace with or over a directory: %s", new_path);
+            return -1;
+        }
+        // Replaced: free it as fs_delete_file() does
+        current_superblock.free_blocks += (target->size_bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+        memset(target, 0, sizeof(fs_file_entry_t));
+    }
+
+    // Only the name changes, the data stays where it is. Both entries
+    // change in the cached table and reach the disk in one write.
+    memset(entry->filename, 0, FS_MAX_FILENAME_LEN);
+    strncpy(entry->filename, new_path, FS_MAX_FILENAME_LEN - 1);
+    if (target_idx != -1) {
+        update_superblock();
+    }
+    update_file_table();
+    klog(LOG_INFO, "FS_DISK: Renamed %s to %s", old_path, new_path);
+    return 0;
+}
+
+static int fs_list_dir_locked(const char *path) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -354,7 +405,7 @@ int fs_list_dir(const char *path) {
     return 0;
 }
 
-int fs_get_file_info(const char *path, fs_file_entry_t *info) {
+static int fs_get_file_info_locked(const char *path, fs_file_entry_t *info) {
     if (mounted_disk_fd < 0) {
         klog(LOG_ERROR, "FS_DISK: No filesystem mounted.");
         return -1;
@@ -367,7 +418,7 @@ int fs_get_file_info(const char *path, fs_file_entry_t *info) {
     return 0;
 }
 
-int fs_get_file_info_by_index(int index, fs_file_entry_t *info) {
+static int fs_get_file_info_by_index_locked(int index, fs_file_entry_t *info) {
     if (mounted_disk_fd < 0 || !file_table_cache || index < 0 || index >= FS_MAX_FILES) {
         return -1;
     }
@@ -377,3 +428,82 @@ int fs_get_file_info_by_index(int index, fs_file_entry_t *info) {
     memcpy(info, &file_table_cache[index], sizeof(fs_file_entry_t));
     return 0;
 }
+
+// Public entry points: every operation runs under fs_disk_lock
+
+int fs_format(int disk_fd, uint32_t partition_lba, uint32_t partition_size) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_format_locked(disk_fd, partition_lba, partition_size);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_mount(int disk_fd, uint32_t partition_lba) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_mount_locked(disk_fd, partition_lba);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_unmount() {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_unmount_locked();
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_create_file(const char *path, uint32_t flags) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_create_file_locked(path, flags);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_write_file(const char *path, const uint8_t *data, size_t size) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_write_file_locked(path, data, size);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_read_file(const char *path, uint8_t *buffer, size_t size) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_read_file_locked(path, buffer, size);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_delete_file(const char *path) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_delete_file_locked(path);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_rename_file(const char *old_path, const char *new_path) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_rename_file_locked(old_path, new_path);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_list_dir(const char *path) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_list_dir_locked(path);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_get_file_info(const char *path, fs_file_entry_t *info) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_get_file_info_locked(path, info);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
+
+int fs_get_file_info_by_index(int index, fs_file_entry_t *info) {
+    kmutex_lock(&fs_disk_lock);
+    int ret = fs_get_file_info_by_index_locked(index, info);
+    kmutex_unlock(&fs_disk_lock);
+    return ret;
+}
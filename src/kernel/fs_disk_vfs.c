@@ -5,6 +5,7 @@
 #include "log.h"
 #include "vfs.h"
 #include "thread.h" // For get_current_thread (to get disk_fd)
+#include <stdbool.h>
 
 // --- VFS Node Operations for Mounted FS_DISK ---
 // These functions will call the fs_disk.c functions
@@ -17,25 +18,79 @@ static uint32_t fs_disk_vfs_read(vfs_node_t *node, uint64_t offset, uint32_t siz
         return (uint32_t)-1; // Cannot read a directory as a file
     }
     // For simple flat FS_DISK, path is actually node->name
-    // Offset is not supported directly, only full file read for now
-    if (offset != 0) {
-        klog(LOG_WARN, "FS_DISK_VFS: Offset not supported for read yet.");
+    if (offset == 0) {
+        return fs_read_file(node->name, buffer, size);
+    }
+    // fs_disk only reads from the start of a file: read up to the end of
+    // the range and keep the tail
+    fs_file_entry_t info;
+    if (fs_get_file_info(node->name, &info) != 0) {
         return (uint32_t)-1;
     }
-    return fs_read_file(node->name, buffer, size);
+    if (offset >= info.size_bytes) {
+        return 0;
+    }
+    uint32_t end = info.size_bytes;
+    if (size < end - offset) {
+        end = (uint32_t)offset + size;
+    }
+    uint8_t *tmp = (uint8_t *)kmalloc(end);
+    if (!tmp) {
+        return (uint32_t)-1;
+    }
+    int n = fs_read_file(node->name, tmp, end);
+    uint32_t ret = (uint32_t)-1;
+    if (n >= 0 && (uint32_t)n > offset) {
+        ret = (uint32_t)n - (uint32_t)offset;
+        memcpy(buffer, tmp + offset, ret);
+    } else if (n >= 0) {
+        ret = 0;
+    }
+    kfree(tmp);
+    return ret;
 }
 
 static uint32_t fs_disk_vfs_write(vfs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
     if (node->flags & VFS_DIRECTORY) {
         return (uint32_t)-1; // Cannot write a directory as a file
     }
-    // For simple flat FS_DISK, path is actually node->name
-    // Offset is not supported directly, only full file write for now
-    if (offset != 0) {
-        klog(LOG_WARN, "FS_DISK_VFS: Offset not supported for write yet.");
+    // For simple flat FS_DISK, path is actually node->name. A write at the
+    // start replaces the whole file.
+    if (offset == 0) {
+        int n = fs_write_file(node->name, buffer, size);
+        if (n >= 0) {
+            node->length = (uint32_t)n;
+        }
+        return (uint32_t)n;
+    }
+    // Anywhere else it's read, patched and written back whole. Slow, but it
+    // lets a big write arrive in pieces.
+    fs_file_entry_t info;
+    if (fs_get_file_info(node->name, &info) != 0 || offset + size > VFS_FILE_SIZE_MAX) {
         return (uint32_t)-1;
     }
-    return fs_write_file(node->name, buffer, size);
+    uint32_t old_size = info.size_bytes;
+    uint32_t new_size = (uint32_t)offset + size;
+    if (new_size < old_size) {
+        new_size = old_size;
+    }
+    uint8_t *tmp = (uint8_t *)kmalloc(new_size);
+    if (!tmp) {
+        return (uint32_t)-1;
+    }
+    uint32_t ret = (uint32_t)-1;
+    if (old_size == 0 || fs_read_file(node->name, tmp, old_size) == (int)old_size) {
+        if (offset > old_size) {
+            memset(tmp + old_size, 0, offset - old_size); // The gap reads as zeros
+        }
+        memcpy(tmp + offset, buffer, size);
+        if (fs_write_file(node->name, tmp, new_size) == (int)new_size) {
+            node->length = new_size;
+            ret = size;
+        }
+    }
+    kfree(tmp);
+    return ret;
 }
 
 static void fs_disk_vfs_open(vfs_node_t *node, int flags) {
@@ -131,6 +186,12 @@ static int fs_disk_vfs_rmdir(vfs_node_t *node, char *name, uint16_t mode) {
     return fs_delete_file(name); // Deleting a "directory" entry is same as file
 }
 
+static int fs_disk_vfs_rename(vfs_node_t *old_dir, char *old_name, vfs_node_t *new_dir, char *new_name) {
+    // Flat FS: every name lives in the root, the directories don't matter
+    (void)old_dir; (void)new_dir;
+    return fs_rename_file(old_name, new_name);
+}
+
 static int fs_disk_vfs_stat(vfs_node_t *node, struct stat *stat_buf) {
     fs_file_entry_t file_info;
     if (fs_get_file_info(node->name, &file_info) == 0) {
@@ -164,8 +225,11 @@ int fs_disk_mount_func(vfs_node_t *mount_point, vfs_node_t *device_node) {
     // This is a hacky way to get the fd of /dev/sda
     int disk_fd = -1;
     thread_t *curr_thread = get_current_thread();
-    for(int i = 0; i < MAX_FILES; i++) {
-        if (curr_thread->fd_table[i].type == FD_TYPE_FILE && curr_thread->fd_table[i].data.file.node == device_node) {
+    for (int i = fd_next_open(curr_thread->files, 0); i >= 0; i = fd_next_open(curr_thread->files, i + 1)) {
+        fd_entry_t *f = fd_get(curr_thread->files, i);
+        bool match = f && f->type == FD_TYPE_FILE && f->data.file.node == device_node;
+        fd_put(f);
+        if (match) {
             disk_fd = i;
             break;
         }
@@ -196,6 +260,7 @@ int fs_disk_mount_func(vfs_node_t *mount_point, vfs_node_t *device_node) {
     mount_point->remove = fs_disk_vfs_remove;
     mount_point->rmdir = fs_disk_vfs_rmdir;
     mount_point->stat = fs_disk_vfs_stat;
+    mount_point->rename = fs_disk_vfs_rename;
     mount_point->ioctl = fs_disk_vfs_ioctl; // Pass through if needed by FS
     mount_point->ptr = NULL; // FS_DISK manages its own global state
 
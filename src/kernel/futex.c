@@ -0,0 +1,199 @@
+#include "futex.h"
+#include "clock.h"
+#include "cpu.h" // For rdtsc
+#include "hashtable.h" // For hash_u64
+#include "scheduler.h"
+#include "thread.h"
+#include "uaccess.h"
+#include "vmm.h"
+#include "waitqueue.h"
+#include <stddef.h> // for NULL
+
+// A sleeping thread, on the bucket of its key. Lives on the waiter's stack.
+typedef struct futex_waiter {
+  wait_queue_entry_t wait; // First, so entries cast back to the waiter
+  uint64_t key;
+  wait_queue_t *wq; // Current bucket, changed by FUTEX_REQUEUE
+  int woken;        // Set, and the entry unlinked, by whoever woke us
+} futex_waiter_t;
+
+static wait_queue_t buckets[FUTEX_BUCKETS] = {
+    [0 ... FUTEX_BUCKETS - 1] = WAIT_QUEUE_INIT("futex"),
+};
+
+static wait_queue_t *futex_bucket(uint64_t key) {
+  return &buckets[hash_u64(key) % FUTEX_BUCKETS];
+}
+
+// Physical address of a user word. The word must be aligned, so it can't
+// straddle two pages.
+static int futex_key(uint32_t *uaddr, uint64_t *key) {
+  if (((uint64_t)uaddr & 3) || !access_ok(uaddr, sizeof(uint32_t))) {
+    return -1;
+  }
+  void *phys = vmm_get_phys(get_current_thread()->pml4, uaddr);
+  if (!phys) {
+    return -1;
+  }
+  *key = (uint64_t)phys;
+  return 0;
+}
+
+// Lock the bucket the waiter is on now. Interrupts must be off.
+static wait_queue_t *futex_lock_waiter(futex_waiter_t *w) {
+  for (;;) {
+    wait_queue_t *wq = __atomic_load_n(&w->wq, __ATOMIC_ACQUIRE);
+    spin_lock(&wq->lock);
+    if (wq == w->wq) {
+      return wq;
+    }
+    spin_unlock(&wq->lock); // Requeued meanwhile
+  }
+}
+
+// Wake up to `max` waiters on `key`, oldest first. Holding wq->lock.
+static int futex_wake_locked(wait_queue_t *wq, uint64_t key, uint32_t max) {
+  wait_queue_entry_t *entry = wq->head;
+  while (entry && entry->next) {
+    entry = entry->next;
+  }
+  int woken = 0;
+  while (entry && (uint32_t)woken < max) {
+    wait_queue_entry_t *prev = entry->prev;
+    futex_waiter_t *w = (futex_waiter_t *)entry;
+    if (w->key == key) {
+      wait_queue_unlink(wq, entry);
+      w->woken = 1;
+      // The waiter can't return before we drop the lock, the entry stays valid
+      entry->func(entry, 0);
+      woken++;
+    }
+    entry = prev;
+  }
+  return woken;
+}
+
+static int64_t futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns) {
+  uint64_t key;
+  if (futex_key(uaddr, &key) < 0) {
+    return -1;
+  }
+  thread_t *self = get_current_thread();
+  uint64_t deadline = timeout_ns ? rdtsc() + clock_ns_to_tsc(timeout_ns) : 0;
+
+  futex_waiter_t w;
+  wait_entry_init(&w.wait, self);
+  w.key = key;
+  w.wq = futex_bucket(key);
+  w.woken = 0;
+
+  uint64_t flags = local_irq_save();
+  wait_queue_t *wq = w.wq;
+  spin_lock(&wq->lock);
+  // Check under the bucket lock: a waker changes the word before taking the
+  // lock, so either we see the new value or it sees us queued
+  uint32_t cur;
+  if (copy_from_user(&cur, uaddr, sizeof(cur)) < 0 || cur != val) {
+    spin_unlock(&wq->lock);
+    local_irq_restore(flags);
+    return -1;
+  }
+  wait_queue_link(wq, &w.wait);
+
+  int64_t ret = 0;
+  for (;;) {
+    self->state = THREAD_BLOCKED;
+    spin_unlock(&wq->lock);
+    int timed_out = 0;
+    if (deadline) {
+      timed_out = scheduler_block_until(deadline);
+    } else {
+      schedule();
+    }
+    wq = futex_lock_waiter(&w);
+    if (w.woken) {
+      break;
+    }
+    if (timed_out || (deadline && rdtsc() >= deadline)) {
+      wait_queue_unlink(wq, &w.wait);
+      ret = -1;
+      break;
+    }
+  }
+  spin_unlock(&wq->lock);
+  local_irq_restore(flags);
+  return ret;
+}
+
+static int64_t futex_wake(uint32_t *uaddr, uint32_t max) {
+  uint64_t key;
+  if (futex_key(uaddr, &key) < 0) {
+    return -1;
+  }
+  // Always under the lock, no peek at an empty bucket first: a waiter that
+  // has read the old value may not be linked yet, and only the lock orders
+  // our store to the word against its read
+  wait_queue_t *wq = futex_bucket(key);
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  int woken = futex_wake_locked(wq, key, max);
+  spin_unlock_irqrestore(&wq->lock, flags);
+  return woken;
+}
+
+static int64_t futex_requeue(uint32_t *uaddr, uint32_t max_wake, uint64_t max_requeue,
+                             uint32_t *uaddr2) {
+  uint64_t key, key2;
+  if (futex_key(uaddr, &key) < 0 || futex_key(uaddr2, &key2) < 0) {
+    return -1;
+  }
+  wait_queue_t *from = futex_bucket(key);
+  wait_queue_t *to = futex_bucket(key2);
+
+  // Two buckets: lock in address order
+  uint64_t flags = local_irq_save();
+  wait_queue_t *first = from < to ? from : to;
+  wait_queue_t *second = from < to ? to : from;
+  spin_lock(&first->lock);
+  if (second != first) {
+    spin_lock(&second->lock);
+  }
+
+  int64_t count = futex_wake_locked(from, key, max_wake);
+  uint64_t moved = 0;
+  wait_queue_entry_t *entry = from->head;
+  while (entry && entry->next) {
+    entry = entry->next;
+  }
+  while (entry && moved < max_requeue) {
+    wait_queue_entry_t *prev = entry->prev;
+    futex_waiter_t *w = (futex_waiter_t *)entry;
+    if (w->key == key) {
+      wait_queue_unlink(from, entry);
+      wait_queue_link(to, entry);
+      w->key = key2;
+      __atomic_store_n(&w->wq, to, __ATOMIC_RELEASE);
+      moved++;
+    }
+    entry = prev;
+  }
+
+  if (second != first) {
+    spin_unlock(&second->lock);
+  }
+  spin_unlock(&first->lock);
+  local_irq_restore(flags);
+  return count + (int64_t)moved;
+}
+
+int64_t ksys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2) {
+  switch (op) {
+  case FUTEX_WAIT:
+    return futex_wait(uaddr, val, val2);
+  case FUTEX_WAKE:
+    return futex_wake(uaddr, val);
+  case FUTEX_REQUEUE:
+    return futex_requeue(uaddr, val, val2, uaddr2);
+  default:
+    return -1;
+  }
+}
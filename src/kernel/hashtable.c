@@ -0,0 +1,112 @@
+#include "hashtable.h"
+#include "heap.h"
+#include "kstring.h"
+
+// Grow when the average chain is longer than 2, shrink below 1/8
+#define HASHTABLE_GROW_LOAD 2
+#define HASHTABLE_SHRINK_LOAD 8
+
+static size_t round_up_pow2(size_t n) {
+  size_t p = HASHTABLE_MIN_BUCKETS;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+static hash_node_t **bucket_for(const hashtable_t *table, uint64_t hash) {
+  return &table->buckets[hash & (table->bucket_count - 1)];
+}
+
+int hashtable_init(hashtable_t *table, size_t buckets) {
+  size_t count = round_up_pow2(buckets);
+  table->buckets = (hash_node_t **)kmalloc(count * sizeof(hash_node_t *));
+  if (!table->buckets) {
+    return -1;
+  }
+  memset(table->buckets, 0, count * sizeof(hash_node_t *));
+  table->bucket_count = count;
+  table->min_buckets = count;
+  table->count = 0;
+  return 0;
+}
+
+void hashtable_destroy(hashtable_t *table) {
+  kfree(table->buckets);
+  table->buckets = NULL;
+  table->bucket_count = 0;
+  table->count = 0;
+}
+
+// Move every node into a new bucket array. Keeps the old one if the
+// allocation fails.
+static void hashtable_resize(hashtable_t *table, size_t new_count) {
+  hash_node_t **buckets =
+      (hash_node_t **)kmalloc(new_count * sizeof(hash_node_t *));
+  if (!buckets) {
+    return;
+  }
+  memset(buckets, 0, new_count * sizeof(hash_node_t *));
+
+  for (size_t i = 0; i < table->bucket_count; i++) {
+    hash_node_t *node = table->buckets[i];
+    while (node) {
+      hash_node_t *next = node->next;
+      hash_node_t **bucket = &buckets[node->hash & (new_count - 1)];
+      node->next = *bucket;
+      *bucket = node;
+      node = next;
+    }
+  }
+
+  kfree(table->buckets);
+  table->buckets = buckets;
+  table->bucket_count = new_count;
+}
+
+void hashtable_insert(hashtable_t *table, hash_node_t *node, uint64_t hash) {
+  node->hash = hash;
+  hash_node_t **bucket = bucket_for(table, hash);
+  node->next = *bucket;
+  *bucket = node;
+  table->count++;
+
+  if (table->count > table->bucket_count * HASHTABLE_GROW_LOAD) {
+    hashtable_resize(table, table->bucket_count * 2);
+  }
+}
+
+void hashtable_remove(hashtable_t *table, hash_node_t *node) {
+  hash_node_t **link = bucket_for(table, node->hash);
+  while (*link && *link != node) {
+    link = &(*link)->next;
+  }
+  if (!*link) {
+    return;
+  }
+  *link = node->next;
+  node->next = NULL;
+  table->count--;
+
+  if (table->bucket_count > table->min_buckets &&
+      table->count < table->bucket_count / HASHTABLE_SHRINK_LOAD) {
+    hashtable_resize(table, table->bucket_count / 2);
+  }
+}
+
+hash_node_t *hashtable_first(const hashtable_t *table, uint64_t hash) {
+  hash_node_t *node = *bucket_for(table, hash);
+  while (node && node->hash != hash) {
+    node = node->next;
+  }
+  return node;
+}
+
+hash_node_t *hashtable_next(const hash_node_t *node) {
+  uint64_t hash = node->hash;
+  node = node->next;
+  while (node && node->hash != hash) {
+    node = node->next;
+  }
+  return (hash_node_t *)node;
+}
@@ -1,6 +1,7 @@
 #include "heap.h"
 #include "log.h"
 #include "pmm.h"
+#include "spinlock.h"
 #include "vmm.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -14,6 +15,10 @@ typedef struct header {
 
 static header_t base; // Empty list to start
 static header_t *freelist = NULL;
+// Taken with interrupts off: IRQ handlers allocate too.
+static spinlock_t heap_lock = SPINLOCK_INIT("heap");
+
+static void kfree_locked(void *ap);
 
 // Ask the OS for more memory
 static header_t *morecore(size_t nunits) {
@@ -31,7 +36,7 @@ static header_t *morecore(size_t nunits) {
   // Wrap physical pages in HHDM virtual address
   header_t *up = (header_t *)p_to_v(page);
   up->size = npages * PAGE_SIZE / sizeof(header_t);
-  kfree((void *)(up + 1));
+  kfree_locked((void *)(up + 1));
   return freelist;
 }
 
@@ -50,6 +55,7 @@ void *kmalloc(size_t nbytes) {
   // Calculate number of header-sized units required
   size_t nunits = (nbytes + sizeof(header_t) - 1) / sizeof(header_t) + 1;
 
+  uint64_t flags = spin_lock_irqsave(&heap_lock);
   header_t *prevp = freelist;
   header_t *p;
 
@@ -63,10 +69,12 @@ void *kmalloc(size_t nbytes) {
         p->size = nunits;
       }
       freelist = prevp;
+      spin_unlock_irqrestore(&heap_lock, flags);
       return (void *)(p + 1);
     }
     if (p == freelist) { // Wrapped around free list
       if ((p = morecore(nunits)) == NULL) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         klog(LOG_WARN, "Heap: out of memory!");
         return NULL; // No memory left
       }
@@ -79,6 +87,12 @@ void kfree(void *ap) {
     return;
   }
 
+  uint64_t flags = spin_lock_irqsave(&heap_lock);
+  kfree_locked(ap);
+  spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+static void kfree_locked(void *ap) {
   header_t *bp = (header_t *)ap - 1; // Point to block header
   header_t *p;
 
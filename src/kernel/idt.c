@@ -1,4 +1,5 @@
 #include "idt.h"
+#include "apic.h"
 #include "isr.h"
 #include "log.h"
 #include "port_io.h"
@@ -20,6 +21,7 @@ extern void isr16(), isr17(), isr18(), isr19(), isr20(), isr21(), isr22(),
 extern void irq0(), irq1(), irq2(), irq3(), irq4(), irq5(), irq6(), irq7(),
     irq8(), irq9(), irq10(), irq11(), irq12(), irq13(), irq14(), irq15();
 extern void isr128();
+extern void isr239(), isr240(), isr241(), isr255();
 
 static void idt_set_gate(uint8_t num, uint64_t base, uint16_t sel,
                          uint8_t flags) {
@@ -112,6 +114,16 @@ void idt_init() {
 
   idt_set_gate(128, (uint64_t)isr128, KERNEL_CS, USER_GATE_FLAGS);
 
-  __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
+  // Local APIC vectors
+  idt_set_gate(LAPIC_TIMER_VECTOR, (uint64_t)isr239, KERNEL_CS, KERNEL_GATE_FLAGS);
+  idt_set_gate(IPI_VECTOR_RESCHEDULE, (uint64_t)isr240, KERNEL_CS, KERNEL_GATE_FLAGS);
+  idt_set_gate(IPI_VECTOR_TLB_SHOOTDOWN, (uint64_t)isr241, KERNEL_CS, KERNEL_GATE_FLAGS);
+  idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint64_t)isr255, KERNEL_CS, KERNEL_GATE_FLAGS);
+
+  idt_load();
   klog(LOG_INFO, "IDT: Loaded successfully.");
+}
+
+void idt_load() {
+  __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
 }
\ No newline at end of file
@@ -0,0 +1,412 @@
+#include "io_ring.h"
+#include "clock.h"
+#include "fdtable.h"
+#include "heap.h"
+#include "kstring.h"
+#include "log.h"
+#include "pmm.h"
+#include "poll.h" // For POLLIN
+#include "process.h"
+#include "scheduler.h"
+#include "socket.h"
+#include "spinlock.h"
+#include "syscall.h" // For ksys_read and friends
+#include "thread.h"
+#include "uaccess.h"
+#include "vmm.h"
+#include <stddef.h> // for NULL
+
+#define IORING_IDLE_MS_DEFAULT 10
+
+typedef struct io_ring {
+  volatile int refcount; // The descriptor, plus the SQPOLL thread if any
+  process_t *proc;       // Keeps the address space with our mapping alive
+  void *phys;            // Region, `pages` contiguous pages
+  uint64_t pages;
+  uint64_t user_addr;
+  // Kernel view of the region. Userspace can scribble over all of it, so
+  // sizes and our own indices are kept here as well.
+  io_ring_header_t *hdr;
+  io_sqe_t *sqes;
+  io_cqe_t *cqes;
+  uint32_t sq_entries;
+  uint32_t cq_entries;
+  uint32_t sq_head;
+  uint32_t cq_tail;
+
+  volatile int submitting; // A thread is running SQEs, only one at a time
+  wait_queue_t wq;         // Pollers of the descriptor, woken when CQEs are posted
+
+  spinlock_t lock;     // Protects the fields below
+  thread_t *waiter;    // Blocked in enter until enough CQEs are ready
+  thread_t *poller;    // SQPOLL thread
+  int poller_sleeping; // Blocked with IORING_SQ_NEED_WAKEUP set
+  int stop;            // Tells the SQPOLL thread to exit
+  fd_table_t *poller_files; // Reference handed to the SQPOLL thread
+  uint64_t idle_ns;
+} io_ring_t;
+
+static void io_ring_put(io_ring_t *ring) {
+  if (__atomic_sub_fetch(&ring->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  for (uint64_t i = 0; i < ring->pages; i++) {
+    vmm_unmap_page(ring->proc->pml4, (void *)(ring->user_addr + i * PAGE_SIZE));
+    pmm_free_page((void *)((uint64_t)ring->phys + i * PAGE_SIZE));
+  }
+  process_put(ring->proc);
+  kfree(ring);
+}
+
+// Also called by poll without ring->lock, which relies on wake_up() taking
+// the wait queue's lock to see a new tail
+static uint32_t cq_ready(io_ring_t *ring) {
+  return __atomic_load_n(&ring->cq_tail, __ATOMIC_RELAXED) -
+         __atomic_load_n(&ring->hdr->cq_head, __ATOMIC_ACQUIRE);
+}
+
+// Caller holds ring->lock
+static void wake_poller_locked(io_ring_t *ring) {
+  if (ring->poller_sleeping) {
+    ring->poller_sleeping = 0;
+    scheduler_wake(ring->poller);
+  }
+}
+
+static int32_t run_sock_op(fd_table_t *files, const io_sqe_t *sqe) {
+  fd_entry_t *f = fd_get(files, sqe->fd);
+  if (!f) {
+    return -1;
+  }
+  int32_t ret = -1;
+  if (f->type == FD_TYPE_SOCKET) {
+    void *buf = (void *)sqe->addr;
+    int flags = (int)sqe->op_flags;
+    ret = sqe->opcode == IORING_OP_SEND
+              ? sock_send_user(f->data.sock, buf, sqe->len, flags)
+              : sock_recv_user(f->data.sock, buf, sqe->len, flags);
+  }
+  fd_put(f);
+  return ret;
+}
+
+static int32_t run_close(fd_table_t *files, int fd) {
+  // Closing a ring from its own SQPOLL thread would have it wait on itself
+  fd_entry_t *f = fd_get(files, fd);
+  if (!f) {
+    return -1;
+  }
+  int is_ring = f->type == FD_TYPE_IORING;
+  fd_put(f);
+  return is_ring ? -1 : fd_close(files, fd);
+}
+
+static int32_t run_sqe(fd_table_t *files, const io_sqe_t *sqe) {
+  if (sqe->flags) {
+    return -1;
+  }
+  void *addr = (void *)sqe->addr;
+  // The buffer must lie in user space as a whole, not just start there. The
+  // path for OPEN is checked again as it's copied in.
+  size_t len = sqe->opcode == IORING_OP_OPEN ? 1 : sqe->len;
+  if (sqe->opcode != IORING_OP_NOP && sqe->opcode != IORING_OP_CLOSE && !access_ok(addr, len)) {
+    return -1;
+  }
+  switch (sqe->opcode) {
+  case IORING_OP_NOP:
+    return 0;
+  case IORING_OP_READ:
+    return (int32_t)ksys_read(files, sqe->fd, addr, sqe->len);
+  case IORING_OP_WRITE:
+    return (int32_t)ksys_write(files, sqe->fd, addr, sqe->len);
+  case IORING_OP_SEND:
+  case IORING_OP_RECV:
+    return run_sock_op(files, sqe);
+  case IORING_OP_OPEN:
+    return ksys_open(files, (const char *)addr, (int)sqe->op_flags);
+  case IORING_OP_CLOSE:
+    return run_close(files, sqe->fd);
+  default:
+    return -1;
+  }
+}
+
+// Run up to `max` queued SQEs, as long as their completions fit in the CQ.
+// Returns how many ran.
+static uint32_t io_ring_submit(io_ring_t *ring, fd_table_t *files, uint32_t max) {
+  io_ring_header_t *hdr = ring->hdr;
+  uint32_t tail = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE);
+  uint32_t done = 0;
+
+  while (ring->sq_head != tail && done < max && cq_ready(ring) < ring->cq_entries) {
+    // Copy it first, the slot is userspace's again once sq_head moves
+    io_sqe_t sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+    ring->sq_head++;
+    __atomic_store_n(&hdr->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+
+    io_cqe_t *cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+    cqe->res = run_sqe(files, &sqe);
+    cqe->user_data = sqe.user_data;
+    cqe->flags = 0;
+    __atomic_store_n(&ring->cq_tail, ring->cq_tail + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+    done++;
+  }
+
+  if (done) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    if (ring->waiter) {
+      scheduler_wake(ring->waiter);
+      ring->waiter = NULL;
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+    wake_up(&ring->wq, POLLIN);
+  }
+  return done;
+}
+
+static void io_ring_poller(void *arg) {
+  io_ring_t *ring = (io_ring_t *)arg;
+  thread_t *self = get_current_thread();
+
+  // Work in the program's address space and descriptor table, so requests
+  // see the same buffers and descriptors as its threads do
+  fd_table_t *kernel_files = self->files;
+  pml4_t *kernel_pml4 = self->pml4;
+  uint64_t flags = local_irq_save();
+  self->files = ring->poller_files;
+  self->pml4 = ring->proc->pml4;
+  vmm_switch_address_space(self->pml4);
+  local_irq_restore(flags);
+  fd_table_release(kernel_files);
+
+  uint64_t idle_since = clock_monotonic_ns();
+  for (;;) {
+    flags = spin_lock_irqsave(&ring->lock);
+    int stop = ring->stop;
+    spin_unlock_irqrestore(&ring->lock, flags);
+    if (stop) {
+      break;
+    }
+
+    if (io_ring_submit(ring, self->files, UINT32_MAX) > 0) {
+      idle_since = clock_monotonic_ns();
+      continue;
+    }
+    if (clock_monotonic_ns() - idle_since < ring->idle_ns) {
+      schedule(); // Still polling, but let everyone else run first
+      continue;
+    }
+
+    // Sleep until enter wakes us. The flag goes up before we look at the
+    // tail one last time, so a submitter either sees it or we see its SQE.
+    flags = spin_lock_irqsave(&ring->lock);
+    __atomic_or_fetch(&ring->hdr->sq_flags, IORING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+    if (!ring->stop && __atomic_load_n(&ring->hdr->sq_tail, __ATOMIC_SEQ_CST) == ring->sq_head) {
+      ring->poller_sleeping = 1;
+      self->state = THREAD_BLOCKED;
+      spin_unlock(&ring->lock);
+      schedule();
+      local_irq_restore(flags);
+    } else {
+      spin_unlock_irqrestore(&ring->lock, flags);
+    }
+    __atomic_and_fetch(&ring->hdr->sq_flags, ~IORING_SQ_NEED_WAKEUP, __ATOMIC_RELAXED);
+    idle_since = clock_monotonic_ns();
+  }
+
+  // Off the address space before dropping the ring, which may free it.
+  // The reaper drops our reference to the descriptor table.
+  flags = local_irq_save();
+  self->pml4 = kernel_pml4;
+  vmm_switch_address_space(kernel_pml4);
+  local_irq_restore(flags);
+  io_ring_put(ring);
+}
+
+int io_ring_setup(uint32_t entries, io_ring_params_t *params) {
+  thread_t *t = get_current_thread();
+  io_ring_params_t p;
+  if (!t->proc || !params || entries == 0 || entries > IORING_MAX_ENTRIES ||
+      copy_from_user(&p, params, sizeof(p)) != 0) {
+    return -1;
+  }
+  if (p.flags & ~IORING_SETUP_SQPOLL) {
+    return -1;
+  }
+
+  uint32_t sq_entries = 1;
+  while (sq_entries < entries) {
+    sq_entries <<= 1;
+  }
+  uint32_t cq_entries = sq_entries * 2;
+  uint32_t sq_offset = sizeof(io_ring_header_t);
+  uint32_t cq_offset = sq_offset + sq_entries * sizeof(io_sqe_t);
+  uint64_t size = ALIGN_UP(cq_offset + cq_entries * sizeof(io_cqe_t), PAGE_SIZE);
+
+  io_ring_t *ring = (io_ring_t *)kmalloc(sizeof(io_ring_t));
+  if (!ring) {
+    return -1;
+  }
+  memset(ring, 0, sizeof(io_ring_t));
+  ring->pages = size / PAGE_SIZE;
+  ring->phys = pmm_alloc_pages(ring->pages);
+  if (!ring->phys) {
+    klog(LOG_ERROR, "IORING: Out of memory for a %d-entry ring.", sq_entries);
+    kfree(ring);
+    return -1;
+  }
+  ring->refcount = 1;
+  ring->proc = process_get(t->proc);
+  // Every ring gets fresh addresses, with an unmapped page after it
+  ring->user_addr = __atomic_fetch_add(&t->proc->ioring_vaddr, size + PAGE_SIZE,
+                                       __ATOMIC_RELAXED);
+  spinlock_init(&ring->lock, "io_ring");
+  wait_queue_init(&ring->wq, "io_ring_wq");
+
+  uint8_t *region = (uint8_t *)vmm_phys_to_virt(ring->phys);
+  memset(region, 0, size);
+  ring->hdr = (io_ring_header_t *)region;
+  ring->sqes = (io_sqe_t *)(region + sq_offset);
+  ring->cqes = (io_cqe_t *)(region + cq_offset);
+  ring->sq_entries = sq_entries;
+  ring->cq_entries = cq_entries;
+  ring->hdr->sq_entries = sq_entries;
+  ring->hdr->sq_offset = sq_offset;
+  ring->hdr->cq_entries = cq_entries;
+  ring->hdr->cq_offset = cq_offset;
+  for (uint64_t i = 0; i < ring->pages; i++) {
+    vmm_map_page(t->pml4, (void *)(ring->user_addr + i * PAGE_SIZE),
+                 (void *)((uint64_t)ring->phys + i * PAGE_SIZE),
+                 PAGE_PRESENT | PAGE_WRITE | PAGE_USER | PAGE_NO_EXEC);
+  }
+
+  fd_entry_t *f = fd_entry_alloc(FD_TYPE_IORING);
+  if (!f) {
+    io_ring_put(ring);
+    return -1;
+  }
+  f->data.ring = ring;
+
+  if (p.flags & IORING_SETUP_SQPOLL) {
+    ring->idle_ns = (uint64_t)(p.sq_idle_ms ? p.sq_idle_ms : IORING_IDLE_MS_DEFAULT) * 1000000ULL;
+    ring->poller_files = fd_table_share(t->files);
+    // The poller's reference; it has nothing to do until the caller
+    // has the descriptor
+    ring->refcount++;
+    ring->poller = thread_create(io_ring_poller, ring);
+    if (!ring->poller) {
+      fd_table_release(ring->poller_files);
+      ring->refcount--;
+      fd_put(f);
+      return -1;
+    }
+    thread_set_name(ring->poller, "io_ring_sq");
+  }
+
+  int fd = fd_install(t->files, f);
+  if (fd < 0) {
+    fd_put(f); // Stops the poller
+    return -1;
+  }
+
+  p.sq_entries = sq_entries;
+  p.cq_entries = cq_entries;
+  p.ring_addr = ring->user_addr;
+  p.ring_size = size;
+  if (copy_to_user(params, &p, sizeof(p)) != 0) {
+    fd_close(t->files, fd);
+    return -1;
+  }
+  return fd;
+}
+
+int io_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete) {
+  thread_t *t = get_current_thread();
+  fd_entry_t *f = fd_get(t->files, fd);
+  if (!f) {
+    return -1;
+  }
+  if (f->type != FD_TYPE_IORING) {
+    fd_put(f);
+    return -1;
+  }
+  io_ring_t *ring = f->data.ring;
+
+  int ret = 0;
+  if (ring->poller) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    wake_poller_locked(ring);
+    spin_unlock_irqrestore(&ring->lock, flags);
+  } else if (to_submit) {
+    if (__atomic_exchange_n(&ring->submitting, 1, __ATOMIC_ACQUIRE)) {
+      fd_put(f);
+      return -1; // Another thread is submitting on this ring
+    }
+    ret = (int)io_ring_submit(ring, t->files, to_submit);
+    __atomic_store_n(&ring->submitting, 0, __ATOMIC_RELEASE);
+  }
+
+  // Without a poller everything submitted has completed by now, so only
+  // SQPOLL rings have anything to wait for
+  if (min_complete > ring->cq_entries) {
+    min_complete = ring->cq_entries;
+  }
+  while (ring->poller && cq_ready(ring) < min_complete) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    if (cq_ready(ring) >= min_complete) {
+      spin_unlock_irqrestore(&ring->lock, flags);
+      break;
+    }
+    if (ring->waiter && ring->waiter != t) {
+      // Someone else is waiting already, check back after a tick
+      spin_unlock_irqrestore(&ring->lock, flags);
+      scheduler_sleep_ns(clock_tick_ns());
+      continue;
+    }
+    ring->waiter = t;
+    t->state = THREAD_BLOCKED;
+    spin_unlock(&ring->lock);
+    schedule();
+    local_irq_restore(flags);
+  }
+
+  fd_put(f);
+  return ret;
+}
+
+void io_ring_release(io_ring_t *ring) {
+  if (ring->poller) {
+    // The poller drops its own reference once it's out of the way
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    ring->stop = 1;
+    wake_poller_locked(ring);
+    spin_unlock_irqrestore(&ring->lock, flags);
+  }
+  io_ring_put(ring);
+}
+
+void io_ring_exit(fd_table_t *files) {
+  for (int fd = fd_next_open(files, 0); fd >= 0; fd = fd_next_open(files, fd + 1)) {
+    fd_entry_t *f = fd_get(files, fd);
+    if (!f) {
+      continue;
+    }
+    if (f->type == FD_TYPE_IORING && f->data.ring->poller) {
+      io_ring_t *ring = f->data.ring;
+      uint64_t flags = spin_lock_irqsave(&ring->lock);
+      ring->stop = 1;
+      wake_poller_locked(ring);
+      spin_unlock_irqrestore(&ring->lock, flags);
+    }
+    fd_put(f);
+  }
+}
+
+uint32_t io_ring_poll(io_ring_t *ring) {
+  return cq_ready(ring) ? POLLIN : 0;
+}
+
+wait_queue_t *io_ring_wait_queue(io_ring_t *ring) {
+  return &ring->wq;
+}
@@ -61,14 +61,12 @@ static uint16_t ip_checksum(const void *data, size_t len) {
 
 void ip_send_packet(net_dev_t *net_dev, uint32_t dest_ip, uint8_t protocol,
                     const uint8_t *payload, size_t payload_size) {
-  uint8_t *dest_mac;
-  uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  uint8_t dest_mac[6];
 
   if (dest_ip == 0xFFFFFFFF) {
-    dest_mac = broadcast_mac;
+    memset(dest_mac, 0xFF, 6);
   } else {
-    dest_mac = arp_lookup_mac(dest_ip);
-    if (!dest_mac) {
+    if (!arp_lookup_mac(dest_ip, dest_mac)) {
       klog(LOG_WARN, "IP: MAC address not found for destination IP, sending ARP request.");
       arp_send_request(dest_ip);
       return; // Cannot send packet without MAC
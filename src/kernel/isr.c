@@ -1,7 +1,13 @@
 #include "isr.h"
+#include "apic.h"
+#include "fpu.h"
 #include "log.h"
 #include "port_io.h"
+#include "preempt.h"
 #include "scheduler.h"
+#include "smp.h"
+#include "thread.h"
+#include "uaccess.h"
 
 extern void syscall_handler(struct registers *regs); // Declare syscall_handler here
 
@@ -42,51 +48,58 @@ static const char *exception_messages[] = {"Division By Zero",
                                            "Reserved",
                                            "Reserved"};
 
-static uint64_t ticks = 0;
-
-uint64_t timer_get_ticks() { return ticks; }
-
-void timer_init(uint32_t frequency) {
-  uint32_t divisor = 1193180 / frequency;
-
-  // Send the command byte.
-  outb(0x43, 0x36);
-
-  // Divisor has to be sent byte-wise, so split here into upper/lower bytes.
-  uint8_t l = (uint8_t)(divisor & 0xFF);
-  uint8_t h = (uint8_t)((divisor >> 8) & 0xFF);
-
-  // Send the frequency divisor.
-  outb(0x40, l);
-  outb(0x40, h);
-}
-
 void isr_handler(struct registers *regs) {
-  if (regs->int_no < 32) { // CPU Exceptions
+  if (regs->int_no == 7) { // Device Not Available, first FPU use since a switch
+    fpu_handle_nm();
+  } else if (regs->int_no == 14 && (regs->cs & 3)) {
+    // A user thread touched memory it doesn't have. There's no demand paging,
+    // so count the fault and end the thread instead of the whole system.
+    uint64_t addr;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(addr));
+    thread_t *self = get_current_thread();
+    self->stats.page_faults++;
+    klog(LOG_ERROR, "Thread %d: page fault at %p (rip %p), terminating.", self->id,
+         (void *)addr, (void *)regs->rip);
+    thread_exit(-1);
+  } else if ((regs->int_no == 14 || regs->int_no == 13) && uaccess_fixup(regs)) {
+    // A copy from or to userspace hit a bad user pointer. It resumes at its
+    // fixup and fails the syscall instead.
+  } else if (regs->int_no < 32) { // CPU Exceptions
     panic(exception_messages[regs->int_no], regs);
   } else if (regs->int_no >= 32 && regs->int_no <= 47) { // IRQs
     uint8_t irq_num = regs->int_no - 32;
 
-    if (irq_num == 0) {
-      ticks++;
-    }
-
     if (irq_handlers[irq_num] != 0) {
       irq_handlers[irq_num](regs);
     }
 
-    // Send EOI (End Of Interrupt) to PIC before scheduling
+    // Send EOI (End Of Interrupt) to PIC
     if (irq_num >= 8) {
       outb(0xA0, 0x20); // Send EOI to slave
     }
     outb(0x20, 0x20); // Send EOI to master
-
-    // Call the scheduler on timer interrupt
-    if (irq_num == 0) {
-      schedule();
-    }
   } else if (regs->int_no == 128) { // Syscall interrupt (0x80)
       syscall_handler(regs);
+  } else if (regs->int_no == LAPIC_TIMER_VECTOR) {
+    // Every CPU has its own tick, rearm it before we possibly switch away
+    lapic_timer_rearm();
+    lapic_eoi();
+    scheduler_tick();
+    set_need_resched(); // Time slice is up
+  } else if (regs->int_no == IPI_VECTOR_RESCHEDULE) {
+    lapic_eoi();
+    set_need_resched();
+  } else if (regs->int_no == IPI_VECTOR_TLB_SHOOTDOWN) {
+    tlb_shootdown_handle();
+    lapic_eoi();
+  } else if (regs->int_no == LAPIC_SPURIOUS_VECTOR) {
+    // Spurious interrupts must not be acknowledged
+  }
+
+  // IRQs, IPIs and syscalls are preemption points. If the interrupted code
+  // holds a spinlock, the switch happens when it drops it instead.
+  if (regs->int_no >= 32) {
+    preempt_irq_exit();
   }
 }
 
@@ -9,6 +9,7 @@
 #include "e1000.h"
 #include "event.h"
 #include "fb.h"
+#include "fpu.h"
 #include "gdt.h"
 #include "heap.h"
 #include "idt.h"
@@ -22,7 +23,11 @@
 #include "pci.h"
 #include "panic_screen.h"
 #include "pmm.h"
+#include "scheduler.h"
 #include "shell.h"
+#include "workqueue.h"
+#include "rcu.h"
+#include "smp.h"
 #include "syscall.h"
 #include "thread.h"
 #include "tss.h"
@@ -34,6 +39,7 @@
 #include "elf.h"
 #include "image.h" // Include image.h
 #include "isr.h" // For timer_get_ticks() 
+#include "vdso.h"
 
 
 // Limine Requests with order guarantees
@@ -45,6 +51,7 @@ __attribute__((used, section(".limine_reqs"))) static volatile struct limine_hhd
 __attribute__((used, section(".limine_reqs"))) static volatile struct limine_kernel_address_request kernel_address_request = {.id = LIMINE_KERNEL_ADDRESS_REQUEST, .revision = 0};
 uint64_t hhdm_offset = 0;
 __attribute__((used, section(".limine_reqs"))) static volatile struct limine_module_request module_request = {.id = LIMINE_MODULE_REQUEST, .revision = 0};
+__attribute__((used, section(".limine_reqs"))) static volatile struct limine_smp_request smp_request = {.id = LIMINE_SMP_REQUEST, .revision = 0, .flags = 0};
 __attribute__((used, section(".limine_reqs_end"))) static volatile LIMINE_REQUESTS_END_MARKER;
 
 // Kernel entry point
@@ -52,6 +59,9 @@ void kmain_x64(void) {
   // --- FORCE PANIC FOR TESTING ---
   // __asm__ __volatile__("int $0x00"); // This will trigger a divide-by-zero error
 
+  // Per-CPU data has to be reachable before anything takes a spinlock
+  smp_early_init();
+
   serial_print("KMAIN: before log_init()\n");
   log_init(); // Serial only, VGA cleared by console_clear after HHDM set. 
   serial_print("KMAIN: after log_init()\n");
@@ -98,6 +108,10 @@ void kmain_x64(void) {
     serial_print("KMAIN: before thread_init()\n");
     thread_init(); // Basic thread system initialization
     serial_print("KMAIN: after thread_init()\n");
+    serial_print("KMAIN: before workqueue_init()\n");
+    workqueue_init(); // Worker threads for deferred IRQ work
+    serial_print("KMAIN: after workqueue_init()\n");
+    rcu_init(); // Grace periods and deferred frees for read-mostly lists
   }
   serial_print("KMAIN: after memmap_request check\n");
   
@@ -113,6 +127,14 @@ void kmain_x64(void) {
   tss_init();
   serial_print("KMAIN: after tss_init()\n");
 
+  serial_print("KMAIN: before fpu_init_cpu()\n");
+  fpu_init_cpu();
+  serial_print("KMAIN: after fpu_init_cpu()\n");
+
+  serial_print("KMAIN: before syscall_init_cpu()\n");
+  syscall_init_cpu();
+  serial_print("KMAIN: after syscall_init_cpu()\n");
+
   serial_print("KMAIN: before keyboard_init()\n");
   keyboard_init();
   serial_print("KMAIN: after keyboard_init()\n");
@@ -121,6 +143,10 @@ void kmain_x64(void) {
   timer_init(100);
   serial_print("KMAIN: after timer_init()\n");
 
+  serial_print("KMAIN: before vdso_init()\n");
+  vdso_init(); // Needs the calibrated clock
+  serial_print("KMAIN: after vdso_init()\n");
+
   serial_print("KMAIN: before vfs_init()\n");
   vfs_init();
   serial_print("KMAIN: after vfs_init()\n");
@@ -207,10 +233,20 @@ void kmain_x64(void) {
   dhcp_discover();
   serial_print("KMAIN: after dhcp_discover()\n");
 
+  serial_print("KMAIN: before smp_init()\n");
+  smp_init(smp_request.response);
+  serial_print("KMAIN: after smp_init()\n");
+
   serial_print("KMAIN: before starting shell_main as a kernel thread\n");
-  thread_create(shell_main, NULL);
+  thread_t *shell_thread = thread_create(shell_main, NULL);
+  if (shell_thread) {
+    thread_set_name(shell_thread, "shell");
+  }
   serial_print("KMAIN: after starting shell_main as a kernel thread\n");
   
   __asm__ __volatile__("sti"); // Enable interrupts only if necessary services are started
   klog(LOG_INFO, "Interrupts Enabled.");
+
+  // kmain's thread is the BSP's idle thread from here on
+  scheduler_idle_loop();
 }
@@ -3,6 +3,7 @@
 #include "isr.h"
 #include "log.h" // Added
 #include "port_io.h"
+#include "workqueue.h"
 #include <stdbool.h>
 
 // Basic US QWERTY scancode to ASCII map
@@ -23,10 +24,14 @@ bool keyboard_is_ctrl_pressed() {
     return ctrl_pressed;
 }
 
-static void keyboard_handler(struct registers *regs) {
-  (void)regs; // Suppress unused parameter warning
+// Scancodes from the IRQ handler waiting to be decoded. Single producer (the
+// IRQ handler) and single consumer (keyboard_work on system_wq).
+#define SCANCODE_RING_SIZE 128
+static uint8_t scancode_ring[SCANCODE_RING_SIZE];
+static volatile uint32_t scancode_head = 0; // Written by the IRQ handler
+static volatile uint32_t scancode_tail = 0; // Written by keyboard_work
 
-  uint8_t scancode = inb(0x60);
+static void keyboard_process(uint8_t scancode) {
   event_t event;
 
   // Handle modifier keys
@@ -49,4 +54,29 @@ static void keyboard_handler(struct registers *regs) {
   event_push(event);
 }
 
+static void keyboard_work_fn(void *arg) {
+  (void)arg;
+  uint32_t tail = scancode_tail;
+  while (tail != __atomic_load_n(&scancode_head, __ATOMIC_ACQUIRE)) {
+    keyboard_process(scancode_ring[tail % SCANCODE_RING_SIZE]);
+    tail++;
+    __atomic_store_n(&scancode_tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
+static work_t keyboard_work = WORK_INIT(keyboard_work_fn, NULL);
+
+static void keyboard_handler(struct registers *regs) {
+  (void)regs; // Suppress unused parameter warning
+
+  // Just take the byte off the controller, decoding happens in keyboard_work
+  uint8_t scancode = inb(0x60);
+  uint32_t head = scancode_head;
+  if (head - __atomic_load_n(&scancode_tail, __ATOMIC_ACQUIRE) < SCANCODE_RING_SIZE) {
+    scancode_ring[head % SCANCODE_RING_SIZE] = scancode;
+    __atomic_store_n(&scancode_head, head + 1, __ATOMIC_RELEASE);
+  }
+  schedule_work(&keyboard_work);
+}
+
 void keyboard_init() { register_irq_handler(1, keyboard_handler); }
\ No newline at end of file
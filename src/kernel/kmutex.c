@@ -0,0 +1,65 @@
+#include "kmutex.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "waitqueue.h"
+#include <stddef.h> // for NULL
+
+// A thread waiting for `mutex`. Lives on the waiter's stack.
+typedef struct kmutex_waiter {
+  wait_queue_entry_t wait; // First, so entries cast back to the waiter
+  kmutex_t *mutex;
+  int granted; // Set, and the entry unlinked, by the unlocking thread
+} kmutex_waiter_t;
+
+// Contention is rare, one queue for every mutex will do. Its lock also
+// guards the mutexes' fields.
+static wait_queue_t kmutex_queue = WAIT_QUEUE_INIT("kmutex");
+
+void kmutex_lock(kmutex_t *m) {
+  uint64_t flags = spin_lock_irqsave(&kmutex_queue.lock);
+  if (!m->locked) {
+    m->locked = 1;
+    spin_unlock_irqrestore(&kmutex_queue.lock, flags);
+    return;
+  }
+
+  thread_t *self = get_current_thread();
+  kmutex_waiter_t w;
+  wait_entry_init(&w.wait, self);
+  w.mutex = m;
+  w.granted = 0;
+  wait_queue_link(&kmutex_queue, &w.wait);
+  m->waiters++;
+  // Woken spuriously or not, only a handover ends the wait
+  while (!w.granted) {
+    self->state = THREAD_BLOCKED;
+    spin_unlock(&kmutex_queue.lock);
+    schedule();
+    spin_lock(&kmutex_queue.lock);
+  }
+  spin_unlock_irqrestore(&kmutex_queue.lock, flags);
+}
+
+void kmutex_unlock(kmutex_t *m) {
+  uint64_t flags = spin_lock_irqsave(&kmutex_queue.lock);
+  if (m->waiters == 0) {
+    m->locked = 0;
+    spin_unlock_irqrestore(&kmutex_queue.lock, flags);
+    return;
+  }
+
+  // New entries go to the head, so the oldest waiter is the last match.
+  // The mutex stays locked and passes to it.
+  kmutex_waiter_t *oldest = NULL;
+  for (wait_queue_entry_t *e = kmutex_queue.head; e; e = e->next) {
+    if (((kmutex_waiter_t *)e)->mutex == m) {
+      oldest = (kmutex_waiter_t *)e;
+    }
+  }
+  wait_queue_unlink(&kmutex_queue, &oldest->wait);
+  m->waiters--;
+  oldest->granted = 1;
+  // The waiter can't return before we drop the lock, the entry stays valid
+  oldest->wait.func(&oldest->wait, 0);
+  spin_unlock_irqrestore(&kmutex_queue.lock, flags);
+}
@@ -1,7 +1,11 @@
 #include "kyrofs.h"
 #include "heap.h"
+#include "kmutex.h"
 #include "kstring.h"
 #include "log.h"
+#include "preempt.h" // For cond_resched
+#include "rcu.h"
+#include "spinlock.h"
 #include "vfs.h"
 #include "fs_disk.h" // For fs_unmount
 #include <stddef.h>
@@ -11,12 +15,41 @@ typedef struct kyrofs_dirent {
   vfs_node_t node;
   struct vfs_node *parent; // Pointer to parent directory node
   struct kyrofs_dirent *next;
+  uint32_t refs;  // The link from its directory, plus one per open descriptor
+  rcu_head_t rcu; // Deferred free once unlinked and closed
 } kyrofs_dirent_t;
 
+// Directory lists (a directory's node.ptr and the dirents' next pointers) are
+// read under rcu_read_lock(), so lookups never block on each other. Changes
+// to any list are serialized by kyrofs_lock.
+static spinlock_t kyrofs_lock = SPINLOCK_INIT("kyrofs");
+
+// Bumped to odd before a rename and to even after. A rename moves a dirent
+// (and its next pointer) to another list and rewrites its name, so a lookup
+// that overlapped one may have missed an entry and starts over.
+static volatile uint32_t kyrofs_rename_seq;
+
+static uint32_t kyrofs_read_begin() {
+  uint32_t seq;
+  while ((seq = __atomic_load_n(&kyrofs_rename_seq, __ATOMIC_ACQUIRE)) & 1) {
+    __asm__ __volatile__("pause");
+  }
+  return seq;
+}
+
+static int kyrofs_read_retry(uint32_t seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&kyrofs_rename_seq, __ATOMIC_RELAXED) != seq;
+}
+
+// A file's data. `lock` serializes reads, writes and truncation: copies
+// can be long and are preempted in between chunks, and a write may move
+// the content to a bigger buffer.
 typedef struct {
   uint8_t *content;
   uint32_t size;
   uint32_t capacity;
+  kmutex_t lock;
 } kyrofs_file_content_t;
 
 // Forward declarations
@@ -25,12 +58,17 @@ static int kyrofs_create(vfs_node_t *node, char *name, uint16_t mode);
 static int kyrofs_remove(vfs_node_t *node, char *name);
 static int kyrofs_rmdir(vfs_node_t *node, char *name, uint16_t mode);
 static int kyrofs_stat(vfs_node_t *node, struct stat *stat_buf);
+static int kyrofs_rename(vfs_node_t *old_dir, char *old_name, vfs_node_t *new_dir, char *new_name);
 static int kyrofs_ioctl(vfs_node_t *node, int request, void* argp);
+static void kyrofs_close(vfs_node_t *node);
 
 static void kyrofs_open(vfs_node_t *node, int flags) {
+    // Descriptors hold the node outside RCU, keep it until they're closed
+    __atomic_add_fetch(&((kyrofs_dirent_t *)node)->refs, 1, __ATOMIC_RELAXED);
     if (node->flags & VFS_FILE) {
         if (flags & O_TRUNC) {
             kyrofs_file_content_t *file_content = (kyrofs_file_content_t *)node->ptr;
+            kmutex_lock(&file_content->lock);
             // Free existing content if any
             if (file_content->content) {
                 kfree(file_content->content);
@@ -38,53 +76,133 @@ static void kyrofs_open(vfs_node_t *node, int flags) {
             // Reallocate initial capacity if needed, or just set to NULL and size 0
             file_content->content = NULL; // Mark as empty
             file_content->size = 0;
+            file_content->capacity = 0; // Nothing to write into until the next reserve
             node->length = 0;
             // Optionally reallocate with initial capacity if a non-zero capacity is desired on truncate
             // For now, it will be allocated on first write
+            kmutex_unlock(&file_content->lock);
         }
         // In a real FS, read/write flags might affect access checks.
         // For in-memory KyroFS, we allow read/write always once opened.
     }
 }
 
+// Files can be large and copies of them long. Copy in chunks with a
+// preemption point in between.
+#define KYROFS_COPY_CHUNK (64 * 1024)
+
+static void kyrofs_copy(uint8_t *dest, const uint8_t *src, size_t n) {
+  while (n > KYROFS_COPY_CHUNK) {
+    memcpy(dest, src, KYROFS_COPY_CHUNK);
+    dest += KYROFS_COPY_CHUNK;
+    src += KYROFS_COPY_CHUNK;
+    n -= KYROFS_COPY_CHUNK;
+    cond_resched();
+  }
+  memcpy(dest, src, n);
+}
+
 static uint32_t kyrofs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                             uint8_t *buffer) {
   kyrofs_file_content_t *file_content = (kyrofs_file_content_t *)node->ptr;
-  if (!file_content || !file_content->content) {
-      klog(LOG_ERROR, "kyrofs_read: Attempt to read from NULL file_content or content pointer.");
+  if (!file_content) {
+      klog(LOG_ERROR, "kyrofs_read: Attempt to read from NULL file_content pointer.");
       return 0;
   }
-  if (offset >= file_content->size)
-    return 0;
-  if (offset + size > file_content->size)
-    size = file_content->size - offset;
-  memcpy(buffer, file_content->content + offset, size);
+  kmutex_lock(&file_content->lock);
+  if (!file_content->content || offset >= file_content->size) {
+    size = 0; // Empty (truncated) or past the end
+  } else {
+    if (offset + size > file_content->size)
+      size = file_content->size - offset;
+    kyrofs_copy(buffer, file_content->content + offset, size);
+  }
+  kmutex_unlock(&file_content->lock);
   return size;
 }
 
-static uint32_t kyrofs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
-                             uint8_t *buffer) {
-  kyrofs_file_content_t *file_content = (kyrofs_file_content_t *)node->ptr;
-  if (offset + size > file_content->capacity) {
-    uint32_t new_cap = (offset + size) * 2;
+// Make room for `end` bytes, keeping the content, and zero what lies
+// between the current end and `start` so a write past EOF leaves no stale
+// heap data behind. -1 if the file would get too large or memory is short.
+// Holding file_content->lock.
+static int kyrofs_reserve(kyrofs_file_content_t *file_content, uint64_t start, uint64_t end) {
+  if (end > VFS_FILE_SIZE_MAX) {
+    return -1;
+  }
+  if (end > file_content->capacity) {
+    uint64_t new_cap = end * 2 > VFS_FILE_SIZE_MAX ? VFS_FILE_SIZE_MAX : end * 2;
     uint8_t *new_cont = (uint8_t *)kmalloc(new_cap);
     if (!new_cont) {
-        panic("kyrofs_write: kmalloc failed for new content buffer", NULL);
+      klog(LOG_ERROR, "kyrofs_reserve: kmalloc failed for %d bytes", (int)new_cap);
+      return -1;
     }
     if (file_content->content) {
-      memcpy(new_cont, file_content->content, file_content->size);
+      kyrofs_copy(new_cont, file_content->content, file_content->size);
       kfree(file_content->content);
     }
     file_content->content = new_cont;
-    file_content->capacity = new_cap;
+    file_content->capacity = (uint32_t)new_cap;
+  }
+  if (start > file_content->size) {
+    memset(file_content->content + file_content->size, 0, start - file_content->size);
   }
-  memcpy(file_content->content + offset, buffer, size);
+  return 0;
+}
+
+static uint32_t kyrofs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
+                             uint8_t *buffer) {
+  kyrofs_file_content_t *file_content = (kyrofs_file_content_t *)node->ptr;
+  kmutex_lock(&file_content->lock);
+  if (kyrofs_reserve(file_content, offset, offset + size) != 0) {
+    kmutex_unlock(&file_content->lock);
+    return (uint32_t)-1;
+  }
+  kyrofs_copy(file_content->content + offset, buffer, size);
   if (offset + size > file_content->size)
     file_content->size = offset + size;
   node->length = file_content->size;
+  kmutex_unlock(&file_content->lock);
   return size;
 }
 
+// Both files are in memory: copy from one content buffer straight into the
+// other
+static uint32_t kyrofs_copy_range(vfs_node_t *in, uint64_t off_in, vfs_node_t *out,
+                                  uint64_t off_out, uint32_t size) {
+  kyrofs_file_content_t *src = (kyrofs_file_content_t *)in->ptr;
+  kyrofs_file_content_t *dst = (kyrofs_file_content_t *)out->ptr;
+  // Two files: lock in address order
+  kyrofs_file_content_t *first = src < dst ? src : dst;
+  kyrofs_file_content_t *second = src < dst ? dst : src;
+  kmutex_lock(&first->lock);
+  if (second != first)
+    kmutex_lock(&second->lock);
+
+  uint32_t ret = size;
+  if (off_in >= src->size) {
+    ret = 0;
+  } else {
+    if (off_in + ret > src->size)
+      ret = src->size - off_in;
+    if (in == out && off_in < off_out + ret && off_out < off_in + ret) {
+      ret = (uint32_t)-1; // Overlapping ranges of one file
+    } else if (kyrofs_reserve(dst, off_out, off_out + ret) != 0) {
+      ret = (uint32_t)-1;
+    } else {
+      // The reserve may move the content, so take the source pointer after
+      kyrofs_copy(dst->content + off_out, src->content + off_in, ret);
+      if (off_out + ret > dst->size)
+        dst->size = off_out + ret;
+      out->length = dst->size;
+    }
+  }
+
+  if (second != first)
+    kmutex_unlock(&second->lock);
+  kmutex_unlock(&first->lock);
+  return ret;
+}
+
 static vfs_node_t *kyrofs_finddir(vfs_node_t *node, char *name) {
   if (strcmp(name, ".") == 0)
     return node;
@@ -98,28 +216,46 @@ static vfs_node_t *kyrofs_finddir(vfs_node_t *node, char *name) {
     return node; // Root returns self for ..
   }
 
-  kyrofs_dirent_t *current = (kyrofs_dirent_t *)node->ptr;
-  while (current) {
-    if (strcmp(current->node.name, name) == 0)
-      return &current->node;
-    current = current->next;
-  }
-  return NULL;
+  vfs_node_t *found;
+  uint32_t seq;
+  do {
+    seq = kyrofs_read_begin();
+    found = NULL;
+    rcu_read_lock();
+    kyrofs_dirent_t *current = rcu_dereference(node->ptr);
+    while (current) {
+      if (strcmp(current->node.name, name) == 0) {
+        found = &current->node;
+        break;
+      }
+      current = rcu_dereference(current->next);
+    }
+    rcu_read_unlock();
+  } while (kyrofs_read_retry(seq));
+  return found;
 }
 
 static int kyrofs_readdir(vfs_node_t *node, uint32_t index, struct dirent *dir_entry) {
-  kyrofs_dirent_t *current = (kyrofs_dirent_t *)node->ptr;
-  uint32_t i = 0;
-  while (current && i < index) {
-    current = current->next;
-    i++;
-  }
-  if (current) {
-    strncpy(dir_entry->name, current->node.name, MAX_FILENAME_LEN);
-    dir_entry->ino = current->node.inode;
-    return 1; // Success
-  }
-  return 0; // End of directory or invalid index
+  int ret;
+  uint32_t seq;
+  do {
+    seq = kyrofs_read_begin();
+    ret = 0; // End of directory or invalid index
+    rcu_read_lock();
+    kyrofs_dirent_t *current = rcu_dereference(node->ptr);
+    uint32_t i = 0;
+    while (current && i < index) {
+      current = rcu_dereference(current->next);
+      i++;
+    }
+    if (current) {
+      strncpy(dir_entry->name, current->node.name, MAX_FILENAME_LEN);
+      dir_entry->ino = current->node.inode;
+      ret = 1; // Success
+    }
+    rcu_read_unlock();
+  } while (kyrofs_read_retry(seq));
+  return ret;
 }
 
 static int kyrofs_create_node(vfs_node_t *parent, char *name, uint32_t flags) {
@@ -130,6 +266,9 @@ static int kyrofs_create_node(vfs_node_t *parent, char *name, uint32_t flags) {
   memset(new_de, 0, sizeof(kyrofs_dirent_t));
   strncpy(new_de->node.name, name, MAX_FILENAME_LEN);
   new_de->node.flags = flags;
+  new_de->refs = 1;
+  new_de->node.open = kyrofs_open;
+  new_de->node.close = kyrofs_close;
 
   if (flags & VFS_FILE) {
     kyrofs_file_content_t *content =
@@ -139,6 +278,7 @@ static int kyrofs_create_node(vfs_node_t *parent, char *name, uint32_t flags) {
     }
     content->size = 0;
     content->capacity = 128;
+    kmutex_init(&content->lock);
     content->content = (uint8_t *)kmalloc(content->capacity);
     if (!content->content) {
         panic("kyrofs_create_node: kmalloc failed for initial file buffer", NULL);
@@ -146,7 +286,8 @@ static int kyrofs_create_node(vfs_node_t *parent, char *name, uint32_t flags) {
     new_de->node.ptr = content;
     new_de->node.read = kyrofs_read;
     new_de->node.write = kyrofs_write;
-    new_de->node.open = kyrofs_open; // Assign the open function
+    new_de->node.stat = kyrofs_stat;
+    new_de->node.copy_range = kyrofs_copy_range;
   } else {
     new_de->node.ptr = NULL; // Head of dirent list for this dir
     new_de->node.finddir = kyrofs_finddir;
@@ -156,16 +297,57 @@ static int kyrofs_create_node(vfs_node_t *parent, char *name, uint32_t flags) {
     new_de->node.remove = kyrofs_remove;
     new_de->node.rmdir = kyrofs_rmdir; // Assign new rmdir function
     new_de->node.stat = kyrofs_stat; // Assign new stat function
+    new_de->node.rename = kyrofs_rename;
     new_de->node.ioctl = kyrofs_ioctl; // Assign new ioctl function
   }
 
   new_de->parent = parent;
-  // Link into parent
+  // Link into parent. The dirent is fully set up before it is published.
+  uint64_t irq_flags = spin_lock_irqsave(&kyrofs_lock);
   new_de->next = (kyrofs_dirent_t *)parent->ptr;
-  parent->ptr = new_de;
+  rcu_assign_pointer(parent->ptr, (void *)new_de);
+  spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
   return 0;
 }
 
+static void kyrofs_free_dirent(rcu_head_t *head) {
+  kyrofs_dirent_t *de = rcu_container_of(head, kyrofs_dirent_t, rcu);
+  if (de->node.flags & VFS_FILE) {
+    kyrofs_file_content_t *content = (kyrofs_file_content_t *)de->node.ptr;
+    if (content->content)
+      kfree(content->content);
+    kfree(content);
+  }
+  kfree(de);
+}
+
+static void kyrofs_put(kyrofs_dirent_t *de) {
+  if (__atomic_sub_fetch(&de->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    // Lookups that already reached it finish before it is freed
+    call_rcu(&de->rcu, kyrofs_free_dirent);
+  }
+}
+
+static void kyrofs_close(vfs_node_t *node) {
+  kyrofs_put((kyrofs_dirent_t *)node);
+}
+
+// Mount points are kyrofs directories whose ops belong to the mounted
+// filesystem: they look empty, but can't be removed or replaced.
+static int kyrofs_busy(kyrofs_dirent_t *de) {
+  return (de->node.flags & VFS_MOUNTPOINT) != 0;
+}
+
+// Unlink `current` from `node`'s list. Caller holds kyrofs_lock.
+static void kyrofs_unlink_locked(vfs_node_t *node, kyrofs_dirent_t *prev,
+                                 kyrofs_dirent_t *current) {
+  if (prev) {
+    rcu_assign_pointer(prev->next, current->next);
+  } else {
+    rcu_assign_pointer(node->ptr, (void *)current->next);
+  }
+}
+
 static int kyrofs_mkdir(vfs_node_t *node, char *name, uint16_t mode) {
   (void)mode;
   return kyrofs_create_node(node, name, VFS_DIRECTORY);
@@ -177,69 +359,139 @@ static int kyrofs_create(vfs_node_t *node, char *name, uint16_t mode) {
 }
 
 static int kyrofs_remove(vfs_node_t *node, char *name) {
+  uint64_t irq_flags = spin_lock_irqsave(&kyrofs_lock);
   kyrofs_dirent_t *current = (kyrofs_dirent_t *)node->ptr;
   kyrofs_dirent_t *prev = NULL;
 
   while (current) {
     if (strcmp(current->node.name, name) == 0) {
-      if ((current->node.flags & VFS_DIRECTORY) && current->node.ptr != NULL) {
-        // Directory is not empty
+      if (((current->node.flags & VFS_DIRECTORY) && current->node.ptr != NULL) ||
+          kyrofs_busy(current)) {
+        // Directory is not empty, or something is mounted on it
+        spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
         return -1; 
       }
 
-      if (prev) {
-        prev->next = current->next;
-      } else {
-        node->ptr = current->next;
-      }
-
-      if (current->node.flags & VFS_FILE) {
-        kyrofs_file_content_t *content =
-            (kyrofs_file_content_t *)current->node.ptr;
-        if (content->content)
-          kfree(content->content);
-        kfree(content);
-      }
-      kfree(current);
+      kyrofs_unlink_locked(node, prev, current);
+      spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+      kyrofs_put(current);
       return 0;
     }
     prev = current;
     current = current->next;
   }
+  spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
   return -1;
 }
 
 static int kyrofs_rmdir(vfs_node_t *node, char *name, uint16_t mode) {
     (void)mode; // Unused for now
+    uint64_t irq_flags = spin_lock_irqsave(&kyrofs_lock);
     kyrofs_dirent_t *current = (kyrofs_dirent_t *)node->ptr;
     kyrofs_dirent_t *prev = NULL;
 
     while (current) {
         if (strcmp(current->node.name, name) == 0) {
-            if (!(current->node.flags & VFS_DIRECTORY)) {
-                return -1; // Not a directory
-            }
-            if (((kyrofs_dirent_t*)current->node.ptr) != NULL) { // Check if directory has contents
-                return -1; // Directory is not empty
+            if (!(current->node.flags & VFS_DIRECTORY) ||
+                ((kyrofs_dirent_t*)current->node.ptr) != NULL || kyrofs_busy(current)) {
+                // Not a directory, not empty, or something is mounted on it
+                spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+                return -1;
             }
 
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                node->ptr = current->next;
-            }
-            kfree(current);
+            kyrofs_unlink_locked(node, prev, current);
+            spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+            kyrofs_put(current);
             return 0;
         }
         prev = current;
         current = current->next;
     }
+    spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
     return -1; // Directory not found
 }
 
+// Entry `name` of `dir` and the one before it. Caller holds kyrofs_lock.
+static kyrofs_dirent_t *kyrofs_find_locked(vfs_node_t *dir, const char *name,
+                                           kyrofs_dirent_t **prev_out) {
+  kyrofs_dirent_t *prev = NULL;
+  for (kyrofs_dirent_t *current = (kyrofs_dirent_t *)dir->ptr; current; current = current->next) {
+    if (strcmp(current->node.name, name) == 0) {
+      *prev_out = prev;
+      return current;
+    }
+    prev = current;
+  }
+  return NULL;
+}
+
+// Relink the dirent: open descriptors keep pointing at the same node, and
+// the file's content isn't touched.
+static int kyrofs_rename(vfs_node_t *old_dir, char *old_name, vfs_node_t *new_dir, char *new_name) {
+  if (strlen(new_name) >= MAX_FILENAME_LEN) {
+    return -1;
+  }
+  uint64_t irq_flags = spin_lock_irqsave(&kyrofs_lock);
+  kyrofs_dirent_t *prev, *target_prev;
+  kyrofs_dirent_t *src = kyrofs_find_locked(old_dir, old_name, &prev);
+  if (!src || kyrofs_busy(src)) {
+    spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+    return -1;
+  }
+  int is_dir = (src->node.flags & VFS_DIRECTORY) != 0;
+  if (is_dir) {
+    // A directory can't go below itself
+    kyrofs_dirent_t *d = (kyrofs_dirent_t *)new_dir;
+    for (;;) {
+      if (d == src) {
+        spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+        return -1;
+      }
+      if (!d->parent || d->parent == &d->node) {
+        break; // Reached the root
+      }
+      d = (kyrofs_dirent_t *)d->parent;
+    }
+  }
+  kyrofs_dirent_t *target = kyrofs_find_locked(new_dir, new_name, &target_prev);
+  if (target == src) {
+    spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+    return 0; // Renamed onto itself
+  }
+  if (target && (is_dir != ((target->node.flags & VFS_DIRECTORY) != 0) ||
+                 (is_dir && target->node.ptr != NULL) || kyrofs_busy(target))) {
+    // Only a file replaces a file, and a directory an empty directory that
+    // nothing is mounted on
+    spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+    return -1;
+  }
+
+  __atomic_store_n(&kyrofs_rename_seq, kyrofs_rename_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  if (target) {
+    kyrofs_unlink_locked(new_dir, target_prev, target);
+    if (prev == target) {
+      prev = target_prev; // Target was right before src
+    }
+  }
+  kyrofs_unlink_locked(old_dir, prev, src);
+  strncpy(src->node.name, new_name, MAX_FILENAME_LEN);
+  src->parent = new_dir;
+  src->next = (kyrofs_dirent_t *)new_dir->ptr;
+  rcu_assign_pointer(new_dir->ptr, (void *)src);
+  __atomic_store_n(&kyrofs_rename_seq, kyrofs_rename_seq + 1, __ATOMIC_RELEASE);
+  spin_unlock_irqrestore(&kyrofs_lock, irq_flags);
+
+  if (target) {
+    kyrofs_put(target); // Freed once any descriptors on it are closed
+  }
+  return 0;
+}
+
 static int kyrofs_stat(vfs_node_t *node, struct stat *stat_buf) {
-    (void)node;
-    (void)stat_buf;
+    stat_buf->st_size = node->length;
+    stat_buf->st_mode = ((node->flags & VFS_DIRECTORY) ? S_IFDIR : S_IFREG) | 0755;
+    stat_buf->st_ino = node->inode;
     return 0;
 }
 
@@ -306,8 +558,11 @@ void kyrofs_init() {
   root_node->node.remove = kyrofs_remove;
   root_node->node.rmdir = kyrofs_rmdir; // Assign new rmdir function
   root_node->node.stat = kyrofs_stat; // Assign stat function
+  root_node->node.rename = kyrofs_rename;
   root_node->node.ioctl = kyrofs_ioctl; // Assign new ioctl function
   root_node->node.open = kyrofs_open; // Assign the open function
+  root_node->node.close = kyrofs_close;
+  root_node->refs = 1; // Never unlinked
   root_node->node.ptr = NULL;
   root_node->parent = &root_node->node; // Root's parent is root
 
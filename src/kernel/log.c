@@ -10,6 +10,7 @@
 #include "fb.h" // For framebuffer operations
 #include "font.h" // For font dimensions and glyphs
 #include "panic_screen.h"
+#include "spinlock.h"
 
 // Default colors for framebuffer output
 #define FB_DEFAULT_FG_COLOR 0xFFFFFFFF // White
@@ -25,6 +26,8 @@ uint32_t console_y = 0;
 static char log_history[LOG_HISTORY_SIZE][LOG_MESSAGE_MAX_LEN];
 static uint32_t log_history_idx = 0;
 static bool log_history_full = false;
+// Keeps lines from different CPUs from interleaving
+static spinlock_t log_lock = SPINLOCK_INIT("log");
 
 // --- Serial Functions ---
 
@@ -145,6 +148,8 @@ void klog(log_level_t level, const char *fmt, ...) {
         log_buffer[len] = '\0';
     }
     
+    uint64_t flags = spin_lock_irqsave(&log_lock);
+
     // Store in circular buffer
     strncpy(log_history[log_history_idx], log_buffer, LOG_MESSAGE_MAX_LEN - 1);
     log_history[log_history_idx][LOG_MESSAGE_MAX_LEN - 1] = '\0'; // Ensure null termination
@@ -180,6 +185,8 @@ void klog(log_level_t level, const char *fmt, ...) {
     klog_print_str("] ");
     klog_print_str(log_buffer);
     klog_print_str("\n");
+
+    spin_unlock_irqrestore(&log_lock, flags);
 }
 
 void log_get_entries(char* entries, int* count, int num_to_get) {
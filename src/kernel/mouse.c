@@ -4,6 +4,7 @@
 #include "isr.h"
 #include "log.h"
 #include "port_io.h"
+#include "workqueue.h"
 
 #define KBC_STATUS_PORT 0x64
 #define KBC_CMD_PORT 0x64
@@ -42,7 +43,75 @@ static uint8_t mouse_read() {
   return inb(KBC_DATA_PORT);
 }
 
-// The main IRQ12 handler
+// Complete 3-byte packets from the IRQ handler, decoded by mouse_work on
+// system_wq. Single producer, single consumer.
+#define MOUSE_RING_SIZE 64
+static int8_t packet_ring[MOUSE_RING_SIZE][3];
+static volatile uint32_t packet_head = 0; // Written by the IRQ handler
+static volatile uint32_t packet_tail = 0; // Written by mouse_work
+
+static void mouse_process(const int8_t packet[3]) {
+  int8_t delta_x = packet[1];
+  int8_t delta_y = packet[2];
+
+  if (packet[0] & 0x20)
+    delta_y = -delta_y;
+  if (packet[0] & 0x10)
+    delta_x = -delta_x;
+
+  mouse_x += delta_x;
+  mouse_y -= delta_y;
+
+  const fb_info_t *info = fb_get_info();
+  if (mouse_x < 0)
+    mouse_x = 0;
+  if (mouse_y < 0)
+    mouse_y = 0;
+  if (info) {
+    if (mouse_x >= (int32_t)info->width)
+      mouse_x = info->width - 1;
+    if (mouse_y >= (int32_t)info->height)
+      mouse_y = info->height - 1;
+  }
+
+  event_t event;
+  event.type = EVENT_MOUSE_MOVE;
+  event.data1 = mouse_x;
+  event.data2 = mouse_y;
+  event_push(event);
+
+  // Button presses
+  uint8_t current_button_state = packet[0] & 0x07;
+  if (current_button_state != last_button_state) {
+    event_t btn_event;
+    // Check left button
+    if ((current_button_state & 1) && !(last_button_state & 1)) {
+      btn_event.type = EVENT_MOUSE_DOWN;
+      btn_event.data1 = 1;
+      event_push(btn_event);
+    } else if (!(current_button_state & 1) && (last_button_state & 1)) {
+      btn_event.type = EVENT_MOUSE_UP;
+      btn_event.data1 = 1;
+      event_push(btn_event);
+    }
+    // TODO: Check other buttons (right, middle)
+    last_button_state = current_button_state;
+  }
+}
+
+static void mouse_work_fn(void *arg) {
+  (void)arg;
+  uint32_t tail = packet_tail;
+  while (tail != __atomic_load_n(&packet_head, __ATOMIC_ACQUIRE)) {
+    mouse_process(packet_ring[tail % MOUSE_RING_SIZE]);
+    tail++;
+    __atomic_store_n(&packet_tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
+static work_t mouse_work = WORK_INIT(mouse_work_fn, NULL);
+
+// The main IRQ12 handler. Only assembles packets, mouse_work does the rest.
 void mouse_handler(struct registers *regs) {
   (void)regs; // Suppress unused parameter warning
 
@@ -61,58 +130,22 @@ void mouse_handler(struct registers *regs) {
     mouse_byte[1] = inb(MOUSE_DATA_PORT);
     mouse_cycle++;
     break;
-  case 2:
+  case 2: {
     mouse_byte[2] = inb(MOUSE_DATA_PORT);
     mouse_cycle = 0;
 
-    int8_t delta_x = mouse_byte[1];
-    int8_t delta_y = mouse_byte[2];
-
-    if (mouse_byte[0] & 0x20)
-      delta_y = -delta_y;
-    if (mouse_byte[0] & 0x10)
-      delta_x = -delta_x;
-
-    mouse_x += delta_x;
-    mouse_y -= delta_y;
-
-    const fb_info_t *info = fb_get_info();
-    if (mouse_x < 0)
-      mouse_x = 0;
-    if (mouse_y < 0)
-      mouse_y = 0;
-    if (info) {
-      if (mouse_x >= (int32_t)info->width)
-        mouse_x = info->width - 1;
-      if (mouse_y >= (int32_t)info->height)
-        mouse_y = info->height - 1;
-    }
-
-    event_t event;
-    event.type = EVENT_MOUSE_MOVE;
-    event.data1 = mouse_x;
-    event.data2 = mouse_y;
-    event_push(event);
-
-    // Button presses
-    uint8_t current_button_state = mouse_byte[0] & 0x07;
-    if (current_button_state != last_button_state) {
-      event_t btn_event;
-      // Check left button
-      if ((current_button_state & 1) && !(last_button_state & 1)) {
-        btn_event.type = EVENT_MOUSE_DOWN;
-        btn_event.data1 = 1;
-        event_push(btn_event);
-      } else if (!(current_button_state & 1) && (last_button_state & 1)) {
-        btn_event.type = EVENT_MOUSE_UP;
-        btn_event.data1 = 1;
-        event_push(btn_event);
-      }
-      // TODO: Check other buttons (right, middle)
-      last_button_state = current_button_state;
+    uint32_t head = packet_head;
+    if (head - __atomic_load_n(&packet_tail, __ATOMIC_ACQUIRE) < MOUSE_RING_SIZE) {
+      int8_t *slot = packet_ring[head % MOUSE_RING_SIZE];
+      slot[0] = mouse_byte[0];
+      slot[1] = mouse_byte[1];
+      slot[2] = mouse_byte[2];
+      __atomic_store_n(&packet_head, head + 1, __ATOMIC_RELEASE);
     }
+    schedule_work(&mouse_work);
     break;
   }
+  }
 }
 
 void mouse_init() {
@@ -1,6 +1,7 @@
 #include "pmm.h"
 #include "kstring.h"
 #include "log.h"
+#include "spinlock.h"
 // #include "stivale2.h"
 
 static uint8_t *pmm_bitmap = NULL;
@@ -9,6 +10,7 @@ static uint64_t pmm_usable_pages = 0;
 static uint64_t pmm_allocated_pages = 0; // NEW: track actual allocations
 static uint64_t pmm_last_free_page = 0;
 static uint64_t pmm_hhdm_offset = 0;
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm");
 
 // External symbols from linker script are still useful for marking the kernel
 // itself.
@@ -96,11 +98,13 @@ void pmm_init(struct limine_memmap_response *mmap_response, uint64_t offset) {
 }
 
 void *pmm_alloc_page() {
+  uint64_t flags = spin_lock_irqsave(&pmm_lock);
   for (uint64_t i = pmm_last_free_page; i < pmm_total_pages; i++) {
     if (!pmm_bitmap_test(i)) {
       pmm_bitmap_set(i);
       pmm_allocated_pages++; // Track allocation
       pmm_last_free_page = i + 1;
+      spin_unlock_irqrestore(&pmm_lock, flags);
       return (void *)(i * PAGE_SIZE);
     }
   }
@@ -111,9 +115,11 @@ void *pmm_alloc_page() {
       pmm_bitmap_set(i);
       pmm_allocated_pages++; // Track allocation
       pmm_last_free_page = i + 1;
+      spin_unlock_irqrestore(&pmm_lock, flags);
       return (void *)(i * PAGE_SIZE);
     }
   }
+  spin_unlock_irqrestore(&pmm_lock, flags);
 
   klog(LOG_WARN, "PMM: Out of physical memory!");
   return NULL;
@@ -125,6 +131,7 @@ void *pmm_alloc_pages(size_t count) {
   if (count == 1)
     return pmm_alloc_page();
 
+  uint64_t flags = spin_lock_irqsave(&pmm_lock);
   for (uint64_t i = 0; i <= pmm_total_pages - count; i++) {
     int found = 1;
     for (uint64_t j = 0; j < count; j++) {
@@ -140,9 +147,11 @@ void *pmm_alloc_pages(size_t count) {
         pmm_bitmap_set(i + j);
       }
       pmm_allocated_pages += count; // Track allocations
+      spin_unlock_irqrestore(&pmm_lock, flags);
       return (void *)(i * PAGE_SIZE);
     }
   }
+  spin_unlock_irqrestore(&pmm_lock, flags);
 
   klog(LOG_WARN, "PMM: Out of contiguous physical memory!");
   return NULL;
@@ -151,6 +160,7 @@ void *pmm_alloc_pages(size_t count) {
 void pmm_free_page(void *p) {
   uint64_t page_index = (uint64_t)p / PAGE_SIZE;
   if (page_index < pmm_total_pages) {
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
     if (pmm_bitmap_test(page_index)) { // Only decrement if it was allocated
       pmm_bitmap_unset(page_index);
       pmm_allocated_pages--; // Track deallocation
@@ -158,6 +168,7 @@ void pmm_free_page(void *p) {
         pmm_last_free_page = page_index;
       }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
   } else {
     klog(LOG_WARN, "PMM: Attempted to free an invalid physical page.");
   }
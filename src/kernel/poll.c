@@ -0,0 +1,515 @@
+#include "poll.h"
+#include "clock.h"
+#include "cpu.h" // For rdtsc
+#include "event.h"
+#include "fdtable.h"
+#include "heap.h"
+#include "io_ring.h"
+#include "kstring.h"
+#include "log.h"
+#include "scheduler.h"
+#include "socket.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "uaccess.h"
+#include "waitqueue.h"
+#include <stdbool.h>
+#include <stddef.h> // for NULL
+
+// One registered descriptor. Its wait entry sits on the descriptor's wait
+// queue and puts the item on the ready list when an event it cares about
+// happens; epoll_wait() only looks at the ready list.
+typedef struct epoll_item {
+  struct epoll *ep;
+  int fd;
+  fd_entry_t *file; // Reference held while registered
+  uint32_t events;  // EPOLL* asked for, EPOLLET included
+  uint64_t data;
+  wait_queue_t *wq; // File's wait queue, NULL for files that are always ready
+  wait_queue_entry_t wait;
+  int ready; // On the ready list
+  struct epoll_item *next;
+  struct epoll_item *ready_next;
+} epoll_item_t;
+
+typedef struct epoll {
+  spinlock_t ctl_lock; // Serializes epoll_ctl(), taken before the others
+  spinlock_t lock;     // Protects the lists, taken from wait queue callbacks
+  epoll_item_t *items;
+  epoll_item_t *ready_head;
+  epoll_item_t *ready_tail;
+  wait_queue_t wq; // Threads in epoll_wait(), pollers of the descriptor
+} epoll_t;
+
+static wait_queue_t *fd_wait_queue(fd_entry_t *f) {
+  switch (f->type) {
+  case FD_TYPE_SOCKET:
+    return &f->data.sock->wq;
+  case FD_TYPE_IORING:
+    return io_ring_wait_queue(f->data.ring);
+  case FD_TYPE_INPUT:
+    return event_wait_queue();
+  case FD_TYPE_EPOLL:
+    return &f->data.ep->wq;
+  default:
+    return NULL;
+  }
+}
+
+uint32_t fd_poll(fd_entry_t *f) {
+  switch (f->type) {
+  case FD_TYPE_FILE:
+    return POLLIN | POLLOUT; // Reads and writes never wait
+  case FD_TYPE_SOCKET:
+    return sock_poll(f->data.sock);
+  case FD_TYPE_IORING:
+    return io_ring_poll(f->data.ring);
+  case FD_TYPE_INPUT:
+    return event_pending() ? POLLIN : 0;
+  case FD_TYPE_EPOLL:
+    return __atomic_load_n(&f->data.ep->ready_head, __ATOMIC_RELAXED) ? POLLIN : 0;
+  default:
+    return POLLERR;
+  }
+}
+
+// Block until check(arg) returns non-zero or `timeout_ms` pass (< 0: no
+// timeout, 0: check once). The caller's wait entries are queued already, so
+// a wakeup between the check and blocking isn't lost. Returns the last check.
+static int wait_event(int (*check)(void *arg), void *arg, int timeout_ms) {
+  thread_t *self = get_current_thread();
+  uint64_t deadline = 0;
+  if (timeout_ms > 0) {
+    deadline = rdtsc() + clock_ns_to_tsc((uint64_t)timeout_ms * 1000000ULL);
+  }
+  for (;;) {
+    uint64_t flags = local_irq_save();
+    // Blocked before checking: a wake_up() from here on makes us runnable
+    self->state = THREAD_BLOCKED;
+    int n = check(arg);
+    if (n != 0 || timeout_ms == 0 || (timeout_ms > 0 && rdtsc() >= deadline)) {
+      thread_state_t expected = THREAD_BLOCKED;
+      if (!__atomic_compare_exchange_n(&self->state, &expected, THREAD_RUNNING, false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        schedule(); // Somebody woke us already, we're READY and queued
+      }
+      local_irq_restore(flags);
+      return n;
+    }
+    if (timeout_ms < 0) {
+      schedule();
+    } else {
+      scheduler_block_until(deadline);
+    }
+    local_irq_restore(flags);
+  }
+}
+
+// --- poll ---
+
+typedef struct {
+  fd_entry_t *file; // NULL if the descriptor isn't open or is ignored
+  wait_queue_t *wq;
+  wait_queue_entry_t wait;
+} poll_slot_t;
+
+typedef struct {
+  pollfd_t *fds; // Kernel copy
+  poll_slot_t *slots;
+  uint32_t nfds;
+} poll_ctx_t;
+
+static int poll_check(void *arg) {
+  poll_ctx_t *ctx = (poll_ctx_t *)arg;
+  int count = 0;
+  for (uint32_t i = 0; i < ctx->nfds; i++) {
+    pollfd_t *p = &ctx->fds[i];
+    uint32_t revents = 0;
+    if (p->fd >= 0) {
+      revents = ctx->slots[i].file
+                    ? fd_poll(ctx->slots[i].file) & ((uint16_t)p->events | POLLERR | POLLHUP)
+                    : POLLNVAL;
+    }
+    p->revents = (int16_t)revents;
+    if (revents) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int ksys_poll(pollfd_t *user_fds, uint32_t nfds, int timeout_ms) {
+  if (nfds > POLL_MAX_FDS) {
+    return -1;
+  }
+  poll_ctx_t ctx;
+  ctx.nfds = nfds;
+  ctx.fds = (pollfd_t *)kmalloc((nfds ? nfds : 1) * sizeof(pollfd_t));
+  ctx.slots = (poll_slot_t *)kmalloc((nfds ? nfds : 1) * sizeof(poll_slot_t));
+  if (!ctx.fds || !ctx.slots) {
+    kfree(ctx.fds);
+    kfree(ctx.slots);
+    return -1;
+  }
+  if (copy_from_user(ctx.fds, user_fds, nfds * sizeof(pollfd_t)) != 0) {
+    kfree(ctx.fds);
+    kfree(ctx.slots);
+    return -1;
+  }
+
+  thread_t *self = get_current_thread();
+  for (uint32_t i = 0; i < nfds; i++) {
+    poll_slot_t *slot = &ctx.slots[i];
+    slot->file = ctx.fds[i].fd >= 0 ? fd_get(self->files, ctx.fds[i].fd) : NULL;
+    slot->wq = slot->file ? fd_wait_queue(slot->file) : NULL;
+    if (slot->wq) {
+      wait_entry_init(&slot->wait, self);
+      wait_queue_add(slot->wq, &slot->wait);
+    }
+  }
+
+  int n = wait_event(poll_check, &ctx, timeout_ms);
+
+  for (uint32_t i = 0; i < nfds; i++) {
+    poll_slot_t *slot = &ctx.slots[i];
+    if (slot->wq) {
+      wait_queue_remove(slot->wq, &slot->wait);
+    }
+    fd_put(slot->file);
+  }
+  if (copy_to_user(user_fds, ctx.fds, nfds * sizeof(pollfd_t)) != 0) {
+    n = -1;
+  }
+  kfree(ctx.fds);
+  kfree(ctx.slots);
+  return n;
+}
+
+// --- epoll ---
+
+// Caller holds ep->lock
+static void ready_add(epoll_t *ep, epoll_item_t *item) {
+  if (item->ready) {
+    return;
+  }
+  item->ready = 1;
+  item->ready_next = NULL;
+  if (ep->ready_tail) {
+    ep->ready_tail->ready_next = item;
+  } else {
+    ep->ready_head = item;
+  }
+  ep->ready_tail = item;
+}
+
+// Caller holds ep->lock
+static void ready_remove(epoll_t *ep, epoll_item_t *item) {
+  if (!item->ready) {
+    return;
+  }
+  epoll_item_t *prev = NULL;
+  for (epoll_item_t *it = ep->ready_head; it; prev = it, it = it->ready_next) {
+    if (it == item) {
+      if (prev) {
+        prev->ready_next = it->ready_next;
+      } else {
+        ep->ready_head = it->ready_next;
+      }
+      if (ep->ready_tail == it) {
+        ep->ready_tail = prev;
+      }
+      break;
+    }
+  }
+  item->ready = 0;
+  item->ready_next = NULL;
+}
+
+// Wait queue callback: the watched descriptor changed
+static void epoll_callback(wait_queue_entry_t *entry, uint32_t events) {
+  epoll_item_t *item = (epoll_item_t *)entry->private;
+  if (!(events & (item->events | POLLERR | POLLHUP))) {
+    return;
+  }
+  epoll_t *ep = item->ep;
+  spin_lock(&ep->lock); // Interrupts are off already
+  ready_add(ep, item);
+  spin_unlock(&ep->lock);
+  wake_up(&ep->wq, POLLIN);
+}
+
+// Queue `item` if its descriptor is ready right now. Caller holds ctl_lock.
+static void epoll_check_now(epoll_t *ep, epoll_item_t *item) {
+  uint64_t flags = spin_lock_irqsave(&ep->lock);
+  int ready = (fd_poll(item->file) & (item->events | POLLERR | POLLHUP)) != 0;
+  if (ready) {
+    ready_add(ep, item);
+  }
+  spin_unlock_irqrestore(&ep->lock, flags);
+  if (ready) {
+    wake_up(&ep->wq, POLLIN);
+  }
+}
+
+int ksys_epoll_create() {
+  epoll_t *ep = (epoll_t *)kmalloc(sizeof(epoll_t));
+  if (!ep) {
+    return -1;
+  }
+  memset(ep, 0, sizeof(epoll_t));
+  spinlock_init(&ep->ctl_lock, "epoll_ctl");
+  spinlock_init(&ep->lock, "epoll");
+  wait_queue_init(&ep->wq, "epoll_wq");
+
+  fd_entry_t *f = fd_entry_alloc(FD_TYPE_EPOLL);
+  if (!f) {
+    kfree(ep);
+    return -1;
+  }
+  f->data.ep = ep;
+  int fd = fd_install(get_current_thread()->files, f);
+  if (fd < 0) {
+    fd_put(f);
+  }
+  return fd;
+}
+
+// Reference to `epfd` if it's an epoll descriptor, NULL otherwise
+static fd_entry_t *fd_get_epoll(int epfd) {
+  fd_entry_t *f = fd_get(get_current_thread()->files, epfd);
+  if (f && f->type != FD_TYPE_EPOLL) {
+    fd_put(f);
+    return NULL;
+  }
+  return f;
+}
+
+static epoll_item_t *epoll_find(epoll_t *ep, int fd) {
+  for (epoll_item_t *item = ep->items; item; item = item->next) {
+    if (item->fd == fd) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+static int epoll_add(epoll_t *ep, int fd, const epoll_event_t *event) {
+  fd_entry_t *file = fd_get(get_current_thread()->files, fd);
+  // An epoll set inside another could form a cycle, so that isn't allowed
+  if (!file || file->type == FD_TYPE_EPOLL) {
+    fd_put(file);
+    return -1;
+  }
+  epoll_item_t *item = (epoll_item_t *)kmalloc(sizeof(epoll_item_t));
+  if (!item) {
+    fd_put(file);
+    return -1;
+  }
+  memset(item, 0, sizeof(epoll_item_t));
+  item->ep = ep;
+  item->fd = fd;
+  item->file = file;
+  item->events = event->events;
+  item->data = event->data;
+  item->wq = fd_wait_queue(file);
+  item->wait.func = epoll_callback;
+  item->wait.private = item;
+
+  spin_lock(&ep->ctl_lock);
+  if (epoll_find(ep, fd)) {
+    spin_unlock(&ep->ctl_lock);
+    fd_put(file);
+    kfree(item);
+    return -1; // Already registered
+  }
+  uint64_t flags = spin_lock_irqsave(&ep->lock);
+  item->next = ep->items;
+  ep->items = item;
+  spin_unlock_irqrestore(&ep->lock, flags);
+  if (item->wq) {
+    wait_queue_add(item->wq, &item->wait);
+  }
+  epoll_check_now(ep, item);
+  spin_unlock(&ep->ctl_lock);
+  return 0;
+}
+
+static int epoll_mod(epoll_t *ep, int fd, const epoll_event_t *event) {
+  spin_lock(&ep->ctl_lock);
+  epoll_item_t *item = epoll_find(ep, fd);
+  if (!item) {
+    spin_unlock(&ep->ctl_lock);
+    return -1;
+  }
+  uint64_t flags = spin_lock_irqsave(&ep->lock);
+  item->events = event->events;
+  item->data = event->data;
+  ready_remove(ep, item);
+  spin_unlock_irqrestore(&ep->lock, flags);
+  epoll_check_now(ep, item);
+  spin_unlock(&ep->ctl_lock);
+  return 0;
+}
+
+static int epoll_del(epoll_t *ep, int fd) {
+  spin_lock(&ep->ctl_lock);
+  epoll_item_t *item = epoll_find(ep, fd);
+  if (!item) {
+    spin_unlock(&ep->ctl_lock);
+    return -1;
+  }
+  // Off the wait queue first, then no callback can queue it again
+  if (item->wq) {
+    wait_queue_remove(item->wq, &item->wait);
+  }
+  uint64_t flags = spin_lock_irqsave(&ep->lock);
+  for (epoll_item_t **link = &ep->items; *link; link = &(*link)->next) {
+    if (*link == item) {
+      *link = item->next;
+      break;
+    }
+  }
+  ready_remove(ep, item);
+  spin_unlock_irqrestore(&ep->lock, flags);
+  spin_unlock(&ep->ctl_lock);
+
+  fd_put(item->file);
+  kfree(item);
+  return 0;
+}
+
+int ksys_epoll_ctl(int epfd, int op, int fd, const epoll_event_t *user_event) {
+  epoll_event_t event;
+  if (op != EPOLL_CTL_DEL && copy_from_user(&event, user_event, sizeof(event)) != 0) {
+    return -1;
+  }
+  fd_entry_t *f = fd_get_epoll(epfd);
+  if (!f) {
+    return -1;
+  }
+  int ret;
+  switch (op) {
+  case EPOLL_CTL_ADD:
+    ret = epoll_add(f->data.ep, fd, &event);
+    break;
+  case EPOLL_CTL_MOD:
+    ret = epoll_mod(f->data.ep, fd, &event);
+    break;
+  case EPOLL_CTL_DEL:
+    ret = epoll_del(f->data.ep, fd);
+    break;
+  default:
+    ret = -1;
+    break;
+  }
+  fd_put(f);
+  return ret;
+}
+
+typedef struct {
+  epoll_t *ep;
+  epoll_event_t *out; // Kernel buffer
+  int max;
+} epoll_wait_ctx_t;
+
+// Take up to `max` events off the ready list. Level-triggered items that
+// are still ready go back at the end; edge-triggered ones wait for the next
+// callback.
+static int epoll_harvest(void *arg) {
+  epoll_wait_ctx_t *ctx = (epoll_wait_ctx_t *)arg;
+  epoll_t *ep = ctx->ep;
+  int n = 0;
+  epoll_item_t *requeue = NULL;
+  epoll_item_t *requeue_tail = NULL;
+
+  uint64_t flags = spin_lock_irqsave(&ep->lock);
+  while (ep->ready_head && n < ctx->max) {
+    epoll_item_t *item = ep->ready_head;
+    ep->ready_head = item->ready_next;
+    if (!ep->ready_head) {
+      ep->ready_tail = NULL;
+    }
+    item->ready_next = NULL;
+
+    uint32_t events = fd_poll(item->file) & (item->events | POLLERR | POLLHUP);
+    if (events) {
+      ctx->out[n].events = events;
+      ctx->out[n].pad = 0;
+      ctx->out[n].data = item->data;
+      n++;
+    }
+    if (events && !(item->events & EPOLLET)) {
+      if (requeue_tail) {
+        requeue_tail->ready_next = item;
+      } else {
+        requeue = item;
+      }
+      requeue_tail = item;
+    } else {
+      item->ready = 0;
+    }
+  }
+  // After the ones we didn't get to, so nobody starves
+  if (requeue) {
+    if (ep->ready_tail) {
+      ep->ready_tail->ready_next = requeue;
+    } else {
+      ep->ready_head = requeue;
+    }
+    ep->ready_tail = requeue_tail;
+  }
+  spin_unlock_irqrestore(&ep->lock, flags);
+  return n;
+}
+
+int ksys_epoll_wait(int epfd, epoll_event_t *user_events, int max, int timeout_ms) {
+  if (max <= 0) {
+    return -1;
+  }
+  if (max > EPOLL_MAX_EVENTS) {
+    max = EPOLL_MAX_EVENTS;
+  }
+  if (!access_ok(user_events, max * sizeof(epoll_event_t))) {
+    return -1;
+  }
+  fd_entry_t *f = fd_get_epoll(epfd);
+  if (!f) {
+    return -1;
+  }
+  epoll_wait_ctx_t ctx;
+  ctx.ep = f->data.ep;
+  ctx.max = max;
+  ctx.out = (epoll_event_t *)kmalloc(max * sizeof(epoll_event_t));
+  if (!ctx.out) {
+    fd_put(f);
+    return -1;
+  }
+
+  wait_queue_entry_t wait;
+  wait_entry_init(&wait, get_current_thread());
+  wait_queue_add(&ctx.ep->wq, &wait);
+  int n = wait_event(epoll_harvest, &ctx, timeout_ms);
+  wait_queue_remove(&ctx.ep->wq, &wait);
+
+  if (n > 0 && copy_to_user(user_events, ctx.out, n * sizeof(epoll_event_t)) != 0) {
+    n = -1; // The events are lost, as with a bad buffer anywhere else
+  }
+  kfree(ctx.out);
+  fd_put(f);
+  return n;
+}
+
+void epoll_release(epoll_t *ep) {
+  // Last reference, nobody else can be in epoll_ctl() or epoll_wait()
+  epoll_item_t *item = ep->items;
+  while (item) {
+    epoll_item_t *next = item->next;
+    if (item->wq) {
+      wait_queue_remove(item->wq, &item->wait);
+    }
+    fd_put(item->file);
+    kfree(item);
+    item = next;
+  }
+  kfree(ep);
+}
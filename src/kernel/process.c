@@ -0,0 +1,58 @@
+#include "process.h"
+#include "heap.h"
+#include "io_ring.h"
+#include "kstring.h"
+#include "log.h"
+#include "syscall_stats.h"
+#include "vdso.h"
+#include <stdbool.h>
+#include <stddef.h> // for NULL
+
+process_t *process_create(pml4_t *pml4) {
+  process_t *proc = (process_t *)kmalloc(sizeof(process_t));
+  if (!proc) {
+    klog(LOG_ERROR, "Failed to allocate process structure.");
+    vmm_destroy_address_space(pml4);
+    return NULL;
+  }
+  proc->pid = 0;
+  proc->pml4 = pml4;
+  proc->refcount = 1;
+  memset(&proc->exited, 0, sizeof(proc->exited));
+  proc->maxrss_pages = 0;
+  proc->nr_threads = 1; // The thread it's created for
+  proc->ioring_vaddr = IORING_VADDR_BASE;
+#if CONFIG_SYSCALL_STATS
+  proc->sc_stats = syscall_stats_alloc(proc);
+#else
+  proc->sc_stats = NULL;
+#endif
+  vdso_map(pml4);
+  return proc;
+}
+
+process_t *process_get(process_t *proc) {
+  __atomic_add_fetch(&proc->refcount, 1, __ATOMIC_RELAXED);
+  return proc;
+}
+
+void process_put(process_t *proc) {
+  if (!proc || __atomic_sub_fetch(&proc->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  // No thread runs in the address space anymore
+  vmm_destroy_address_space(proc->pml4);
+#if CONFIG_SYSCALL_STATS
+  syscall_stats_free(proc->sc_stats);
+#endif
+  kfree(proc);
+}
+
+void process_update_rss(process_t *proc) {
+  uint64_t pages = vmm_count_user_pages(proc->pml4);
+  uint64_t peak = __atomic_load_n(&proc->maxrss_pages, __ATOMIC_RELAXED);
+  while (pages > peak &&
+         !__atomic_compare_exchange_n(&proc->maxrss_pages, &peak, pages, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
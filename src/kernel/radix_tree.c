@@ -0,0 +1,206 @@
+#include "radix_tree.h"
+#include "heap.h"
+#include "kstring.h"
+#include <stddef.h>
+
+#define RADIX_TREE_MASK (RADIX_TREE_SLOTS - 1)
+// Enough levels for any 64-bit key
+#define RADIX_TREE_MAX_HEIGHT ((64 + RADIX_TREE_BITS - 1) / RADIX_TREE_BITS)
+
+static radix_tree_node_t *node_alloc() {
+  radix_tree_node_t *node =
+      (radix_tree_node_t *)kmalloc(sizeof(radix_tree_node_t));
+  if (node) {
+    memset(node, 0, sizeof(radix_tree_node_t));
+  }
+  return node;
+}
+
+// Largest key a tree of `height` levels can hold
+static uint64_t max_key(uint32_t height) {
+  if (height == 0) {
+    return 0;
+  }
+  if (height * RADIX_TREE_BITS >= 64) {
+    return UINT64_MAX;
+  }
+  return (1ULL << (height * RADIX_TREE_BITS)) - 1;
+}
+
+void radix_tree_init(radix_tree_t *tree) {
+  tree->root = NULL;
+  tree->height = 0;
+}
+
+static void free_nodes(radix_tree_node_t *node, uint32_t height) {
+  if (height > 1) {
+    for (int i = 0; i < RADIX_TREE_SLOTS; i++) {
+      if (node->slots[i]) {
+        free_nodes((radix_tree_node_t *)node->slots[i], height - 1);
+      }
+    }
+  }
+  kfree(node);
+}
+
+void radix_tree_destroy(radix_tree_t *tree) {
+  if (tree->root) {
+    free_nodes(tree->root, tree->height);
+  }
+  radix_tree_init(tree);
+}
+
+// Add levels on top until `key` fits
+static int radix_tree_extend(radix_tree_t *tree, uint64_t key) {
+  while (tree->height == 0 || key > max_key(tree->height)) {
+    if (tree->root) {
+      radix_tree_node_t *node = node_alloc();
+      if (!node) {
+        return -1;
+      }
+      node->slots[0] = tree->root;
+      node->count = 1;
+      tree->root = node;
+    }
+    tree->height++;
+  }
+  return 0;
+}
+
+int radix_tree_insert(radix_tree_t *tree, uint64_t key, void *value) {
+  if (!value || radix_tree_extend(tree, key) != 0) {
+    return -1;
+  }
+  if (!tree->root) {
+    tree->root = node_alloc();
+    if (!tree->root) {
+      return -1;
+    }
+  }
+
+  // A failure below can leave empty interior nodes behind. They're harmless
+  // and get reused or freed with the tree.
+  radix_tree_node_t *node = tree->root;
+  for (uint32_t shift = (tree->height - 1) * RADIX_TREE_BITS; shift > 0;
+       shift -= RADIX_TREE_BITS) {
+    uint32_t idx = (key >> shift) & RADIX_TREE_MASK;
+    if (!node->slots[idx]) {
+      radix_tree_node_t *child = node_alloc();
+      if (!child) {
+        return -1;
+      }
+      node->slots[idx] = child;
+      node->count++;
+    }
+    node = (radix_tree_node_t *)node->slots[idx];
+  }
+
+  uint32_t idx = key & RADIX_TREE_MASK;
+  if (node->slots[idx]) {
+    return -1;
+  }
+  node->slots[idx] = value;
+  node->count++;
+  return 0;
+}
+
+void *radix_tree_lookup(const radix_tree_t *tree, uint64_t key) {
+  if (!tree->root || key > max_key(tree->height)) {
+    return NULL;
+  }
+  radix_tree_node_t *node = tree->root;
+  for (uint32_t shift = (tree->height - 1) * RADIX_TREE_BITS; shift > 0;
+       shift -= RADIX_TREE_BITS) {
+    node = (radix_tree_node_t *)node->slots[(key >> shift) & RADIX_TREE_MASK];
+    if (!node) {
+      return NULL;
+    }
+  }
+  return node->slots[key & RADIX_TREE_MASK];
+}
+
+void *radix_tree_delete(radix_tree_t *tree, uint64_t key) {
+  if (!tree->root || key > max_key(tree->height)) {
+    return NULL;
+  }
+
+  radix_tree_node_t *path[RADIX_TREE_MAX_HEIGHT];
+  uint32_t index[RADIX_TREE_MAX_HEIGHT];
+  radix_tree_node_t *node = tree->root;
+  uint32_t level = 0;
+  uint32_t shift = (tree->height - 1) * RADIX_TREE_BITS;
+  for (;;) {
+    path[level] = node;
+    index[level] = (key >> shift) & RADIX_TREE_MASK;
+    if (shift == 0) {
+      break;
+    }
+    node = (radix_tree_node_t *)node->slots[index[level]];
+    if (!node) {
+      return NULL;
+    }
+    level++;
+    shift -= RADIX_TREE_BITS;
+  }
+
+  void *value = node->slots[index[level]];
+  if (!value) {
+    return NULL;
+  }
+
+  // Clear the slot and free nodes that became empty, bottom up
+  for (;;) {
+    path[level]->slots[index[level]] = NULL;
+    if (--path[level]->count > 0) {
+      break;
+    }
+    kfree(path[level]);
+    if (level == 0) {
+      radix_tree_init(tree);
+      return value;
+    }
+    level--;
+  }
+
+  // Drop top levels that only lead to slot 0
+  while (tree->height > 1 && tree->root->count == 1 && tree->root->slots[0]) {
+    radix_tree_node_t *old = tree->root;
+    tree->root = (radix_tree_node_t *)old->slots[0];
+    tree->height--;
+    kfree(old);
+  }
+  return value;
+}
+
+// Search the subtree of `node`, which covers keys starting at `base` with
+// `shift` bits resolved below this level
+static void *next_in(const radix_tree_node_t *node, uint32_t shift,
+                     uint64_t base, uint64_t start, uint64_t *key_out) {
+  uint32_t first = start > base ? (uint32_t)((start - base) >> shift) : 0;
+  for (uint32_t i = first; i < RADIX_TREE_SLOTS; i++) {
+    void *slot = node->slots[i];
+    if (!slot) {
+      continue;
+    }
+    uint64_t slot_base = base + ((uint64_t)i << shift);
+    if (shift == 0) {
+      *key_out = slot_base;
+      return slot;
+    }
+    void *found = next_in((const radix_tree_node_t *)slot,
+                          shift - RADIX_TREE_BITS, slot_base, start, key_out);
+    if (found) {
+      return found;
+    }
+  }
+  return NULL;
+}
+
+void *radix_tree_next(const radix_tree_t *tree, uint64_t start,
+                      uint64_t *key_out) {
+  if (!tree->root || start > max_key(tree->height)) {
+    return NULL;
+  }
+  return next_in(tree->root, (tree->height - 1) * RADIX_TREE_BITS, 0, start,
+                 key_out);
+}
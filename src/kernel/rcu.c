@@ -0,0 +1,77 @@
+#include "rcu.h"
+#include "log.h"
+#include "scheduler.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include <stddef.h> // for NULL
+
+// How often synchronize_rcu() looks at the other CPUs again. Every CPU that
+// isn't in a read-side section reschedules at least once per tick.
+#define RCU_POLL_NS 1000000ULL
+
+// Callbacks waiting for the next grace period, newest first
+static spinlock_t rcu_lock = SPINLOCK_INIT("rcu_callbacks");
+static rcu_head_t *rcu_pending = NULL;
+
+static workqueue_t *rcu_wq = NULL;
+static void rcu_process(void *arg);
+static work_t rcu_work = WORK_INIT(rcu_process, NULL);
+
+void synchronize_rcu() {
+  uint32_t count = smp_cpu_count();
+  uint64_t snap[MAX_CPUS];
+  for (uint32_t i = 0; i < count; i++) {
+    snap[i] = __atomic_load_n(&cpus[i].rcu_qs, __ATOMIC_ACQUIRE);
+  }
+  // Our own CPU counts too: sleeping below switches away from us
+  for (uint32_t i = 0; i < count; i++) {
+    if (!cpus[i].online) {
+      continue;
+    }
+    while (__atomic_load_n(&cpus[i].rcu_qs, __ATOMIC_ACQUIRE) == snap[i]) {
+      scheduler_sleep_ns(RCU_POLL_NS);
+    }
+  }
+}
+
+static void rcu_process(void *arg) {
+  (void)arg;
+  uint64_t flags = spin_lock_irqsave(&rcu_lock);
+  rcu_head_t *list = rcu_pending;
+  rcu_pending = NULL;
+  spin_unlock_irqrestore(&rcu_lock, flags);
+  if (!list) {
+    return;
+  }
+
+  // One grace period covers the whole batch. Anything queued meanwhile
+  // requeues the work and waits for the next one.
+  synchronize_rcu();
+  while (list) {
+    rcu_head_t *next = list->next;
+    list->func(list);
+    list = next;
+  }
+}
+
+void call_rcu(rcu_head_t *head, rcu_callback_t func) {
+  head->func = func;
+  uint64_t flags = spin_lock_irqsave(&rcu_lock);
+  head->next = rcu_pending;
+  rcu_pending = head;
+  spin_unlock_irqrestore(&rcu_lock, flags);
+
+  if (rcu_wq) {
+    queue_work(rcu_wq, &rcu_work);
+  }
+}
+
+void rcu_init() {
+  rcu_wq = workqueue_create("rcu");
+  if (!rcu_wq) {
+    panic("Failed to create the RCU workqueue", NULL);
+  }
+  queue_work(rcu_wq, &rcu_work);
+  klog(LOG_INFO, "RCU initialized.");
+}
@@ -1,140 +1,504 @@
 #include "scheduler.h"
+#include "apic.h"
+#include "clock.h"
+#include "cpu.h"
+#include "fpu.h"
 #include "heap.h"
 #include "isr.h"
 #include "log.h"
+#include "preempt.h"
+#include "process.h"
+#include "smp.h"
 #include "thread.h"
+#include "tss.h"
 #include "pmm.h" // For pmm_free_page
-#include "vmm.h" // For vmm_unmap_page, vmm_destroy_address_space, PAGE_SIZE
+#include "vmm.h" // For vmm_unmap_page, PAGE_SIZE
+#include <stdbool.h>
 #include <stddef.h> // for NULL
 
-// Simple round-robin scheduler
+// Round-robin scheduler with one run queue per CPU. Run queues only hold
+// READY threads; the running thread is put back by scheduler_finish_switch()
+// once we're off its stack. Idle CPUs steal work from the busiest queue.
 
-static thread_t *ready_queue = NULL; // Head of the ready queue
-thread_t *current_thread = NULL;
+// Sleeping threads, soonest wake_tsc first, linked through sleep_next
+static spinlock_t sleep_lock = SPINLOCK_INIT("sleep_queue");
+static thread_t *sleep_queue = NULL;
+
+// Dead threads waiting for the reaper, linked through `next`. Pushed from
+// scheduler_finish_switch() with interrupts off; the reaper takes the whole
+// list at once, so a plain CAS push is enough.
+static thread_t *zombie_list = NULL;
+static thread_t *reaper_thread = NULL;
+
+static void reaper_main(void *arg);
 
 void scheduler_init() {
   klog(LOG_INFO, "Scheduler: Initializing...");
-  // The main kernel thread is already running, no need to add it to the ready
-  // queue. `current_thread` is initialized in thread_init()
-  ready_queue = NULL;
+  // The main kernel thread is already running as the BSP's idle thread, it
+  // never goes on a run queue. The BSP's queue was set up by smp_early_init().
+  reaper_thread = thread_create(reaper_main, NULL);
+  if (!reaper_thread) {
+    panic("Failed to create the reaper thread", NULL);
+  }
+  thread_set_name(reaper_thread, "reaper");
   klog(LOG_INFO, "Scheduler initialized.");
 }
 
+// --- Run queue helpers, caller holds cpu->rq_lock ---
+
+static void rq_push(cpu_t *cpu, thread_t *thread) {
+  thread->next = NULL;
+  if (cpu->rq_tail) {
+    cpu->rq_tail->next = thread;
+  } else {
+    cpu->rq_head = thread;
+  }
+  cpu->rq_tail = thread;
+  cpu->rq_len++;
+}
+
+static thread_t *rq_pop(cpu_t *cpu) {
+  thread_t *thread = cpu->rq_head;
+  if (!thread) {
+    return NULL;
+  }
+  cpu->rq_head = thread->next;
+  if (!cpu->rq_head) {
+    cpu->rq_tail = NULL;
+  }
+  thread->next = NULL;
+  cpu->rq_len--;
+  return thread;
+}
+
+// Queue a READY thread on `cpu` and kick it if it's sitting idle.
+static void enqueue_on(cpu_t *cpu, thread_t *thread) {
+  uint64_t flags = spin_lock_irqsave(&cpu->rq_lock);
+  thread->cpu = cpu->id;
+  rq_push(cpu, thread);
+  spin_unlock(&cpu->rq_lock);
+
+  if (cpu != this_cpu() && cpu->current_thread == cpu->idle_thread) {
+    lapic_send_ipi(cpu->lapic_id, IPI_VECTOR_RESCHEDULE);
+  }
+  local_irq_restore(flags);
+}
+
+static uint32_t cpu_load(cpu_t *cpu) {
+  return cpu->rq_len + (cpu->current_thread != cpu->idle_thread ? 1 : 0);
+}
+
 void scheduler_add_thread(thread_t *thread) {
   if (!thread)
     return;
+  thread->stats.ready_since = rdtsc();
 
-  disable_interrupts();
-  if (ready_queue == NULL) {
-    ready_queue = thread;
-    thread->next = thread; // Circular list
-  } else {
-    thread->next = ready_queue->next;
-    ready_queue->next = thread;
-    ready_queue = thread; // New thread becomes the tail
+  // New threads go to the least loaded CPU. The loads are read without
+  // locking; a slightly stale answer only costs balance, not correctness.
+  uint64_t flags = local_irq_save();
+  cpu_t *target = this_cpu();
+  uint32_t best = cpu_load(target);
+  uint32_t count = smp_cpu_count();
+  for (uint32_t i = 0; i < count; i++) {
+    cpu_t *cpu = &cpus[i];
+    if (!cpu->online) {
+      continue;
+    }
+    uint32_t load = cpu_load(cpu);
+    if (load < best) {
+      best = load;
+      target = cpu;
+    }
   }
-  enable_interrupts();
+  enqueue_on(target, thread);
+  local_irq_restore(flags);
 }
 
-thread_t *get_current_thread() { return current_thread; }
+void scheduler_wake(thread_t *thread) {
+  if (!thread)
+    return;
 
-// The core scheduler function
-void schedule() {
-  disable_interrupts();
+  thread_state_t expected = THREAD_BLOCKED;
+  if (!__atomic_compare_exchange_n(&thread->state, &expected, THREAD_READY, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return; // Already runnable (or dead)
+  }
+  thread->stats.ready_since = rdtsc();
+  thread->stats.woken = 1;
 
-  if (!current_thread) {
-    enable_interrupts();
-    return; // Nothing to schedule
+  // Prefer the CPU it last ran on, its cache is still warm there
+  uint64_t flags = local_irq_save();
+  cpu_t *target = &cpus[thread->cpu];
+  if (!target->online) {
+    target = this_cpu();
+  }
+  enqueue_on(target, thread);
+  if (target == this_cpu()) {
+    // Let it run at the next preemption point rather than at the next tick
+    set_need_resched();
   }
+  local_irq_restore(flags);
+}
 
-  thread_t *old_thread = current_thread;
-  thread_t *next_thread = NULL;
-
-  if (ready_queue) {
-    next_thread = ready_queue->next;
-
-    // Find a ready thread
-    while (next_thread->state != THREAD_READY &&
-           next_thread != ready_queue->next) {
-      if (next_thread->state == THREAD_DEAD) {
-        // Clean up the dead thread
-        thread_t* dead_thread = next_thread;
-        next_thread = next_thread->next;
-        
-        // Unlink from ready queue
-        // Find the thread before the dead one
-        thread_t* prev = ready_queue;
-        while(prev->next != dead_thread) {
-            prev = prev->next;
-        }
-        prev->next = next_thread;
-        if (ready_queue == dead_thread) {
-            ready_queue = prev;
-        }
-        
-        // Free user stack
-        if (dead_thread->user_stack_base) {
-            for (uint64_t i = 0; i < USER_STACK_SIZE; i += PAGE_SIZE) {
-                void* vaddr = (void*)((uint64_t)dead_thread->user_stack_base + i);
-                void* phys_addr = vmm_unmap_page(dead_thread->pml4, vaddr);
-                if (phys_addr) {
-                    pmm_free_page(phys_addr);
-                }
-            }
-        }
-        
-        // Free address space
-        if (dead_thread->pml4) {
-            // Don't destroy kernel address space
-            if (dead_thread->id != 0) { // Assuming kernel thread has id 0
-                 vmm_destroy_address_space(dead_thread->pml4);
-            }
-        }
-
-        // Free kernel stack
-        if (dead_thread->stack) {
-            kfree(dead_thread->stack);
-        }
-
-        // Free thread struct
-        kfree(dead_thread);
-
-      } else {
-        next_thread = next_thread->next;
+// Take the oldest thread from the longest run queue of another CPU.
+static thread_t *steal_thread(cpu_t *self) {
+  cpu_t *victim = NULL;
+  uint32_t longest = 0;
+  uint32_t count = smp_cpu_count();
+  for (uint32_t i = 0; i < count; i++) {
+    cpu_t *cpu = &cpus[i];
+    if (cpu == self || !cpu->online) {
+      continue;
+    }
+    if (cpu->rq_len > longest) {
+      longest = cpu->rq_len;
+      victim = cpu;
+    }
+  }
+  if (!victim) {
+    return NULL;
+  }
+
+  spin_lock(&victim->rq_lock);
+  thread_t *thread = rq_pop(victim);
+  spin_unlock(&victim->rq_lock);
+  return thread;
+}
+
+thread_t *get_current_thread() {
+  // A single %gs-relative load, so we can't be migrated halfway through
+  thread_t *thread;
+  __asm__ __volatile__("mov %%gs:%c1, %0"
+                       : "=r"(thread)
+                       : "i"(__builtin_offsetof(cpu_t, current_thread)));
+  return thread;
+}
+
+static void reap_thread(thread_t *dead_thread) {
+  thread_unregister(dead_thread);
+
+  // Free user stack. It's still mapped, so this is the process's last chance
+  // to see its peak resident set.
+  if (dead_thread->user_stack_base) {
+      process_update_rss(dead_thread->proc);
+      for (uint64_t i = 0; i < USER_STACK_SIZE; i += PAGE_SIZE) {
+          void* vaddr = (void*)((uint64_t)dead_thread->user_stack_base + i);
+          void* phys_addr = vmm_unmap_page(dead_thread->pml4, vaddr);
+          if (phys_addr) {
+              pmm_free_page(phys_addr);
+          }
       }
+  }
+
+  // Free address space once the program's last thread is gone. Kernel
+  // threads borrow whatever was active when they were created.
+  process_put(dead_thread->proc);
+
+  fpu_thread_free(dead_thread);
+  fd_table_release(dead_thread->files);
+
+  // Free kernel stack
+  if (dead_thread->stack) {
+      kfree(dead_thread->stack);
+  }
+
+  // Free thread struct
+  kfree(dead_thread);
+}
+
+// Freeing an address space means TLB shootdowns and heap work, which we'd
+// rather not do in the middle of a context switch with interrupts off. Dead
+// threads are queued here and freed by the reaper thread instead.
+static void reaper_main(void *arg) {
+  (void)arg;
+  thread_t *self = get_current_thread();
+
+  for (;;) {
+    thread_t *dead = __atomic_exchange_n(&zombie_list, NULL, __ATOMIC_ACQUIRE);
+    while (dead) {
+      thread_t *next = dead->next;
+      uint64_t id = dead->id;
+      reap_thread(dead);
+      // Its children's exit statuses have nobody to go to now
+      thread_forget_children(id);
+      dead = next;
     }
 
-    if (next_thread->state != THREAD_READY) {
-      // No ready threads found
-      next_thread = NULL;
+    // Block, unless a thread died since we looked. scheduler_wake() only
+    // wakes BLOCKED threads, so publish that first and then recheck.
+    uint64_t flags = local_irq_save();
+    self->state = THREAD_BLOCKED;
+    if (__atomic_load_n(&zombie_list, __ATOMIC_SEQ_CST)) {
+      thread_state_t expected = THREAD_BLOCKED;
+      if (__atomic_compare_exchange_n(&self->state, &expected, THREAD_RUNNING, false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        local_irq_restore(flags);
+        continue;
+      }
+      // Somebody woke us already, we're READY and queued; let it run its course
     }
+    schedule();
+    local_irq_restore(flags);
+  }
+}
+
+static void queue_zombie(thread_t *thread) {
+  thread_t *head = __atomic_load_n(&zombie_list, __ATOMIC_RELAXED);
+  do {
+    thread->next = head;
+  } while (!__atomic_compare_exchange_n(&zombie_list, &head, thread, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  scheduler_wake(reaper_thread);
+}
+
+void scheduler_finish_switch() {
+  cpu_t *cpu = this_cpu();
+  // Pick up where the new thread left its preempt count, before the locks
+  // below touch it
+  cpu->preempt_count = cpu->current_thread->preempt_count;
+
+  thread_t *prev = cpu->prev_thread;
+  if (!prev) {
+    return;
   }
+  cpu->prev_thread = NULL;
 
-  if (!next_thread) {
+  if (prev->state == THREAD_DEAD) {
+    // Nobody can switch to it anymore and we're off its stack
+    queue_zombie(prev);
+    return;
+  }
+
+  int requeue = cpu->prev_requeue;
+  // From here on another CPU may pick prev up
+  __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+  if (requeue) {
+    enqueue_on(cpu, prev);
+  }
+}
+
+static void account_switch(thread_t *prev, thread_t *next, bool preempted, uint64_t now) {
+  thread_stats_t *ps = &prev->stats;
+  ps->run_cycles += now - ps->on_cpu_since;
+  if (ps->in_syscall) {
+    ps->sys_cycles += now - ps->sys_since;
+  }
+  if (preempted) {
+    ps->nivcsw++;
+  } else {
+    ps->nvcsw++;
+  }
+
+  thread_stats_t *ns = &next->stats;
+  ns->on_cpu_since = now;
+  ns->sys_since = now; // Only used while in_syscall
+  if (next == this_cpu()->idle_thread) {
+    return; // Idle threads are never queued
+  }
+  uint64_t waited = now - ns->ready_since;
+  ns->wait_cycles += waited;
+  if (ns->woken) {
+    ns->woken = 0;
+    ns->wakeups++;
+    ns->wakeup_cycles += waited;
+    if (waited > ns->wakeup_max_cycles) {
+      ns->wakeup_max_cycles = waited;
+    }
+  }
+}
+
+// The core scheduler function
+void schedule() {
+  uint64_t flags = local_irq_save();
+
+  cpu_t *cpu = this_cpu();
+  thread_t *prev = cpu->current_thread;
+  if (!prev) {
+    local_irq_restore(flags);
+    return; // Nothing to schedule
+  }
+
+  cpu->need_resched = 0;
+  // Nobody calls schedule() from inside an RCU read-side section
+  if (cpu->preempt_count == 0) {
+    __atomic_store_n(&cpu->rcu_qs, cpu->rcu_qs + 1, __ATOMIC_RELEASE);
+  }
+
+  spin_lock(&cpu->rq_lock);
+  thread_t *next = rq_pop(cpu);
+  spin_unlock(&cpu->rq_lock);
+
+  bool prev_running = prev->state == THREAD_RUNNING;
+  if (!next && (prev == cpu->idle_thread || !prev_running)) {
+    next = steal_thread(cpu);
+  }
+
+  if (!next) {
     // No other ready threads, continue with the current one if it's running
-    if (old_thread->state == THREAD_RUNNING) {
-      enable_interrupts();
+    if (prev_running) {
+      local_irq_restore(flags);
       return;
+    }
+    // Current thread is blocked/dead, nothing else to run
+    next = cpu->idle_thread;
+  }
+
+  if (next == prev) {
+    // We were woken up before we managed to switch away
+    prev->state = THREAD_RUNNING;
+    local_irq_restore(flags);
+    return;
+  }
+
+  uint64_t now = rdtsc();
+  cpu->prev_requeue = 0;
+  if (prev_running && prev != cpu->idle_thread) {
+    prev->state = THREAD_READY;
+    prev->stats.ready_since = now;
+    cpu->prev_requeue = 1;
+  }
+  account_switch(prev, next, prev_running, now);
+
+  // A thread woken up right after blocking can be queued while its old CPU
+  // is still switching away from it. Wait until its stack is free.
+  while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+    cpu_relax();
+  }
+  next->on_cpu = 1;
+  next->state = THREAD_RUNNING;
+  next->cpu = cpu->id;
+  prev->preempt_count = cpu->preempt_count;
+  cpu->current_thread = next;
+  cpu->prev_thread = prev;
+
+  // Interrupts from ring 3 must land on the new thread's own kernel stack
+  if (next->stack) {
+    tss_set_stack((uint64_t)next->stack + KERNEL_STACK_SIZE);
+  }
+
+  // User TLS. Kernel threads keep 0, the kernel itself doesn't use FS.
+  if (next->fs_base != prev->fs_base) {
+    wrmsr(MSR_FS_BASE, next->fs_base);
+  }
+
+  fpu_switch(prev, next);
+  thread_switch(prev, next);
+  scheduler_finish_switch();
+
+  local_irq_restore(flags);
+}
+
+void preempt_schedule() {
+  uint64_t rflags;
+  __asm__ __volatile__("pushfq; pop %0" : "=r"(rflags));
+  if (preempt_count() == 0 && (rflags & 0x200)) {
+    schedule();
+  }
+}
+
+void cond_resched() {
+  if (preempt_count() != 0) {
+    return;
+  }
+  uint64_t rflags;
+  __asm__ __volatile__("pushfq; pop %0" : "=r"(rflags));
+  if (!(rflags & 0x200)) {
+    // `sti` takes effect after the next instruction, so pending interrupts
+    // are taken between the nop and the cli
+    __asm__ __volatile__("sti; nop; cli" ::: "memory");
+  }
+  if (need_resched()) {
+    schedule();
+  }
+}
+
+void preempt_irq_exit() {
+  // The count is the interrupted code's, we don't raise it for IRQs
+  if (need_resched() && preempt_count() == 0) {
+    schedule();
+  }
+}
+
+void scheduler_idle_loop() {
+  for (;;) {
+    schedule();
+
+    // Only halt if nothing showed up in the meantime. `sti; hlt` can't be
+    // split by an interrupt, so a wakeup IPI can't get lost here.
+    disable_interrupts();
+    if (this_cpu()->rq_len == 0) {
+      __asm__ __volatile__("sti; hlt");
     } else {
-      // Current thread is blocked/dead, but there's nothing else to run
-      panic("Scheduler: No runnable threads!", NULL);
+      enable_interrupts();
     }
   }
+}
 
-  ready_queue =
-      next_thread; // The new head of the ready queue is the next thread to run.
+int scheduler_block_until(uint64_t wake_tsc) {
+  thread_t *self = get_current_thread();
 
-  if (old_thread->state == THREAD_RUNNING) {
-    old_thread->state = THREAD_READY;
+  spin_lock(&sleep_lock);
+  self->wake_tsc = wake_tsc;
+  self->timed_out = 0;
+  thread_t **link = &sleep_queue;
+  while (*link && (*link)->wake_tsc <= wake_tsc) {
+    link = &(*link)->sleep_next;
   }
+  self->sleep_next = *link;
+  *link = self;
+  self->sleeping = 1;
+  spin_unlock(&sleep_lock);
 
-  next_thread->state = THREAD_RUNNING;
-  current_thread = next_thread;
+  schedule();
 
-  if (old_thread != next_thread) {
-    klog(LOG_DEBUG, "Scheduler: Switching from %p (ID: %d) to %p (ID: %d)", old_thread, old_thread->id, next_thread, next_thread->id);
-    thread_switch(old_thread, next_thread);
+  // Woken early: leave the queue, so the tick can't wake us later on, when
+  // we may be blocked on something else
+  spin_lock(&sleep_lock);
+  if (self->sleeping) {
+    for (link = &sleep_queue; *link; link = &(*link)->sleep_next) {
+      if (*link == self) {
+        *link = self->sleep_next;
+        break;
+      }
+    }
+    self->sleep_next = NULL;
+    self->sleeping = 0;
   }
+  int timed_out = self->timed_out;
+  spin_unlock(&sleep_lock);
+  return timed_out;
+}
 
-  enable_interrupts();
+void scheduler_sleep_ns(uint64_t ns) {
+  thread_t *self = get_current_thread();
+  uint64_t flags = local_irq_save();
+  uint64_t wake_tsc = rdtsc() + clock_ns_to_tsc(ns);
+  do {
+    // Before queueing, so the tick can't see us queued but still running
+    self->state = THREAD_BLOCKED;
+  } while (!scheduler_block_until(wake_tsc));
+  local_irq_restore(flags);
+}
+
+void scheduler_tick() {
+  thread_t *head = __atomic_load_n(&sleep_queue, __ATOMIC_RELAXED);
+  if (!head) {
+    return;
+  }
+  // Whoever gets the lock first wakes everyone that is due
+  if (!spin_trylock(&sleep_lock)) {
+    return;
+  }
+  // Wake under the lock: a thread that was woken early takes itself off
+  // the queue under it too, so it can't get a stale wakeup from here
+  uint64_t now = rdtsc();
+  while (sleep_queue && sleep_queue->wake_tsc <= now) {
+    thread_t *thread = sleep_queue;
+    sleep_queue = thread->sleep_next;
+    thread->sleep_next = NULL;
+    thread->sleeping = 0;
+    thread->timed_out = 1;
+    scheduler_wake(thread);
+  }
+  spin_unlock(&sleep_lock);
 }
@@ -0,0 +1,60 @@
+#include "simd.h"
+
+// immintrin.h pulls in mm_malloc.h, which needs a hosted libc. We don't use
+// _mm_malloc, so pretend it was already included.
+#define _MM_MALLOC_H_INCLUDED
+#include <immintrin.h>
+
+// The SHA extensions keep the state as {A,B,E,F} and {C,D,G,H} and do two
+// rounds per sha256rnds2. Each iteration below is four rounds; the message
+// schedule runs a few words ahead in msg[] (indexed mod 4).
+void sha256_ni_transform(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);   // DCBA
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]); // HGFE
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                           // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);                     // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);             // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                  // CDGH
+
+    while (blocks--) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msg[4];
+
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), bswap);
+            }
+            __m128i wk = _mm_add_epi32(msg[i & 3], _mm_load_si128((const __m128i *)&K_SHA256[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+
+            if (i >= 3 && i < 15) {
+                tmp = _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4);
+                msg[(i + 1) & 3] = _mm_add_epi32(msg[(i + 1) & 3], tmp);
+                msg[(i + 1) & 3] = _mm_sha256msg2_epu32(msg[(i + 1) & 3], msg[i & 3]);
+            }
+
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+
+            if (i >= 1 && i < 13) {
+                msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);    // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    // HGFE
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
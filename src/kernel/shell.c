@@ -13,6 +13,11 @@
 #include "epstein.h" // For epstein global variable
 #include "port_io.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "syscall.h" // For rusage_t
+#include "syscall_stats.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -30,6 +35,10 @@ static int current_history_view = -1;
 
 static char cwd[256] = "/";
 
+// Resource usage of the last program run from the shell, for `time`
+static rusage_t last_usage;
+static bool last_usage_valid = false;
+
 static void get_cpu_brand(char *buf) {
   uint32_t eax, ebx, ecx, edx;
   __asm__ __volatile__("cpuid" : "=a"(eax) : "a"(0x80000000));
@@ -138,11 +147,56 @@ static void add_to_history(const char *cmd) {
   current_history_view = -1;
 }
 
+// Run a program in the foreground, the prompt comes back once it exits.
+// Returns -1 if it couldn't be started.
+static int run_program(const char *path, int *status) {
+  int tid = elf_exec_as_thread(path);
+  if (tid < 0) {
+    return -1;
+  }
+  if (thread_wait(tid, status, &last_usage) == 0) {
+    last_usage_valid = true;
+  }
+  return 0;
+}
+
+// Print `ns` as seconds with millisecond precision
+static void print_seconds(const char *label, uint64_t ns) {
+  char buf[64];
+  uint64_t ms = ns / 1000000;
+  ksprintf(buf, "%s %lu.%03us\n", label, ms / 1000, (uint32_t)(ms % 1000));
+  klog_print_str(buf);
+}
+
+static void print_time(uint64_t elapsed_ns) {
+  print_seconds("real", elapsed_ns);
+  if (!last_usage_valid) {
+    return; // A builtin, it ran on the shell's own thread
+  }
+  char buf[128];
+  print_seconds("user", last_usage.utime_ns);
+  print_seconds("sys ", last_usage.stime_ns);
+  ksprintf(buf, "maxrss %lu pages, %lu page faults\n", last_usage.maxrss_pages,
+           last_usage.page_faults);
+  klog_print_str(buf);
+  ksprintf(buf, "io %lu bytes read, %lu bytes written\n", last_usage.read_bytes,
+           last_usage.write_bytes);
+  klog_print_str(buf);
+  ksprintf(buf, "csw %lu voluntary, %lu involuntary\n", last_usage.nvcsw,
+           last_usage.nivcsw);
+  klog_print_str(buf);
+}
+
+static void run_command(char *line);
+
 static void execute_command(char *line) {
   if (strlen(line) == 0)
     return;
   add_to_history(line);
+  run_command(line);
+}
 
+static void run_command(char *line) {
   // Simple tokenization (cmd arg)
   char cmd[64];
   char arg[128];
@@ -166,7 +220,7 @@ static void execute_command(char *line) {
   if (strcmp(cmd, "help") == 0) {
     klog_print_str(
         "Built-in: ls, cd, pwd, cat, mkdir, touch, rm, edit, kpm, clear, "
-        "version, info, reboot, kyrofetch\n");
+        "version, info, reboot, kyrofetch, lockstat, syscallstat, ulimit, time\n");
   } else if (strcmp(cmd, "pwd") == 0) {
     klog_print_str(cwd);
     klog_putchar('\n');
@@ -465,7 +519,7 @@ static void execute_command(char *line) {
     // For now, we'll just execute kpm without arguments and it will likely print its own usage.
     // A proper argument passing mechanism for userspace executables would be needed to pass 'list', 'install', etc.
     klog(LOG_INFO, "SHELL: Executing userspace kpm.");
-    if (elf_exec_as_thread(kpm_path) != 0) {
+    if (run_program(kpm_path, NULL) < 0) {
         klog(LOG_ERROR, "SHELL: Failed to execute userspace kpm.");
     }
   } else if (strcmp(cmd, "testpanic") == 0) {
@@ -493,6 +547,79 @@ static void execute_command(char *line) {
     klog_print_str(" (Build ");
     klog_print_str(KYROOS_VERSION_BUILD);
     klog_print_str(")\n");
+  } else if (strcmp(cmd, "lockstat") == 0) {
+    if (strcmp(arg, "reset") == 0) {
+      spinlock_reset_stats();
+      klog_print_str("Lock statistics reset.\n");
+    } else {
+      spinlock_dump_stats();
+    }
+  } else if (strcmp(cmd, "syscallstat") == 0) {
+    // syscallstat [-h] [PID] | reset: per-syscall counters, system-wide or
+    // for one program, -h adds the latency histograms
+    const char *value = arg;
+    int hist = 0;
+    if (strcmp(value, "reset") == 0) {
+      syscall_stats_reset();
+      klog_print_str("Syscall statistics reset.\n");
+      return;
+    }
+    if (strncmp(value, "-h", 2) == 0) {
+      hist = 1;
+      value += 2;
+      while (*value == ' ') {
+        value++;
+      }
+    }
+    uint64_t pid = 0;
+    for (; *value >= '0' && *value <= '9'; value++) {
+      pid = pid * 10 + (*value - '0');
+    }
+    if (*value != '\0') {
+      klog_print_str("usage: syscallstat [-h] [pid] | reset\n");
+    } else {
+      syscall_stats_dump(pid, hist);
+    }
+  } else if (strcmp(cmd, "ulimit") == 0) {
+    // ulimit [-n] [N]: show or set the open file limit. Programs started
+    // from the shell inherit it.
+    fd_table_t *files = get_current_thread()->files;
+    const char *value = arg;
+    if (strncmp(value, "-n", 2) == 0) {
+      value += 2;
+      while (*value == ' ') {
+        value++;
+      }
+    }
+    uint64_t soft, hard;
+    fd_table_get_limit(files, &soft, &hard);
+    if (*value == '\0') {
+      char buf[64];
+      ksprintf(buf, "open files: %d (max %d)\n", (int)soft, (int)hard);
+      klog_print_str(buf);
+    } else {
+      uint64_t limit = 0;
+      for (; *value >= '0' && *value <= '9'; value++) {
+        limit = limit * 10 + (*value - '0');
+      }
+      if (*value != '\0' || limit == 0 || fd_table_set_limit(files, limit, hard) != 0) {
+        klog_print_str("ulimit: invalid limit\n");
+      }
+    }
+  } else if (strcmp(cmd, "time") == 0) {
+    // time CMD: run CMD, then report the wall clock time and, for programs,
+    // their CPU time and resource usage
+    if (arg[0] == '\0') {
+      klog_print_str("usage: time <command>\n");
+    } else {
+      char sub[128];
+      strncpy(sub, arg, sizeof(sub) - 1);
+      sub[sizeof(sub) - 1] = '\0';
+      last_usage_valid = false;
+      uint64_t start = clock_monotonic_ns();
+      run_command(sub);
+      print_time(clock_monotonic_ns() - start);
+    }
   } else if (strcmp(cmd, "kyrofetch") == 0) {
     shell_kyrofetch();
   } else if (strcmp(cmd, "info") == 0) {
@@ -543,13 +670,12 @@ static void execute_command(char *line) {
     vfs_node_t *node = vfs_resolve_path(vfs_root, path);
     if (node && (node->flags & VFS_FILE)) { // Ensure it's a file
       klog(LOG_INFO, "SHELL: Executing external command: %s", path);
-      if (elf_exec_as_thread(path) != 0) {
+      int status = 0;
+      if (run_program(path, &status) < 0) {
           klog(LOG_ERROR, "SHELL: Failed to execute %s", path);
+      } else if (status != 0) {
+          klog(LOG_INFO, "SHELL: %s exited with status %d", path, status);
       }
-      // After exec, the shell thread will likely yield or terminate,
-      // and the scheduler will pick up the new userspace thread.
-      // The shell should wait for the child process to finish before printing a new prompt.
-      // For now, we just let the new thread run. A proper `waitpid` equivalent would be needed.
     } else {
       klog(LOG_INFO, "Unknown command: %s", cmd);
     }
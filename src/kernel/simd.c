@@ -0,0 +1,45 @@
+#include "simd.h"
+#include "kstring.h"
+
+// immintrin.h pulls in mm_malloc.h, which needs a hosted libc. We don't use
+// _mm_malloc, so pretend it was already included.
+#define _MM_MALLOC_H_INCLUDED
+#include <immintrin.h>
+
+void simd_copy_nt(void *dest, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    // Streaming stores need an aligned destination
+    size_t head = (16 - ((uint64_t)d & 15)) & 15;
+    if (head > n) {
+        head = n;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    while (n >= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)(d + 0), a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+        d += 64;
+        s += 64;
+        n -= 64;
+    }
+    while (n >= 16) {
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+        d += 16;
+        s += 16;
+        n -= 16;
+    }
+    // Non-temporal stores are weakly ordered
+    _mm_sfence();
+    memcpy(d, s, n);
+}
@@ -0,0 +1,181 @@
+#include "smp.h"
+#include "apic.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "isr.h"
+#include "log.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Rough upper bound for an AP to check in (pause iterations, ~1s on QEMU)
+#define AP_BOOT_TIMEOUT 100000000ULL
+
+cpu_t cpus[MAX_CPUS];
+static volatile uint32_t cpu_count = 1; // The BSP
+
+// TLB shootdown request, one at a time
+static spinlock_t tlb_lock = SPINLOCK_INIT("tlb_shootdown");
+static volatile uint64_t tlb_flush_addr = 0;
+static volatile uint64_t tlb_pending_mask = 0; // One bit per logical CPU id
+
+static void percpu_setup(cpu_t *cpu, uint32_t id, uint32_t lapic_id) {
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->lapic_id = lapic_id;
+    cpu->online = 0;
+    cpu->current_thread = NULL;
+    cpu->idle_thread = NULL;
+    cpu->prev_thread = NULL;
+    cpu->prev_requeue = 0;
+    cpu->preempt_count = 0;
+    cpu->need_resched = 0;
+    cpu->rcu_qs = 0;
+    cpu->timer_deadline = 0;
+    cpu->fpu_owner = NULL;
+    cpu->kernel_fpu_active = 0;
+    spinlock_init(&cpu->rq_lock, "runqueue");
+    cpu->rq_head = NULL;
+    cpu->rq_tail = NULL;
+    cpu->rq_len = 0;
+}
+
+void smp_early_init() {
+    percpu_setup(&cpus[0], 0, 0); // LAPIC ID is filled in by smp_init()
+    cpus[0].online = 1;
+    wrmsr(MSR_GS_BASE, (uint64_t)&cpus[0]);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+uint32_t smp_cpu_count() {
+    return __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+}
+
+// Entry point for application processors. Limine hands us a 64-bit CPU on
+// its own page tables, GDT and stack.
+static void ap_entry(struct limine_smp_info *info) {
+    cpu_t *cpu = (cpu_t *)info->extra_argument;
+
+    vmm_switch_address_space(kernel_pml4);
+    gdt_init_cpu(cpu); // Also points GS base at `cpu`
+    tss_init_cpu(cpu);
+    idt_load();
+    fpu_init_cpu();
+    syscall_init_cpu();
+    lapic_init();
+    lapic_timer_start();
+
+    thread_create_idle();
+
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    klog(LOG_INFO, "SMP: CPU %d (LAPIC ID %d) online.", cpu->id, cpu->lapic_id);
+
+    enable_interrupts();
+    scheduler_idle_loop();
+}
+
+void smp_init(struct limine_smp_response *smp) {
+    lapic_init();
+    cpus[0].lapic_id = lapic_get_id();
+
+    if (!smp) {
+        klog(LOG_WARN, "SMP: No response from bootloader, running on the BSP only.");
+        return;
+    }
+    klog(LOG_INFO, "SMP: %d CPUs reported, BSP LAPIC ID %d.", (int)smp->cpu_count, smp->bsp_lapic_id);
+
+    for (uint64_t i = 0; i < smp->cpu_count; i++) {
+        struct limine_smp_info *info = smp->cpus[i];
+        if (info->lapic_id == smp->bsp_lapic_id) {
+            continue;
+        }
+        uint32_t id = cpu_count;
+        if (id >= MAX_CPUS) {
+            klog(LOG_WARN, "SMP: More than %d CPUs, ignoring the rest.", MAX_CPUS);
+            break;
+        }
+
+        cpu_t *cpu = &cpus[id];
+        percpu_setup(cpu, id, info->lapic_id);
+        info->extra_argument = (uint64_t)cpu;
+        // The slot stays taken even if the AP never checks in; everything
+        // that walks cpus[] skips CPUs that aren't online.
+        __atomic_store_n(&cpu_count, id + 1, __ATOMIC_RELEASE);
+        // Writing goto_address is what releases the AP
+        __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_SEQ_CST);
+
+        uint64_t spins = 0;
+        while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) && spins < AP_BOOT_TIMEOUT) {
+            cpu_relax();
+            spins++;
+        }
+        if (!cpu->online) {
+            klog(LOG_ERROR, "SMP: CPU with LAPIC ID %d did not come up.", info->lapic_id);
+        }
+    }
+
+    int online = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        if (cpus[i].online) {
+            online++;
+        }
+    }
+    klog(LOG_INFO, "SMP: %d CPUs online.", online);
+}
+
+void tlb_shootdown_handle() {
+    uint64_t bit = 1ULL << this_cpu()->id;
+    if (__atomic_load_n(&tlb_pending_mask, __ATOMIC_ACQUIRE) & bit) {
+        __asm__ __volatile__("invlpg (%0)" :: "r"(tlb_flush_addr) : "memory");
+        __atomic_fetch_and(&tlb_pending_mask, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+void tlb_shootdown(pml4_t *pml4, uint64_t addr) {
+    uint32_t count = smp_cpu_count();
+    if (count <= 1) {
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    // Another CPU may be waiting for us to acknowledge its request while we
+    // spin here with interrupts off, so keep servicing it.
+    while (!spin_trylock(&tlb_lock)) {
+        tlb_shootdown_handle();
+        cpu_relax();
+    }
+
+    cpu_t *self = this_cpu();
+    bool kernel_addr = addr >= 0xFFFF800000000000ULL; // Shared by every address space
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        cpu_t *cpu = &cpus[i];
+        if (cpu == self || !cpu->online) {
+            continue;
+        }
+        thread_t *running = cpu->current_thread;
+        if (kernel_addr || (running && running->pml4 == pml4)) {
+            mask |= 1ULL << cpu->id;
+        }
+    }
+
+    if (mask) {
+        tlb_flush_addr = addr;
+        __atomic_store_n(&tlb_pending_mask, mask, __ATOMIC_RELEASE);
+        for (uint32_t i = 0; i < count; i++) {
+            if (mask & (1ULL << i)) {
+                lapic_send_ipi(cpus[i].lapic_id, IPI_VECTOR_TLB_SHOOTDOWN);
+            }
+        }
+        while (__atomic_load_n(&tlb_pending_mask, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+
+    spin_unlock(&tlb_lock);
+    local_irq_restore(flags);
+}
@@ -4,41 +4,50 @@
 #include "log.h"
 #include "net.h"
 #include "udp.h" // For UDP protocol handler registration and sending
-#include "thread.h" // For get_current_thread, THREAD_BLOCKED, THREAD_READY
-#include "scheduler.h" // For schedule
+#include "thread.h" // For get_current_thread, THREAD_BLOCKED
+#include "scheduler.h" // For schedule, scheduler_wake
+#include "spinlock.h"
+#include "poll.h" // For POLLIN, POLLOUT
+#include "uaccess.h"
 
 socket_t *active_sockets = NULL;
+// Serializes changes to active_sockets and port binding. Lookups on the receive
+// path don't take it, they walk the list under rcu_read_lock() instead.
+static spinlock_t sockets_lock = SPINLOCK_INIT("sockets");
 
 // This function is now the specific handler for UDP data, called by the IP layer
 void sock_udp_receive_packet_handler(net_dev_t *net_dev, ipv4_header_t *ip_hdr, udp_header_t *udp_hdr, const uint8_t *data, size_t len) {
     (void)net_dev; // Unused for now
     (void)ip_hdr; // Unused for now
 
-    // Find the socket that is bound to the destination port
-    socket_t *current_sock = active_sockets;
-    while (current_sock) {
+    // Find the socket that is bound to the destination port. A socket closed
+    // meanwhile stays valid until rcu_read_unlock().
+    rcu_read_lock();
+    socket_t *current_sock;
+    rcu_list_for_each(current_sock, active_sockets) {
         if (current_sock->protocol == IPPROTO_UDP && current_sock->local_addr.sin_port == udp_hdr->dest_port) {
             // Buffer the incoming data
+            uint64_t flags = spin_lock_irqsave(&current_sock->lock);
             size_t space_available = current_sock->proto_data.udp_data.recv_buffer_size - current_sock->proto_data.udp_data.recv_data_len;
             if (len > space_available) {
+                spin_unlock_irqrestore(&current_sock->lock, flags);
+                rcu_read_unlock();
                 klog(LOG_WARN, "SOCKET: UDP receive: Buffer overflow, dropping packet.");
                 return;
             }
             // Copy data to the end of the circular buffer
             memcpy(current_sock->proto_data.udp_data.recv_buffer + current_sock->proto_data.udp_data.recv_data_len, data, len);
             current_sock->proto_data.udp_data.recv_data_len += len;
-            klog(LOG_INFO, "SOCKET: UDP packet received for port %d, len=%d", __builtin_bswap16(udp_hdr->dest_port), len);
+            spin_unlock_irqrestore(&current_sock->lock, flags);
 
-            // Wake up any waiting threads (TODO: proper thread blocking/unblocking)
-            // For now, if waiting_thread is set, simply mark it as ready.
-            if (current_sock->waiting_thread) {
-                current_sock->waiting_thread->state = THREAD_READY;
-                current_sock->waiting_thread = NULL; // Only wake up once
-            }
+            // Wake up threads blocked in sock_recv and pollers
+            wake_up(&current_sock->wq, POLLIN);
+            rcu_read_unlock();
+            klog(LOG_INFO, "SOCKET: UDP packet received for port %d, len=%d", __builtin_bswap16(udp_hdr->dest_port), len);
             return;
         }
-        current_sock = current_sock->next;
     }
+    rcu_read_unlock();
     
     // If we get here, no listening socket was found for this port.
     // This is common for DHCP replies before the socket is fully managed.
@@ -95,6 +104,8 @@ socket_t *sock_create(int domain, int type, int protocol) {
     sock->type = type;
     sock->protocol = protocol;
     sock->state = SOCK_STATE_CLOSED;
+    spinlock_init(&sock->lock, "socket");
+    wait_queue_init(&sock->wq, "socket_wq");
     
     // Initialize UDP specific data
     if (protocol == IPPROTO_UDP) {
@@ -111,8 +122,9 @@ socket_t *sock_create(int domain, int type, int protocol) {
 
 
     // Add to active sockets list
-    sock->next = active_sockets;
-    active_sockets = sock;
+    uint64_t flags = spin_lock_irqsave(&sockets_lock);
+    rcu_list_add(active_sockets, sock);
+    spin_unlock_irqrestore(&sockets_lock, flags);
 
     klog(LOG_INFO, "SOCKET: Created new socket (fd).");
     return sock;
@@ -154,7 +166,7 @@ int sock_send(socket_t *sock, const void *buf, size_t len, int flags) {
             return -1;
         }
         // Use the default network device (E1000 for now)
-        if (!network_devices) {
+        if (!net_default_device()) {
             klog(LOG_ERROR, "SOCKET: No network device available for sending.");
             return -1;
         }
@@ -182,12 +194,18 @@ int sock_recv(socket_t *sock, void *buf, size_t len, int flags) {
         }
 
         // Wait for data if buffer is empty
+        wait_queue_entry_t wait;
+        wait_entry_init(&wait, get_current_thread());
+        wait_queue_add(&sock->wq, &wait);
+        uint64_t irq_flags = spin_lock_irqsave(&sock->lock);
         while (sock->proto_data.udp_data.recv_data_len == 0) {
-            // This is a blocking call. Put current thread to sleep.
-            sock->waiting_thread = get_current_thread();
+            // This is a blocking call. Put current thread to sleep. The state
+            // is set under the lock so a packet arriving before schedule()
+            // still wakes us up.
             get_current_thread()->state = THREAD_BLOCKED;
+            spin_unlock_irqrestore(&sock->lock, irq_flags);
             schedule(); // Yield CPU until woken up by interrupt handler
-            sock->waiting_thread = NULL; // Clear after waking up
+            irq_flags = spin_lock_irqsave(&sock->lock);
         }
 
         size_t bytes_to_copy = len;
@@ -202,6 +220,8 @@ int sock_recv(socket_t *sock, void *buf, size_t len, int flags) {
         if (sock->proto_data.udp_data.recv_data_len == 0) {
             sock->proto_data.udp_data.recv_read_idx = 0;
         }
+        spin_unlock_irqrestore(&sock->lock, irq_flags);
+        wait_queue_remove(&sock->wq, &wait);
         klog(LOG_INFO, "SOCKET: UDP recv: %d bytes.", bytes_to_copy);
         return bytes_to_copy;
     }
@@ -210,24 +230,78 @@ int sock_recv(socket_t *sock, void *buf, size_t len, int flags) {
     return -1;
 }
 
-int sock_close(socket_t *sock) {
-    if (!sock) {
+int sock_send_user(socket_t *sock, const void *user_buf, size_t len, int flags) {
+    // A datagram goes out whole, so it's copied in whole
+    if (len == 0 || len > SOCK_USER_MAX) {
         return -1;
     }
-    // Remove from active sockets list
-    socket_t **current = &active_sockets;
-    while (*current) {
-        if (*current == sock) {
-            *current = sock->next;
-            break;
-        }
-        current = &(*current)->next;
+    uint8_t *bounce = (uint8_t *)kmalloc(len);
+    if (!bounce) {
+        return -1;
     }
+    int ret = -1;
+    if (copy_from_user(bounce, user_buf, len) == 0) {
+        ret = sock_send(sock, bounce, len, flags);
+    }
+    kfree(bounce);
+    return ret;
+}
+
+int sock_recv_user(socket_t *sock, void *user_buf, size_t len, int flags) {
+    if (len > SOCK_USER_MAX) {
+        len = SOCK_USER_MAX; // No datagram is bigger
+    }
+    uint8_t *bounce = (uint8_t *)kmalloc(len ? len : 1);
+    if (!bounce) {
+        return -1;
+    }
+    int ret = sock_recv(sock, bounce, len, flags);
+    if (ret > 0 && copy_to_user(user_buf, bounce, (size_t)ret) != 0) {
+        ret = -1; // The datagram is gone either way
+    }
+    kfree(bounce);
+    return ret;
+}
 
+uint32_t sock_poll(socket_t *sock) {
+    if (sock->protocol != IPPROTO_UDP) {
+        return 0; // TCP can't send or receive yet
+    }
+    uint32_t events = 0;
+    uint64_t flags = spin_lock_irqsave(&sock->lock);
+    if (sock->proto_data.udp_data.recv_data_len > 0) {
+        events |= POLLIN;
+    }
+    spin_unlock_irqrestore(&sock->lock, flags);
+    if (sock->state == SOCK_STATE_CONNECTED) {
+        events |= POLLOUT; // Sends go straight to the device
+    }
+    return events;
+}
+
+static void sock_free(rcu_head_t *head) {
+    socket_t *sock = rcu_container_of(head, socket_t, rcu);
     if (sock->protocol == IPPROTO_UDP && sock->proto_data.udp_data.recv_buffer) {
         kfree(sock->proto_data.udp_data.recv_buffer);
     }
     kfree(sock);
+}
+
+int sock_close(socket_t *sock) {
+    if (!sock) {
+        return -1;
+    }
+    // Remove from active sockets list. The port is released in the same
+    // step, so a bind that finds it free can also register it.
+    uint64_t flags = spin_lock_irqsave(&sockets_lock);
+    rcu_list_del(active_sockets, sock);
+    uint16_t port = sock->state != SOCK_STATE_CLOSED ? sock->local_addr.sin_port : 0;
+    if (sock->protocol == IPPROTO_UDP && port) {
+        udp_unregister_handler(__builtin_bswap16(port), sock); // Only if still ours
+    }
+    spin_unlock_irqrestore(&sockets_lock, flags);
+    // The receive path may still be looking at it
+    call_rcu(&sock->rcu, sock_free);
     klog(LOG_INFO, "SOCKET: Closed socket.");
     return 0;
 }
@@ -240,18 +314,29 @@ int sock_bind(socket_t *sock, const sockaddr_in_t *addr) {
 
     if (sock->protocol == IPPROTO_UDP) {
         // Ensure port is not already in use
-        socket_t *current_sock = active_sockets;
-        while (current_sock) {
+        uint64_t flags = spin_lock_irqsave(&sockets_lock);
+        if (sock->local_addr.sin_port != 0) {
+            spin_unlock_irqrestore(&sockets_lock, flags);
+            return -1; // Already bound
+        }
+        for (socket_t *current_sock = active_sockets; current_sock; current_sock = current_sock->next) {
             if (current_sock != sock && current_sock->protocol == IPPROTO_UDP && current_sock->local_addr.sin_port == addr->sin_port) {
+                spin_unlock_irqrestore(&sockets_lock, flags);
                 klog(LOG_ERROR, "SOCKET: Bind failed: Port %d already in use.", __builtin_bswap16(addr->sin_port));
                 return -1; // Port already in use
             }
-            current_sock = current_sock->next;
+        }
+        // Register the receive handler for this port with the UDP layer.
+        // This fails if a kernel service like DHCP already has the port.
+        if (udp_register_handler(__builtin_bswap16(addr->sin_port), sock_udp_receive_packet_handler,
+                                 sock) != 0) {
+            spin_unlock_irqrestore(&sockets_lock, flags);
+            klog(LOG_ERROR, "SOCKET: Bind failed: Port %d already in use.", __builtin_bswap16(addr->sin_port));
+            return -1;
         }
         memcpy(&sock->local_addr, addr, sizeof(sockaddr_in_t));
         sock->state = SOCK_STATE_BOUND;
-        // Register the receive handler for this port with the UDP layer
-        udp_register_handler(__builtin_bswap16(addr->sin_port), sock_udp_receive_packet_handler);
+        spin_unlock_irqrestore(&sockets_lock, flags);
         klog(LOG_INFO, "SOCKET: UDP socket bound to port %d", __builtin_bswap16(addr->sin_port));
         return 0;
     }
@@ -0,0 +1,216 @@
+#include "spinlock.h"
+#include "cpu.h"
+#include "isr.h" // For local_irq_save/restore
+#include "kstring.h"
+#include "log.h"
+#include "preempt.h"
+#include "smp.h" // For the per-CPU held lock stack
+#include <stdbool.h>
+#include <stddef.h>
+
+// All locks that have been acquired at least once, newest first.
+static spinlock_t *lock_registry = NULL;
+static volatile int next_lock_id = 1;
+
+#if CONFIG_LOCKDEP
+// lock_order[a] has bit b set once lock class b was taken while a was held.
+// The stack of currently held locks lives in cpu_t.
+static uint64_t lock_order[LOCKDEP_MAX_CLASSES];
+#endif
+
+void spinlock_init(spinlock_t *lock, const char *name) {
+    lock->next_ticket = 0;
+    lock->owner_ticket = 0;
+    lock->name = name;
+    lock->registered = 0;
+    lock->id = 0;
+    lock->next_registered = NULL;
+#if CONFIG_LOCK_STATS
+    lock->acquisitions = 0;
+    lock->contended = 0;
+    lock->spin_cycles = 0;
+#endif
+}
+
+static void spinlock_register(spinlock_t *lock) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&lock->registered, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return; // Someone else got here first
+    }
+    lock->id = __atomic_fetch_add(&next_lock_id, 1, __ATOMIC_RELAXED);
+
+    spinlock_t *head = __atomic_load_n(&lock_registry, __ATOMIC_RELAXED);
+    do {
+        lock->next_registered = head;
+    } while (!__atomic_compare_exchange_n(&lock_registry, &head, lock, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+#if CONFIG_LOCKDEP
+static const char *lock_name(spinlock_t *lock) {
+    return lock->name ? lock->name : "(anon)";
+}
+
+static void lockdep_acquire(spinlock_t *lock) {
+    int id = lock->id;
+    if (id <= 0 || id > LOCKDEP_MAX_CLASSES) {
+        return; // Out of class slots, don't track
+    }
+    int cls = id - 1;
+    cpu_t *cpu = this_cpu();
+
+    for (int i = 0; i < cpu->held_depth; i++) {
+        spinlock_t *held = cpu->held_locks[i];
+        if (held == lock) {
+            klog(LOG_ERROR, "LOCKDEP: recursive acquisition of '%s'", lock_name(lock));
+            panic("LOCKDEP: recursive spinlock acquisition", NULL);
+        }
+        int held_id = held->id;
+        if (held_id <= 0 || held_id > LOCKDEP_MAX_CLASSES) {
+            continue;
+        }
+        int held_cls = held_id - 1;
+
+        // If `lock` was ever held while taking `held`, we're now doing the
+        // reverse and two CPUs can deadlock.
+        if (lock_order[cls] & (1ULL << held_cls)) {
+            klog(LOG_WARN, "LOCKDEP: lock order inversion: '%s' taken while holding '%s'",
+                 lock_name(lock), lock_name(held));
+        }
+        __atomic_fetch_or(&lock_order[held_cls], 1ULL << cls, __ATOMIC_RELAXED);
+    }
+
+    if (cpu->held_depth < LOCKDEP_MAX_DEPTH) {
+        cpu->held_locks[cpu->held_depth++] = lock;
+    } else {
+        klog(LOG_WARN, "LOCKDEP: too many locks held, not tracking '%s'", lock_name(lock));
+    }
+}
+
+static void lockdep_release(spinlock_t *lock) {
+    // Locks are usually released in LIFO order but don't have to be.
+    cpu_t *cpu = this_cpu();
+    for (int i = cpu->held_depth - 1; i >= 0; i--) {
+        if (cpu->held_locks[i] == lock) {
+            for (int j = i; j < cpu->held_depth - 1; j++) {
+                cpu->held_locks[j] = cpu->held_locks[j + 1];
+            }
+            cpu->held_depth--;
+            return;
+        }
+    }
+    if (lock->id > 0 && lock->id <= LOCKDEP_MAX_CLASSES) {
+        klog(LOG_WARN, "LOCKDEP: releasing '%s' which is not held", lock_name(lock));
+    }
+}
+#endif
+
+void spin_lock(spinlock_t *lock) {
+    // The holder must not be switched out, or the next thread on this CPU
+    // could spin on it for a whole time slice
+    preempt_disable();
+    if (!lock->registered) {
+        spinlock_register(lock);
+    }
+
+    uint32_t ticket = __atomic_fetch_add(&lock->next_ticket, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&lock->owner_ticket, __ATOMIC_ACQUIRE) != ticket) {
+#if CONFIG_LOCK_STATS
+        uint64_t start = rdtsc();
+#endif
+        while (__atomic_load_n(&lock->owner_ticket, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+#if CONFIG_LOCK_STATS
+        // Counters are only touched by the owner, so plain updates are fine.
+        lock->contended++;
+        lock->spin_cycles += rdtsc() - start;
+#endif
+    }
+
+#if CONFIG_LOCK_STATS
+    lock->acquisitions++;
+#endif
+#if CONFIG_LOCKDEP
+    lockdep_acquire(lock);
+#endif
+}
+
+int spin_trylock(spinlock_t *lock) {
+    preempt_disable();
+    if (!lock->registered) {
+        spinlock_register(lock);
+    }
+
+    uint32_t owner = __atomic_load_n(&lock->owner_ticket, __ATOMIC_RELAXED);
+    uint32_t expected = owner;
+    // Only take a ticket if it would be served immediately.
+    if (!__atomic_compare_exchange_n(&lock->next_ticket, &expected, owner + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        preempt_enable_no_resched();
+        return 0;
+    }
+
+#if CONFIG_LOCK_STATS
+    lock->acquisitions++;
+#endif
+#if CONFIG_LOCKDEP
+    lockdep_acquire(lock);
+#endif
+    return 1;
+}
+
+static inline void spin_release(spinlock_t *lock) {
+#if CONFIG_LOCKDEP
+    lockdep_release(lock);
+#endif
+    __atomic_store_n(&lock->owner_ticket, lock->owner_ticket + 1, __ATOMIC_RELEASE);
+}
+
+void spin_unlock(spinlock_t *lock) {
+    spin_release(lock);
+    preempt_enable(); // Preemption point, if interrupts are on
+}
+
+uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_release(lock);
+    local_irq_restore(flags);
+    preempt_enable(); // Now that interrupts may be back on
+}
+
+void spinlock_dump_stats(void) {
+    char buf[160];
+#if CONFIG_LOCK_STATS
+    klog_print_str("Lock                    Acquired     Contended    Spin cycles\n");
+    for (spinlock_t *lock = lock_registry; lock; lock = lock->next_registered) {
+        const char *name = lock->name ? lock->name : "(anon)";
+        int len = ksprintf(buf, "%s", name);
+        while (len < 24) {
+            buf[len++] = ' ';
+        }
+        ksprintf(buf + len, "%12lu %12lu %14lu\n", lock->acquisitions, lock->contended, lock->spin_cycles);
+        klog_print_str(buf);
+    }
+#else
+    klog_print_str("Lock statistics are disabled (CONFIG_LOCK_STATS=0).\n");
+    for (spinlock_t *lock = lock_registry; lock; lock = lock->next_registered) {
+        ksprintf(buf, "%s\n", lock->name ? lock->name : "(anon)");
+        klog_print_str(buf);
+    }
+#endif
+}
+
+void spinlock_reset_stats(void) {
+#if CONFIG_LOCK_STATS
+    for (spinlock_t *lock = lock_registry; lock; lock = lock->next_registered) {
+        lock->acquisitions = 0;
+        lock->contended = 0;
+        lock->spin_cycles = 0;
+    }
+#endif
+}
@@ -17,29 +17,45 @@ void *memcpy(void *dest, const void *src, size_t n) {
 void *memmove(void *dest, const void *src, size_t n) {
     unsigned char *d = dest;
     const unsigned char *s = src;
-    if (d == s) {
+    if (d == s || n == 0) {
         return d;
     }
-    if (d < s) {
-        // Copy forwards
-        for (size_t i = 0; i < n; i++) {
-            d[i] = s[i];
-        }
-    } else {
-        // Copy backwards
-        for (size_t i = n; i != 0; i--) {
-            d[i-1] = s[i-1];
-        }
+    if (d < s || d >= s + n) {
+        // Copying forwards is safe, and fast string ops make it the quick path
+        return memcpy(dest, src, n);
     }
+
+    // Overlapping with dest above src: copy backwards, 8 bytes at a time
+    // while we can.
+    size_t tail = n & 7;
+    size_t words = n >> 3;
+    const unsigned char *s_end = s + n - 1;
+    unsigned char *d_end = d + n - 1;
+    __asm__ __volatile__ (
+        "std;"
+        "rep movsb;"
+        "sub $7, %%rsi;"
+        "sub $7, %%rdi;"
+        "mov %%rdx, %%rcx;"
+        "rep movsq;"
+        "cld"
+        : "+D"(d_end), "+S"(s_end), "+c"(tail)
+        : "d"(words)
+        : "memory", "cc"
+    );
     return dest;
 }
 
 void *memset(void *s, int c, size_t n) {
-  uint8_t *p = (uint8_t *)s;
-  for (size_t i = 0; i < n; i++) {
-    p[i] = (uint8_t)c;
-  }
-  return s;
+    void *p = s;
+    __asm__ __volatile__ (
+        "cld;"
+        "rep stosb"
+        : "+D"(p), "+c"(n)
+        : "a"(c)
+        : "memory"
+    );
+    return s;
 }
 
 // Simple implementation of __memcpy_chk that just calls our memcpy
@@ -163,25 +179,28 @@ int vksprintf(char *buffer, const char *format, va_list args) {
       int padding = 0;
       char pad_char = ' ';
 
-      // Check for padding like %02d or %04d
+      // Check for padding like %02d, %04d or %12lu
       if (*format == '0') {
+        pad_char = '0';
         format++;
-        if (*format >= '0' && *format <= '9') {
-          padding = *format - '0';
+      }
+      if (*format >= '0' && *format <= '9') {
+        padding = *format - '0';
+        format++;
+        if (*format >= '0' && *format <= '9') { // For %04d
+          padding = padding * 10 + (*format - '0');
           format++;
-          if (*format >= '0' && *format <= '9') { // For %04d
-            padding = padding * 10 + (*format - '0');
-            format++;
-          }
-          pad_char = '0';
         }
       }
 
-      // Check for 'l' modifier for 64-bit hex
+      // Check for 'l'/'ll' modifier for 64-bit values
       bool is_long = false;
       if (*format == 'l') {
           is_long = true;
           format++;
+          if (*format == 'l') {
+            format++;
+          }
       }
 
       switch (*format) {
@@ -245,6 +264,28 @@ int vksprintf(char *buffer, const char *format, va_list args) {
         }
         break;
       }
+      case 'u': {
+        uint64_t val;
+        if (is_long) {
+          val = va_arg(args, uint64_t);
+        } else {
+          val = va_arg(args, uint32_t);
+        }
+        char dec_buf[20];
+        int i = 0;
+        do {
+          dec_buf[i++] = (val % 10) + '0';
+          val /= 10;
+        } while (val > 0);
+
+        for (int j = 0; j < padding - i; j++) {
+          *buf_ptr++ = pad_char;
+        }
+        while (i > 0) {
+          *buf_ptr++ = dec_buf[--i];
+        }
+        break;
+      }
       default:
         if (pad_char == '0' && padding > 0) { // If it was a %0X but not %0Xd
           *buf_ptr++ = '%';
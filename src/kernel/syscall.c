@@ -1,101 +1,183 @@
 #include "syscall.h"
+#include "syscall_stats.h"
 #include "vfs.h"
 #include "pmm.h"
 #include "elf.h"
 #include "event.h"
 #include "fb.h"
+#include "futex.h"
 #include "heap.h"
+#include "io_ring.h"
+#include "poll.h"
 #include "isr.h" // For timer_get_ticks
+#include "clock.h"
+#include "cpu.h" // For wrmsr, MSR_FS_BASE, rdtsc
+#include "gdt.h" // For the MSR_STAR selectors
+#include "preempt.h"
 #include "kstring.h"
 #include "log.h"
 #include "scheduler.h"
 #include "thread.h"
+#include "uaccess.h"
 #include "vfs.h"
 #include "vmm.h"
 #include "pmm.h"
 #include "socket.h" // For socket_t, etc.
 #include "kstring.h" // For strrchr
+#include <stdbool.h>
 
 // HHDM offset from kernel.c, needed for V_TO_P
 extern uint64_t hhdm_offset;
 #define V_TO_P(v) ((void*)((uint64_t)(v) - hhdm_offset))
 
+// Most entries SYS_THREAD_STATS returns in one call
+#define THREAD_STATS_MAX 256
+
+// Largest kernel buffer file data is bounced through
+#define FILE_BOUNCE_MAX (1024 * 1024)
+
 typedef void (*syscall_func_t)(struct registers *regs);
 static syscall_func_t syscall_table[256];
 
 static void sys_exit(struct registers *regs) {
-  (void)regs;
-  thread_exit();
+  thread_exit((int)regs->rdi);
 }
 
-static void sys_write(struct registers *regs) {
-  int fd = (int)regs->rdi;
-  char *buffer = (char *)regs->rsi;
-  size_t size = (size_t)regs->rdx;
-  thread_t *t = get_current_thread();
+// Read or write `size` bytes of a file at `pos` from or to a user buffer.
+// Filesystems only ever see kernel memory: the data goes through a bounce
+// buffer, so a bad pointer fails the copy instead of faulting inside them.
+// Returns the bytes transferred, stopping at a short transfer or a fault,
+// or -1 if it failed before anything was transferred.
+static int64_t file_rw_user(vfs_node_t *node, uint64_t pos, void *user_buf, size_t size,
+                            bool write) {
+  if (size == 0) {
+    return 0;
+  }
+  size_t chunk = size < FILE_BOUNCE_MAX ? size : FILE_BOUNCE_MAX;
+  uint8_t *bounce = (uint8_t *)kmalloc(chunk);
+  if (!bounce) {
+    return -1;
+  }
+  size_t done = 0;
+  bool failed = false;
+  while (done < size) {
+    uint32_t len = (uint32_t)(size - done < chunk ? size - done : chunk);
+    uint8_t *ubuf = (uint8_t *)user_buf + done;
+    if (write && copy_from_user(bounce, ubuf, len) != 0) {
+      failed = true;
+      break;
+    }
+    uint32_t n = write ? vfs_write(node, pos + done, len, bounce)
+                       : vfs_read(node, pos + done, len, bounce);
+    if (n == (uint32_t)-1 || (!write && copy_to_user(ubuf, bounce, n) != 0)) {
+      failed = true;
+      break;
+    }
+    done += n;
+    if (n < len) {
+      break;
+    }
+  }
+  kfree(bounce);
+  return done == 0 && failed ? -1 : (int64_t)done;
+}
 
+int64_t ksys_write(fd_table_t *files, int fd, const void *buffer, size_t size) {
+  if (!access_ok(buffer, size)) {
+    return -1;
+  }
   if (fd == 1) { // stdout
     klog(LOG_DEBUG, "SYS_WRITE: stdout request from userspace. Buffer: %p, Size: %d", buffer, size);
     
     char kbuf[1024]; 
     size_t len_to_copy = (size < 1023) ? size : 1023;
 
-    // This is the danger zone. If the userspace pointer is invalid, this will page fault.
-    memcpy(kbuf, buffer, len_to_copy);
+    if (copy_from_user(kbuf, buffer, len_to_copy) != 0) {
+      return -1;
+    }
     kbuf[len_to_copy] = '\0';
 
     klog(LOG_DEBUG, "SYS_WRITE: Copied user buffer. Content: %s", kbuf);
 
     klog_print_str(kbuf);
-    regs->rax = len_to_copy;
-    return;
+    return len_to_copy;
   }
   
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type == FD_TYPE_NONE) {
-    regs->rax = -1; // Invalid FD or not open
-    return;
+  fd_entry_t *f = fd_get(files, fd);
+  if (!f) {
+    return -1; // Invalid FD or not open
   }
   
-  if (t->fd_table[fd].type == FD_TYPE_FILE) {
-      uint64_t current_offset = t->fd_table[fd].data.file.offset;
-      if (t->fd_table[fd].data.file.flags & O_APPEND) {
-          current_offset = t->fd_table[fd].data.file.node->length; // For append, write at end
+  int64_t ret;
+  if (f->type == FD_TYPE_FILE) {
+      uint64_t current_offset = f->data.file.offset;
+      if (f->data.file.flags & O_APPEND) {
+          current_offset = f->data.file.node->length; // For append, write at end
       }
       
-      regs->rax = vfs_write(t->fd_table[fd].data.file.node, current_offset, size, (uint8_t*)buffer);
-      if (regs->rax != -1) {
-          t->fd_table[fd].data.file.offset = current_offset + regs->rax; // Update offset
+      ret = file_rw_user(f->data.file.node, current_offset, (void*)buffer, size, true);
+      if (ret >= 0) {
+          f->data.file.offset = current_offset + ret; // Update offset
       }
-  } else if (t->fd_table[fd].type == FD_TYPE_SOCKET) {
+  } else if (f->type == FD_TYPE_SOCKET) {
       // Handle socket write
-      regs->rax = sock_send(t->fd_table[fd].data.sock, buffer, size, 0); // Flags 0 for now
+      ret = sock_send_user(f->data.sock, buffer, size, 0); // Flags 0 for now
   } else {
-      regs->rax = -1; // Invalid FD type
+      ret = -1; // Invalid FD type
   }
+  fd_put(f);
+  return ret;
 }
 
-static void sys_open(struct registers *regs) {
-  char *user_path = (char *)regs->rdi;
-  int flags = (int)regs->rsi; // Get flags from rsi
+static void sys_write(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  char *buffer = (char *)regs->rsi;
+  size_t size = (size_t)regs->rdx;
+
+  regs->rax = ksys_write(get_current_thread()->files, fd, buffer, size);
+}
+
+// Directory a *at() path starts from: the root for absolute paths and
+// AT_FDCWD (there's no working directory yet), otherwise the directory open
+// as `dirfd`. A reference to it is left in *held, NULL for the root; drop it
+// with fd_put() once done with the node.
+static vfs_node_t *at_base(fd_table_t *files, int dirfd, const char *path, fd_entry_t **held) {
+  *held = NULL;
+  if (path[0] == '/' || dirfd == AT_FDCWD) {
+    return vfs_root;
+  }
+  fd_entry_t *f = fd_get(files, dirfd);
+  if (!f) {
+    return NULL;
+  }
+  if (f->type != FD_TYPE_FILE || !(f->data.file.node->flags & VFS_DIRECTORY)) {
+    fd_put(f);
+    return NULL;
+  }
+  *held = f;
+  return f->data.file.node;
+}
+
+static void at_done(fd_entry_t *held) {
+  if (held) {
+    fd_put(held);
+  }
+}
 
+int ksys_openat(fd_table_t *files, int dirfd, const char *user_path, int flags) {
   // Copy path from userspace to a kernel buffer to avoid faulting.
   char path[MAX_FILENAME_LEN];
-  // A proper implementation would validate this pointer and the memory it points to.
-  // For now, this is a stop-gap to prevent the most obvious kernel crashes.
-  // We assume the user process will fault if it passes a bad pointer.
-  // A simple strncpy is not safe, but it's the best we can do without a full
-  // copy_from_user implementation. Let's assume it faults inside the user process
-  // if the pointer is bad, and we handle that fault. (This is a big assumption).
-  // A slightly safer, but still not perfect, approach is to check the pointer is in userspace.
-  if ((uint64_t)user_path >= hhdm_offset) {
-      regs->rax = -1; // Pointer is in kernel space, deny.
-      return;
+  if (strncpy_from_user(path, user_path, sizeof(path)) < 0) {
+      return -1;
   }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
 
+  fd_entry_t *held;
+  vfs_node_t *base = at_base(files, dirfd, path, &held);
+  if (!base) {
+      return -1;
+  }
 
-  vfs_node_t *node = vfs_resolve_path(vfs_root, path);
+  vfs_node_t *node = vfs_resolve_path(base, path);
   
   // Handle O_CREAT flag
   if (!node && (flags & O_CREAT)) {
@@ -103,177 +185,622 @@ static void sys_open(struct registers *regs) {
       char parent_path[MAX_FILENAME_LEN];
       char filename[MAX_FILENAME_LEN];
       char *last_slash = strrchr(path, '/');
-      vfs_node_t *parent_node = vfs_root;
+      vfs_node_t *parent_node = base;
 
       if (last_slash) {
           int parent_len = last_slash - path;
           strncpy(parent_path, path, parent_len);
           parent_path[parent_len] = '\0';
           strncpy(filename, last_slash + 1, MAX_FILENAME_LEN);
-          parent_node = vfs_resolve_path(vfs_root, parent_path);
+          parent_node = vfs_resolve_path(base, parent_path);
       } else {
-          // File in root, or current directory for relative path.
-          // For now, assume root for simplicity if no parent path given.
+          // A name in the base directory
           strncpy(filename, path, MAX_FILENAME_LEN);
       }
 
       if (!parent_node || !(parent_node->flags & VFS_DIRECTORY)) {
-          regs->rax = -1; // Parent not found or not a directory
           klog(LOG_WARN, "SYSCALL: sys_open: Parent directory not found or invalid for %s", path);
-          return;
+          at_done(held);
+          return -1; // Parent not found or not a directory
       }
       
       if (vfs_create(parent_node, filename, 0) != 0) { // Mode 0 for now
-          regs->rax = -1; // Creation failed
           klog(LOG_ERROR, "SYSCALL: sys_open: Failed to create file %s", path);
-          return;
+          at_done(held);
+          return -1; // Creation failed
       }
-      node = vfs_resolve_path(vfs_root, path); // Resolve again to get the newly created node
+      node = vfs_finddir(parent_node, filename); // Get the newly created node
       if (!node) {
-          regs->rax = -1; // Should not happen if create succeeded
           klog(LOG_ERROR, "SYSCALL: sys_open: Created file %s but could not resolve it.", path);
-          return;
+          at_done(held);
+          return -1; // Should not happen if create succeeded
       }
   } else if (!node) {
-      regs->rax = -1; // File not found and O_CREAT not set
       klog(LOG_WARN, "SYSCALL: sys_open: File not found: %s", path);
-      return;
+      at_done(held);
+      return -1; // File not found and O_CREAT not set
   }
+  at_done(held);
 
-  // File exists or was created, now handle other flags
-  if (node->open) {
-      node->open(node, flags);
-  }
+  // File exists or was created, now handle other flags. The descriptor
+  // closes it again when the last reference goes.
+  vfs_open(node, flags);
 
-        thread_t *t = get_current_thread();
-        for (int i = 0; i < MAX_FILES; i++) {
-          if (t->fd_table[i].type == FD_TYPE_NONE) { // Check if slot is free
-            t->fd_table[i].type = FD_TYPE_FILE;
-            t->fd_table[i].data.file.node = node;
-            t->fd_table[i].data.file.flags = flags;
-            t->fd_table[i].data.file.offset = (flags & O_APPEND) ? node->length : 0; // Set initial offset for append
-            regs->rax = i; // Return the file descriptor
-            return;
-          }
-        }
-  regs->rax = -1; // No free file descriptors
+  fd_entry_t *f = fd_entry_alloc(FD_TYPE_FILE);
+  if (!f) {
+    vfs_close(node);
+  } else {
+    f->data.file.node = node;
+    f->data.file.flags = flags;
+    f->data.file.offset = (flags & O_APPEND) ? node->length : 0; // Set initial offset for append
+    int fd = fd_install(files, f);
+    if (fd >= 0) {
+      return fd; // Return the file descriptor
+    }
+    fd_put(f);
+  }
   klog(LOG_ERROR, "SYSCALL: sys_open: No free file descriptors for %s", path);
+  return -1; // No free file descriptors
+}
+
+int ksys_open(fd_table_t *files, const char *user_path, int flags) {
+  return ksys_openat(files, AT_FDCWD, user_path, flags);
+}
+
+static void sys_openat(struct registers *regs) {
+  int dirfd = (int)regs->rdi;
+  const char *user_path = (const char *)regs->rsi;
+  int flags = (int)regs->rdx;
+
+  regs->rax = ksys_openat(get_current_thread()->files, dirfd, user_path, flags);
+}
+
+static void sys_open(struct registers *regs) {
+  const char *user_path = (const char *)regs->rdi;
+  int flags = (int)regs->rsi; // Get flags from rsi
+
+  regs->rax = ksys_open(get_current_thread()->files, user_path, flags);
 }
 
 static void sys_close(struct registers *regs) {
   int fd = (int)regs->rdi;
   thread_t *t = get_current_thread();
   
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type == FD_TYPE_NONE) {
-    regs->rax = -1;
-    return;
+  // The file or socket itself is closed once nothing else is using it
+  regs->rax = fd_close(t->files, fd);
+}
+int64_t ksys_read(fd_table_t *files, int fd, void *buf, size_t size) {
+  if (!access_ok(buf, size)) {
+    return -1;
+  }
+  fd_entry_t *f = fd_get(files, fd);
+  if (!f) {
+    return -1;
   }
   
-  if (t->fd_table[fd].type == FD_TYPE_FILE) {
-      // TODO: Call node->close if implemented (for files)
-      t->fd_table[fd].type = FD_TYPE_NONE; // Clear type
-      t->fd_table[fd].data.file.node = NULL; // Clear node, reset other fields
-      t->fd_table[fd].data.file.offset = 0;
-      t->fd_table[fd].data.file.flags = 0;
-  } else if (t->fd_table[fd].type == FD_TYPE_SOCKET) {
-      // Close socket
-      sock_close(t->fd_table[fd].data.sock);
-      t->fd_table[fd].type = FD_TYPE_NONE; // Clear type
-      t->fd_table[fd].data.sock = NULL;
+  int64_t ret;
+  if (f->type == FD_TYPE_FILE) {
+      // Read from current offset
+      ret = file_rw_user(f->data.file.node, f->data.file.offset, buf, size, false);
+      if (ret >= 0) {
+          f->data.file.offset += ret; // Update offset
+      }
+  } else if (f->type == FD_TYPE_SOCKET) {
+      // Handle socket read
+      ret = sock_recv_user(f->data.sock, buf, size, 0); // Flags 0 for now
+  } else if (f->type == FD_TYPE_INPUT) {
+      ret = event_read(buf, size);
+  } else {
+      ret = -1; // Invalid FD type
   }
-  regs->rax = 0;
+  fd_put(f);
+  return ret;
 }
+
 static void sys_read(struct registers *regs) {
   int fd = (int)regs->rdi;
   char* buf = (char*)regs->rsi;
   size_t size = (size_t)regs->rdx;
-  thread_t *t = get_current_thread();
 
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type == FD_TYPE_NONE) {
+  regs->rax = ksys_read(get_current_thread()->files, fd, buf, size);
+}
+
+// Reference to `fd` if it's an open file, NULL otherwise
+static fd_entry_t *fd_get_file(thread_t *t, int fd) {
+  fd_entry_t *f = fd_get(t->files, fd);
+  if (f && f->type != FD_TYPE_FILE) {
+    fd_put(f);
+    return NULL;
+  }
+  return f;
+}
+
+static void sys_lseek(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  int64_t offset = (int64_t)regs->rsi;
+  int whence = (int)regs->rdx;
+
+  fd_entry_t *f = fd_get_file(get_current_thread(), fd);
+  if (!f) {
+    regs->rax = -1; // Not open, or a socket: those have no position
+    return;
+  }
+  int64_t base;
+  switch (whence) {
+  case SEEK_SET: base = 0; break;
+  case SEEK_CUR: base = (int64_t)f->data.file.offset; break;
+  case SEEK_END: base = (int64_t)f->data.file.node->length; break;
+  default: base = -1; break;
+  }
+  // Seeking past the end is fine, a write there extends the file. Not past
+  // the largest file, though.
+  if (base < 0 || base + offset < 0 || (uint64_t)(base + offset) > VFS_FILE_SIZE_MAX) {
+    regs->rax = -1;
+  } else {
+    f->data.file.offset = (uint64_t)(base + offset);
+    regs->rax = f->data.file.offset;
+  }
+  fd_put(f);
+}
+
+// pread/pwrite use their own offset and leave the descriptor's alone, so
+// threads sharing a descriptor don't race on its position
+static void sys_pread(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  void *buf = (void *)regs->rsi;
+  size_t size = (size_t)regs->rdx;
+  uint64_t offset = regs->r10;
+
+  fd_entry_t *f = fd_get_file(get_current_thread(), fd);
+  if (!f || !access_ok(buf, size)) {
+    fd_put(f);
     regs->rax = -1;
     return;
   }
-  
-  if (t->fd_table[fd].type == FD_TYPE_FILE) {
-      // Read from current offset
-      regs->rax = vfs_read(t->fd_table[fd].data.file.node, t->fd_table[fd].data.file.offset, size, (uint8_t*)buf);
-      if (regs->rax != -1) {
-          t->fd_table[fd].data.file.offset += regs->rax; // Update offset
+  regs->rax = file_rw_user(f->data.file.node, offset, buf, size, false);
+  fd_put(f);
+}
+
+static void sys_pwrite(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  void *buf = (void *)regs->rsi;
+  size_t size = (size_t)regs->rdx;
+  uint64_t offset = regs->r10;
+
+  fd_entry_t *f = fd_get_file(get_current_thread(), fd);
+  if (!f || !access_ok(buf, size)) {
+    fd_put(f);
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = file_rw_user(f->data.file.node, offset, buf, size, true);
+  fd_put(f);
+}
+
+// Sum of the iovec lengths (of the kernel copy), or -1 if a buffer isn't in
+// userspace
+static int64_t iov_total(const iovec_t *iov, int iovcnt) {
+  int64_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > UINT32_MAX || !access_ok(iov[i].iov_base, iov[i].iov_len)) {
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+// One file transfer per buffer, at consecutive offsets, stopping at the
+// first short one. Sockets gather the buffers into one bounce buffer
+// instead, so a datagram is sent or received whole.
+static int64_t do_iov(fd_entry_t *f, const iovec_t *iov, int iovcnt, int64_t total,
+                      bool write) {
+  if (f->type == FD_TYPE_SOCKET) {
+    if (total > SOCK_USER_MAX) {
+      if (write) {
+        return -1; // Too big for one datagram
       }
-  } else if (t->fd_table[fd].type == FD_TYPE_SOCKET) {
-      // Handle socket read
-      regs->rax = sock_recv(t->fd_table[fd].data.sock, buf, size, 0); // Flags 0 for now
+      total = SOCK_USER_MAX;
+    }
+    uint8_t *bounce = (uint8_t *)kmalloc(total ? total : 1);
+    if (!bounce) {
+      return -1;
+    }
+    int64_t ret = 0;
+    if (write) {
+      size_t at = 0;
+      for (int i = 0; i < iovcnt && ret == 0; i++) {
+        if (copy_from_user(bounce + at, iov[i].iov_base, iov[i].iov_len) != 0) {
+          ret = -1;
+        }
+        at += iov[i].iov_len;
+      }
+      if (ret == 0) {
+        ret = sock_send(f->data.sock, bounce, total, 0);
+      }
+    } else {
+      ret = sock_recv(f->data.sock, bounce, total, 0);
+      size_t at = 0;
+      for (int i = 0; i < iovcnt && ret > 0 && at < (size_t)ret; i++) {
+        size_t len = iov[i].iov_len;
+        if (len > (size_t)ret - at) {
+          len = (size_t)ret - at;
+        }
+        if (copy_to_user(iov[i].iov_base, bounce + at, len) != 0) {
+          ret = -1; // The data is gone either way
+          break;
+        }
+        at += len;
+      }
+    }
+    kfree(bounce);
+    return ret;
+  }
+  if (f->type != FD_TYPE_FILE) {
+    return -1;
+  }
+
+  vfs_node_t *node = f->data.file.node;
+  uint64_t pos = f->data.file.offset;
+  if (write && (f->data.file.flags & O_APPEND)) {
+    pos = node->length;
+  }
+  int64_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    int64_t n = file_rw_user(node, pos, iov[i].iov_base, iov[i].iov_len, write);
+    if (n < 0) {
+      if (done == 0) {
+        return -1;
+      }
+      break;
+    }
+    pos += n;
+    done += n;
+    if ((size_t)n < iov[i].iov_len) {
+      break;
+    }
+  }
+  f->data.file.offset = pos;
+  return done;
+}
+
+static void sys_iov(struct registers *regs, bool write) {
+  int fd = (int)regs->rdi;
+  const iovec_t *user_iov = (const iovec_t *)regs->rsi;
+  int iovcnt = (int)regs->rdx;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    regs->rax = -1;
+    return;
+  }
+  // Work on a copy, so the lengths can't change between checking and use
+  iovec_t *iov = (iovec_t *)kmalloc(iovcnt * sizeof(iovec_t));
+  if (!iov) {
+    regs->rax = -1;
+    return;
+  }
+  int64_t total = -1;
+  if (copy_from_user(iov, user_iov, iovcnt * sizeof(iovec_t)) == 0) {
+    total = iov_total(iov, iovcnt);
+  }
+  fd_entry_t *f = fd_get(get_current_thread()->files, fd);
+  if (!f || total < 0) {
+    regs->rax = -1;
   } else {
-      regs->rax = -1; // Invalid FD type
+    regs->rax = do_iov(f, iov, iovcnt, total, write);
   }
+  fd_put(f);
+  kfree(iov);
+}
+
+static void sys_readv(struct registers *regs) {
+  sys_iov(regs, false);
+}
+
+static void sys_writev(struct registers *regs) {
+  sys_iov(regs, true);
+}
+
+static int stat_node(vfs_node_t *node, struct stat *user_buf) {
+  if (!node->stat) {
+    return -1; // Stat not implemented for this node
+  }
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  int ret = node->stat(node, &st);
+  if (ret == 0 && copy_to_user(user_buf, &st, sizeof(st)) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+static int stat_at(fd_table_t *files, int dirfd, const char *user_path, struct stat *stat_buf) {
+  char path[MAX_FILENAME_LEN];
+  if (strncpy_from_user(path, user_path, sizeof(path)) < 0) {
+    return -1;
+  }
+  fd_entry_t *held;
+  vfs_node_t *base = at_base(files, dirfd, path, &held);
+  if (!base) {
+    return -1;
+  }
+  vfs_node_t *node = vfs_resolve_path(base, path);
+  int ret = node ? stat_node(node, stat_buf) : -1;
+  at_done(held);
+  return ret;
 }
 
 static void sys_stat(struct registers *regs) {
   char *user_path = (char *)regs->rdi;
   struct stat *stat_buf = (struct stat *)regs->rsi;
 
-  char path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
+  regs->rax = stat_at(get_current_thread()->files, AT_FDCWD, user_path, stat_buf);
+}
 
-  // Also need to be careful with stat_buf pointer, but for now we assume it's valid
-  vfs_node_t *node = vfs_resolve_path(vfs_root, path);
-  if (!node) {
-    regs->rax = -1; // Not found
+static void sys_fstatat(struct registers *regs) {
+  int dirfd = (int)regs->rdi;
+  char *user_path = (char *)regs->rsi;
+  struct stat *stat_buf = (struct stat *)regs->rdx;
+
+  regs->rax = stat_at(get_current_thread()->files, dirfd, user_path, stat_buf);
+}
+
+static void sys_fstat(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  struct stat *stat_buf = (struct stat *)regs->rsi;
+
+  // The node is at hand, no path to walk
+  fd_entry_t *f = fd_get(get_current_thread()->files, fd);
+  if (!f) {
+    regs->rax = -1;
     return;
   }
-  
-  if (node->stat) {
-      regs->rax = node->stat(node, stat_buf);
-  } else {
-      regs->rax = -1; // Stat not implemented for this node
+  regs->rax = f->type == FD_TYPE_FILE ? stat_node(f->data.file.node, stat_buf) : -1;
+  fd_put(f);
+}
+
+static int mkdir_at(int dirfd, char *user_path) {
+  char path[MAX_FILENAME_LEN];
+  if (strncpy_from_user(path, user_path, sizeof(path)) < 0) {
+    return -1;
   }
+  fd_entry_t *held;
+  vfs_node_t *base = at_base(get_current_thread()->files, dirfd, path, &held);
+  if (!base) {
+    return -1;
+  }
+  int ret = vfs_mkdir(base, path, 0);
+  at_done(held);
+  return ret;
 }
 
 static void sys_mkdir(struct registers *regs) {
-  char *user_path = (char *)regs->rdi;
-
-  char path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
+  regs->rax = mkdir_at(AT_FDCWD, (char *)regs->rdi);
+}
 
-  regs->rax = vfs_mkdir(vfs_root, path, 0);
+static void sys_mkdirat(struct registers *regs) {
+  regs->rax = mkdir_at((int)regs->rdi, (char *)regs->rsi);
 }
 
 static void sys_readdir(struct registers *regs) {
-  vfs_node_t *node = (vfs_node_t *)regs->rdi;
+  int fd = (int)regs->rdi;
   uint32_t index = (uint32_t)regs->rsi;
   struct dirent *dir_entry = (struct dirent *)regs->rdx; // Third argument for dirent buffer
 
-  if (!node) {
-      node = vfs_root;
+  fd_entry_t *f = fd_get(get_current_thread()->files, fd);
+  if (!f || f->type != FD_TYPE_FILE) {
+    if (f) {
+      fd_put(f);
+    }
+    regs->rax = -1;
+    return;
   }
   
-  regs->rax = vfs_readdir(node, index, dir_entry); // vfs_readdir now returns int (1 for success, 0 for end)
+  struct dirent entry;
+  memset(&entry, 0, sizeof(entry));
+  int ret = vfs_readdir(f->data.file.node, index, &entry); // vfs_readdir now returns int (1 for success, 0 for end)
+  fd_put(f);
+  if (ret > 0 && copy_to_user(dir_entry, &entry, sizeof(entry)) != 0) {
+      ret = -1;
+  }
+  regs->rax = ret;
 }
 
-static void sys_unlink(struct registers *regs) {
-  char *user_path = (char*)regs->rdi;
-  
+static int unlink_at(int dirfd, char *user_path, int flags) {
   char path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
+  if (strncpy_from_user(path, user_path, sizeof(path)) < 0) {
+    return -1;
+  }
+  fd_entry_t *held;
+  vfs_node_t *base = at_base(get_current_thread()->files, dirfd, path, &held);
+  if (!base) {
+    return -1;
+  }
+  int ret = (flags & AT_REMOVEDIR) ? vfs_rmdir(base, path, 0) : vfs_remove(base, path);
+  at_done(held);
+  return ret;
+}
 
-  regs->rax = vfs_remove(vfs_root, path);
+static void sys_unlink(struct registers *regs) {
+  regs->rax = unlink_at(AT_FDCWD, (char *)regs->rdi, 0);
 }
 
 static void sys_rmdir(struct registers *regs) {
-  char *user_path = (char*)regs->rdi;
-  
-  char path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
+  regs->rax = unlink_at(AT_FDCWD, (char *)regs->rdi, AT_REMOVEDIR);
+}
 
-  regs->rax = vfs_rmdir(vfs_root, path, 0); // Mode 0 for now
+static void sys_unlinkat(struct registers *regs) {
+  regs->rax = unlink_at((int)regs->rdi, (char *)regs->rsi, (int)regs->rdx);
+}
+
+static int rename_at(int old_dirfd, char *user_old, int new_dirfd, char *user_new) {
+  char old_path[MAX_FILENAME_LEN];
+  char new_path[MAX_FILENAME_LEN];
+  if (strncpy_from_user(old_path, user_old, sizeof(old_path)) < 0 ||
+      strncpy_from_user(new_path, user_new, sizeof(new_path)) < 0) {
+    return -1;
+  }
+  fd_table_t *files = get_current_thread()->files;
+  fd_entry_t *old_held, *new_held;
+  vfs_node_t *old_base = at_base(files, old_dirfd, old_path, &old_held);
+  if (!old_base) {
+    return -1;
+  }
+  vfs_node_t *new_base = at_base(files, new_dirfd, new_path, &new_held);
+  int ret = new_base ? vfs_rename(old_base, old_path, new_base, new_path) : -1;
+  at_done(new_held);
+  at_done(old_held);
+  return ret;
+}
+
+static void sys_rename(struct registers *regs) {
+  regs->rax = rename_at(AT_FDCWD, (char *)regs->rdi, AT_FDCWD, (char *)regs->rsi);
+}
+
+static void sys_renameat(struct registers *regs) {
+  regs->rax = rename_at((int)regs->rdi, (char *)regs->rsi, (int)regs->rdx, (char *)regs->r10);
+}
+
+#define COPY_MAX (1U << 30)    // Most bytes one copy_file_range/sendfile moves
+#define SENDFILE_BUF (64 * 1024)
+#define SENDFILE_DGRAM 1472    // UDP payload that fits one Ethernet frame, there's no fragmentation
+
+// Where a copy starts in `f`: *user_off if given, else the file offset
+// (the end for an O_APPEND output)
+static int copy_pos(fd_entry_t *f, uint64_t *user_off, bool out, uint64_t *pos) {
+  if (user_off) {
+    return copy_from_user(pos, user_off, sizeof(*pos));
+  }
+  *pos = (out && (f->data.file.flags & O_APPEND)) ? f->data.file.node->length : f->data.file.offset;
+  return 0;
+}
+
+// Move the position copy_pos() returned past `n` copied bytes
+static void copy_advance(fd_entry_t *f, uint64_t *user_off, uint64_t pos, int64_t n) {
+  if (n <= 0) {
+    return;
+  }
+  if (user_off) {
+    uint64_t end = pos + (uint64_t)n;
+    copy_to_user(user_off, &end, sizeof(end));
+  } else {
+    f->data.file.offset = pos + (uint64_t)n;
+  }
+}
+
+static int64_t copy_file_range(int fd_in, uint64_t *off_in, int fd_out, uint64_t *off_out, size_t len) {
+  thread_t *t = get_current_thread();
+  fd_entry_t *in = fd_get_file(t, fd_in);
+  fd_entry_t *out = fd_get_file(t, fd_out);
+  uint64_t pos_in, pos_out;
+  int64_t ret = -1;
+  if (in && out && copy_pos(in, off_in, false, &pos_in) == 0 &&
+      copy_pos(out, off_out, true, &pos_out) == 0) {
+    uint32_t n = vfs_copy_range(in->data.file.node, pos_in, out->data.file.node, pos_out,
+                                len < COPY_MAX ? (uint32_t)len : COPY_MAX);
+    if (n != (uint32_t)-1) {
+      ret = n;
+      copy_advance(in, off_in, pos_in, ret);
+      copy_advance(out, off_out, pos_out, ret);
+    }
+  }
+  fd_put(out);
+  fd_put(in);
+  return ret;
+}
+
+static void sys_copy_file_range(struct registers *regs) {
+  regs->rax = copy_file_range((int)regs->rdi, (uint64_t *)regs->rsi, (int)regs->rdx,
+                              (uint64_t *)regs->r10, (size_t)regs->r8);
+}
+
+// Read `count` bytes of `in` into a kernel buffer and hand them to the
+// socket a datagram at a time
+static int64_t send_to_socket(vfs_node_t *in, uint64_t pos, socket_t *sock, size_t count) {
+  uint32_t size = count < SENDFILE_BUF ? (uint32_t)count : SENDFILE_BUF;
+  uint8_t *buf = (uint8_t *)kmalloc(size);
+  if (!buf) {
+    return -1;
+  }
+  int64_t done = 0;
+  while ((size_t)done < count) {
+    uint32_t want = count - done < size ? (uint32_t)(count - done) : size;
+    uint32_t r = vfs_read(in, pos + done, want, buf);
+    if (r == (uint32_t)-1 || r == 0) {
+      if (r == (uint32_t)-1 && done == 0) {
+        done = -1;
+      }
+      break;
+    }
+    for (uint32_t at = 0; at < r; at += SENDFILE_DGRAM) {
+      uint32_t len = r - at < SENDFILE_DGRAM ? r - at : SENDFILE_DGRAM;
+      if (sock_send(sock, buf + at, len, 0) < 0) {
+        kfree(buf);
+        return done ? done : -1;
+      }
+      done += len;
+    }
+    if (r < want) {
+      break;
+    }
+    cond_resched();
+  }
+  kfree(buf);
+  return done;
+}
+
+static int64_t sendfile(int out_fd, int in_fd, uint64_t *offset, size_t count) {
+  thread_t *t = get_current_thread();
+  fd_entry_t *in = fd_get_file(t, in_fd);
+  fd_entry_t *out = fd_get(t->files, out_fd);
+  uint64_t pos_in, pos_out;
+  int64_t ret = -1;
+  if (count > COPY_MAX) {
+    count = COPY_MAX;
+  }
+  if (in && out && copy_pos(in, offset, false, &pos_in) == 0) {
+    if (out->type == FD_TYPE_SOCKET) {
+      ret = send_to_socket(in->data.file.node, pos_in, out->data.sock, count);
+    } else if (out->type == FD_TYPE_FILE && copy_pos(out, NULL, true, &pos_out) == 0) {
+      uint32_t n = vfs_copy_range(in->data.file.node, pos_in, out->data.file.node, pos_out,
+                                  (uint32_t)count);
+      ret = n == (uint32_t)-1 ? -1 : (int64_t)n;
+      copy_advance(out, NULL, pos_out, ret);
+    }
+    copy_advance(in, offset, pos_in, ret);
+  }
+  fd_put(out);
+  fd_put(in);
+  return ret;
+}
+
+static void sys_sendfile(struct registers *regs) {
+  regs->rax = sendfile((int)regs->rdi, (int)regs->rsi, (uint64_t *)regs->rdx, (size_t)regs->r10);
+}
+
+// Reference to `fd` if it's an open socket, NULL otherwise
+static fd_entry_t *fd_get_socket(thread_t *t, int fd) {
+  fd_entry_t *f = fd_get(t->files, fd);
+  if (f && f->type != FD_TYPE_SOCKET) {
+    fd_put(f);
+    return NULL;
+  }
+  return f;
+}
+
+// Give `sock` a descriptor. On failure the socket is closed.
+static int install_socket(thread_t *t, socket_t *sock) {
+  fd_entry_t *f = fd_entry_alloc(FD_TYPE_SOCKET);
+  if (!f) {
+    sock_close(sock);
+    return -1;
+  }
+  f->data.sock = sock;
+  int fd = fd_install(t->files, f);
+  if (fd < 0) {
+    fd_put(f); // Closes the socket
+  }
+  return fd;
 }
 
 static void sys_socket(struct registers *regs) {
@@ -282,18 +809,12 @@ static void sys_socket(struct registers *regs) {
   int protocol = (int)regs->rdx;
 
   thread_t *t = get_current_thread();
-  for (int i = 0; i < MAX_FILES; i++) { // Reuse MAX_FILES for sockets too
-    if (t->fd_table[i].type == FD_TYPE_NONE) {
-      socket_t *sock = sock_create(domain, type, protocol);
-      if (sock) {
-        t->fd_table[i].type = FD_TYPE_SOCKET;
-        t->fd_table[i].data.sock = sock;
-        regs->rax = i; // Return socket descriptor
-        return;
-      }
-    }
+  socket_t *sock = sock_create(domain, type, protocol);
+  if (!sock) {
+    regs->rax = -1;
+    return;
   }
-  regs->rax = -1; // No free descriptors
+  regs->rax = install_socket(t, sock); // Socket descriptor, or -1
 }
 
 static void sys_connect(struct registers *regs) {
@@ -302,13 +823,20 @@ static void sys_connect(struct registers *regs) {
   // int addrlen = (int)regs->rdx; // Not used yet, assuming sockaddr_in_t size
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type != FD_TYPE_SOCKET) {
+  fd_entry_t *f = fd_get_socket(t, fd);
+  if (!f) {
     regs->rax = -1; // Not a valid socket FD
     return;
   }
 
-  socket_t *sock = t->fd_table[fd].data.sock;
-  regs->rax = sock_connect(sock, addr);
+  sockaddr_in_t kaddr;
+  if (copy_from_user(&kaddr, addr, sizeof(kaddr)) != 0) {
+    fd_put(f);
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = sock_connect(f->data.sock, &kaddr);
+  fd_put(f);
 }
 
 static void sys_bind(struct registers *regs) {
@@ -317,13 +845,20 @@ static void sys_bind(struct registers *regs) {
   // int addrlen = (int)regs->rdx; // Not used yet, assuming sockaddr_in_t size
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type != FD_TYPE_SOCKET) {
+  fd_entry_t *f = fd_get_socket(t, fd);
+  if (!f) {
     regs->rax = -1; // Not a valid socket FD
     return;
   }
 
-  socket_t *sock = t->fd_table[fd].data.sock;
-  regs->rax = sock_bind(sock, addr);
+  sockaddr_in_t kaddr;
+  if (copy_from_user(&kaddr, addr, sizeof(kaddr)) != 0) {
+    fd_put(f);
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = sock_bind(f->data.sock, &kaddr);
+  fd_put(f);
 }
 
 static void sys_listen(struct registers *regs) {
@@ -331,13 +866,14 @@ static void sys_listen(struct registers *regs) {
   int backlog = (int)regs->rsi;
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type != FD_TYPE_SOCKET) {
+  fd_entry_t *f = fd_get_socket(t, fd);
+  if (!f) {
     regs->rax = -1; // Not a valid socket FD
     return;
   }
 
-  socket_t *sock = t->fd_table[fd].data.sock;
-  regs->rax = sock_listen(sock, backlog);
+  regs->rax = sock_listen(f->data.sock, backlog);
+  fd_put(f);
 }
 
 static void sys_accept(struct registers *regs) {
@@ -346,26 +882,19 @@ static void sys_accept(struct registers *regs) {
   // size_t *addrlen = (size_t *)regs->rdx; // This is unused for now
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type != FD_TYPE_SOCKET) {
+  fd_entry_t *f = fd_get_socket(t, fd);
+  if (!f) {
     regs->rax = -1; // Not a valid socket FD
     return;
   }
 
-  socket_t *new_sock = sock_accept(t->fd_table[fd].data.sock, addr);
+  socket_t *new_sock = sock_accept(f->data.sock, addr);
+  fd_put(f);
   if (!new_sock) {
       regs->rax = -1; // Accept failed
       return;
   }
-
-  for (int i = 0; i < MAX_FILES; i++) {
-    if (t->fd_table[i].type == FD_TYPE_NONE) { // Check if slot is free
-      t->fd_table[i].type = FD_TYPE_SOCKET;
-      t->fd_table[i].data.sock = new_sock;
-      regs->rax = i; // Return the new socket descriptor
-      return;
-    }
-  }
-  regs->rax = -1; // No free descriptors
+  regs->rax = install_socket(t, new_sock); // The new socket descriptor, or -1
 }
 
 #include "crypto.h" // For sha256_hash
@@ -379,13 +908,14 @@ static void sys_recv(struct registers *regs) {
   int flags = (int)regs->r10; // Assuming r10 for 4th arg
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type != FD_TYPE_SOCKET) {
+  fd_entry_t *f = fd_get_socket(t, fd);
+  if (!f) {
     regs->rax = -1; // Not a valid socket FD
     return;
   }
 
-  socket_t *sock = t->fd_table[fd].data.sock;
-  regs->rax = sock_recv(sock, buf, len, flags);
+  regs->rax = sock_recv_user(f->data.sock, buf, len, flags);
+  fd_put(f);
 }
 
 static void sys_sha256(struct registers *regs) {
@@ -393,7 +923,31 @@ static void sys_sha256(struct registers *regs) {
   size_t len = (size_t)regs->rsi;
   uint8_t *hash_out = (uint8_t *)regs->rdx;
 
-  sha256_hash(data, len, hash_out);
+  // Hash the data a page at a time, as it's copied in
+  uint8_t *bounce = (uint8_t *)kmalloc(PAGE_SIZE);
+  if (!bounce) {
+    regs->rax = -1;
+    return;
+  }
+  sha256_context ctx;
+  sha256_init_ctx(&ctx);
+  size_t done = 0;
+  while (done < len) {
+    size_t n = len - done < PAGE_SIZE ? len - done : PAGE_SIZE;
+    if (copy_from_user(bounce, data + done, n) != 0) {
+      break;
+    }
+    sha256_update_ctx(&ctx, bounce, n);
+    done += n;
+    cond_resched();
+  }
+  kfree(bounce);
+  uint8_t hash[SHA256_HASH_SIZE];
+  sha256_final_ctx(&ctx, hash);
+  if (done < len || copy_to_user(hash_out, hash, sizeof(hash)) != 0) {
+    regs->rax = -1;
+    return;
+  }
   regs->rax = 0; // Success
 }
 
@@ -418,18 +972,20 @@ static void sys_ioctl(struct registers *regs) {
   void *argp = (void *)regs->rdx;
 
   thread_t *t = get_current_thread();
-  if (fd < 0 || fd >= MAX_FILES || t->fd_table[fd].type == FD_TYPE_NONE) {
+  fd_entry_t *f = fd_get(t->files, fd);
+  if (!f) {
     regs->rax = -1; // Invalid FD
     return;
   }
   
   // For now, only handle IOCTLs for files/devices represented by VFS nodes.
   // Sockets might have their own ioctl-like operations.
-  if (t->fd_table[fd].type == FD_TYPE_FILE && t->fd_table[fd].data.file.node->ioctl) {
-      regs->rax = t->fd_table[fd].data.file.node->ioctl(t->fd_table[fd].data.file.node, request, argp);
+  if (f->type == FD_TYPE_FILE && f->data.file.node->ioctl) {
+      regs->rax = f->data.file.node->ioctl(f->data.file.node, request, argp);
   } else {
       regs->rax = -1; // IOCTL not supported for this FD type or node.
   }
+  fd_put(f);
 }
 
 // New Mount/Unmount Syscalls
@@ -439,19 +995,13 @@ static void sys_mount(struct registers *regs) {
   char* user_fs_type_name = (char*)regs->rdx;
 
   char mount_point_path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_mount_point_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(mount_point_path, user_mount_point_path, MAX_FILENAME_LEN - 1);
-  mount_point_path[MAX_FILENAME_LEN - 1] = '\0';
+  if (strncpy_from_user(mount_point_path, user_mount_point_path, sizeof(mount_point_path)) < 0) { regs->rax = -1; return; }
 
   char device_node_path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_device_node_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(device_node_path, user_device_node_path, MAX_FILENAME_LEN - 1);
-  device_node_path[MAX_FILENAME_LEN - 1] = '\0';
+  if (strncpy_from_user(device_node_path, user_device_node_path, sizeof(device_node_path)) < 0) { regs->rax = -1; return; }
 
   char fs_type_name[32]; // Filesystem names are short
-  if ((uint64_t)user_fs_type_name >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(fs_type_name, user_fs_type_name, 31);
-  fs_type_name[31] = '\0';
+  if (strncpy_from_user(fs_type_name, user_fs_type_name, sizeof(fs_type_name)) < 0) { regs->rax = -1; return; }
 
   vfs_node_t *mount_point = vfs_resolve_path(vfs_root, mount_point_path);
   if (!mount_point || !(mount_point->flags & VFS_DIRECTORY)) {
@@ -474,9 +1024,7 @@ static void sys_unmount(struct registers *regs) {
   char* user_mount_point_path = (char*)regs->rdi;
 
   char mount_point_path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_mount_point_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(mount_point_path, user_mount_point_path, MAX_FILENAME_LEN - 1);
-  mount_point_path[MAX_FILENAME_LEN - 1] = '\0';
+  if (strncpy_from_user(mount_point_path, user_mount_point_path, sizeof(mount_point_path)) < 0) { regs->rax = -1; return; }
 
   vfs_node_t *mount_point = vfs_resolve_path(vfs_root, mount_point_path);
   if (!mount_point || !(mount_point->flags & VFS_MOUNTPOINT)) {
@@ -492,9 +1040,7 @@ static void sys_exec(struct registers *regs) {
   char *user_path = (char *)regs->rdi;
   
   char path[MAX_FILENAME_LEN];
-  if ((uint64_t)user_path >= hhdm_offset) { regs->rax = -1; return; }
-  strncpy(path, user_path, MAX_FILENAME_LEN - 1);
-  path[MAX_FILENAME_LEN - 1] = '\0';
+  if (strncpy_from_user(path, user_path, sizeof(path)) < 0) { regs->rax = -1; return; }
 
   vfs_node_t *node = vfs_finddir(vfs_root, path);
   if (!node) {
@@ -561,7 +1107,10 @@ static void sys_gfx_get_fb_info(struct registers *regs) {
       
       klog(LOG_DEBUG, "SYSCALL_GFX: Copying temp_info from %p to user_info_ptr %p (size %u)", &temp_info, user_info_ptr, sizeof(user_fb_info_t));
       // Safely copy the correctly-sized structure to the userspace pointer.
-      memcpy(user_info_ptr, &temp_info, sizeof(user_fb_info_t));
+      if (copy_to_user(user_info_ptr, &temp_info, sizeof(user_fb_info_t)) != 0) {
+          regs->rax = -1;
+          return;
+      }
       
       regs->rax = 0; // Success
   } else {
@@ -571,10 +1120,253 @@ static void sys_gfx_get_fb_info(struct registers *regs) {
 }
 
 static void sys_input_poll_event(struct registers *regs) {
-  if (event_pop((event_t *)regs->rdi))
-    regs->rax = 1;
-  else
+  event_t *user_event = (event_t *)regs->rdi;
+  event_t event;
+
+  if (!access_ok(user_event, sizeof(event_t))) {
+    regs->rax = -1;
+    return;
+  }
+  if (event_pop(&event)) {
+    // The event is lost if the copy faults, as it would be with a bad pointer
+    regs->rax = copy_to_user(user_event, &event, sizeof(event_t)) == 0 ? 1 : (uint64_t)-1;
+  } else {
     regs->rax = 0;
+  }
+}
+
+static void sys_sleep(struct registers *regs) {
+  uint64_t ms = regs->rdi;
+  scheduler_sleep_ns(ms * 1000000ULL);
+  regs->rax = 0;
+}
+
+static void sys_thread_stats(struct registers *regs) {
+  thread_info_t *buf = (thread_info_t *)regs->rdi;
+  int max = (int)regs->rsi;
+  uint64_t *uptime_ns = (uint64_t *)regs->rdx;
+
+  if (!buf || max <= 0) {
+    regs->rax = -1;
+    return;
+  }
+  if (max > THREAD_STATS_MAX) {
+    max = THREAD_STATS_MAX;
+  }
+  // thread_snapshot() holds the thread list lock, so fill a kernel buffer
+  thread_info_t *info = (thread_info_t *)kmalloc(max * sizeof(thread_info_t));
+  if (!info) {
+    regs->rax = -1;
+    return;
+  }
+  uint64_t now = clock_monotonic_ns();
+  int count = thread_snapshot(info, max);
+  if (copy_to_user(buf, info, count * sizeof(thread_info_t)) != 0 ||
+      (uptime_ns && copy_to_user(uptime_ns, &now, sizeof(now)) != 0)) {
+    regs->rax = -1;
+  } else {
+    regs->rax = count;
+  }
+  kfree(info);
+}
+
+static void sys_waitpid(struct registers *regs) {
+  uint64_t tid = regs->rdi;
+  int *status = (int *)regs->rsi;
+
+  if (status && !access_ok(status, sizeof(int))) {
+    regs->rax = -1;
+    return;
+  }
+  int code = 0;
+  if (thread_wait(tid, &code, NULL) != 0) {
+    regs->rax = -1;
+    return;
+  }
+  if (status && copy_to_user(status, &code, sizeof(code)) != 0) {
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = tid;
+}
+
+static void sys_wait4(struct registers *regs) {
+  uint64_t tid = regs->rdi;
+  int *status = (int *)regs->rsi;
+  rusage_t *usage = (rusage_t *)regs->rdx;
+
+  if ((status && !access_ok(status, sizeof(int))) ||
+      (usage && !access_ok(usage, sizeof(rusage_t)))) {
+    regs->rax = -1;
+    return;
+  }
+  int code = 0;
+  rusage_t ru;
+  if (thread_wait(tid, &code, &ru) != 0) {
+    regs->rax = -1;
+    return;
+  }
+  if ((status && copy_to_user(status, &code, sizeof(code)) != 0) ||
+      (usage && copy_to_user(usage, &ru, sizeof(ru)) != 0)) {
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = tid;
+}
+
+static void sys_getrusage(struct registers *regs) {
+  int who = (int)regs->rdi;
+  rusage_t *usage = (rusage_t *)regs->rsi;
+
+  if ((who != RUSAGE_SELF && who != RUSAGE_THREAD) || !usage) {
+    regs->rax = -1;
+    return;
+  }
+  rusage_t ru;
+  thread_get_usage(get_current_thread(), who, &ru);
+  regs->rax = copy_to_user(usage, &ru, sizeof(ru)) == 0 ? 0 : (uint64_t)-1;
+}
+
+static void sys_ioring_setup(struct registers *regs) {
+  uint32_t entries = (uint32_t)regs->rdi;
+  io_ring_params_t *params = (io_ring_params_t *)regs->rsi;
+
+  regs->rax = io_ring_setup(entries, params);
+}
+
+static void sys_ioring_enter(struct registers *regs) {
+  int fd = (int)regs->rdi;
+  uint32_t to_submit = (uint32_t)regs->rsi;
+  uint32_t min_complete = (uint32_t)regs->rdx;
+
+  regs->rax = io_ring_enter(fd, to_submit, min_complete);
+}
+
+static void sys_poll(struct registers *regs) {
+  pollfd_t *fds = (pollfd_t *)regs->rdi;
+  uint32_t nfds = (uint32_t)regs->rsi;
+  int timeout_ms = (int)regs->rdx;
+
+  regs->rax = ksys_poll(fds, nfds, timeout_ms);
+}
+
+static void sys_epoll_create(struct registers *regs) {
+  regs->rax = ksys_epoll_create();
+}
+
+static void sys_epoll_ctl(struct registers *regs) {
+  int epfd = (int)regs->rdi;
+  int op = (int)regs->rsi;
+  int fd = (int)regs->rdx;
+  const epoll_event_t *event = (const epoll_event_t *)regs->r10;
+
+  regs->rax = ksys_epoll_ctl(epfd, op, fd, event);
+}
+
+static void sys_epoll_wait(struct registers *regs) {
+  int epfd = (int)regs->rdi;
+  epoll_event_t *events = (epoll_event_t *)regs->rsi;
+  int max = (int)regs->rdx;
+  int timeout_ms = (int)regs->r10;
+
+  regs->rax = ksys_epoll_wait(epfd, events, max, timeout_ms);
+}
+
+static void sys_input_open(struct registers *regs) {
+  // Every input descriptor reads from the one system-wide event queue
+  fd_entry_t *f = fd_entry_alloc(FD_TYPE_INPUT);
+  if (!f) {
+    regs->rax = -1;
+    return;
+  }
+  int fd = fd_install(get_current_thread()->files, f);
+  if (fd < 0) {
+    fd_put(f);
+  }
+  regs->rax = fd;
+}
+
+static void sys_futex(struct registers *regs) {
+  uint32_t *uaddr = (uint32_t *)regs->rdi;
+  int op = (int)regs->rsi;
+  uint32_t val = (uint32_t)regs->rdx;
+  uint64_t val2 = regs->r10;
+  uint32_t *uaddr2 = (uint32_t *)regs->r8;
+
+  regs->rax = ksys_futex(uaddr, op, val, val2, uaddr2);
+}
+
+static void sys_getrlimit(struct registers *regs) {
+  int resource = (int)regs->rdi;
+  rlimit_t *rlim = (rlimit_t *)regs->rsi;
+
+  if (resource != RLIMIT_NOFILE || !rlim) {
+    regs->rax = -1;
+    return;
+  }
+  rlimit_t limits;
+  if (fd_table_get_limit(get_current_thread()->files, &limits.rlim_cur, &limits.rlim_max) != 0) {
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = copy_to_user(rlim, &limits, sizeof(limits)) == 0 ? 0 : (uint64_t)-1;
+}
+
+static void sys_setrlimit(struct registers *regs) {
+  int resource = (int)regs->rdi;
+  const rlimit_t *rlim = (const rlimit_t *)regs->rsi;
+
+  rlimit_t limits;
+  if (resource != RLIMIT_NOFILE || !rlim || copy_from_user(&limits, rlim, sizeof(limits)) != 0) {
+    regs->rax = -1;
+    return;
+  }
+  regs->rax = fd_table_set_limit(get_current_thread()->files, limits.rlim_cur, limits.rlim_max);
+}
+
+static void sys_thread_spawn(struct registers *regs) {
+  uint64_t entry = regs->rdi;
+  uint64_t stack = regs->rsi;
+  uint64_t arg = regs->rdx;
+
+  if (!entry || !stack || entry >= USER_SPACE_END || stack >= USER_SPACE_END) {
+    regs->rax = -1;
+    return;
+  }
+  thread_t *thread = thread_spawn_user(entry, stack, arg);
+  regs->rax = thread ? thread->id : (uint64_t)-1;
+}
+
+static void sys_arch_prctl(struct registers *regs) {
+  int code = (int)regs->rdi;
+  uint64_t addr = regs->rsi;
+  thread_t *t = get_current_thread();
+
+  if (addr >= USER_SPACE_END) {
+    regs->rax = -1;
+    return;
+  }
+  switch (code) {
+  case ARCH_SET_FS: {
+    uint64_t flags = local_irq_save();
+    // schedule() reloads the MSR from here on every switch
+    t->fs_base = addr;
+    wrmsr(MSR_FS_BASE, addr);
+    local_irq_restore(flags);
+    regs->rax = 0;
+    break;
+  }
+  case ARCH_GET_FS:
+    if (!addr) {
+      regs->rax = -1;
+      break;
+    }
+    regs->rax = copy_to_user((void *)addr, &t->fs_base, sizeof(uint64_t)) == 0 ? 0 : (uint64_t)-1;
+    break;
+  default:
+    regs->rax = -1;
+    break;
+  }
 }
 
 void syscall_init() {
@@ -607,14 +1399,79 @@ void syscall_init() {
   syscall_table[SYS_EXEC] = sys_exec;
   syscall_table[SYS_GFX_GET_FB_INFO] = sys_gfx_get_fb_info;
   syscall_table[SYS_INPUT_POLL_EVENT] = sys_input_poll_event;
+  syscall_table[SYS_SLEEP] = sys_sleep;
+  syscall_table[SYS_THREAD_STATS] = sys_thread_stats;
+  syscall_table[SYS_WAITPID] = sys_waitpid;
+  syscall_table[SYS_GETRLIMIT] = sys_getrlimit;
+  syscall_table[SYS_SETRLIMIT] = sys_setrlimit;
+  syscall_table[SYS_THREAD_SPAWN] = sys_thread_spawn;
+  syscall_table[SYS_ARCH_PRCTL] = sys_arch_prctl;
+  syscall_table[SYS_WAIT4] = sys_wait4;
+  syscall_table[SYS_GETRUSAGE] = sys_getrusage;
+  syscall_table[SYS_IORING_SETUP] = sys_ioring_setup;
+  syscall_table[SYS_IORING_ENTER] = sys_ioring_enter;
+  syscall_table[SYS_LSEEK] = sys_lseek;
+  syscall_table[SYS_PREAD] = sys_pread;
+  syscall_table[SYS_PWRITE] = sys_pwrite;
+  syscall_table[SYS_READV] = sys_readv;
+  syscall_table[SYS_WRITEV] = sys_writev;
+  syscall_table[SYS_POLL] = sys_poll;
+  syscall_table[SYS_EPOLL_CREATE] = sys_epoll_create;
+  syscall_table[SYS_EPOLL_CTL] = sys_epoll_ctl;
+  syscall_table[SYS_EPOLL_WAIT] = sys_epoll_wait;
+  syscall_table[SYS_INPUT_OPEN] = sys_input_open;
+  syscall_table[SYS_FUTEX] = sys_futex;
+  syscall_table[SYS_OPENAT] = sys_openat;
+  syscall_table[SYS_FSTATAT] = sys_fstatat;
+  syscall_table[SYS_MKDIRAT] = sys_mkdirat;
+  syscall_table[SYS_UNLINKAT] = sys_unlinkat;
+  syscall_table[SYS_FSTAT] = sys_fstat;
+  syscall_table[SYS_RENAME] = sys_rename;
+  syscall_table[SYS_RENAMEAT] = sys_renameat;
+  syscall_table[SYS_COPY_FILE_RANGE] = sys_copy_file_range;
+  syscall_table[SYS_SENDFILE] = sys_sendfile;
   klog(LOG_INFO, "Syscall handler expanded.");
 }
 
+extern void syscall_entry();
+
+void syscall_init_cpu() {
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+  // SYSCALL loads CS from STAR[47:32] and SS from the next descriptor.
+  // SYSRET loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16.
+  wrmsr(MSR_STAR, ((uint64_t)(USER_DATA_SELECTOR - 8) << 48) |
+                      ((uint64_t)KERNEL_CODE_SELECTOR << 32));
+  wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+  // Enter with interrupts off like the int 0x80 gate, and with a sane DF
+  wrmsr(MSR_SFMASK, RFLAGS_TF | RFLAGS_IF | RFLAGS_DF | RFLAGS_NT | RFLAGS_AC);
+}
+
 void syscall_handler(struct registers *regs) {
+  // From here until we return to userspace the thread's CPU time counts as
+  // system time. Both int 0x80 and SYSCALL enter with interrupts off, so
+  // nothing can switch us out halfway through the update.
+  thread_t *self = get_current_thread();
+  thread_stats_t *st = &self->stats;
+  uint64_t start = rdtsc();
+  st->sys_since = start;
+  st->in_syscall = 1;
+
   uint64_t syscall_num = regs->rax;
   if (syscall_num < 256 && syscall_table[syscall_num] != 0) {
     syscall_table[syscall_num](regs);
   } else {
     klog(LOG_WARN, "Unknown syscall received.");
   }
+
+  uint64_t flags = local_irq_save();
+  uint64_t end = rdtsc();
+  st->sys_cycles += end - st->sys_since;
+  st->in_syscall = 0;
+  local_irq_restore(flags);
+#if CONFIG_SYSCALL_STATS
+  syscall_stats_record(self->proc, syscall_num, end - start, (int64_t)regs->rax);
+#endif
+
+  // Like IRQs, syscall return is a preemption point
+  preempt_irq_exit();
 }
@@ -0,0 +1,292 @@
+#include "syscall_stats.h"
+#include "clock.h"
+#include "heap.h"
+#include "kstring.h"
+#include "log.h"
+#include "process.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include <stddef.h> // for NULL
+
+#if CONFIG_SYSCALL_STATS
+
+#define SUMMARY_MAX 32 // Processes listed by a plain `syscallstat`
+
+static const char *syscall_names[SYSCALL_STATS_NR] = {
+    [SYS_EXIT] = "exit",
+    [SYS_WRITE] = "write",
+    [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close",
+    [SYS_READ] = "read",
+    [SYS_STAT] = "stat",
+    [SYS_MKDIR] = "mkdir",
+    [SYS_READDIR] = "readdir",
+    [SYS_UNLINK] = "unlink",
+    [SYS_RMDIR] = "rmdir",
+    [SYS_SOCKET] = "socket",
+    [SYS_CONNECT] = "connect",
+    [SYS_SEND] = "send",
+    [SYS_RECV] = "recv",
+    [SYS_BIND] = "bind",
+    [SYS_LISTEN] = "listen",
+    [SYS_ACCEPT] = "accept",
+    [SYS_GET_TICKS] = "get_ticks",
+    [SYS_SHA256] = "sha256",
+    [SYS_MALLOC] = "malloc",
+    [SYS_FREE] = "free",
+    [SYS_IOCTL] = "ioctl",
+    [SYS_MOUNT] = "mount",
+    [SYS_UNMOUNT] = "unmount",
+    [SYS_EXEC] = "exec",
+    [SYS_GFX_GET_FB_INFO] = "gfx_get_fb_info",
+    [SYS_INPUT_POLL_EVENT] = "input_poll_event",
+    [SYS_SLEEP] = "sleep",
+    [SYS_THREAD_STATS] = "thread_stats",
+    [SYS_WAITPID] = "waitpid",
+    [SYS_GETRLIMIT] = "getrlimit",
+    [SYS_SETRLIMIT] = "setrlimit",
+    [SYS_THREAD_SPAWN] = "thread_spawn",
+    [SYS_ARCH_PRCTL] = "arch_prctl",
+    [SYS_WAIT4] = "wait4",
+    [SYS_GETRUSAGE] = "getrusage",
+    [SYS_IORING_SETUP] = "ioring_setup",
+    [SYS_IORING_ENTER] = "ioring_enter",
+    [SYS_LSEEK] = "lseek",
+    [SYS_PREAD] = "pread",
+    [SYS_PWRITE] = "pwrite",
+    [SYS_READV] = "readv",
+    [SYS_WRITEV] = "writev",
+    [SYS_POLL] = "poll",
+    [SYS_EPOLL_CREATE] = "epoll_create",
+    [SYS_EPOLL_CTL] = "epoll_ctl",
+    [SYS_EPOLL_WAIT] = "epoll_wait",
+    [SYS_INPUT_OPEN] = "input_open",
+    [SYS_FUTEX] = "futex",
+    [SYS_OPENAT] = "openat",
+    [SYS_FSTATAT] = "fstatat",
+    [SYS_MKDIRAT] = "mkdirat",
+    [SYS_UNLINKAT] = "unlinkat",
+    [SYS_FSTAT] = "fstat",
+    [SYS_RENAME] = "rename",
+    [SYS_RENAMEAT] = "renameat",
+    [SYS_COPY_FILE_RANGE] = "copy_file_range",
+    [SYS_SENDFILE] = "sendfile",
+};
+
+static syscall_stats_t global_stats;
+
+// Per-process counters, for listing them
+static syscall_stats_t *stats_list = NULL;
+static spinlock_t stats_lock = SPINLOCK_INIT("syscall_stats");
+
+syscall_stats_t *syscall_stats_alloc(process_t *proc) {
+  syscall_stats_t *stats = (syscall_stats_t *)kmalloc(sizeof(syscall_stats_t));
+  if (!stats) {
+    return NULL;
+  }
+  memset(stats, 0, sizeof(syscall_stats_t));
+  stats->proc = proc;
+
+  uint64_t flags = spin_lock_irqsave(&stats_lock);
+  stats->next = stats_list;
+  stats_list = stats;
+  spin_unlock_irqrestore(&stats_lock, flags);
+  return stats;
+}
+
+void syscall_stats_free(syscall_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+  uint64_t flags = spin_lock_irqsave(&stats_lock);
+  for (syscall_stats_t **p = &stats_list; *p; p = &(*p)->next) {
+    if (*p == stats) {
+      *p = stats->next;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+  kfree(stats);
+}
+
+static void stat_add(syscall_stat_t *s, uint64_t ns, int bucket, int error) {
+  __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+  if (error) {
+    __atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&s->ns, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void syscall_stats_record(process_t *proc, uint64_t num, uint64_t cycles, int64_t ret) {
+  if (num >= SYSCALL_STATS_NR) {
+    return;
+  }
+  uint64_t ns = clock_tsc_to_ns(cycles);
+  int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+  if (bucket >= SYSCALL_STATS_BUCKETS) {
+    bucket = SYSCALL_STATS_BUCKETS - 1;
+  }
+  stat_add(&global_stats.sys[num], ns, bucket, ret < 0);
+  if (proc && proc->sc_stats) {
+    stat_add(&proc->sc_stats->sys[num], ns, bucket, ret < 0);
+  }
+}
+
+// Left-aligned in `width` columns, like lockstat
+static int pad(char *buf, int len, int width) {
+  while (len < width) {
+    buf[len++] = ' ';
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+static int format_ns(char *buf, uint64_t ns) {
+  if (ns < 1000) {
+    return ksprintf(buf, "%luns", ns);
+  } else if (ns < 1000000) {
+    return ksprintf(buf, "%luus", ns / 1000);
+  } else if (ns < NSEC_PER_SEC) {
+    return ksprintf(buf, "%lums", ns / 1000000);
+  }
+  return ksprintf(buf, "%lus", ns / NSEC_PER_SEC);
+}
+
+static void print_hist(const syscall_stat_t *s) {
+  char buf[160];
+  int len = ksprintf(buf, "   ");
+  for (int k = 0; k < SYSCALL_STATS_BUCKETS; k++) {
+    if (!s->hist[k]) {
+      continue;
+    }
+    if (len > 120) {
+      ksprintf(buf + len, "\n");
+      klog_print_str(buf);
+      len = ksprintf(buf, "   ");
+    }
+    len += ksprintf(buf + len, " >=");
+    len += format_ns(buf + len, 1ULL << k);
+    len += ksprintf(buf + len, ":%u", s->hist[k]);
+  }
+  ksprintf(buf + len, "\n");
+  klog_print_str(buf);
+}
+
+static void print_table(const syscall_stats_t *stats, int hist) {
+  char buf[160];
+  klog_print_str("Syscall              Calls       Errors      Total ms    Avg ns\n");
+  for (int i = 0; i < SYSCALL_STATS_NR; i++) {
+    const syscall_stat_t *s = &stats->sys[i];
+    if (!s->calls) {
+      continue;
+    }
+    int len = syscall_names[i] ? ksprintf(buf, "%s", syscall_names[i]) : ksprintf(buf, "#%d", i);
+    len = pad(buf, len, 20);
+    ksprintf(buf + len, "%12lu %12lu %12lu %9lu\n", s->calls, s->errors, s->ns / 1000000,
+             s->ns / s->calls);
+    klog_print_str(buf);
+    if (hist) {
+      print_hist(s);
+    }
+  }
+}
+
+typedef struct {
+  uint64_t pid;
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t ns;
+  int top; // Syscall with the most time
+} summary_t;
+
+static void print_summary() {
+  summary_t *rows = (summary_t *)kmalloc(SUMMARY_MAX * sizeof(summary_t));
+  if (!rows) {
+    return;
+  }
+  int count = 0;
+  uint64_t flags = spin_lock_irqsave(&stats_lock);
+  for (syscall_stats_t *st = stats_list; st && count < SUMMARY_MAX; st = st->next) {
+    summary_t *row = &rows[count++];
+    memset(row, 0, sizeof(summary_t));
+    row->pid = st->proc->pid;
+    row->top = -1;
+    for (int i = 0; i < SYSCALL_STATS_NR; i++) {
+      const syscall_stat_t *s = &st->sys[i];
+      row->calls += s->calls;
+      row->errors += s->errors;
+      row->ns += s->ns;
+      if (s->calls && (row->top < 0 || s->ns > st->sys[row->top].ns)) {
+        row->top = i;
+      }
+    }
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+
+  char buf[160];
+  klog_print_str("\nPID          Calls       Errors      Total ms    Most time in\n");
+  for (int i = 0; i < count; i++) {
+    summary_t *row = &rows[i];
+    int len = ksprintf(buf, "%lu", row->pid);
+    len = pad(buf, len, 8);
+    len += ksprintf(buf + len, "%12lu %12lu %12lu    ", row->calls, row->errors, row->ns / 1000000);
+    if (row->top < 0) {
+      ksprintf(buf + len, "-\n");
+    } else if (syscall_names[row->top]) {
+      ksprintf(buf + len, "%s\n", syscall_names[row->top]);
+    } else {
+      ksprintf(buf + len, "#%d\n", row->top);
+    }
+    klog_print_str(buf);
+  }
+  kfree(rows);
+}
+#endif // CONFIG_SYSCALL_STATS
+
+void syscall_stats_dump(uint64_t pid, int hist) {
+#if CONFIG_SYSCALL_STATS
+  if (pid == 0) {
+    print_table(&global_stats, hist);
+    print_summary();
+    return;
+  }
+
+  // Copy the counters out, the process may exit while we print
+  syscall_stats_t *copy = (syscall_stats_t *)kmalloc(sizeof(syscall_stats_t));
+  if (!copy) {
+    return;
+  }
+  int found = 0;
+  uint64_t flags = spin_lock_irqsave(&stats_lock);
+  for (syscall_stats_t *st = stats_list; st; st = st->next) {
+    if (st->proc->pid == pid) {
+      memcpy(copy, st, sizeof(syscall_stats_t));
+      found = 1;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+  if (found) {
+    print_table(copy, hist);
+  } else {
+    klog_print_str("syscallstat: no such process\n");
+  }
+  kfree(copy);
+#else
+  (void)pid;
+  (void)hist;
+  klog_print_str("Syscall statistics are disabled (CONFIG_SYSCALL_STATS=0).\n");
+#endif
+}
+
+void syscall_stats_reset(void) {
+#if CONFIG_SYSCALL_STATS
+  memset(&global_stats, 0, sizeof(global_stats));
+  uint64_t flags = spin_lock_irqsave(&stats_lock);
+  for (syscall_stats_t *st = stats_list; st; st = st->next) {
+    memset(st->sys, 0, sizeof(st->sys));
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+#endif
+}
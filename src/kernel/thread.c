@@ -1,18 +1,191 @@
 #include "thread.h"
+#include "gdt.h" // For the user selectors
 #include "heap.h"
+#include "io_ring.h" // For io_ring_exit
 #include "isr.h"
 #include "log.h"
 #include "scheduler.h"
 #include "vfs.h"
 #include "pmm.h" // For pmm_alloc_page
 #include "vmm.h" // For vmm_map_page, PAGE_PRESENT, PAGE_WRITE, PAGE_USER
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "syscall.h" // For thread_info_t
+#include "clock.h"
+#include "cpu.h" // For rdtsc
+#include "kstring.h"
+#include <stdbool.h>
 #include <stddef.h> // for NULL
 
 static uint64_t next_thread_id = 0;
-extern thread_t *current_thread;
+
+// Every live thread, for statistics. Threads leave it when they're reaped.
+static thread_t *all_threads = NULL;
+static spinlock_t threads_lock = SPINLOCK_INIT("threads");
+
+// Descriptor table shared by all kernel threads
+static fd_table_t *kernel_files = NULL;
+
+// Exit status of a thread whose parent hasn't collected it yet
+typedef struct exit_record {
+  uint64_t id;
+  uint64_t parent_id;
+  int status;
+  rusage_t usage;
+  struct exit_record *next;
+} exit_record_t;
+
+// Exit records and the threads blocked in thread_wait(). Lock order:
+// exit_lock, then threads_lock.
+static exit_record_t *exit_records = NULL;
+static thread_t *exit_waiters = NULL;
+static spinlock_t exit_lock = SPINLOCK_INIT("exit_records");
+
+static uint64_t alloc_thread_id() {
+  return __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+}
+
+void thread_set_name(thread_t *thread, const char *name) {
+  strncpy(thread->name, name, THREAD_NAME_LEN - 1);
+  thread->name[THREAD_NAME_LEN - 1] = '\0';
+}
+
+// Common tail of the thread_create* functions
+static void thread_register(thread_t *thread, const char *name) {
+  thread_set_name(thread, name);
+  memset(&thread->stats, 0, sizeof(thread->stats));
+  thread->wake_tsc = 0;
+  thread->sleep_next = NULL;
+  thread->sleeping = 0;
+  thread->timed_out = 0;
+  thread_t *parent = get_current_thread();
+  thread->parent_id = parent ? parent->id : 0;
+  thread->exit_status = 0;
+  thread->wait_tid = 0;
+  thread->wait_next = NULL;
+  thread->preempt_count = 0;
+  thread->fs_base = 0;
+
+  uint64_t flags = spin_lock_irqsave(&threads_lock);
+  thread->all_prev = NULL;
+  thread->all_next = all_threads;
+  if (all_threads) {
+    all_threads->all_prev = thread;
+  }
+  all_threads = thread;
+  spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+// Add the counters of `t` to `out`. Caller holds threads_lock.
+static void usage_add_locked(thread_t *t, rusage_t *out, uint64_t now) {
+  thread_stats_t *st = &t->stats;
+  uint64_t run = st->run_cycles;
+  uint64_t sys = st->sys_cycles;
+  if (t->state == THREAD_RUNNING) {
+    run += now - st->on_cpu_since; // Include the current time slice
+    if (st->in_syscall) {
+      sys += now - st->sys_since;
+    }
+  }
+  if (!t->proc || sys > run) {
+    sys = run; // Kernel threads never leave the kernel
+  }
+  out->utime_ns += clock_tsc_to_ns(run - sys);
+  out->stime_ns += clock_tsc_to_ns(sys);
+  out->page_faults += st->page_faults;
+  out->read_bytes += st->read_bytes;
+  out->write_bytes += st->write_bytes;
+  out->nvcsw += st->nvcsw;
+  out->nivcsw += st->nivcsw;
+}
+
+static void usage_sum(rusage_t *out, const rusage_t *in) {
+  out->utime_ns += in->utime_ns;
+  out->stime_ns += in->stime_ns;
+  out->page_faults += in->page_faults;
+  out->read_bytes += in->read_bytes;
+  out->write_bytes += in->write_bytes;
+  out->nvcsw += in->nvcsw;
+  out->nivcsw += in->nivcsw;
+}
+
+void thread_get_usage(thread_t *thread, int who, rusage_t *out) {
+  memset(out, 0, sizeof(*out));
+  process_t *proc = thread->proc;
+  if (proc && who == RUSAGE_SELF) {
+    process_update_rss(proc);
+  }
+
+  uint64_t flags = spin_lock_irqsave(&threads_lock);
+  uint64_t now = rdtsc();
+  if (!proc || who == RUSAGE_THREAD) {
+    usage_add_locked(thread, out, now);
+  } else {
+    usage_sum(out, &proc->exited);
+    for (thread_t *t = all_threads; t; t = t->all_next) {
+      if (t->proc == proc) {
+        usage_add_locked(t, out, now);
+      }
+    }
+  }
+  spin_unlock_irqrestore(&threads_lock, flags);
+
+  if (proc) {
+    out->maxrss_pages = proc->maxrss_pages;
+  }
+}
+
+void thread_unregister(thread_t *thread) {
+  uint64_t flags = spin_lock_irqsave(&threads_lock);
+  // Its process keeps the final counts, under the same lock that hides it
+  if (thread->proc) {
+    usage_add_locked(thread, &thread->proc->exited, rdtsc());
+  }
+  if (thread->all_prev) {
+    thread->all_prev->all_next = thread->all_next;
+  } else {
+    all_threads = thread->all_next;
+  }
+  if (thread->all_next) {
+    thread->all_next->all_prev = thread->all_prev;
+  }
+  spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+int thread_snapshot(thread_info_t *out, int max) {
+  int count = 0;
+  uint64_t flags = spin_lock_irqsave(&threads_lock);
+  uint64_t now = rdtsc();
+  for (thread_t *t = all_threads; t && count < max; t = t->all_next) {
+    thread_stats_t *st = &t->stats;
+    uint64_t run = st->run_cycles;
+    if (t->state == THREAD_RUNNING) {
+      run += now - st->on_cpu_since; // Include the current time slice
+    }
+
+    thread_info_t *info = &out[count++];
+    info->id = t->id;
+    info->state = t->state;
+    info->cpu = t->cpu;
+    memcpy(info->name, t->name, sizeof(info->name));
+    info->run_ns = clock_tsc_to_ns(run);
+    info->wait_ns = clock_tsc_to_ns(st->wait_cycles);
+    info->wakeup_avg_ns = st->wakeups ? clock_tsc_to_ns(st->wakeup_cycles / st->wakeups) : 0;
+    info->wakeup_max_ns = clock_tsc_to_ns(st->wakeup_max_cycles);
+    info->wakeups = st->wakeups;
+    info->nvcsw = st->nvcsw;
+    info->nivcsw = st->nivcsw;
+  }
+  spin_unlock_irqrestore(&threads_lock, flags);
+  return count;
+}
 
 // This function is called from assembly when a thread starts for the first time
 void thread_entry(thread_func_t func, void *arg) {
+  // We arrive here from thread_switch's `ret`, not from schedule()
+  scheduler_finish_switch();
+
   // Re-enable interrupts for the new thread
   enable_interrupts();
 
@@ -20,35 +193,58 @@ void thread_entry(thread_func_t func, void *arg) {
   func(arg);
 
   // If the thread function returns, exit the thread
-  thread_exit();
+  thread_exit(0);
 }
 
 extern pml4_t* kernel_pml4;
 
-void thread_init() {
-  klog(LOG_INFO, "Thread: Initializing...");
-  // Create a thread structure for the main kernel thread (the
-  // kmain)
-  current_thread = (thread_t *)kmalloc(sizeof(thread_t));
-  if (!current_thread) {
-    panic("Failed to allocate main kernel thread!", NULL);
-  }
-  current_thread->id = next_thread_id++;
-  current_thread->state = THREAD_RUNNING;
-  current_thread->stack = NULL; // Kernel main stack is managed separately
-  current_thread->user_stack_base = NULL; // No userspace stack for kernel thread
-  current_thread->pml4 = vmm_get_current_pml4(); // Kernel thread uses kernel pml4
-  // Save the current RSP for the initial kernel thread
-  __asm__ __volatile__("mov %%rsp, %0" : "=r"(current_thread->rsp));
-  current_thread->next = NULL;
+// Wrap the stack we're currently running on (kmain's, or the one Limine
+// gave an AP) in a thread structure. It becomes this CPU's idle thread.
+thread_t *thread_create_idle() {
+  thread_t *thread = (thread_t *)kmalloc(sizeof(thread_t));
+  if (!thread) {
+    panic("Failed to allocate idle thread!", NULL);
+  }
+  cpu_t *cpu = this_cpu();
 
-  for (int i = 0; i < MAX_FILES; i++) {
-    current_thread->fd_table[i].type = FD_TYPE_NONE;
-    current_thread->fd_table[i].data.file.node = NULL;
-    current_thread->fd_table[i].data.file.offset = 0;
-    current_thread->fd_table[i].data.file.flags = 0;
-    current_thread->fd_table[i].data.sock = NULL;
+  thread->id = alloc_thread_id();
+  thread->state = THREAD_RUNNING;
+  thread->stack = NULL; // Boot stack is managed separately
+  thread->user_stack_base = NULL; // No userspace stack for kernel thread
+  thread->pml4 = vmm_get_current_pml4(); // Kernel thread uses kernel pml4
+  thread->proc = NULL;
+  // Save the current RSP for the initial kernel thread
+  __asm__ __volatile__("mov %%rsp, %0" : "=r"(thread->rsp));
+  thread->next = NULL;
+  thread->cpu = cpu->id;
+  thread->on_cpu = 1;
+  thread->fpu_state = NULL;
+  thread->fpu_alloc = NULL;
+  thread->fpu_cpu = (uint32_t)-1;
+
+  // Every kernel thread shares one descriptor table, made along with the
+  // BSP's idle thread
+  if (!kernel_files) {
+    kernel_files = fd_table_create(NULL);
+    if (!kernel_files) {
+      panic("Failed to allocate the kernel fd table!", NULL);
+    }
   }
+  thread->files = fd_table_share(kernel_files);
+
+  thread_register(thread, "idle");
+  thread->stats.on_cpu_since = rdtsc();
+
+  cpu->idle_thread = thread;
+  cpu->current_thread = thread;
+  return thread;
+}
+
+void thread_init() {
+  klog(LOG_INFO, "Thread: Initializing...");
+  // The main kernel thread (kmain) becomes the BSP's idle thread once
+  // initialization is done.
+  thread_create_idle();
 
   scheduler_init();
 }
@@ -56,12 +252,9 @@ void thread_init() {
 extern void thread_starter();
 
 thread_t *thread_create(thread_func_t func, void *arg) {
-  disable_interrupts();
-
   thread_t *thread = (thread_t *)kmalloc(sizeof(thread_t));
   if (!thread) {
     klog(LOG_ERROR, "Failed to allocate thread structure.");
-    enable_interrupts();
     return NULL;
   }
 
@@ -69,23 +262,21 @@ thread_t *thread_create(thread_func_t func, void *arg) {
   if (!thread->stack) {
     klog(LOG_ERROR, "Failed to allocate thread stack.");
     kfree(thread);
-    enable_interrupts();
     return NULL;
   }
 
   thread->user_stack_base = NULL; // No userspace stack for kernel thread
   thread->pml4 = vmm_get_current_pml4();   // Kernel thread uses kernel pml4
+  thread->proc = NULL;
 
-  thread->id = next_thread_id++;
+  thread->id = alloc_thread_id();
   thread->state = THREAD_READY;
+  thread->on_cpu = 0;
+  thread->fpu_state = NULL;
+  thread->fpu_alloc = NULL;
+  thread->fpu_cpu = (uint32_t)-1;
 
-  for (int i = 0; i < MAX_FILES; i++) {
-    thread->fd_table[i].type = FD_TYPE_NONE;
-    thread->fd_table[i].data.file.node = NULL;
-    thread->fd_table[i].data.file.offset = 0;
-    thread->fd_table[i].data.file.flags = 0;
-    thread->fd_table[i].data.sock = NULL;
-  }
+  thread->files = fd_table_share(kernel_files);
 
   // Set up the initial stack for the new thread
   uint64_t *stack_ptr =
@@ -114,26 +305,66 @@ thread_t *thread_create(thread_func_t func, void *arg) {
 
   thread->rsp = (uint64_t)stack_ptr;
 
+  thread_register(thread, "kthread");
   scheduler_add_thread(thread);
 
-  enable_interrupts();
   return thread;
 }
 
 extern void userspace_trampoline();
 
+// Craft the initial kernel stack of a user thread: thread_switch() returns
+// into userspace_trampoline, which IRETQs to `rip` with `arg` in rdi.
+static void setup_user_frame(thread_t *thread, uint64_t rip, uint64_t rsp, uint64_t arg) {
+    uint64_t *stack_ptr = (uint64_t *)((uint64_t)thread->stack + KERNEL_STACK_SIZE);
+
+    // IRETQ frame
+    *--stack_ptr = USER_DATA_SELECTOR | 3;    // SS (User Data Segment)
+    *--stack_ptr = rsp;                       // RSP (User Stack)
+    *--stack_ptr = 0x202;                     // RFLAGS (Interrupts enabled)
+    *--stack_ptr = USER_CODE_SELECTOR | 3;    // CS (User Code Segment)
+    *--stack_ptr = rip;                       // RIP
+
+    // The address that `thread_switch` will `ret` to.
+    *--stack_ptr = (uint64_t)userspace_trampoline;
+
+    // Fake callee-saved registers for thread_switch to pop
+    *--stack_ptr = 0;   // rbp
+    *--stack_ptr = 0;   // rbx
+    *--stack_ptr = arg; // r12, moved to rdi by the trampoline
+    *--stack_ptr = 0;   // r13
+    *--stack_ptr = 0;   // r14
+    *--stack_ptr = 0;   // r15
+
+    thread->rsp = (uint64_t)stack_ptr;
+}
+
 // New function for userspace threads
 thread_t* thread_create_userspace(uint64_t entry_point, pml4_t* pml4) {
-    disable_interrupts();
-
     thread_t *thread = (thread_t *)kmalloc(sizeof(thread_t));
     if (!thread) {
         klog(LOG_ERROR, "Failed to allocate userspace thread structure.");
-        enable_interrupts();
+        vmm_destroy_address_space(pml4);
+        return NULL;
+    }
+    // The process owns the address space from here on, dropping it frees it
+    thread->proc = process_create(pml4);
+    if (!thread->proc) {
+        kfree(thread);
         return NULL;
     }
     thread->pml4 = pml4;
 
+    // A new program gets its own descriptor table, with its creator's limits
+    thread_t *creator = get_current_thread();
+    thread->files = fd_table_create(creator ? creator->files : NULL);
+    if (!thread->files) {
+        klog(LOG_ERROR, "Failed to allocate userspace fd table.");
+        process_put(thread->proc);
+        kfree(thread);
+        return NULL;
+    }
+
     // Allocate userspace stack
     void* user_stack_vaddr_start = (void*)(USER_STACK_TOP - USER_STACK_SIZE);
     klog(LOG_DEBUG, "Userspace stack: vaddr_start = %p, size = %u", user_stack_vaddr_start, USER_STACK_SIZE);
@@ -142,9 +373,9 @@ thread_t* thread_create_userspace(uint64_t entry_point, pml4_t* pml4) {
         void* phys_page = pmm_alloc_page();
         if (!phys_page) {
             klog(LOG_ERROR, "Failed to allocate physical page for userspace stack.");
-            vmm_destroy_address_space(thread->pml4);
+            process_put(thread->proc);
+            fd_table_release(thread->files);
             kfree(thread);
-            enable_interrupts();
             return NULL;
         }
         vmm_map_page(thread->pml4, (void*)((uint64_t)user_stack_vaddr_start + i), phys_page, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
@@ -166,61 +397,220 @@ thread_t* thread_create_userspace(uint64_t entry_point, pml4_t* pml4) {
                 pmm_free_page(phys_addr);
             }
         }
-        vmm_destroy_address_space(thread->pml4);
+        process_put(thread->proc);
+        fd_table_release(thread->files);
         kfree(thread);
-        enable_interrupts();
         return NULL;
     }
 
-    thread->id = next_thread_id++;
+    thread->id = alloc_thread_id();
+    thread->proc->pid = thread->id;
     thread->state = THREAD_READY;
+    thread->on_cpu = 0;
+    thread->fpu_state = NULL;
+    thread->fpu_alloc = NULL;
+    thread->fpu_cpu = (uint32_t)-1;
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        thread->fd_table[i].type = FD_TYPE_NONE;
-        thread->fd_table[i].data.file.node = NULL;
-        thread->fd_table[i].data.file.offset = 0;
-        thread->fd_table[i].data.file.flags = 0;
-        thread->fd_table[i].data.sock = NULL;
-    }
+    klog(LOG_DEBUG, "Userspace IRETQ frame setup: entry_point = %p, USER_STACK_TOP = %p", (void*)entry_point, (void*)USER_STACK_TOP);
+    setup_user_frame(thread, entry_point, USER_STACK_TOP, 0);
 
-    // Set up the initial KERNEL stack for the new userspace thread.
-    // This stack is what `thread_switch` will restore. It needs to be
-    // crafted to eventually `iretq` to userspace.
-    uint64_t *stack_ptr = (uint64_t *)((uint64_t)thread->stack + KERNEL_STACK_SIZE);
+    thread_register(thread, "user");
+    scheduler_add_thread(thread);
 
-    klog(LOG_DEBUG, "Userspace IRETQ frame setup: entry_point = %p, USER_STACK_TOP = %p", (void*)entry_point, (void*)USER_STACK_TOP);
-    // IRETQ frame
-    *--stack_ptr = 0x23;                      // SS (User Data Segment)
-    *--stack_ptr = USER_STACK_TOP;            // RSP (User Stack)
-    *--stack_ptr = 0x202;                     // RFLAGS (Interrupts enabled)
-    *--stack_ptr = 0x1B;                      // CS (User Code Segment)
-    *--stack_ptr = entry_point;               // RIP
+    return thread;
+}
 
-    // The address that `thread_switch` will `ret` to.
-    // This trampoline just contains `iretq`.
-    *--stack_ptr = (uint64_t)userspace_trampoline;
+thread_t *thread_spawn_user(uint64_t entry_point, uint64_t user_stack, uint64_t arg) {
+    thread_t *self = get_current_thread();
+    if (!self || !self->proc) {
+        return NULL; // Kernel threads have no address space to share
+    }
 
-    // Fake callee-saved registers for thread_switch to pop
-    *--stack_ptr = 0; // rbp
-    *--stack_ptr = 0; // rbx
-    *--stack_ptr = 0; // r12
-    *--stack_ptr = 0; // r13
-    *--stack_ptr = 0; // r14
-    *--stack_ptr = 0; // r15
+    thread_t *thread = (thread_t *)kmalloc(sizeof(thread_t));
+    if (!thread) {
+        klog(LOG_ERROR, "Failed to allocate userspace thread structure.");
+        return NULL;
+    }
+    thread->stack = kmalloc(KERNEL_STACK_SIZE);
+    if (!thread->stack) {
+        klog(LOG_ERROR, "Failed to allocate kernel stack for userspace thread.");
+        kfree(thread);
+        return NULL;
+    }
 
-    thread->rsp = (uint64_t)stack_ptr;
+    // Same address space and descriptors as the caller. The user stack
+    // belongs to the program, we don't free it.
+    thread->proc = process_get(self->proc);
+    __atomic_add_fetch(&thread->proc->nr_threads, 1, __ATOMIC_RELAXED);
+    thread->pml4 = self->pml4;
+    thread->files = fd_table_share(self->files);
+    thread->user_stack_base = NULL;
+
+    thread->id = alloc_thread_id();
+    thread->state = THREAD_READY;
+    thread->on_cpu = 0;
+    thread->fpu_state = NULL;
+    thread->fpu_alloc = NULL;
+    thread->fpu_cpu = (uint32_t)-1;
+
+    setup_user_frame(thread, entry_point, user_stack, arg);
 
+    thread_register(thread, self->name);
     scheduler_add_thread(thread);
 
-    enable_interrupts();
     return thread;
 }
 
-void thread_exit() {
+// Caller holds threads_lock
+static thread_t *find_thread_locked(uint64_t id) {
+  for (thread_t *t = all_threads; t; t = t->all_next) {
+    if (t->id == id) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+// Leave an exit record for our parent if it's still around to collect it,
+// and wake it if it's already waiting.
+static void record_exit(thread_t *self) {
+  exit_record_t *rec = (exit_record_t *)kmalloc(sizeof(exit_record_t));
+  thread_t *waiter = NULL;
+
+  // A program's first thread reports for the whole program
+  if (rec) {
+    bool main_thread = self->proc && self->proc->pid == self->id;
+    thread_get_usage(self, main_thread ? RUSAGE_SELF : RUSAGE_THREAD, &rec->usage);
+  }
+
+  uint64_t flags = spin_lock_irqsave(&exit_lock);
+  spin_lock(&threads_lock);
+  thread_t *parent = find_thread_locked(self->parent_id);
+  bool keep = parent && parent != self && parent->state != THREAD_DEAD;
+  spin_unlock(&threads_lock);
+
+  if (keep && rec) {
+    rec->id = self->id;
+    rec->parent_id = self->parent_id;
+    rec->status = self->exit_status;
+    rec->next = exit_records;
+    exit_records = rec;
+    rec = NULL;
+
+    for (thread_t **pp = &exit_waiters; *pp; pp = &(*pp)->wait_next) {
+      if ((*pp)->wait_tid == self->id) {
+        waiter = *pp;
+        *pp = waiter->wait_next;
+        waiter->wait_next = NULL;
+        break;
+      }
+    }
+  }
+  spin_unlock_irqrestore(&exit_lock, flags);
+
+  if (rec) {
+    kfree(rec);
+  }
+  if (waiter) {
+    scheduler_wake(waiter);
+  }
+}
+
+// Take `t` off exit_waiters if it's still there. Holding exit_lock.
+static void exit_waiter_unlink(thread_t *t) {
+  for (thread_t **pp = &exit_waiters; *pp; pp = &(*pp)->wait_next) {
+    if (*pp == t) {
+      *pp = t->wait_next;
+      t->wait_next = NULL;
+      return;
+    }
+  }
+}
+
+int thread_wait(uint64_t tid, int *status, rusage_t *usage) {
+  thread_t *self = get_current_thread();
+
+  for (;;) {
+    uint64_t flags = spin_lock_irqsave(&exit_lock);
+    // A spurious wakeup leaves us linked; linking twice would corrupt the
+    // list, and a return must not leave us on it
+    exit_waiter_unlink(self);
+    for (exit_record_t **pp = &exit_records; *pp; pp = &(*pp)->next) {
+      exit_record_t *rec = *pp;
+      if (rec->id == tid && rec->parent_id == self->id) {
+        *pp = rec->next;
+        spin_unlock_irqrestore(&exit_lock, flags);
+        if (status) {
+          *status = rec->status;
+        }
+        if (usage) {
+          *usage = rec->usage;
+        }
+        kfree(rec);
+        return 0;
+      }
+    }
+
+    // No record yet, so it's still running if it's our child at all. A
+    // thread can't exit past us: record_exit() needs exit_lock.
+    spin_lock(&threads_lock);
+    thread_t *child = find_thread_locked(tid);
+    bool is_child = child && child->parent_id == self->id && child != self;
+    spin_unlock(&threads_lock);
+    if (!is_child) {
+      spin_unlock_irqrestore(&exit_lock, flags);
+      return -1;
+    }
+
+    self->wait_tid = tid;
+    self->wait_next = exit_waiters;
+    exit_waiters = self;
+    self->state = THREAD_BLOCKED;
+    spin_unlock(&exit_lock);
+    schedule();
+    local_irq_restore(flags);
+  }
+}
+
+void thread_forget_children(uint64_t parent_id) {
+  exit_record_t *dropped = NULL;
+
+  uint64_t flags = spin_lock_irqsave(&exit_lock);
+  exit_record_t **pp = &exit_records;
+  while (*pp) {
+    exit_record_t *rec = *pp;
+    if (rec->parent_id == parent_id) {
+      *pp = rec->next;
+      rec->next = dropped;
+      dropped = rec;
+    } else {
+      pp = &rec->next;
+    }
+  }
+  spin_unlock_irqrestore(&exit_lock, flags);
+
+  while (dropped) {
+    exit_record_t *next = dropped->next;
+    kfree(dropped);
+    dropped = next;
+  }
+}
+
+void thread_exit(int status) {
+  thread_t *self = get_current_thread();
+  self->exit_status = status;
+  record_exit(self);
+
+  // The program's io ring pollers hold its descriptor table, and through
+  // it their own rings. Stop them once nobody can submit anymore.
+  if (self->proc && __atomic_sub_fetch(&self->proc->nr_threads, 1, __ATOMIC_ACQ_REL) == 0) {
+    io_ring_exit(self->files);
+  }
+
   disable_interrupts();
-  get_current_thread()->state = THREAD_DEAD;
-  klog(LOG_INFO, "Thread exited.");
-  // The scheduler will handle cleaning up the dead thread
+  self->state = THREAD_DEAD;
+  klog(LOG_INFO, "Thread %d exited with status %d.", self->id, status);
+  // The scheduler hands us to the reaper once we're off this CPU
   schedule();
   // We should never get here
   panic("Returned to a dead thread!", NULL);
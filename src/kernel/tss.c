@@ -2,34 +2,51 @@
 #include "gdt.h"
 #include "heap.h" // For kmalloc
 #include "log.h"
+#include "smp.h"
 #include <string.h> // For memset
 
 #define KERNEL_TSS_STACK_SIZE 8192
 
-static struct tss_entry_struct tss_entry;
+// Each CPU's TSS lives in its cpu_t. rsp0 is switched to the running
+// thread's kernel stack by the scheduler; this stack is only the fallback.
 static uint8_t
-    tss_stack[KERNEL_TSS_STACK_SIZE]; // Static stack avoiding heap dependency
+    tss_stack[KERNEL_TSS_STACK_SIZE]; // BSP stack, avoids heap dependency
 
 // External assembly function to load the TSS register
 extern void tss_flush();
 
-void tss_init() {
-  // No need to kmalloc, use static stack
-  // tss_kernel_stack = (uint8_t*)kmalloc(KERNEL_TSS_STACK_SIZE);
+void tss_init_cpu(struct cpu *cpu) {
+  struct tss_entry_struct *tss = &cpu->tss;
+  memset(tss, 0, sizeof(struct tss_entry_struct));
 
-  memset(&tss_entry, 0, sizeof(struct tss_entry_struct));
+  uint8_t *stack = tss_stack;
+  if (cpu->id != 0) {
+    stack = (uint8_t *)kmalloc(KERNEL_TSS_STACK_SIZE);
+    if (!stack) {
+      panic("TSS: Failed to allocate AP kernel stack!", NULL);
+    }
+  }
 
   // Set the kernel stack pointer for Ring 0
-  tss_entry.rsp0 = (uint64_t)tss_stack + KERNEL_TSS_STACK_SIZE;
+  tss->rsp0 = (uint64_t)stack + KERNEL_TSS_STACK_SIZE;
+  cpu->kernel_rsp = tss->rsp0;
+  tss->iomap_base = sizeof(struct tss_entry_struct); // No I/O permission bitmap
 
   // Set up the TSS descriptor in the GDT
-  gdt_set_tss(&tss_entry);
+  gdt_set_tss(tss);
 
   // Load the TSS register (ltr)
   // The selector for TSS is the 5th entry in our GDT
   tss_flush();
+}
 
+void tss_init() {
+  tss_init_cpu(this_cpu());
   klog(LOG_INFO, "TSS Initialized.");
 }
 
-void tss_set_stack(uint64_t stack) { tss_entry.rsp0 = stack; }
+void tss_set_stack(uint64_t stack) {
+  cpu_t *cpu = this_cpu();
+  cpu->tss.rsp0 = stack;
+  cpu->kernel_rsp = stack; // Same stack for SYSCALL
+}
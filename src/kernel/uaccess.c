@@ -0,0 +1,132 @@
+#include "uaccess.h"
+#include "cpu.h" // For cpuid
+
+// One entry per instruction that may fault on a user address. The linker
+// script collects them between __start___ex_table and __stop___ex_table.
+typedef struct {
+  uint64_t insn;  // Faulting instruction
+  uint64_t fixup; // Where to continue instead
+} ex_entry_t;
+
+extern const ex_entry_t __start___ex_table[];
+extern const ex_entry_t __stop___ex_table[];
+
+#define EX_ENTRY(insn, fixup)                 \
+  ".pushsection __ex_table, \"a\"\n\t"        \
+  ".balign 8\n\t"                             \
+  ".quad " #insn ", " #fixup "\n\t"           \
+  ".popsection\n\t"
+
+// 0 = not checked yet, 1 = fast `rep movsb` (ERMS or FSRM), -1 = use movsq
+static int fast_movsb_state = 0;
+
+static bool fast_movsb() {
+  if (fast_movsb_state == 0) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    bool fast = false;
+    if (eax >= 7) {
+      cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+      fast = (ebx & (1 << 9)) || (edx & (1 << 4)); // ERMS, FSRM
+    }
+    fast_movsb_state = fast ? 1 : -1;
+  }
+  return fast_movsb_state > 0;
+}
+
+// Copy and return how many bytes were left when it faulted, 0 if it didn't.
+// A faulting `rep movs` leaves rcx at the remaining count, so the fixup is
+// just the end of the copy.
+static size_t copy_user_generic(void *dst, const void *src, size_t size) {
+  if (fast_movsb() || size < 64) {
+    __asm__ __volatile__("cld\n\t"
+                         "1: rep movsb\n\t"
+                         "2:\n\t"
+                         EX_ENTRY(1b, 2b)
+                         : "+D"(dst), "+S"(src), "+c"(size)
+                         :
+                         : "memory");
+    return size;
+  }
+
+  // Without fast strings, 8 bytes at a time and the tail bytewise
+  size_t tail = size & 7;
+  size_t words = size >> 3;
+  __asm__ __volatile__("cld\n\t"
+                       "1: rep movsq\n\t"
+                       "mov %3, %%rcx\n\t"
+                       "2: rep movsb\n\t"
+                       "jmp 4f\n\t"
+                       "3: lea (%3, %%rcx, 8), %%rcx\n\t" // Words left, plus the tail
+                       "4:\n\t"
+                       EX_ENTRY(1b, 3b)
+                       EX_ENTRY(2b, 4b)
+                       : "+D"(dst), "+S"(src), "+c"(words)
+                       : "r"(tail)
+                       : "memory");
+  return words;
+}
+
+int copy_from_user(void *dst, const void *user_src, size_t size) {
+  if (!access_ok(user_src, size)) {
+    return -1;
+  }
+  return copy_user_generic(dst, user_src, size) ? -1 : 0;
+}
+
+int copy_to_user(void *user_dst, const void *src, size_t size) {
+  if (!access_ok(user_dst, size)) {
+    return -1;
+  }
+  return copy_user_generic(user_dst, src, size) ? -1 : 0;
+}
+
+// Load one user byte. Returns 0, or -1 if it faulted.
+static inline int get_user_u8(uint8_t *out, const uint8_t *user_ptr) {
+  int err = 0;
+  uint32_t val = 0;
+  __asm__ __volatile__("1: movzbl (%2), %1\n\t"
+                       "2:\n\t"
+                       ".pushsection .text.fixup, \"ax\"\n\t"
+                       "3: movl $-1, %0\n\t"
+                       "jmp 2b\n\t"
+                       ".popsection\n\t"
+                       EX_ENTRY(1b, 3b)
+                       : "+r"(err), "+r"(val)
+                       : "r"(user_ptr)
+                       : "memory");
+  *out = (uint8_t)val;
+  return err;
+}
+
+int64_t strncpy_from_user(char *dst, const char *user_src, size_t max) {
+  // Stop at the end of userspace rather than reading past it
+  if ((uint64_t)user_src >= USER_SPACE_END) {
+    return -1;
+  }
+  uint64_t room = USER_SPACE_END - (uint64_t)user_src;
+  if (max > room) {
+    max = room;
+  }
+  for (size_t i = 0; i < max; i++) {
+    uint8_t c;
+    if (get_user_u8(&c, (const uint8_t *)user_src + i) != 0) {
+      return -1;
+    }
+    dst[i] = (char)c;
+    if (c == '\0') {
+      return (int64_t)i;
+    }
+  }
+  return -1; // No NUL within `max` bytes
+}
+
+bool uaccess_fixup(struct registers *regs) {
+  for (const ex_entry_t *e = __start___ex_table; e < __stop___ex_table; e++) {
+    if (e->insn == regs->rip) {
+      regs->rip = e->fixup;
+      return true;
+    }
+  }
+  return false;
+}
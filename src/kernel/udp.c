@@ -3,27 +3,86 @@
 #include "ip.h"
 #include "kstring.h"
 #include "log.h"
+#include "rcu.h"
+#include "spinlock.h"
 
-#define UDP_MAX_HANDLERS 64
-static struct {
+// Port handlers. Looked up for every received datagram, so readers use RCU;
+// writers hold udp_lock.
+typedef struct udp_binding {
   uint16_t port;
   udp_handler_t handler;
-} udp_handlers[UDP_MAX_HANDLERS];
+  void *owner; // NULL for kernel services
+  struct udp_binding *next;
+  rcu_head_t rcu;
+} udp_binding_t;
 
-static int udp_handler_count = 0;
+static udp_binding_t *udp_bindings = NULL;
+static spinlock_t udp_lock = SPINLOCK_INIT("udp_bindings");
 
 void udp_init() {
-  memset(udp_handlers, 0, sizeof(udp_handlers));
-  udp_handler_count = 0;
+  udp_bindings = NULL;
   ip_register_protocol_handler(IP_PROTOCOL_UDP, udp_handle_packet);
   klog(LOG_INFO, "UDP layer initialized.");
 }
 
-void udp_register_handler(uint16_t port, udp_handler_t handler) {
-  if (udp_handler_count < UDP_MAX_HANDLERS) {
-    udp_handlers[udp_handler_count].port = port;
-    udp_handlers[udp_handler_count].handler = handler;
-    udp_handler_count++;
+// Caller holds udp_lock
+static udp_binding_t *udp_find_locked(uint16_t port) {
+  for (udp_binding_t *b = udp_bindings; b; b = b->next) {
+    if (b->port == port) {
+      return b;
+    }
+  }
+  return NULL;
+}
+
+int udp_register_handler(uint16_t port, udp_handler_t handler, void *owner) {
+  udp_binding_t *binding = (udp_binding_t *)kmalloc(sizeof(udp_binding_t));
+
+  int ret = 0;
+  uint64_t flags = spin_lock_irqsave(&udp_lock);
+  udp_binding_t *existing = udp_find_locked(port);
+  if (existing && existing->owner != owner) {
+    ret = -1; // Someone else's, e.g. DHCP's port taken by a socket
+  } else if (existing) {
+    // Rebinding a port just swaps the handler
+    __atomic_store_n(&existing->handler, handler, __ATOMIC_RELEASE);
+  } else if (binding) {
+    binding->port = port;
+    binding->handler = handler;
+    binding->owner = owner;
+    rcu_list_add(udp_bindings, binding);
+    binding = NULL;
+  } else {
+    ret = -1;
+  }
+  spin_unlock_irqrestore(&udp_lock, flags);
+
+  if (binding) {
+    kfree(binding); // Port was already bound
+  } else if (!existing) {
+    // Nothing was added or reused, so the allocation must have failed
+    klog(LOG_ERROR, "UDP: failed to allocate a port binding.");
+  }
+  return ret;
+}
+
+static void udp_free_binding(rcu_head_t *head) {
+  kfree(rcu_container_of(head, udp_binding_t, rcu));
+}
+
+void udp_unregister_handler(uint16_t port, void *owner) {
+  uint64_t flags = spin_lock_irqsave(&udp_lock);
+  udp_binding_t *binding = udp_find_locked(port);
+  if (binding && binding->owner != owner) {
+    binding = NULL; // Rebound by someone else since
+  }
+  if (binding) {
+    rcu_list_del(udp_bindings, binding);
+  }
+  spin_unlock_irqrestore(&udp_lock, flags);
+
+  if (binding) {
+    call_rcu(&binding->rcu, udp_free_binding);
   }
 }
 
@@ -46,13 +105,21 @@ void udp_handle_packet(net_dev_t *net_dev, const ipv4_header_t *ip_hdr,
   const uint8_t *data = packet + sizeof(udp_header_t);
   size_t data_len = length - sizeof(udp_header_t);
 
-  for (int i = 0; i < udp_handler_count; i++) {
-    if (udp_handlers[i].port == dest_port) {
-      udp_handlers[i].handler(net_dev, (ipv4_header_t *)ip_hdr, udp_hdr, data,
-                              data_len);
-      return;
+  udp_handler_t handler = NULL;
+  udp_binding_t *binding;
+  rcu_read_lock();
+  rcu_list_for_each(binding, udp_bindings) {
+    if (binding->port == dest_port) {
+      handler = __atomic_load_n(&binding->handler, __ATOMIC_ACQUIRE);
+      break;
     }
   }
+  rcu_read_unlock();
+
+  if (handler) {
+    handler(net_dev, (ipv4_header_t *)ip_hdr, udp_hdr, data, data_len);
+    return;
+  }
 
   char buf[64];
   ksprintf(buf, "UDP: No handler for port %d", (int)dest_port);
@@ -74,6 +141,6 @@ void udp_send_packet(uint32_t dest_ip, uint16_t src_port, uint16_t dest_port,
 
   memcpy(buffer + sizeof(udp_header_t), data, len);
 
-  ip_send_packet(network_devices, dest_ip, IP_PROTOCOL_UDP, buffer, udp_size);
+  ip_send_packet(net_default_device(), dest_ip, IP_PROTOCOL_UDP, buffer, udp_size);
   kfree(buffer);
 }
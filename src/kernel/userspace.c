@@ -5,10 +5,6 @@
 #include "log.h"
 #include <stddef.h> // For NULL
 
-// Selectors from GDT
-#define USER_CODE_SELECTOR 0x18 | 3 // Ring 3
-#define USER_DATA_SELECTOR 0x20 | 3 // Ring 3
-
 #define USER_STACK_VADDR 0x70000000
 #define USER_STACK_PAGES 4
 
@@ -35,9 +31,10 @@ void enter_userspace(uint64_t entry_point) {
         "pushq %2\n\t"          // RFLAGS (with IF bit set)
         "pushq %3\n\t"          // CS
         "pushq %4\n\t"          // RIP
+        "swapgs\n\t"           // Per-CPU GS base stays in KERNEL_GS_BASE
         "iretq"
         : 
-        : "i"(USER_DATA_SELECTOR), "r"(user_rsp), "i"(0x202), "i"(USER_CODE_SELECTOR), "r"(entry_point)
+        : "i"(USER_DATA_SELECTOR | 3), "r"(user_rsp), "i"(0x202), "i"(USER_CODE_SELECTOR | 3), "r"(entry_point)
         : "memory"
     );
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "vdso.h"
+#include "clock.h"
+#include "kstring.h"
+#include "log.h"
+#include "pmm.h"
+#include "vmm.h"
+#include <stddef.h> // for NULL
+
+// The vDSO functions are compiled into the kernel like any other code, but
+// in their own section, which vdso_init() copies to the code page. They run
+// in ring 3 at VDSO_TEXT_VADDR, so they may only use the data page (at its
+// fixed address) and code inside the section: no kernel symbols, no calls
+// out, no constant tables in .rodata.
+#define VDSO_FUNC __attribute__((section(".vdso_text"), used, noinline))
+
+extern char __vdso_text_start[];
+extern char __vdso_text_end[];
+
+static void *vdso_data_phys = NULL;
+static void *vdso_text_phys = NULL;
+static vdso_data_t *vdso_data = NULL; // Kernel's writable view
+
+// Monotonic nanoseconds and tick length, consistent with each other
+static inline __attribute__((always_inline)) uint64_t
+vdso_read_ns(uint64_t *tick_ns) {
+  const vdso_data_t *data = (const vdso_data_t *)VDSO_DATA_VADDR;
+  uint32_t seq;
+  uint64_t tsc_boot, ns_mult, tick;
+  uint32_t lo, hi;
+  do {
+    seq = __atomic_load_n(&data->seq, __ATOMIC_ACQUIRE);
+    tsc_boot = data->tsc_boot;
+    ns_mult = data->ns_mult;
+    tick = data->tick_ns;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || __atomic_load_n(&data->seq, __ATOMIC_RELAXED) != seq);
+
+  uint64_t cycles = (((uint64_t)hi << 32) | lo) - tsc_boot;
+  *tick_ns = tick;
+  return (uint64_t)(((unsigned __int128)cycles * ns_mult) >> 32);
+}
+
+VDSO_FUNC uint64_t vdso_get_ticks() {
+  uint64_t tick_ns;
+  uint64_t ns = vdso_read_ns(&tick_ns);
+  return ns / tick_ns;
+}
+
+VDSO_FUNC int vdso_clock_gettime(int clock, vdso_timespec_t *ts) {
+  if (clock != CLOCK_MONOTONIC) {
+    return -1;
+  }
+  uint64_t tick_ns;
+  uint64_t ns = vdso_read_ns(&tick_ns);
+  ts->tv_sec = (int64_t)(ns / NSEC_PER_SEC);
+  ts->tv_nsec = (int64_t)(ns % NSEC_PER_SEC);
+  return 0;
+}
+
+void vdso_update() {
+  // Readers retry while seq is odd or has changed
+  __atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  vdso_data->tsc_boot = clock_tsc_boot();
+  vdso_data->ns_mult = clock_ns_mult();
+  vdso_data->tick_ns = clock_tick_ns();
+  __atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELEASE);
+}
+
+void vdso_init() {
+  size_t text_size = (size_t)(__vdso_text_end - __vdso_text_start);
+  if (text_size > PAGE_SIZE) {
+    panic("vDSO: code doesn't fit in one page", NULL);
+  }
+
+  vdso_data_phys = pmm_alloc_page();
+  vdso_text_phys = pmm_alloc_page();
+  if (!vdso_data_phys || !vdso_text_phys) {
+    panic("vDSO: out of memory", NULL);
+  }
+
+  uint8_t *text = (uint8_t *)vmm_phys_to_virt(vdso_text_phys);
+  memset(text, 0xCC, PAGE_SIZE); // int3 past the end
+  memcpy(text, __vdso_text_start, text_size);
+
+  vdso_data = (vdso_data_t *)vmm_phys_to_virt(vdso_data_phys);
+  memset(vdso_data, 0, PAGE_SIZE);
+  vdso_data->version = VDSO_VERSION;
+  vdso_data->get_ticks_offset = (uint64_t)((char *)vdso_get_ticks - __vdso_text_start);
+  vdso_data->clock_gettime_offset =
+      (uint64_t)((char *)vdso_clock_gettime - __vdso_text_start);
+  vdso_update();
+  // Last, so a process that sees the magic sees everything else
+  __atomic_store_n(&vdso_data->magic, VDSO_MAGIC, __ATOMIC_RELEASE);
+
+  klog(LOG_INFO, "vDSO: %lu bytes of code.", (uint64_t)text_size);
+}
+
+void vdso_map(pml4_t *pml4) {
+  if (!vdso_data) {
+    return; // Only before vdso_init(), while no process exists yet
+  }
+  vmm_map_page(pml4, (void *)VDSO_DATA_VADDR, vdso_data_phys,
+               PAGE_PRESENT | PAGE_USER | PAGE_NO_EXEC);
+  vmm_map_page(pml4, (void *)VDSO_TEXT_VADDR, vdso_text_phys,
+               PAGE_PRESENT | PAGE_USER);
+}
@@ -1,7 +1,9 @@
 #include "vfs.h"
 #include "log.h"
 #include "kstring.h" // Moved to top
-#include "thread.h" // For current_thread and fd_entry_t
+#include "thread.h" // For get_current_thread and fd_entry_t
+#include "heap.h"
+#include "preempt.h" // For cond_resched
 // #include <stddef.h> // Removed, as kstring.h includes it
 
 vfs_node_t *vfs_root = NULL;
@@ -17,6 +19,12 @@ void vfs_open(vfs_node_t *node, int flags) {
     }
 }
 
+void vfs_close(vfs_node_t *node) {
+    if (node && node->close) {
+        node->close(node);
+    }
+}
+
 int vfs_stat(vfs_node_t *root, const char *path, struct stat *stat_buf) {
     vfs_node_t *node = vfs_resolve_path(root, path);
     if (!node) {
@@ -31,19 +39,91 @@ int vfs_stat(vfs_node_t *root, const char *path, struct stat *stat_buf) {
 uint32_t vfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                   uint8_t *buffer) {
   if (node && node->read) {
-    return node->read(node, offset, size, buffer);
+    uint32_t n = node->read(node, offset, size, buffer);
+    thread_t *t = get_current_thread();
+    if (t && n != (uint32_t)-1) {
+      t->stats.read_bytes += n; // For rusage
+    }
+    return n;
   }
   return 0;
 }
 
 uint32_t vfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer) {
+  if (offset > VFS_FILE_SIZE_MAX || size > VFS_FILE_SIZE_MAX - offset) {
+    return (uint32_t)-1;
+  }
   if (node && node->write) {
-    return node->write(node, offset, size, buffer);
+    uint32_t n = node->write(node, offset, size, buffer);
+    thread_t *t = get_current_thread();
+    if (t && n != (uint32_t)-1) {
+      t->stats.write_bytes += n; // For rusage
+    }
+    return n;
   }
   return 0;
 }
 
+// Largest bounce buffer vfs_copy_range() allocates. Files up to this size
+// are copied with one write, which filesystems that only rewrite whole
+// files (fs_disk) need.
+#define VFS_COPY_BOUNCE_MAX (1024 * 1024)
+
+uint32_t vfs_copy_range(vfs_node_t *in, uint64_t off_in, vfs_node_t *out, uint64_t off_out,
+                        uint32_t size) {
+  if (!in || !out || (in->flags & VFS_DIRECTORY) || (out->flags & VFS_DIRECTORY)) {
+    return (uint32_t)-1;
+  }
+  if (size == 0) {
+    return 0;
+  }
+  if (off_out > VFS_FILE_SIZE_MAX || size > VFS_FILE_SIZE_MAX - off_out) {
+    return (uint32_t)-1;
+  }
+
+  if (in->copy_range && in->copy_range == out->copy_range) {
+    uint32_t n = in->copy_range(in, off_in, out, off_out, size);
+    thread_t *t = get_current_thread();
+    if (t && n != (uint32_t)-1) {
+      t->stats.read_bytes += n; // For rusage, as vfs_read/vfs_write
+      t->stats.write_bytes += n;
+    }
+    return n;
+  }
+
+  uint32_t chunk = size < VFS_COPY_BOUNCE_MAX ? size : VFS_COPY_BOUNCE_MAX;
+  uint8_t *buf = (uint8_t *)kmalloc(chunk);
+  if (!buf) {
+    return (uint32_t)-1;
+  }
+  uint32_t done = 0;
+  while (done < size) {
+    uint32_t want = size - done < chunk ? size - done : chunk;
+    uint32_t r = vfs_read(in, off_in + done, want, buf);
+    if (r == (uint32_t)-1 || r == 0) {
+      if (r == (uint32_t)-1 && done == 0) {
+        done = (uint32_t)-1;
+      }
+      break;
+    }
+    uint32_t w = vfs_write(out, off_out + done, r, buf);
+    if (w == (uint32_t)-1) {
+      if (done == 0) {
+        done = (uint32_t)-1;
+      }
+      break;
+    }
+    done += w;
+    if (w < r || r < want) {
+      break; // Out of space, or end of the input
+    }
+    cond_resched();
+  }
+  kfree(buf);
+  return done;
+}
+
 vfs_node_t *vfs_finddir(vfs_node_t *node, char *name) {
   if (node && (node->flags & VFS_DIRECTORY) && node->finddir) {
     return node->finddir(node, name);
@@ -185,6 +265,51 @@ int vfs_rmdir(vfs_node_t *root, const char *path, uint16_t mode) {
     return parent_node->rmdir(parent_node, target_name, mode);
 }
 
+// Directory holding the last component of `path`, which is left in `name`.
+// NULL if there's no such directory or no usable last component.
+static vfs_node_t *vfs_resolve_parent(vfs_node_t *root, const char *path, char *name) {
+    int last_slash = -1;
+    for (int i = 0; path[i]; i++) {
+        if (path[i] == '/') last_slash = i;
+    }
+    const char *last = path + last_slash + 1;
+    size_t len = strlen(last);
+    if (len == 0 || len >= MAX_FILENAME_LEN ||
+        strcmp(last, ".") == 0 || strcmp(last, "..") == 0) {
+        return NULL;
+    }
+    memcpy(name, last, len + 1);
+
+    if (last_slash <= 0) {
+        return root; // "name" or "/name"
+    }
+    char parent_path[MAX_FILENAME_LEN];
+    memcpy(parent_path, path, last_slash);
+    parent_path[last_slash] = '\0';
+    vfs_node_t *parent = vfs_resolve_path(root, parent_path);
+    if (!parent || !(parent->flags & VFS_DIRECTORY)) {
+        return NULL;
+    }
+    return parent;
+}
+
+int vfs_rename(vfs_node_t *old_root, const char *old_path, vfs_node_t *new_root, const char *new_path) {
+    if (!old_path || !new_path || !old_root || !new_root) return -1;
+
+    char old_name[MAX_FILENAME_LEN];
+    char new_name[MAX_FILENAME_LEN];
+    vfs_node_t *old_dir = vfs_resolve_parent(old_root, old_path, old_name);
+    vfs_node_t *new_dir = vfs_resolve_parent(new_root, new_path, new_name);
+    if (!old_dir || !new_dir || !old_dir->rename) {
+        return -1;
+    }
+    // Different ops, different filesystems: nothing to relink
+    if (old_dir->rename != new_dir->rename) {
+        return -1;
+    }
+    return old_dir->rename(old_dir, old_name, new_dir, new_name);
+}
+
 #include "kstring.h"
 vfs_node_t *vfs_resolve_path(vfs_node_t *root, const char *path) {
   if (!path || !root)
@@ -224,27 +349,29 @@ vfs_node_t *vfs_resolve_path(vfs_node_t *root, const char *path) {
 }
 
 // Kernel-internal ioctl that dispatches to the VFS node associated with a file descriptor
-extern thread_t *current_thread; // Defined in thread.c
 
 int kernel_ioctl(int fd, int request, void* argp) {
-    if (fd < 0 || fd >= MAX_FILES) {
-        klog(LOG_ERROR, "VFS: kernel_ioctl: Invalid file descriptor %d.", fd);
-        return -1;
-    }
-
+    thread_t *current_thread = get_current_thread();
     if (!current_thread) {
         klog(LOG_ERROR, "VFS: kernel_ioctl: No current thread available.");
         return -1;
     }
 
-    fd_entry_t *fde = &current_thread->fd_table[fd];
+    fd_entry_t *fde = fd_get(current_thread->files, fd);
+    if (!fde) {
+        klog(LOG_ERROR, "VFS: kernel_ioctl: Invalid file descriptor %d.", fd);
+        return -1;
+    }
 
     if (fde->type == FD_TYPE_FILE && fde->data.file.node && fde->data.file.node->ioctl) {
-        return fde->data.file.node->ioctl(fde->data.file.node, request, argp);
+        int ret = fde->data.file.node->ioctl(fde->data.file.node, request, argp);
+        fd_put(fde);
+        return ret;
     }
     // Handle other types of FDs (sockets, etc.) here if needed
     // For now, only VFS_FILE ioctl is supported through this mechanism
 
     klog(LOG_WARN, "VFS: kernel_ioctl: No ioctl handler for fd %d (type %d).", fd, fde->type);
+    fd_put(fde);
     return -1;
 }
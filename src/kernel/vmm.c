@@ -2,6 +2,7 @@
 #include "pmm.h"
 #include "log.h"
 #include "kstring.h"
+#include "smp.h" // For tlb_shootdown
 #include <stddef.h> // for NULL
 
 // This is the global offset for the higher-half direct map, defined in kernel.c
@@ -102,9 +103,14 @@ void vmm_map_page(pml4_t* pml4_virt, void* virt, void* phys, uint64_t flags) {
         pt_virt = (pt_t*)vmm_phys_to_virt((void*)(pd_virt->entries[pd_index] & ~0xFFF));
     }
     
+    uint64_t old_entry = pt_virt->entries[pt_index];
     pt_virt->entries[pt_index] = (uint64_t)phys | flags;
 
     __asm__ __volatile__("invlpg (%0)" :: "r"(virt_addr) : "memory");
+    if (old_entry & PAGE_PRESENT) {
+        // Other CPUs may still have the old translation cached
+        tlb_shootdown(pml4_virt, virt_addr);
+    }
 }
 
 void vmm_map_page_current(void* virt, void* phys, uint64_t flags) {
@@ -134,6 +140,7 @@ void* vmm_unmap_page(pml4_t* pml4_virt, void* virt) {
     pt_virt->entries[pt_index] = 0;
     
     __asm__ __volatile__("invlpg (%0)" :: "r"(virt_addr) : "memory");
+    tlb_shootdown(pml4_virt, virt_addr);
 
     return phys_addr;
 }
@@ -142,6 +149,47 @@ void* vmm_unmap_page_current(void* virt) {
     return vmm_unmap_page(vmm_get_current_pml4(), virt);
 }
 
+void* vmm_get_phys(pml4_t* pml4_virt, void* virt) {
+    uint64_t virt_addr = (uint64_t)virt;
+    uint64_t pml4_index = (virt_addr >> 39) & 0x1FF;
+    uint64_t pdpt_index = (virt_addr >> 30) & 0x1FF;
+    uint64_t pd_index = (virt_addr >> 21) & 0x1FF;
+    uint64_t pt_index = (virt_addr >> 12) & 0x1FF;
+
+    if (!(pml4_virt->entries[pml4_index] & PAGE_PRESENT)) return NULL;
+    pdpt_t* pdpt_virt = (pdpt_t*)vmm_phys_to_virt((void*)(pml4_virt->entries[pml4_index] & PAGE_ADDR_MASK));
+    if (!(pdpt_virt->entries[pdpt_index] & PAGE_PRESENT)) return NULL;
+    pd_t* pd_virt = (pd_t*)vmm_phys_to_virt((void*)(pdpt_virt->entries[pdpt_index] & PAGE_ADDR_MASK));
+    if (!(pd_virt->entries[pd_index] & PAGE_PRESENT)) return NULL;
+    pt_t* pt_virt = (pt_t*)vmm_phys_to_virt((void*)(pd_virt->entries[pd_index] & PAGE_ADDR_MASK));
+    if (!(pt_virt->entries[pt_index] & PAGE_PRESENT)) return NULL;
+
+    // The NX bit is set on data pages, keep it out of the address
+    return (void*)((pt_virt->entries[pt_index] & PAGE_ADDR_MASK) | (virt_addr & 0xFFF));
+}
+
+uint64_t vmm_count_user_pages(pml4_t* pml4) {
+    uint64_t pages = 0;
+    for (int i = 0; i < 256; i++) {
+        if (!(pml4->entries[i] & PAGE_PRESENT)) continue;
+        pdpt_t* pdpt = (pdpt_t*)vmm_phys_to_virt((void*)(pml4->entries[i] & ~0xFFF));
+        for (int j = 0; j < 512; j++) {
+            if (!(pdpt->entries[j] & PAGE_PRESENT)) continue;
+            pd_t* pd = (pd_t*)vmm_phys_to_virt((void*)(pdpt->entries[j] & ~0xFFF));
+            for (int k = 0; k < 512; k++) {
+                if (!(pd->entries[k] & PAGE_PRESENT)) continue;
+                pt_t* pt = (pt_t*)vmm_phys_to_virt((void*)(pd->entries[k] & ~0xFFF));
+                for (int l = 0; l < 512; l++) {
+                    if (pt->entries[l] & PAGE_PRESENT) {
+                        pages++;
+                    }
+                }
+            }
+        }
+    }
+    return pages;
+}
+
 void vmm_destroy_address_space(pml4_t* pml4) {
     if (!pml4) return;
 
@@ -0,0 +1,67 @@
+#include "waitqueue.h"
+#include "scheduler.h"
+#include <stddef.h> // for NULL
+
+void wait_queue_init(wait_queue_t *wq, const char *name) {
+  spinlock_init(&wq->lock, name);
+  wq->head = NULL;
+}
+
+void wait_wake_thread(wait_queue_entry_t *entry, uint32_t events) {
+  (void)events;
+  scheduler_wake((thread_t *)entry->private);
+}
+
+void wait_entry_init(wait_queue_entry_t *entry, thread_t *thread) {
+  entry->func = wait_wake_thread;
+  entry->private = thread;
+  entry->next = NULL;
+  entry->prev = NULL;
+}
+
+void wait_queue_link(wait_queue_t *wq, wait_queue_entry_t *entry) {
+  entry->prev = NULL;
+  entry->next = wq->head;
+  if (wq->head) {
+    wq->head->prev = entry;
+  }
+  wq->head = entry;
+}
+
+void wait_queue_unlink(wait_queue_t *wq, wait_queue_entry_t *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    wq->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  }
+  entry->next = NULL;
+  entry->prev = NULL;
+}
+
+void wait_queue_add(wait_queue_t *wq, wait_queue_entry_t *entry) {
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  wait_queue_link(wq, entry);
+  spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_queue_remove(wait_queue_t *wq, wait_queue_entry_t *entry) {
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  wait_queue_unlink(wq, entry);
+  spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up(wait_queue_t *wq, uint32_t events) {
+  // Always take the lock, even with nobody waiting. Peeking at the head
+  // without it could miss a waiter that just added itself: the state the
+  // waker changed (say an io ring's CQ tail) isn't ordered against the peek,
+  // so the waiter's check could see the old state too. The lock orders
+  // them: the waiter either sees the change or its entry is seen here.
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  for (wait_queue_entry_t *entry = wq->head; entry; entry = entry->next) {
+    entry->func(entry, events);
+  }
+  spin_unlock_irqrestore(&wq->lock, flags);
+}
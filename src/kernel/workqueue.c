@@ -0,0 +1,104 @@
+#include "workqueue.h"
+#include "heap.h"
+#include "isr.h"
+#include "log.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "thread.h"
+#include <stddef.h> // for NULL
+
+struct workqueue {
+  spinlock_t lock;
+  work_t *head; // FIFO of pending work
+  work_t *tail;
+  thread_t *worker;
+};
+
+workqueue_t *system_wq = NULL;
+
+void work_init(work_t *work, work_func_t func, void *arg) {
+  work->func = func;
+  work->arg = arg;
+  work->next = NULL;
+  work->pending = 0;
+}
+
+static void worker_main(void *arg) {
+  workqueue_t *wq = (workqueue_t *)arg;
+  thread_t *self = get_current_thread();
+
+  for (;;) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    work_t *work = wq->head;
+    if (!work) {
+      // Set under the lock, so queue_work() either sees us blocked and
+      // wakes us, or queued its item before we looked
+      self->state = THREAD_BLOCKED;
+      spin_unlock(&wq->lock);
+      schedule();
+      local_irq_restore(flags);
+      continue;
+    }
+    wq->head = work->next;
+    if (!wq->head) {
+      wq->tail = NULL;
+    }
+    work->next = NULL;
+    // From here on it can be queued again, even by its own handler
+    __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    work->func(work->arg);
+  }
+}
+
+workqueue_t *workqueue_create(const char *name) {
+  workqueue_t *wq = (workqueue_t *)kmalloc(sizeof(workqueue_t));
+  if (!wq) {
+    klog(LOG_ERROR, "Workqueue: Failed to allocate %s.", name);
+    return NULL;
+  }
+  spinlock_init(&wq->lock, name);
+  wq->head = NULL;
+  wq->tail = NULL;
+  wq->worker = thread_create(worker_main, wq);
+  if (!wq->worker) {
+    klog(LOG_ERROR, "Workqueue: Failed to start the %s worker.", name);
+    kfree(wq);
+    return NULL;
+  }
+  thread_set_name(wq->worker, name);
+  return wq;
+}
+
+bool queue_work(workqueue_t *wq, work_t *work) {
+  if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) {
+    return false; // Already queued, it'll see whatever we were about to report
+  }
+
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  work->next = NULL;
+  if (wq->tail) {
+    wq->tail->next = work;
+  } else {
+    wq->head = work;
+  }
+  wq->tail = work;
+  spin_unlock_irqrestore(&wq->lock, flags);
+
+  scheduler_wake(wq->worker);
+  return true;
+}
+
+bool schedule_work(work_t *work) {
+  return queue_work(system_wq, work);
+}
+
+void workqueue_init() {
+  klog(LOG_INFO, "Workqueue: Initializing...");
+  system_wq = workqueue_create("kworker");
+  if (!system_wq) {
+    panic("Failed to create the system workqueue", NULL);
+  }
+  klog(LOG_INFO, "Workqueue initialized.");
+}
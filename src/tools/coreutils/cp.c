@@ -1,84 +1,83 @@
 #include <kyroolib.h>
 
-#define BUF_SIZE 1024
+#define COPY_CHUNK (1024 * 1024) // Per copy_file_range() call
 
-#define BUF_SIZE 1024
-
-// Helper function to recursively copy files and directories
-static int copy_recursive(const char *src, const char *dest) {
+// Copy `src_name` in the directory `src_dir` to `dest_name` in `dest_dir`,
+// recursively. Directories are walked through descriptors, so every entry
+// is looked up once in its parent instead of from the root.
+static int copy_recursive(int src_dir, const char *src_name, int dest_dir, const char *dest_name) {
     struct stat st;
-    if (stat(src, &st) != 0) {
-        print("cp: could not stat source '"); print(src); print("'\n");
+    if (fstatat(src_dir, src_name, &st) != 0) {
+        print("cp: could not stat source '"); print(src_name); print("'\n");
         return -1;
     }
 
     if (S_ISREG(st.st_mode)) { // It's a regular file
-        int src_fd = open(src, O_RDONLY);
+        int src_fd = openat(src_dir, src_name, O_RDONLY);
         if (src_fd < 0) {
-            print("cp: cannot open source file '"); print(src); print("'\n");
+            print("cp: cannot open source file '"); print(src_name); print("'\n");
             return -1;
         }
 
-        int dest_fd = open(dest, O_CREAT | O_TRUNC | O_WRONLY);
+        int dest_fd = openat(dest_dir, dest_name, O_CREAT | O_TRUNC | O_WRONLY);
         if (dest_fd < 0) {
-            print("cp: cannot create destination file '"); print(dest); print("'\n");
+            print("cp: cannot create destination file '"); print(dest_name); print("'\n");
             close(src_fd);
             return -1;
         }
 
-        char buffer[BUF_SIZE];
-        int bytes_read;
-        while ((bytes_read = read(src_fd, buffer, BUF_SIZE)) > 0) {
-            if (write(dest_fd, buffer, bytes_read) < 0) {
-                print("cp: write error to '"); print(dest); print("'\n");
-                close(src_fd);
-                close(dest_fd);
-                return -1;
-            }
+        // The kernel moves the data, nothing passes through userspace
+        int64_t copied;
+        while ((copied = copy_file_range(src_fd, NULL, dest_fd, NULL, COPY_CHUNK)) > 0) {
+        }
+        if (copied < 0) {
+            print("cp: write error to '"); print(dest_name); print("'\n");
+            close(src_fd);
+            close(dest_fd);
+            return -1;
         }
         close(src_fd);
         close(dest_fd);
         return 0;
     } else if (S_ISDIR(st.st_mode)) { // It's a directory
-        if (mkdir(dest) != 0) {
-            // If it exists, that's fine. If it's another error, return it.
-            // Our current mkdir might not return specific error codes for "already exists".
-            // For now, if mkdir returns <0, we consider it an error unless we can positively check for "already exists"
+        if (mkdirat(dest_dir, dest_name) != 0) {
+            // Our mkdir doesn't report "already exists", check for it
             struct stat dest_st;
-            if (stat(dest, &dest_st) != 0 || !S_ISDIR(dest_st.st_mode)) {
-                print("cp: cannot create directory '"); print(dest); print("'\n");
+            if (fstatat(dest_dir, dest_name, &dest_st) != 0 || !S_ISDIR(dest_st.st_mode)) {
+                print("cp: cannot create directory '"); print(dest_name); print("'\n");
                 return -1;
             }
         }
 
-        int dir_fd = open(src, O_RDONLY); // Open source directory for reading entries
-        if (dir_fd < 0) {
-            print("cp: cannot open source directory '"); print(src); print("'\n");
+        int src_fd = openat(src_dir, src_name, O_RDONLY); // Source directory, for its entries
+        if (src_fd < 0) {
+            print("cp: cannot open source directory '"); print(src_name); print("'\n");
+            return -1;
+        }
+        int dest_fd = openat(dest_dir, dest_name, O_RDONLY);
+        if (dest_fd < 0) {
+            print("cp: cannot open destination directory '"); print(dest_name); print("'\n");
+            close(src_fd);
             return -1;
         }
 
         struct dirent de;
         int index = 0;
-        char src_entry_path[MAX_FILENAME_LEN * 2];
-        char dest_entry_path[MAX_FILENAME_LEN * 2];
-
-        while (readdir(dir_fd, index++, &de)) {
+        int ret = 0;
+        while (readdir(src_fd, index++, &de) > 0) {
             if (strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0) {
                 continue;
             }
-
-            ksprintf(src_entry_path, "%s/%s", src, de.name);
-            ksprintf(dest_entry_path, "%s/%s", dest, de.name);
-            
-            if (copy_recursive(src_entry_path, dest_entry_path) != 0) {
-                close(dir_fd);
-                return -1; // Propagate error
+            if (copy_recursive(src_fd, de.name, dest_fd, de.name) != 0) {
+                ret = -1; // Propagate error
+                break;
             }
         }
-        close(dir_fd);
-        return 0;
+        close(src_fd);
+        close(dest_fd);
+        return ret;
     }
-    print("cp: unsupported source type '"); print(src); print("'\n");
+    print("cp: unsupported source type '"); print(src_name); print("'\n");
     return -1;
 }
 
@@ -91,9 +90,9 @@ int main(int argc, char **argv) {
     const char *src_path = argv[1];
     const char *dest_path = argv[2];
 
-    if (copy_recursive(src_path, dest_path) != 0) {
+    if (copy_recursive(AT_FDCWD, src_path, AT_FDCWD, dest_path) != 0) {
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
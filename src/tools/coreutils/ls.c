@@ -2,20 +2,40 @@
 #include <vfs.h> // For MAX_FILENAME_LEN
 
 int main(int argc, char **argv) {
-    char path[MAX_FILENAME_LEN];
-    if (argc > 1) {
-        strcpy(path, argv[1]);
-    } else {
-        strcpy(path, "."); // Current directory
-    }
+    const char *path = argc > 1 ? argv[1] : "/"; // No working directory yet
 
-    print("ls: Directory listing for ");
-    print(path);
-    print(" (Not yet fully implemented to list actual contents)\n");
+    int dir_fd = open(path, O_RDONLY);
+    if (dir_fd < 0) {
+        print("ls: cannot access '"); print(path); print("'\n");
+        return 1;
+    }
 
-    // Placeholder content for now
-    print("  a_file.txt\n");
-    print("  another_dir/\n");
+    struct stat st;
+    if (fstat(dir_fd, &st) != 0) {
+        print("ls: cannot stat '"); print(path); print("'\n");
+        close(dir_fd);
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        print(path); print("\n");
+        close(dir_fd);
+        return 0;
+    }
 
+    // Entries are looked up in the open directory, not from the root
+    struct dirent de;
+    int index = 0;
+    char line[MAX_FILENAME_LEN + 32];
+    while (readdir(dir_fd, index++, &de) > 0) {
+        if (fstatat(dir_fd, de.name, &st) != 0) {
+            ksprintf(line, "  %s\n", de.name);
+        } else if (S_ISDIR(st.st_mode)) {
+            ksprintf(line, "  %s/\n", de.name);
+        } else {
+            ksprintf(line, "  %s  %d\n", de.name, (int)st.st_size);
+        }
+        print(line);
+    }
+    close(dir_fd);
     return 0;
-}
\ No newline at end of file
+}
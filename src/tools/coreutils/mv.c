@@ -2,25 +2,28 @@
 
 #define BUF_SIZE 1024
 
-// Helper function to recursively move files and directories (copy + delete)
-static int move_recursive(const char *src, const char *dest) {
+// Move `src_name` in the directory `src_dir` to `dest_name` in `dest_dir`,
+// recursively (copy + delete), for when rename() can't: across filesystems
+// or onto a non-empty directory. Directories are walked through descriptors,
+// so every entry is looked up once in its parent instead of from the root.
+static int move_recursive(int src_dir, const char *src_name, int dest_dir, const char *dest_name) {
     struct stat st;
-    if (stat(src, &st) != 0) {
-        print("mv: could not stat source '"); print(src); print("'\n");
+    if (fstatat(src_dir, src_name, &st) != 0) {
+        print("mv: could not stat source '"); print(src_name); print("'\n");
         return -1;
     }
 
     if (S_ISREG(st.st_mode)) { // It's a regular file
         // Copy the file
-        int src_fd = open(src, O_RDONLY);
+        int src_fd = openat(src_dir, src_name, O_RDONLY);
         if (src_fd < 0) {
-            print("mv: cannot open source file '"); print(src); print("'\n");
+            print("mv: cannot open source file '"); print(src_name); print("'\n");
             return -1;
         }
 
-        int dest_fd = open(dest, O_CREAT | O_TRUNC | O_WRONLY);
+        int dest_fd = openat(dest_dir, dest_name, O_CREAT | O_TRUNC | O_WRONLY);
         if (dest_fd < 0) {
-            print("mv: cannot create destination file '"); print(dest); print("'\n");
+            print("mv: cannot create destination file '"); print(dest_name); print("'\n");
             close(src_fd);
             return -1;
         }
@@ -29,7 +32,7 @@ static int move_recursive(const char *src, const char *dest) {
         int bytes_read;
         while ((bytes_read = read(src_fd, buffer, BUF_SIZE)) > 0) {
             if (write(dest_fd, buffer, bytes_read) < 0) {
-                print("mv: write error to '"); print(dest); print("'\n");
+                print("mv: write error to '"); print(dest_name); print("'\n");
                 close(src_fd);
                 close(dest_fd);
                 return -1;
@@ -39,53 +42,64 @@ static int move_recursive(const char *src, const char *dest) {
         close(dest_fd);
 
         // Delete the original file
-        if (unlink(src) != 0) {
-            print("mv: warning: failed to remove original file '"); print(src); print("'\n");
+        if (unlinkat(src_dir, src_name, 0) != 0) {
+            print("mv: warning: failed to remove original file '"); print(src_name); print("'\n");
         }
         return 0;
     } else if (S_ISDIR(st.st_mode)) { // It's a directory
-        if (mkdir(dest) != 0) {
+        if (mkdirat(dest_dir, dest_name) != 0) {
             // Check if it already exists as a directory
             struct stat dest_st;
-            if (stat(dest, &dest_st) != 0 || !S_ISDIR(dest_st.st_mode)) {
-                print("mv: cannot create directory '"); print(dest); print("'\n");
+            if (fstatat(dest_dir, dest_name, &dest_st) != 0 || !S_ISDIR(dest_st.st_mode)) {
+                print("mv: cannot create directory '"); print(dest_name); print("'\n");
                 return -1;
             }
         }
 
-        int dir_fd = open(src, O_RDONLY); // Open source directory for reading entries
-        if (dir_fd < 0) {
-            print("mv: cannot open source directory '"); print(src); print("'\n");
+        int src_fd = openat(src_dir, src_name, O_RDONLY); // Source directory, for its entries
+        if (src_fd < 0) {
+            print("mv: cannot open source directory '"); print(src_name); print("'\n");
+            return -1;
+        }
+        int dest_fd = openat(dest_dir, dest_name, O_RDONLY);
+        if (dest_fd < 0) {
+            print("mv: cannot open destination directory '"); print(dest_name); print("'\n");
+            close(src_fd);
             return -1;
         }
 
         struct dirent de;
         int index = 0;
-        char src_entry_path[MAX_FILENAME_LEN * 2];
-        char dest_entry_path[MAX_FILENAME_LEN * 2];
-
-        while (readdir(dir_fd, index++, &de)) {
+        int ret = 0;
+        while (readdir(src_fd, index, &de) > 0) {
             if (strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0) {
+                index++;
                 continue;
             }
-
-            ksprintf(src_entry_path, "%s/%s", src, de.name);
-            ksprintf(dest_entry_path, "%s/%s", dest, de.name);
-            
-            if (move_recursive(src_entry_path, dest_entry_path) != 0) {
-                close(dir_fd);
-                return -1; // Propagate error
+            if (move_recursive(src_fd, de.name, dest_fd, de.name) != 0) {
+                ret = -1; // Propagate error
+                break;
             }
+            // A moved entry leaves the directory and the next one takes its
+            // index, unless removing it failed
+            struct stat left;
+            if (fstatat(src_fd, de.name, &left) == 0) {
+                index++;
+            }
+        }
+        close(src_fd);
+        close(dest_fd);
+        if (ret != 0) {
+            return ret;
         }
-        close(dir_fd);
 
         // Remove the now empty source directory
-        if (rmdir(src) != 0) {
-            print("mv: warning: failed to remove source directory '"); print(src); print("'\n");
+        if (unlinkat(src_dir, src_name, AT_REMOVEDIR) != 0) {
+            print("mv: warning: failed to remove source directory '"); print(src_name); print("'\n");
         }
         return 0;
     }
-    print("mv: unsupported source type '"); print(src); print("'\n");
+    print("mv: unsupported source type '"); print(src_name); print("'\n");
     return -1;
 }
 
@@ -98,9 +112,13 @@ int main(int argc, char **argv) {
     const char *src_path = argv[1];
     const char *dest_path = argv[2];
 
-    if (move_recursive(src_path, dest_path) != 0) {
+    // Within one filesystem the kernel just relinks the entry
+    if (rename(src_path, dest_path) == 0) {
+        return 0;
+    }
+    if (move_recursive(AT_FDCWD, src_path, AT_FDCWD, dest_path) != 0) {
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
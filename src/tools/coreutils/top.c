@@ -0,0 +1,135 @@
+#include <kyroolib.h>
+
+#define MAX_THREADS 64
+#define REFRESH_MS 1000
+#define POLL_MS 100
+
+static const char *state_names[] = {"run", "ready", "block", "dead"};
+
+static thread_info_t snap_a[MAX_THREADS];
+static thread_info_t snap_b[MAX_THREADS];
+
+// Append `v` right-aligned in `width` columns
+static char *put_u64(char *p, uint64_t v, int width) {
+    char tmp[21];
+    int len = 0;
+    do {
+        tmp[len++] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    for (int i = len; i < width; i++) {
+        *p++ = ' ';
+    }
+    while (len) {
+        *p++ = tmp[--len];
+    }
+    return p;
+}
+
+// Append `s` left-aligned in `width` columns
+static char *put_str(char *p, const char *s, int width) {
+    int len = 0;
+    while (s[len] && len < width) {
+        *p++ = s[len++];
+    }
+    for (; len < width; len++) {
+        *p++ = ' ';
+    }
+    return p;
+}
+
+static const thread_info_t *find_thread(const thread_info_t *snap, int count, uint64_t id) {
+    for (int i = 0; i < count; i++) {
+        if (snap[i].id == id) {
+            return &snap[i];
+        }
+    }
+    return NULL;
+}
+
+// Sleep for one refresh interval. Returns 1 if 'q' was pressed.
+static int wait_or_quit() {
+    for (int waited = 0; waited < REFRESH_MS; waited += POLL_MS) {
+        sleep_ms(POLL_MS);
+        event_t ev;
+        while (input_poll_event(&ev)) {
+            if (ev.type == EVENT_KEY_DOWN && (ev.data1 == 'q' || ev.data1 == 'Q')) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void print_snapshot(const thread_info_t *cur, int count, const thread_info_t *prev, int prev_count,
+                           uint64_t elapsed_ns) {
+    char line[160];
+    char *p;
+
+    ksprintf(line, "top: %d threads, press q to quit\n", count);
+    print(line);
+    print("  TID NAME            STATE CPU   %CPU   RUN(ms)  WAIT(ms)    VCSW   IVCSW  WAKE avg/max(us)\n");
+
+    for (int i = 0; i < count; i++) {
+        const thread_info_t *t = &cur[i];
+        const thread_info_t *old = find_thread(prev, prev_count, t->id);
+        uint64_t ran = t->run_ns - (old ? old->run_ns : 0);
+        // Tenths of a percent of one CPU over the last interval
+        uint64_t permille = elapsed_ns ? ran * 1000 / elapsed_ns : 0;
+
+        p = line;
+        p = put_u64(p, t->id, 5);
+        *p++ = ' ';
+        p = put_str(p, t->name, 16);
+        p = put_str(p, t->state < 4 ? state_names[t->state] : "?", 6);
+        p = put_u64(p, t->cpu, 3);
+        p = put_u64(p, permille / 10, 5);
+        *p++ = '.';
+        p = put_u64(p, permille % 10, 1);
+        p = put_u64(p, t->run_ns / 1000000, 10);
+        p = put_u64(p, t->wait_ns / 1000000, 10);
+        p = put_u64(p, t->nvcsw, 8);
+        p = put_u64(p, t->nivcsw, 8);
+        p = put_u64(p, t->wakeup_avg_ns / 1000, 8);
+        *p++ = '/';
+        p = put_u64(p, t->wakeup_max_ns / 1000, 0);
+        *p++ = '\n';
+        *p = '\0';
+        print(line);
+    }
+    print("\n");
+}
+
+int main(int argc, char **argv) {
+    // top [refreshes], runs until 'q' by default
+    int refreshes = argc > 1 ? atoi(argv[1]) : 0;
+
+    thread_info_t *prev = snap_a;
+    thread_info_t *cur = snap_b;
+    uint64_t prev_ns = 0;
+    uint64_t now_ns = 0;
+    int prev_count = thread_stats(prev, MAX_THREADS, &prev_ns);
+    if (prev_count < 0) {
+        print("top: cannot read thread statistics\n");
+        return 1;
+    }
+
+    for (int n = 0; refreshes <= 0 || n < refreshes; n++) {
+        if (wait_or_quit()) {
+            break;
+        }
+        int count = thread_stats(cur, MAX_THREADS, &now_ns);
+        if (count < 0) {
+            print("top: cannot read thread statistics\n");
+            return 1;
+        }
+        print_snapshot(cur, count, prev, prev_count, now_ns - prev_ns);
+
+        thread_info_t *tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_count = count;
+        prev_ns = now_ns;
+    }
+    return 0;
+}
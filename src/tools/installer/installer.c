@@ -158,45 +158,52 @@ static int copy_file_to_mounted_fs(const char *src_path, const char *dest_path_o
         return -1;
     }
     
-    // Get file size
+    // Get file size from the open descriptor, no second lookup
     struct stat st;
-    if (stat(src_path, &st) != 0) {
+    if (fstat(src_fd, &st) != 0) {
         print("INSTALLER: Error: Could not stat source file: "); print(src_path); print("\n");
         close(src_fd);
         return -1;
     }
 
-    uint8_t *buffer = (uint8_t*)malloc(st.st_size);
-    if (!buffer) {
-        print("INSTALLER: Error: Failed to allocate buffer for file copy.\n");
-        close(src_fd);
-        return -1;
-    }
-    
-    if (read(src_fd, buffer, st.st_size) != st.st_size) {
-        print("INSTALLER: Error: Failed to read source file: "); print(src_path); print("\n");
-        free(buffer);
-        close(src_fd);
-        return -1;
-    }
-    close(src_fd);
-
     // Create and write to destination on mounted FS
     int dest_fd = open(dest_path_on_mounted_fs, O_CREAT | O_TRUNC | O_WRONLY);
     if (dest_fd < 0) {
         print("INSTALLER: Error: Could not create destination file: "); print(dest_path_on_mounted_fs); print("\n");
-        free(buffer);
+        close(src_fd);
         return -1;
     }
 
-    if (write(dest_fd, buffer, st.st_size) != st.st_size) {
-        print("INSTALLER: Error: Failed to write to destination file: "); print(dest_path_on_mounted_fs); print("\n");
+    // Let the kernel move the data. If it comes up short, the disk
+    // filesystem wants the whole file in one write: fall back to that.
+    if (copy_file_range(src_fd, NULL, dest_fd, NULL, st.st_size) != st.st_size) {
+        uint8_t *buffer = (uint8_t*)malloc(st.st_size);
+        if (!buffer) {
+            print("INSTALLER: Error: Failed to allocate buffer for file copy.\n");
+            close(src_fd);
+            close(dest_fd);
+            return -1;
+        }
+
+        if (pread(src_fd, buffer, st.st_size, 0) != st.st_size) {
+            print("INSTALLER: Error: Failed to read source file: "); print(src_path); print("\n");
+            free(buffer);
+            close(src_fd);
+            close(dest_fd);
+            return -1;
+        }
+
+        if (pwrite(dest_fd, buffer, st.st_size, 0) != st.st_size) {
+            print("INSTALLER: Error: Failed to write to destination file: "); print(dest_path_on_mounted_fs); print("\n");
+            free(buffer);
+            close(src_fd);
+            close(dest_fd);
+            return -1;
+        }
         free(buffer);
-        close(dest_fd);
-        return -1;
     }
+    close(src_fd);
     close(dest_fd);
-    free(buffer);
 
     print("INSTALLER: Copied "); print(src_path); print(" to "); print(dest_path_on_mounted_fs); print("\n");
     return 0;
@@ -76,16 +76,8 @@ int pkg_install_file(const char *path) {
             }
             // We found meta, break to restart reading for data files
             break; 
-        } else {
-            // This is very inefficient. A real `read` syscall would have `seek`.
-            // Without seek, we have to read the data to skip it.
-            char discard_buf[1024];
-            int to_read = entry.size;
-             while (to_read > 0) {
-                int n = read(fd, discard_buf, (to_read > 1024 ? 1024 : to_read));
-                if (n <= 0) break;
-                to_read -= n;
-            }
+        } else if (lseek(fd, entry.size, SEEK_CUR) < 0) {
+            break; // Skip the entry's data
         }
     }
 
@@ -95,12 +87,14 @@ int pkg_install_file(const char *path) {
         return -1;
     }
     
-    // Re-open file to read data entries
-    close(fd);
-    fd = open(path, O_RDONLY);
+    // Rewind to read data entries
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        print("kpm: could not rewind package file.\n");
+        close(fd);
+        return -1;
+    }
 
     // Second pass: extract data files
-    char file_buf[1024];
     while (read(fd, &entry, sizeof(kpkg_entry_t)) == sizeof(kpkg_entry_t)) {
         int to_read = entry.size;
         if (!entry.is_meta) {
@@ -121,13 +115,9 @@ int pkg_install_file(const char *path) {
                 print(full_path);
                 print("\n");
                 mkdir_p(full_path);
-                // Even if it's a directory, we still need to consume any potential data
+                // Even if it's a directory, skip any potential data
                 // (though a directory entry should ideally have size 0)
-                while (to_read > 0) {
-                    int n = read(fd, file_buf, (to_read > 1024 ? 1024 : to_read));
-                    if (n <= 0) break;
-                    to_read -= n;
-                }
+                lseek(fd, to_read, SEEK_CUR);
                 continue; // Move to next entry
             }
 
@@ -150,28 +140,20 @@ int pkg_install_file(const char *path) {
                 print(full_path);
                 print("'\n");
                 // skip this file's data
-                while (to_read > 0) {
-                    int n = read(fd, file_buf, (to_read > 1024 ? 1024 : to_read));
-                    if (n <= 0) break;
-                    to_read -= n;
-                }
+                lseek(fd, to_read, SEEK_CUR);
                 continue;
             }
             
+            // Straight from the package into the file, inside the kernel
             while (to_read > 0) {
-                int n = read(fd, file_buf, (to_read > 1024 ? 1024 : to_read));
+                int64_t n = copy_file_range(fd, NULL, out_fd, NULL, to_read);
                 if (n <= 0) break;
-                write(out_fd, file_buf, n);
                 to_read -= n;
             }
             close(out_fd);
         } else {
             // Skip meta section
-             while (to_read > 0) {
-                int n = read(fd, file_buf, (to_read > 1024 ? 1024 : to_read));
-                if (n <= 0) break;
-                to_read -= n;
-            }
+            lseek(fd, to_read, SEEK_CUR);
         }
     }
     close(fd);
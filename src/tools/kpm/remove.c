@@ -3,48 +3,49 @@
 
 #define MAX_DB_SIZE 4096 // Max size for the in-memory package database
 
-// Helper to recursively remove files and directories
-static int remove_recursive(const char *path) {
-    char entry_full_path[MAX_FILENAME_LEN * 2]; // Path for current entry
+// Helper to recursively remove `name` in the directory `dir_fd`. Directories
+// are walked through descriptors, so entries aren't re-resolved from the root.
+static int remove_recursive(int dir_fd, const char *name) {
     struct stat st;
 
     // Get stat of the current path
-    if (stat(path, &st) != 0) {
-        print("kpm: Failed to stat "); print(path); print("\n");
+    if (fstatat(dir_fd, name, &st) != 0) {
+        print("kpm: Failed to stat "); print(name); print("\n");
         return -1;
     }
 
     if (S_ISREG(st.st_mode)) { // It's a regular file
-        print("kpm: Unlinking file: "); print(path); print("\n");
-        return unlink(path);
+        print("kpm: Unlinking file: "); print(name); print("\n");
+        return unlinkat(dir_fd, name, 0);
     } else if (S_ISDIR(st.st_mode)) { // It's a directory
-        print("kpm: Entering directory: "); print(path); print("\n");
+        print("kpm: Entering directory: "); print(name); print("\n");
 
-        int dir_fd = open(path, O_RDONLY); // Open directory for reading
-        if (dir_fd < 0) {
-            print("kpm: Failed to open directory "); print(path); print("\n");
+        int sub_fd = openat(dir_fd, name, O_RDONLY); // Open directory for reading
+        if (sub_fd < 0) {
+            print("kpm: Failed to open directory "); print(name); print("\n");
             return -1;
         }
 
         struct dirent de;
         int index = 0;
-        // Loop through directory entries
-        while (readdir(dir_fd, index++, &de)) {
+        // Loop through directory entries. A removed entry's index is taken
+        // by the next one, so only step over what stays.
+        while (readdir(sub_fd, index, &de) > 0) {
             // Skip . and ..
             if (strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0) {
+                index++;
                 continue;
             }
 
-            ksprintf(entry_full_path, "%s/%s", path, de.name);
-            if (remove_recursive(entry_full_path) != 0) {
-                close(dir_fd);
+            if (remove_recursive(sub_fd, de.name) != 0) {
+                close(sub_fd);
                 return -1; // Propagate error
             }
         }
-        close(dir_fd); // Close the directory
+        close(sub_fd); // Close the directory
 
-        print("kpm: Removing directory: "); print(path); print("\n");
-        return rmdir(path); // Remove the now empty directory
+        print("kpm: Removing directory: "); print(name); print("\n");
+        return unlinkat(dir_fd, name, AT_REMOVEDIR); // Remove the now empty directory
     }
     return -1; // Unknown type (or not a file/dir)
 }
@@ -134,7 +135,7 @@ int pkg_remove(const char *name) {
           install_path_in_db[path_len] = '\0';
 
           // Delete the package files recursively
-          if (remove_recursive(install_path_in_db) != 0) {
+          if (remove_recursive(AT_FDCWD, install_path_in_db) != 0) {
               print("kpm: Failed to remove package files for '"); print(name); print("'\n");
               // Even if file deletion fails, we still remove from DB for now.
               // A more robust PM would mark it as partially removed.
@@ -8,6 +8,10 @@
 #include "event.h" // For event_t
 #include "syscall.h" // For SYS_* macros
 #include "socket.h" // For sockaddr_in
+#include "vdso.h" // For the vDSO layout
+#include "io_ring.h" // For the io ring layout
+#include "poll.h" // For pollfd_t, epoll_event_t
+#include "futex.h" // For FUTEX_*
 
 // Standard open flags (simplified)
 #define O_RDONLY    0x0001 // Open for reading only
@@ -44,6 +48,37 @@
 #define SYS_EXEC 24
 #define SYS_GFX_GET_FB_INFO 25
 #define SYS_INPUT_POLL_EVENT 26
+#define SYS_SLEEP 27
+#define SYS_THREAD_STATS 28
+#define SYS_WAITPID 29
+#define SYS_GETRLIMIT 30
+#define SYS_SETRLIMIT 31
+#define SYS_THREAD_SPAWN 32
+#define SYS_ARCH_PRCTL 33
+#define SYS_WAIT4 34
+#define SYS_GETRUSAGE 35
+#define SYS_IORING_SETUP 36
+#define SYS_IORING_ENTER 37
+#define SYS_LSEEK 38
+#define SYS_PREAD 39
+#define SYS_PWRITE 40
+#define SYS_READV 41
+#define SYS_WRITEV 42
+#define SYS_POLL 43
+#define SYS_EPOLL_CREATE 44
+#define SYS_EPOLL_CTL 45
+#define SYS_EPOLL_WAIT 46
+#define SYS_INPUT_OPEN 47
+#define SYS_FUTEX 48
+#define SYS_OPENAT 49
+#define SYS_FSTATAT 50
+#define SYS_MKDIRAT 51
+#define SYS_UNLINKAT 52
+#define SYS_FSTAT 53
+#define SYS_RENAME 54
+#define SYS_RENAMEAT 55
+#define SYS_COPY_FILE_RANGE 56
+#define SYS_SENDFILE 57
 
 static inline uint64_t syscall(uint64_t num, uint64_t a1, uint64_t a2,
                                uint64_t a3) {
@@ -52,11 +87,47 @@ static inline uint64_t syscall(uint64_t num, uint64_t a1, uint64_t a2,
                        "movq %2, %%rdi\n\t"
                        "movq %3, %%rsi\n\t"
                        "movq %4, %%rdx\n\t"
-                       "int $0x80\n\t"
+                       "syscall\n\t"
                        "movq %%rax, %0"
                        : "=r"(ret)
                        : "r"(num), "r"(a1), "r"(a2), "r"(a3)
-                       : "rax", "rdi", "rsi", "rdx", "memory");
+                       // SYSCALL clobbers rcx (RIP) and r11 (RFLAGS)
+                       : "rax", "rdi", "rsi", "rdx", "rcx", "r11", "memory");
+  return ret;
+}
+
+// Same, with a 4th argument. It goes in r10, SYSCALL takes rcx.
+static inline uint64_t syscall4(uint64_t num, uint64_t a1, uint64_t a2,
+                                uint64_t a3, uint64_t a4) {
+  uint64_t ret;
+  __asm__ __volatile__("movq %1, %%rax\n\t"
+                       "movq %2, %%rdi\n\t"
+                       "movq %3, %%rsi\n\t"
+                       "movq %4, %%rdx\n\t"
+                       "movq %5, %%r10\n\t"
+                       "syscall\n\t"
+                       "movq %%rax, %0"
+                       : "=r"(ret)
+                       : "r"(num), "r"(a1), "r"(a2), "r"(a3), "r"(a4)
+                       : "rax", "rdi", "rsi", "rdx", "r10", "rcx", "r11", "memory");
+  return ret;
+}
+
+// Fifth argument in r8
+static inline uint64_t syscall5(uint64_t num, uint64_t a1, uint64_t a2,
+                                uint64_t a3, uint64_t a4, uint64_t a5) {
+  uint64_t ret;
+  __asm__ __volatile__("movq %1, %%rax\n\t"
+                       "movq %2, %%rdi\n\t"
+                       "movq %3, %%rsi\n\t"
+                       "movq %4, %%rdx\n\t"
+                       "movq %5, %%r10\n\t"
+                       "movq %6, %%r8\n\t"
+                       "syscall\n\t"
+                       "movq %%rax, %0"
+                       : "=r"(ret)
+                       : "r"(num), "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5)
+                       : "rax", "rdi", "rsi", "rdx", "r10", "r8", "rcx", "r11", "memory");
   return ret;
 }
 
@@ -77,6 +148,24 @@ static inline int read(int fd, void *buf, size_t size) {
 static inline int write(int fd, const void *buf, size_t size) {
   return (int)syscall(SYS_WRITE, fd, (uint64_t)buf, size);
 }
+// Returns the new offset, or -1
+static inline int64_t lseek(int fd, int64_t offset, int whence) {
+  return (int64_t)syscall(SYS_LSEEK, (uint64_t)fd, (uint64_t)offset, (uint64_t)whence);
+}
+// At `offset`, without moving the descriptor's position
+static inline int pread(int fd, void *buf, size_t size, uint64_t offset) {
+  return (int)syscall4(SYS_PREAD, (uint64_t)fd, (uint64_t)buf, size, offset);
+}
+static inline int pwrite(int fd, const void *buf, size_t size, uint64_t offset) {
+  return (int)syscall4(SYS_PWRITE, (uint64_t)fd, (uint64_t)buf, size, offset);
+}
+// Scatter/gather: all buffers in one call
+static inline int readv(int fd, const iovec_t *iov, int iovcnt) {
+  return (int)syscall(SYS_READV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt);
+}
+static inline int writev(int fd, const iovec_t *iov, int iovcnt) {
+  return (int)syscall(SYS_WRITEV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt);
+}
 static inline int mkdir(const char *path) {
   return (int)syscall(SYS_MKDIR, (uint64_t)path, 0, 0);
 }
@@ -92,6 +181,41 @@ static inline int rmdir(const char *path) { // New wrapper for SYS_RMDIR
 static inline int readdir(int fd, int index, struct dirent *dir_entry) {
   return (int)syscall(SYS_READDIR, (uint64_t)fd, (uint64_t)index, (uint64_t)dir_entry);
 }
+// Relative to a directory descriptor (or AT_FDCWD), so walking a tree
+// doesn't re-resolve every path from the root
+static inline int openat(int dirfd, const char *path, int flags) {
+  return (int)syscall(SYS_OPENAT, (uint64_t)dirfd, (uint64_t)path, (uint64_t)flags);
+}
+static inline int fstatat(int dirfd, const char *path, struct stat *stat_buf) {
+  return (int)syscall(SYS_FSTATAT, (uint64_t)dirfd, (uint64_t)path, (uint64_t)stat_buf);
+}
+static inline int mkdirat(int dirfd, const char *path) {
+  return (int)syscall(SYS_MKDIRAT, (uint64_t)dirfd, (uint64_t)path, 0);
+}
+static inline int unlinkat(int dirfd, const char *path, int flags) {
+  return (int)syscall(SYS_UNLINKAT, (uint64_t)dirfd, (uint64_t)path, (uint64_t)flags);
+}
+static inline int fstat(int fd, struct stat *stat_buf) {
+  return (int)syscall(SYS_FSTAT, (uint64_t)fd, (uint64_t)stat_buf, 0);
+}
+// Within one filesystem only, an existing new_path is replaced
+static inline int rename(const char *old_path, const char *new_path) {
+  return (int)syscall(SYS_RENAME, (uint64_t)old_path, (uint64_t)new_path, 0);
+}
+static inline int renameat(int old_dirfd, const char *old_path, int new_dirfd, const char *new_path) {
+  return (int)syscall4(SYS_RENAMEAT, (uint64_t)old_dirfd, (uint64_t)old_path, (uint64_t)new_dirfd,
+                       (uint64_t)new_path);
+}
+// NULL offsets use and advance the descriptor's own offset
+static inline int64_t copy_file_range(int fd_in, uint64_t *off_in, int fd_out, uint64_t *off_out,
+                                      size_t len) {
+  return (int64_t)syscall5(SYS_COPY_FILE_RANGE, (uint64_t)fd_in, (uint64_t)off_in, (uint64_t)fd_out,
+                           (uint64_t)off_out, (uint64_t)len);
+}
+static inline int64_t sendfile(int out_fd, int in_fd, uint64_t *offset, size_t count) {
+  return (int64_t)syscall4(SYS_SENDFILE, (uint64_t)out_fd, (uint64_t)in_fd, (uint64_t)offset,
+                           (uint64_t)count);
+}
 static inline int create(const char *path) {
     return open(path, O_CREAT | O_TRUNC | O_WRONLY); // Using new open
 }
@@ -152,6 +276,28 @@ static inline int unmount(const char* mount_point_path) {
 static inline int input_poll_event(event_t *event) {
     return (int)syscall(SYS_INPUT_POLL_EVENT, (uint64_t)event, 0, 0);
 }
+// Descriptor for the input queue: read() blocks for event_t records, and it
+// can be waited on with poll()/epoll
+static inline int input_open() {
+    return (int)syscall(SYS_INPUT_OPEN, 0, 0, 0);
+}
+static inline int poll(pollfd_t *fds, uint32_t nfds, int timeout_ms) {
+    return (int)syscall(SYS_POLL, (uint64_t)fds, nfds, (uint64_t)(int64_t)timeout_ms);
+}
+static inline int epoll_create() {
+    return (int)syscall(SYS_EPOLL_CREATE, 0, 0, 0);
+}
+static inline int epoll_ctl(int epfd, int op, int fd, epoll_event_t *event) {
+    return (int)syscall4(SYS_EPOLL_CTL, (uint64_t)epfd, (uint64_t)op, (uint64_t)fd, (uint64_t)event);
+}
+static inline int epoll_wait(int epfd, epoll_event_t *events, int max, int timeout_ms) {
+    return (int)syscall4(SYS_EPOLL_WAIT, (uint64_t)epfd, (uint64_t)events, (uint64_t)max,
+                         (uint64_t)(int64_t)timeout_ms);
+}
+// Raw futex; userspace/lib/libc/sync.h has the locks built on it
+static inline long futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2) {
+    return (long)syscall5(SYS_FUTEX, (uint64_t)uaddr, (uint64_t)op, val, val2, (uint64_t)uaddr2);
+}
 
 static inline int atoi(const char *s) {
     int res = 0;
@@ -170,7 +316,105 @@ static inline int atoi(const char *s) {
     return res * sign;
 }
 
-static inline uint64_t get_ticks() { return syscall(SYS_GET_TICKS, 0, 0, 0); }
+// The vDSO data page, or NULL if the kernel didn't set one up
+static inline const vdso_data_t *vdso_data() {
+  const vdso_data_t *vdso = (const vdso_data_t *)VDSO_DATA_VADDR;
+  if (__atomic_load_n(&vdso->magic, __ATOMIC_ACQUIRE) != VDSO_MAGIC) {
+    return NULL;
+  }
+  return vdso;
+}
+
+static inline uint64_t get_ticks() {
+  const vdso_data_t *vdso = vdso_data();
+  if (vdso && vdso->get_ticks_offset) {
+    uint64_t (*fn)(void) = (uint64_t (*)(void))(VDSO_TEXT_VADDR + vdso->get_ticks_offset);
+    return fn();
+  }
+  return syscall(SYS_GET_TICKS, 0, 0, 0);
+}
+
+// Only CLOCK_MONOTONIC is supported. Returns -1 for other clocks or
+// without a vDSO.
+static inline int clock_gettime(int clock, vdso_timespec_t *ts) {
+  const vdso_data_t *vdso = vdso_data();
+  if (!vdso || !vdso->clock_gettime_offset) {
+    return -1;
+  }
+  int (*fn)(int, vdso_timespec_t *) =
+      (int (*)(int, vdso_timespec_t *))(VDSO_TEXT_VADDR + vdso->clock_gettime_offset);
+  return fn(clock, ts);
+}
+
+static inline void sleep_ms(uint64_t ms) { syscall(SYS_SLEEP, ms, 0, 0); }
+
+// Fills `buf` with up to `max` entries, returns the number of threads.
+static inline int thread_stats(thread_info_t *buf, int max, uint64_t *uptime_ns) {
+  return (int)syscall(SYS_THREAD_STATS, (uint64_t)buf, (uint64_t)max, (uint64_t)uptime_ns);
+}
+
+static inline int getrlimit(int resource, rlimit_t *rlim) {
+  return (int)syscall(SYS_GETRLIMIT, (uint64_t)resource, (uint64_t)rlim, 0);
+}
+static inline int setrlimit(int resource, const rlimit_t *rlim) {
+  return (int)syscall(SYS_SETRLIMIT, (uint64_t)resource, (uint64_t)rlim, 0);
+}
+
+// Waits for a child thread to exit, returns its id or -1.
+static inline int waitpid(uint64_t tid, int *status) {
+  return (int)syscall(SYS_WAITPID, tid, (uint64_t)status, 0);
+}
+
+// waitpid() that also returns the child's resource usage
+static inline int wait4(uint64_t tid, int *status, rusage_t *usage) {
+  return (int)syscall(SYS_WAIT4, tid, (uint64_t)status, (uint64_t)usage);
+}
+
+// Resource usage of this program (RUSAGE_SELF) or thread (RUSAGE_THREAD)
+static inline int getrusage(int who, rusage_t *usage) {
+  return (int)syscall(SYS_GETRUSAGE, (uint64_t)who, (uint64_t)usage, 0);
+}
+
+// Starts a thread of this program at entry(arg) with the stack pointer at
+// `stack`. The thread shares memory and descriptors with its creator and must
+// finish with exit(). Returns its id for waitpid(), or -1.
+static inline int thread_spawn(void (*entry)(void *), void *stack, void *arg) {
+  return (int)syscall(SYS_THREAD_SPAWN, (uint64_t)entry, (uint64_t)stack, (uint64_t)arg);
+}
+
+typedef void (*thread_fn_t)(void *);
+
+typedef struct {
+  thread_fn_t fn;
+  void *arg;
+} thread_start_t;
+
+static inline void thread_start_entry(void *p) {
+  thread_start_t *start = (thread_start_t *)p;
+  start->fn(start->arg);
+  exit();
+}
+
+// Runs fn(arg) on a new thread using `size` bytes at `stack`, then ends the
+// thread. Returns its id for waitpid(), or -1.
+static inline int thread_start(thread_fn_t fn, void *arg, void *stack, size_t size) {
+  uint64_t top = ((uint64_t)stack + size) & ~15ULL;
+  thread_start_t *start = (thread_start_t *)(top - sizeof(thread_start_t));
+  start->fn = fn;
+  start->arg = arg;
+  // As if called: the return address slot leaves rsp + 8 16-byte aligned
+  return thread_spawn(thread_start_entry, (uint8_t *)start - 8, start);
+}
+
+// Thread-local storage: the FS base of the calling thread
+static inline int set_fs_base(void *base) {
+  return (int)syscall(SYS_ARCH_PRCTL, ARCH_SET_FS, (uint64_t)base, 0);
+}
+static inline void *get_fs_base() {
+  uint64_t base = 0;
+  syscall(SYS_ARCH_PRCTL, ARCH_GET_FS, (uint64_t)&base, 0);
+  return (void *)base;
+}
 
 // Minimal string/memory functions
 size_t strlen(const char *s);
@@ -185,6 +429,84 @@ char *strncpy(char *dest, const char *src, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
 
+// Raw io ring syscalls, see io_ring.h
+static inline int ioring_setup(uint32_t entries, io_ring_params_t *params) {
+  return (int)syscall(SYS_IORING_SETUP, entries, (uint64_t)params, 0);
+}
+static inline int ioring_enter(int fd, uint32_t to_submit, uint32_t min_complete) {
+  return (int)syscall(SYS_IORING_ENTER, (uint64_t)fd, to_submit, min_complete);
+}
+
+// Userspace side of an io ring:
+//   io_sqe_t *sqe = ioring_get_sqe(&ring);
+//   sqe->opcode = IORING_OP_READ; sqe->fd = fd; ...
+//   ioring_submit(&ring, 1);
+//   io_cqe_t *cqe = ioring_peek_cqe(&ring); ... ioring_cqe_seen(&ring);
+typedef struct {
+  int fd;
+  uint32_t flags;
+  io_ring_header_t *hdr;
+  io_sqe_t *sqes;
+  io_cqe_t *cqes;
+  uint32_t sq_tail; // Ours, published by ioring_submit()
+} ioring_t;
+
+static inline int ioring_init(ioring_t *ring, uint32_t entries, io_ring_params_t *params) {
+  int fd = ioring_setup(entries, params);
+  if (fd < 0) {
+    return -1;
+  }
+  uint8_t *region = (uint8_t *)params->ring_addr;
+  ring->fd = fd;
+  ring->flags = params->flags;
+  ring->hdr = (io_ring_header_t *)region;
+  ring->sqes = (io_sqe_t *)(region + ring->hdr->sq_offset);
+  ring->cqes = (io_cqe_t *)(region + ring->hdr->cq_offset);
+  ring->sq_tail = ring->hdr->sq_tail;
+  return 0;
+}
+
+// Next free SQE, zeroed, or NULL if the SQ is full
+static inline io_sqe_t *ioring_get_sqe(ioring_t *ring) {
+  uint32_t head = __atomic_load_n(&ring->hdr->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sq_tail - head >= ring->hdr->sq_entries) {
+    return NULL;
+  }
+  io_sqe_t *sqe = &ring->sqes[ring->sq_tail++ & (ring->hdr->sq_entries - 1)];
+  memset(sqe, 0, sizeof(io_sqe_t));
+  return sqe;
+}
+
+// Hand the new SQEs to the kernel and wait for `wait_nr` completions. Only
+// enters the kernel when it has to: SQPOLL rings just publish the tail,
+// unless the poller went to sleep or we want to wait.
+static inline int ioring_submit(ioring_t *ring, uint32_t wait_nr) {
+  uint32_t pending = ring->sq_tail - ring->hdr->sq_tail;
+  __atomic_store_n(&ring->hdr->sq_tail, ring->sq_tail, __ATOMIC_SEQ_CST);
+  if (ring->flags & IORING_SETUP_SQPOLL) {
+    if (!wait_nr && !(__atomic_load_n(&ring->hdr->sq_flags, __ATOMIC_SEQ_CST) & IORING_SQ_NEED_WAKEUP)) {
+      return (int)pending;
+    }
+    ioring_enter(ring->fd, 0, wait_nr);
+    return (int)pending;
+  }
+  return ioring_enter(ring->fd, pending, wait_nr);
+}
+
+// Oldest unreaped completion, or NULL
+static inline io_cqe_t *ioring_peek_cqe(ioring_t *ring) {
+  uint32_t head = ring->hdr->cq_head;
+  if (head == __atomic_load_n(&ring->hdr->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & (ring->hdr->cq_entries - 1)];
+}
+
+// Done with the completion from ioring_peek_cqe(), its slot can be reused
+static inline void ioring_cqe_seen(ioring_t *ring) {
+  __atomic_store_n(&ring->hdr->cq_head, ring->hdr->cq_head + 1, __ATOMIC_RELEASE);
+}
+
 // Basic sprintf implementation for userspace (adapted from kernel/string.c)
 static inline int vksprintf(char *buffer, const char *format, va_list args) {
     char *buf_ptr = buffer;
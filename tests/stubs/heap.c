@@ -0,0 +1,23 @@
+#include "heap.h"
+#include <stdlib.h>
+
+long heap_live = 0;
+int heap_fail_after = 0;
+
+void* kmalloc(size_t size) {
+  if (heap_fail_after > 0 && --heap_fail_after == 0) {
+    return NULL;
+  }
+  void *ptr = malloc(size);
+  if (ptr) {
+    heap_live++;
+  }
+  return ptr;
+}
+
+void kfree(void* ptr) {
+  if (ptr) {
+    heap_live--;
+  }
+  free(ptr);
+}
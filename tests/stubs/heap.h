@@ -0,0 +1,16 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h> // for size_t
+
+// Host stand-in for the kernel heap, see tests/stubs/heap.c
+
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+
+// Blocks allocated and not yet freed
+extern long heap_live;
+// Make the next `n`th kmalloc() (1 = the next one) return NULL, 0 = never
+extern int heap_fail_after;
+
+#endif // HEAP_H
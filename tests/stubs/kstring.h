@@ -0,0 +1,7 @@
+#ifndef KSTRING_H
+#define KSTRING_H
+
+// Host stand-in: the kernel's string functions match libc's
+#include <string.h>
+
+#endif // KSTRING_H
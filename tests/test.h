@@ -0,0 +1,31 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Minimal host test harness. CHECK() records a failure and carries on, so
+// one run reports every broken expectation; main() returns test_result().
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      test_failures++;                                                \
+    }                                                                 \
+  } while (0)
+
+#define RUN_TEST(fn)      \
+  do {                    \
+    printf("  %s\n", #fn); \
+    fn();                 \
+  } while (0)
+
+static inline int test_result(const char *suite) {
+  printf("%s: %s\n", suite, test_failures ? "FAILED" : "ok");
+  return test_failures ? 1 : 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,169 @@
+#include "hashtable.h"
+#include "heap.h"
+#include "test.h"
+
+typedef struct {
+  uint64_t key;
+  hash_node_t link;
+} entry_t;
+
+static entry_t *find(hashtable_t *table, uint64_t key, uint64_t hash) {
+  entry_t *e;
+  hashtable_for_each_possible(table, e, link, hash) {
+    if (e->key == key) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void test_init_rounds_up() {
+  hashtable_t table;
+  CHECK(hashtable_init(&table, 0) == 0);
+  CHECK(table.bucket_count == HASHTABLE_MIN_BUCKETS);
+  hashtable_destroy(&table);
+
+  CHECK(hashtable_init(&table, 33) == 0);
+  CHECK(table.bucket_count == 64);
+  CHECK(hashtable_count(&table) == 0);
+  hashtable_destroy(&table);
+  CHECK(heap_live == 0);
+
+  heap_fail_after = 1;
+  CHECK(hashtable_init(&table, 8) == -1);
+  CHECK(heap_live == 0);
+}
+
+static void test_insert_lookup_remove() {
+  hashtable_t table;
+  entry_t entries[10];
+  CHECK(hashtable_init(&table, 8) == 0);
+  for (int i = 0; i < 10; i++) {
+    entries[i].key = (uint64_t)i * 1000;
+    hashtable_insert(&table, &entries[i].link, hash_u64(entries[i].key));
+  }
+  CHECK(hashtable_count(&table) == 10);
+  for (int i = 0; i < 10; i++) {
+    CHECK(find(&table, entries[i].key, hash_u64(entries[i].key)) == &entries[i]);
+  }
+  CHECK(find(&table, 1, hash_u64(1)) == NULL);
+
+  hashtable_remove(&table, &entries[3].link);
+  CHECK(hashtable_count(&table) == 9);
+  CHECK(find(&table, 3000, hash_u64(3000)) == NULL);
+  CHECK(find(&table, 4000, hash_u64(4000)) == &entries[4]);
+
+  hashtable_destroy(&table);
+  CHECK(heap_live == 0);
+}
+
+static void test_collisions() {
+  hashtable_t table;
+  entry_t same[4];
+  entry_t neighbour;
+  CHECK(hashtable_init(&table, 8) == 0);
+
+  // Equal hashes: every entry comes back and the keys tell them apart
+  for (int i = 0; i < 4; i++) {
+    same[i].key = (uint64_t)i;
+    hashtable_insert(&table, &same[i].link, 42);
+  }
+  // Same bucket, different hash: skipped by the hash filter
+  neighbour.key = 100;
+  hashtable_insert(&table, &neighbour.link, 42 + table.bucket_count);
+
+  int seen = 0;
+  entry_t *e;
+  hashtable_for_each_possible(&table, e, link, 42) {
+    CHECK(e != &neighbour);
+    seen++;
+  }
+  CHECK(seen == 4);
+  for (int i = 0; i < 4; i++) {
+    CHECK(find(&table, (uint64_t)i, 42) == &same[i]);
+  }
+  CHECK(find(&table, 100, 42 + table.bucket_count) == &neighbour);
+
+  // Unlink from the middle and both ends of the chain
+  hashtable_remove(&table, &same[2].link);
+  hashtable_remove(&table, &neighbour.link);
+  hashtable_remove(&table, &same[0].link);
+  CHECK(find(&table, 2, 42) == NULL);
+  CHECK(find(&table, 0, 42) == NULL);
+  CHECK(find(&table, 1, 42) == &same[1]);
+  CHECK(find(&table, 3, 42) == &same[3]);
+  CHECK(hashtable_count(&table) == 2);
+
+  hashtable_destroy(&table);
+  CHECK(heap_live == 0);
+}
+
+#define MANY 1000
+
+static void test_resize() {
+  static entry_t entries[MANY];
+  hashtable_t table;
+  CHECK(hashtable_init(&table, 8) == 0);
+
+  for (int i = 0; i < MANY; i++) {
+    entries[i].key = (uint64_t)i;
+    hashtable_insert(&table, &entries[i].link, hash_u64((uint64_t)i));
+  }
+  CHECK(hashtable_count(&table) == MANY);
+  CHECK(table.bucket_count >= MANY / 2); // Grown to an average chain of at most 2
+  for (int i = 0; i < MANY; i++) {
+    CHECK(find(&table, (uint64_t)i, hash_u64((uint64_t)i)) == &entries[i]);
+  }
+
+  int visited = 0;
+  entry_t *e;
+  hashtable_for_each(&table, e, link) {
+    visited++;
+  }
+  CHECK(visited == MANY);
+
+  for (int i = 0; i < MANY - 1; i++) {
+    hashtable_remove(&table, &entries[i].link);
+  }
+  CHECK(hashtable_count(&table) == 1);
+  CHECK(table.bucket_count == table.min_buckets); // Shrunk back, not below
+  CHECK(find(&table, MANY - 1, hash_u64(MANY - 1)) == &entries[MANY - 1]);
+  CHECK(find(&table, 0, hash_u64(0)) == NULL);
+
+  hashtable_destroy(&table);
+  CHECK(heap_live == 0);
+}
+
+static void test_grow_failure() {
+  entry_t entries[17];
+  hashtable_t table;
+  CHECK(hashtable_init(&table, 8) == 0);
+  for (int i = 0; i < 16; i++) {
+    entries[i].key = (uint64_t)i;
+    hashtable_insert(&table, &entries[i].link, hash_u64((uint64_t)i));
+  }
+  CHECK(table.bucket_count == 8);
+
+  // The 17th insert wants to grow; without memory it just chains
+  heap_fail_after = 1;
+  entries[16].key = 16;
+  hashtable_insert(&table, &entries[16].link, hash_u64(16));
+  heap_fail_after = 0;
+  CHECK(table.bucket_count == 8);
+  CHECK(hashtable_count(&table) == 17);
+  for (int i = 0; i < 17; i++) {
+    CHECK(find(&table, (uint64_t)i, hash_u64((uint64_t)i)) == &entries[i]);
+  }
+
+  hashtable_destroy(&table);
+  CHECK(heap_live == 0);
+}
+
+int main() {
+  RUN_TEST(test_init_rounds_up);
+  RUN_TEST(test_insert_lookup_remove);
+  RUN_TEST(test_collisions);
+  RUN_TEST(test_resize);
+  RUN_TEST(test_grow_failure);
+  return test_result("hashtable");
+}
@@ -0,0 +1,153 @@
+#include "radix_tree.h"
+#include "heap.h"
+#include "test.h"
+
+// Stored values only need to be distinct non-NULL pointers
+static char values[16];
+
+static void test_empty() {
+  radix_tree_t tree = RADIX_TREE_INIT;
+  uint64_t key;
+  CHECK(radix_tree_lookup(&tree, 0) == NULL);
+  CHECK(radix_tree_delete(&tree, 0) == NULL);
+  CHECK(radix_tree_next(&tree, 0, &key) == NULL);
+  CHECK(radix_tree_insert(&tree, 1, NULL) == -1); // NULL can't be stored
+  radix_tree_destroy(&tree);
+  CHECK(heap_live == 0);
+}
+
+static void test_insert_lookup_delete() {
+  radix_tree_t tree;
+  radix_tree_init(&tree);
+  CHECK(radix_tree_insert(&tree, 5, &values[0]) == 0);
+  CHECK(tree.height == 1);
+  CHECK(radix_tree_insert(&tree, 5, &values[1]) == -1); // Already there
+  CHECK(radix_tree_insert(&tree, 63, &values[1]) == 0);
+  CHECK(tree.height == 1);
+  CHECK(radix_tree_lookup(&tree, 5) == &values[0]);
+  CHECK(radix_tree_lookup(&tree, 63) == &values[1]);
+  CHECK(radix_tree_lookup(&tree, 6) == NULL);
+  CHECK(radix_tree_lookup(&tree, 64) == NULL); // Past what the tree covers
+
+  CHECK(radix_tree_delete(&tree, 6) == NULL);
+  CHECK(radix_tree_delete(&tree, 5) == &values[0]);
+  CHECK(radix_tree_lookup(&tree, 5) == NULL);
+  CHECK(radix_tree_delete(&tree, 63) == &values[1]);
+  CHECK(tree.root == NULL && tree.height == 0);
+  CHECK(heap_live == 0);
+}
+
+static void test_grow_and_collapse() {
+  radix_tree_t tree = RADIX_TREE_INIT;
+  CHECK(radix_tree_insert(&tree, 3, &values[0]) == 0);
+  CHECK(heap_live == 1);
+
+  // 2^20 needs 4 levels of 6 bits; the old root moves down under slot 0
+  CHECK(radix_tree_insert(&tree, 1ULL << 20, &values[1]) == 0);
+  CHECK(tree.height == 4);
+  CHECK(radix_tree_lookup(&tree, 3) == &values[0]);
+  CHECK(radix_tree_lookup(&tree, 1ULL << 20) == &values[1]);
+
+  // Deleting it frees its branch and the levels that only lead to key 3
+  CHECK(radix_tree_delete(&tree, 1ULL << 20) == &values[1]);
+  CHECK(tree.height == 1);
+  CHECK(heap_live == 1);
+  CHECK(radix_tree_lookup(&tree, 3) == &values[0]);
+
+  // A top level entry keeps the height while small keys come and go
+  CHECK(radix_tree_insert(&tree, 1ULL << 20, &values[1]) == 0);
+  CHECK(radix_tree_delete(&tree, 3) == &values[0]);
+  CHECK(tree.height == 4);
+  CHECK(radix_tree_lookup(&tree, 1ULL << 20) == &values[1]);
+  CHECK(radix_tree_delete(&tree, 1ULL << 20) == &values[1]);
+  CHECK(tree.root == NULL);
+  CHECK(heap_live == 0);
+}
+
+static void test_full_width_keys() {
+  radix_tree_t tree = RADIX_TREE_INIT;
+  uint64_t key = 0;
+  CHECK(radix_tree_insert(&tree, UINT64_MAX, &values[0]) == 0);
+  CHECK(radix_tree_insert(&tree, 0, &values[1]) == 0);
+  CHECK(radix_tree_lookup(&tree, UINT64_MAX) == &values[0]);
+  CHECK(radix_tree_lookup(&tree, UINT64_MAX - 1) == NULL);
+  CHECK(radix_tree_next(&tree, 1, &key) == &values[0]);
+  CHECK(key == UINT64_MAX);
+
+  // The iteration stops after UINT64_MAX instead of wrapping to 0
+  int seen = 0;
+  void *value;
+  radix_tree_for_each(&tree, key, value) {
+    seen++;
+  }
+  CHECK(seen == 2);
+  radix_tree_destroy(&tree);
+  CHECK(heap_live == 0);
+}
+
+static const uint64_t sparse[] = {
+    0, 63, 64, 4095, 4096, 1ULL << 30, (1ULL << 40) + 7, UINT64_MAX - 1,
+};
+#define SPARSE_COUNT (sizeof(sparse) / sizeof(sparse[0]))
+
+static void test_next_sparse() {
+  radix_tree_t tree = RADIX_TREE_INIT;
+  for (size_t i = 0; i < SPARSE_COUNT; i++) {
+    CHECK(radix_tree_insert(&tree, sparse[i], &values[i]) == 0);
+  }
+
+  // From every key and from just past it
+  uint64_t key;
+  for (size_t i = 0; i < SPARSE_COUNT; i++) {
+    key = 0;
+    CHECK(radix_tree_next(&tree, sparse[i], &key) == &values[i]);
+    CHECK(key == sparse[i]);
+    void *next = radix_tree_next(&tree, sparse[i] + 1, &key);
+    if (i + 1 < SPARSE_COUNT) {
+      CHECK(next == &values[i + 1]);
+      CHECK(key == sparse[i + 1]);
+    } else {
+      CHECK(next == NULL);
+    }
+  }
+
+  // In order, and deleting the current entry doesn't derail the walk
+  size_t i = 0;
+  void *value;
+  radix_tree_for_each(&tree, key, value) {
+    CHECK(i < SPARSE_COUNT && key == sparse[i] && value == &values[i]);
+    CHECK(radix_tree_delete(&tree, key) == value);
+    i++;
+  }
+  CHECK(i == SPARSE_COUNT);
+  CHECK(tree.root == NULL);
+  CHECK(heap_live == 0);
+}
+
+static void test_alloc_failure() {
+  radix_tree_t tree = RADIX_TREE_INIT;
+  CHECK(radix_tree_insert(&tree, 1, &values[0]) == 0);
+
+  // Fails partway down: the tree still works and frees cleanly
+  heap_fail_after = 3;
+  CHECK(radix_tree_insert(&tree, 1ULL << 30, &values[1]) == -1);
+  heap_fail_after = 0;
+  CHECK(radix_tree_lookup(&tree, 1) == &values[0]);
+  CHECK(radix_tree_lookup(&tree, 1ULL << 30) == NULL);
+  CHECK(radix_tree_insert(&tree, 1ULL << 30, &values[1]) == 0);
+  CHECK(radix_tree_lookup(&tree, 1ULL << 30) == &values[1]);
+
+  radix_tree_destroy(&tree);
+  CHECK(tree.root == NULL);
+  CHECK(heap_live == 0);
+}
+
+int main() {
+  RUN_TEST(test_empty);
+  RUN_TEST(test_insert_lookup_delete);
+  RUN_TEST(test_grow_and_collapse);
+  RUN_TEST(test_full_width_keys);
+  RUN_TEST(test_next_sparse);
+  RUN_TEST(test_alloc_failure);
+  return test_result("radix_tree");
+}
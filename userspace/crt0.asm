@@ -18,9 +18,9 @@ _start:
     push rax ; Align stack to 16-bytes for ABI
     call main
     
-    ; Exit syscall (assumed 1 for KyroOS)
-    mov rax, 1
-    mov rdi, 0
+    ; SYS_EXIT with main's return value as the exit status
+    mov rdi, rax
+    xor rax, rax
     syscall
 
     ; Should not reach here
@@ -43,5 +43,5 @@ int main() {
     }
     
     // Exit (syscall 0)
-    __asm__ volatile ("mov $0, %%rax; int $0x80" ::: "rax");
+    __asm__ volatile ("mov $0, %%rax; syscall" ::: "rax", "rcx", "r11");
 }
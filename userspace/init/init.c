@@ -7,10 +7,10 @@ void syscall(long number, long arg1, long arg2, long arg3) {
         "mov %1, %%rdi\n\t"
         "mov %2, %%rsi\n\t"
         "mov %3, %%rdx\n\t"
-        "int $0x80"
+        "syscall"
         :
         : "g"(number), "g"(arg1), "g"(arg2), "g"(arg3)
-        : "rax", "rdi", "rsi", "rdx"
+        : "rax", "rdi", "rsi", "rdx", "rcx", "r11"
     );
 }
 
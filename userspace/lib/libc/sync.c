@@ -0,0 +1,112 @@
+#include "sync.h"
+#include "kyroolib.h" // For futex()
+
+// The mutex follows "Futexes Are Tricky" (Drepper), mutex 2: the state says
+// whether anybody may be sleeping, so an uncontended unlock needn't make a
+// syscall.
+
+static uint32_t cmpxchg(uint32_t *p, uint32_t expected, uint32_t desired) {
+  __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+  return expected; // The value seen
+}
+
+void mutex_lock(mutex_t *m) {
+  uint32_t c = cmpxchg(&m->state, 0, 1);
+  if (c == 0) {
+    return;
+  }
+  // Contended. Mark it so the holder wakes us, then sleep until we got it.
+  if (c != 2) {
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+  while (c != 0) {
+    futex(&m->state, FUTEX_WAIT, 2, 0, 0);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+int mutex_trylock(mutex_t *m) {
+  return cmpxchg(&m->state, 0, 1) == 0;
+}
+
+void mutex_unlock(mutex_t *m) {
+  if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex(&m->state, FUTEX_WAKE, 1, 0, 0);
+  }
+}
+
+// Lock after sleeping on a condition. Others may have been requeued onto the
+// mutex behind us, so always leave it marked contended.
+static void mutex_lock_contended(mutex_t *m) {
+  while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+    futex(&m->state, FUTEX_WAIT, 2, 0, 0);
+  }
+}
+
+int cond_timedwait(cond_t *c, mutex_t *m, uint64_t timeout_ns) {
+  // A signal after this read changes seq, so the FUTEX_WAIT below fails
+  // instead of sleeping through it
+  uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&c->mutex, m, __ATOMIC_RELAXED);
+  mutex_unlock(m);
+  long ret = futex(&c->seq, FUTEX_WAIT, seq, timeout_ns, 0);
+  mutex_lock_contended(m);
+  // A changed seq means we were signalled, even if the wait timed out
+  if (ret < 0 && timeout_ns && __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) == seq) {
+    return -1;
+  }
+  return 0;
+}
+
+void cond_wait(cond_t *c, mutex_t *m) {
+  cond_timedwait(c, m, 0);
+}
+
+void cond_signal(cond_t *c) {
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex(&c->seq, FUTEX_WAKE, 1, 0, 0);
+}
+
+void cond_broadcast(cond_t *c) {
+  mutex_t *m = __atomic_load_n(&c->mutex, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  if (!m) {
+    return; // Nobody has ever waited
+  }
+  // Wake one, move the rest to the mutex: they'd only fight over it, so
+  // each unlock wakes the next instead of all of them waking at once
+  futex(&c->seq, FUTEX_REQUEUE, 1, UINT32_MAX, &m->state);
+}
+
+void sem_init(sem_t *s, uint32_t value) {
+  s->value = value;
+  s->waiters = 0;
+}
+
+int sem_trywait(sem_t *s) {
+  uint32_t v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+  while (v > 0) {
+    if (__atomic_compare_exchange_n(&s->value, &v, v - 1, 1, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void sem_wait(sem_t *s) {
+  while (!sem_trywait(s)) {
+    __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    // Returns at once if a post got in since sem_trywait()
+    futex(&s->value, FUTEX_WAIT, 0, 0, 0);
+    __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void sem_post(sem_t *s) {
+  __atomic_fetch_add(&s->value, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)) {
+    futex(&s->value, FUTEX_WAKE, 1, 0, 0);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+// Locks for threads sharing memory, built on SYS_FUTEX. Taking a free lock,
+// releasing one nobody waits for, posting a semaphore nobody waits on and
+// signalling an unwatched condition are a single atomic instruction; the
+// kernel is only entered to sleep or to wake a sleeper.
+//
+// All of them start zeroed: `mutex_t m = MUTEX_INIT;` or memset to 0.
+
+typedef struct {
+  uint32_t state; // 0 free, 1 locked, 2 locked and somebody may sleep on it
+} mutex_t;
+
+typedef struct {
+  uint32_t seq;   // Bumped by every signal/broadcast, the futex word
+  mutex_t *mutex; // Mutex of the last waiter, broadcast requeues onto it
+} cond_t;
+
+typedef struct {
+  uint32_t value;
+  uint32_t waiters; // Threads in sem_wait() that found value 0
+} sem_t;
+
+#define MUTEX_INIT { 0 }
+#define COND_INIT { 0, 0 }
+#define SEM_INIT(count) { (count), 0 }
+
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m); // 1 if taken
+void mutex_unlock(mutex_t *m);
+
+// Unlock `m`, sleep until signalled, lock `m` again. May wake spuriously,
+// so wait in a loop around the condition.
+void cond_wait(cond_t *c, mutex_t *m);
+// As cond_wait, giving up after `timeout_ns`. Returns -1 on timeout.
+int cond_timedwait(cond_t *c, mutex_t *m, uint64_t timeout_ns);
+void cond_signal(cond_t *c);    // Wake one waiter
+void cond_broadcast(cond_t *c); // Wake all of them
+
+void sem_init(sem_t *s, uint32_t value);
+void sem_wait(sem_t *s);
+int sem_trywait(sem_t *s); // 1 if the count was taken
+void sem_post(sem_t *s);
+
+#endif // SYNC_H
@@ -112,7 +112,7 @@ static long syscall(long number, long arg1, long arg2, long arg3) {
         "mov %2, %%rdi\n\t"
         "mov %3, %%rsi\n\t"
         "mov %4, %%rdx\n\t"
-        "int $0x80\n\t"
+        "syscall\n\t"
         "mov %%rax, %0"
         : "=g"(ret)
         : "g"(number), "g"(arg1), "g"(arg2), "g"(arg3)